@@ -0,0 +1,671 @@
+/*
+ * Throughput and allocation benchmark of the parsers.
+ *
+ * Parsers run against a synthetic procfs tree (set_procfs_root), memory
+ * readers run against a forked child through the real "/proc".
+ *
+ *   make benchmark
+ *   ./benchmark -g -r /tmp/pp_fixture
+ *
+ * "make test" generates its fixture with -G.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "procfs_parser_api.h"
+
+#define DEFAULT_FIXTURE_ROOT "/tmp/pp_fixture"
+#define DEFAULT_PID_COUNT    100000
+#define DEFAULT_MAPS_LINES   100000
+#define DEFAULT_CMDLINE_SIZE 65536
+#define DEFAULT_ITERATIONS   10
+#define MEMORY_READ_SIZE     (1024 * 1024)
+
+/* the first fixture pid carries the huge maps file and the long cmdline */
+#define FIXTURE_FIRST_PID 1
+
+/*
+ * allocation counters, malloc family is interposed so that allocations
+ * made by libc on behalf of the library (fopen, ...) are counted as well
+ */
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
+
+static unsigned long long alloc_count;
+static unsigned long long alloc_bytes;
+
+void* malloc(size_t size)
+{
+    alloc_count++;
+    alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    alloc_count++;
+    alloc_bytes += count * size;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    alloc_count++;
+    alloc_bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr)
+{
+    __libc_free(ptr);
+}
+
+struct bench_result
+{
+    const char* name;
+    unsigned long long calls;
+    unsigned long long failures;
+    unsigned long long bytes;
+    unsigned long long allocs;
+    unsigned long long alloc_bytes;
+    double seconds;
+};
+
+struct bench_config
+{
+    const char* root;
+    bool generate;
+    bool generate_only;
+    bool instrument;
+    int pid_count;
+    int maps_lines;
+    int cmdline_size;
+    int iterations;
+};
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench_begin(struct bench_result* result, const char* name)
+{
+    memset(result, 0x00, sizeof(struct bench_result));
+    result->name = name;
+    result->allocs = alloc_count;
+    result->alloc_bytes = alloc_bytes;
+    result->seconds = now();
+}
+
+static void bench_end(struct bench_result* result)
+{
+    result->seconds = now() - result->seconds;
+    result->allocs = alloc_count - result->allocs;
+    result->alloc_bytes = alloc_bytes - result->alloc_bytes;
+}
+
+static void print_result(const struct bench_result* result)
+{
+    double calls = result->calls ? (double)result->calls : 1;
+
+    printf("%-24s %10llu calls %8llu fail %12.0f calls/s %10.1f MB/s %8.1f allocs/call %10.0f B/call\n",
+        result->name, result->calls, result->failures,
+        result->calls / result->seconds,
+        result->bytes / result->seconds / (1024 * 1024),
+        result->allocs / calls,
+        result->alloc_bytes / calls);
+}
+
+static long long file_size(const char* path)
+{
+    struct stat st;
+
+    if (stat(path, &st) != 0) {
+        return 0;
+    }
+
+    return st.st_size;
+}
+
+/* "[dir]/[name]", false if it does not fit */
+static bool make_fixture_path(char* path, size_t size, const char* dir, const char* name)
+{
+    int length = snprintf(path, size, "%s/%s", dir, name);
+
+    return length >= 0 && (size_t)length < size;
+}
+
+static bool write_file(const char* path, const char* data, size_t size)
+{
+    FILE* file = fopen(path, "w");
+    bool result = false;
+
+    if (file == NULL) {
+        return false;
+    }
+
+    result = fwrite(data, 1, size, file) == size;
+    fclose(file);
+
+    return result;
+}
+
+static bool generate_stat(const char* dir, int pid)
+{
+    char path[PATH_MAX];
+    char line[1024];
+    int length;
+
+    length = snprintf(line, sizeof(line),
+        "%d (worker %d) S 1 %d %d 0 -1 4194560 %d 0 12 0 %d %d 0 0 20 0 %d 0 %d %llu %d "
+        "18446744073709551615 94000000000000 94000000100000 140700000000000 0 0 0 0 0 0 0 0 0 17 %d 0 0 0 0 0 "
+        "94000000200000 94000000300000 94000000400000 140700000001000 140700000002000 140700000002000 140700000003000 0\n",
+        pid, pid, pid, pid, pid % 5000, pid % 1000, pid % 700, 1 + pid % 16, 1000 + pid,
+        (unsigned long long)pid * 4096 * 100, pid % 2048, pid % 64);
+
+    if (make_fixture_path(path, sizeof(path), dir, "stat") == false) {
+        return false;
+    }
+
+    return write_file(path, line, length);
+}
+
+static bool generate_status(const char* dir, int pid)
+{
+    char path[PATH_MAX];
+    char text[2048];
+    int length;
+
+    length = snprintf(text, sizeof(text),
+        "Name:\tworker %d\nUmask:\t0022\nState:\tS (sleeping)\nTgid:\t%d\nNgid:\t0\nPid:\t%d\nPPid:\t1\n"
+        "TracerPid:\t0\nUid:\t%d\t%d\t%d\t%d\nGid:\t%d\t%d\t%d\t%d\nFDSize:\t64\nGroups:\t \n"
+        "NStgid:\t%d\nNSpid:\t%d\nNSpgid:\t%d\nNSsid:\t%d\nKthread:\t0\n"
+        "VmPeak:\t  %8d kB\nVmSize:\t  %8d kB\nVmLck:\t       0 kB\nVmPin:\t       0 kB\n"
+        "VmHWM:\t  %8d kB\nVmRSS:\t  %8d kB\nRssAnon:\t  %8d kB\nRssFile:\t    1312 kB\nRssShmem:\t       0 kB\n"
+        "VmData:\t     360 kB\nVmStk:\t     132 kB\nVmExe:\t      20 kB\nVmLib:\t    1528 kB\nVmPTE:\t      44 kB\n"
+        "VmSwap:\t  %8d kB\nHugetlbPages:\t       0 kB\nCoreDumping:\t0\nTHP_enabled:\t1\nThreads:\t%d\n"
+        "SigQ:\t0/24001\nSigPnd:\t0000000000000000\nShdPnd:\t0000000000000000\nSigBlk:\t0000000000000000\n"
+        "SigIgn:\t0000000000000000\nSigCgt:\t0000000000000000\nCapInh:\t0000000000000000\nCapPrm:\t0000000000000000\n"
+        "CapEff:\t0000000000000000\nCapBnd:\t000001ffffffffff\nCapAmb:\t0000000000000000\nNoNewPrivs:\t0\n"
+        "Seccomp:\t0\nSeccomp_filters:\t0\nSpeculation_Store_Bypass:\tthread vulnerable\n"
+        "Cpus_allowed:\tff\nCpus_allowed_list:\t0-7\nMems_allowed:\t00000001\nMems_allowed_list:\t0\n"
+        "voluntary_ctxt_switches:\t%d\nnonvoluntary_ctxt_switches:\t%d\n",
+        pid, pid, pid, pid % 2000, pid % 2000, pid % 2000, pid % 2000, pid % 2000, pid % 2000, pid % 2000, pid % 2000,
+        pid, pid, pid, pid, 1000 + pid % 9000, 1000 + pid % 9000, 500 + pid % 5000, 500 + pid % 5000, 400 + pid % 4000,
+        pid % 100, 1 + pid % 16, pid % 10000, pid % 300);
+
+    if (make_fixture_path(path, sizeof(path), dir, "status") == false) {
+        return false;
+    }
+
+    return write_file(path, text, length);
+}
+
+static bool generate_cmdline(const char* dir, int size)
+{
+    char path[PATH_MAX];
+    char* cmdline = NULL;
+    int length = 0;
+    bool result;
+
+    cmdline = __libc_malloc(size + 64);
+    if (cmdline == NULL) {
+        return false;
+    }
+
+    length = sprintf(cmdline, "/usr/bin/worker") + 1;
+    while (length + 32 < size) {
+        length += sprintf(cmdline + length, "--option-%d=value", length) + 1;
+    }
+
+    result = make_fixture_path(path, sizeof(path), dir, "cmdline") && write_file(path, cmdline, length);
+
+    __libc_free(cmdline);
+
+    return result;
+}
+
+static bool generate_maps(const char* dir, int lines)
+{
+    char path[PATH_MAX];
+    unsigned long long address = 0x555555554000ULL;
+    FILE* file = NULL;
+    int i;
+
+    if (make_fixture_path(path, sizeof(path), dir, "maps") == false) {
+        return false;
+    }
+
+    file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < lines; i++) {
+        unsigned long long size = 0x1000ULL * (1 + i % 32);
+
+        if (i % 4 == 0) {
+            fprintf(file, "%llx-%llx rw-p 00000000 00:00 0 \n", address, address + size);
+        }
+        else {
+            fprintf(file, "%llx-%llx r-xp %08llx 08:01 %d                        /usr/lib/x86_64-linux-gnu/libbench%d.so\n",
+                address, address + size, (unsigned long long)i * 0x1000, 100000 + i % 500, i % 500);
+        }
+
+        address += size;
+    }
+
+    fclose(file);
+
+    return true;
+}
+
+static bool generate_fixture(const struct bench_config* config)
+{
+    char dir[PATH_MAX];
+    int pid;
+
+    if (mkdir(config->root, 0755) != 0 && errno != EEXIST) {
+        return false;
+    }
+
+    for (pid = FIXTURE_FIRST_PID; pid < FIXTURE_FIRST_PID + config->pid_count; pid++) {
+        bool first = pid == FIXTURE_FIRST_PID;
+
+        snprintf(dir, sizeof(dir), "%s/%d", config->root, pid);
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            return false;
+        }
+
+        if (generate_stat(dir, pid) == false) {
+            return false;
+        }
+
+        if (generate_status(dir, pid) == false) {
+            return false;
+        }
+
+        if (generate_cmdline(dir, first ? config->cmdline_size : 64 + pid % 512) == false) {
+            return false;
+        }
+
+        if (generate_maps(dir, first ? config->maps_lines : 32) == false) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void bench_maps(const struct bench_config* config)
+{
+    struct bench_result result;
+    char path[PATH_MAX];
+    long long size;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/%d/maps", config->root, FIXTURE_FIRST_PID);
+    size = file_size(path);
+
+    bench_begin(&result, "parse_maps_file");
+
+    for (i = 0; i < config->iterations; i++) {
+        struct VirtualMemoryArea* VMAs = NULL;
+        int vma_count = 0;
+
+        result.calls++;
+        if (parse_maps_file(FIXTURE_FIRST_PID, &VMAs, &vma_count) == false) {
+            result.failures++;
+            continue;
+        }
+
+        result.bytes += size;
+        free(VMAs);
+    }
+
+    bench_end(&result);
+    print_result(&result);
+}
+
+static void bench_stat(const struct bench_config* config)
+{
+    struct bench_result result;
+    struct ProcessStat stat;
+    char path[PATH_MAX];
+    long long size;
+    int pid;
+
+    snprintf(path, sizeof(path), "%s/%d/stat", config->root, FIXTURE_FIRST_PID);
+    size = file_size(path);
+
+    bench_begin(&result, "parse_process_stat");
+
+    for (pid = FIXTURE_FIRST_PID; pid < FIXTURE_FIRST_PID + config->pid_count; pid++) {
+        result.calls++;
+        if (parse_process_stat(pid, &stat) == false) {
+            result.failures++;
+            continue;
+        }
+
+        result.bytes += size;
+    }
+
+    bench_end(&result);
+    print_result(&result);
+}
+
+/* the memory fields a collector samples every tick, and every field */
+static void bench_status(const struct bench_config* config)
+{
+    struct bench_result result;
+    struct ProcessStatus status;
+    unsigned long long masks[2] = {
+        STATUS_FIELD(STATUS_VM_RSS) | STATUS_FIELD(STATUS_VM_SWAP) | STATUS_FIELD(STATUS_THREADS),
+        STATUS_ALL_FIELDS,
+    };
+    const char* names[2] = { "parse_process_status/rss", "parse_process_status/all" };
+    int pid;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        bench_begin(&result, names[i]);
+
+        for (pid = FIXTURE_FIRST_PID; pid < FIXTURE_FIRST_PID + config->pid_count; pid++) {
+            result.calls++;
+            if (parse_process_status(pid, masks[i], &status) == false) {
+                result.failures++;
+                continue;
+            }
+
+            result.bytes += sizeof(status);
+        }
+
+        bench_end(&result);
+        print_result(&result);
+    }
+}
+
+static void bench_cmdline(const struct bench_config* config)
+{
+    struct bench_result result;
+    char* cmdline = NULL;
+    int pid;
+
+    cmdline = __libc_malloc(config->cmdline_size);
+    if (cmdline == NULL) {
+        return;
+    }
+
+    bench_begin(&result, "read_command_line");
+
+    for (pid = FIXTURE_FIRST_PID; pid < FIXTURE_FIRST_PID + config->pid_count; pid++) {
+        result.calls++;
+        if (read_command_line(pid, cmdline, config->cmdline_size) == false) {
+            result.failures++;
+            continue;
+        }
+
+        result.bytes += strlen(cmdline);
+    }
+
+    bench_end(&result);
+    print_result(&result);
+
+    __libc_free(cmdline);
+}
+
+static void bench_argv(const struct bench_config* config)
+{
+    struct bench_result result;
+    struct ProcessArgs args;
+    int pid;
+
+    memset(&args, 0x00, sizeof(args));
+
+    bench_begin(&result, "read_process_argv");
+
+    for (pid = FIXTURE_FIRST_PID; pid < FIXTURE_FIRST_PID + config->pid_count; pid++) {
+        result.calls++;
+        if (read_process_argv(pid, &args) == false) {
+            result.failures++;
+            continue;
+        }
+
+        result.bytes += args.length;
+    }
+
+    bench_end(&result);
+    print_result(&result);
+
+    free_process_args(&args);
+}
+
+static void batch_completed(int pid, const char* name, const char* data, size_t size, int error, void* arg)
+{
+    struct bench_result* result = arg;
+    struct ProcessStat stat;
+
+    result->calls++;
+
+    if (error || (strcmp(name, "stat") == 0 && parse_process_stat_data(data, &stat) == false)) {
+        result->failures++;
+        return;
+    }
+
+    result->bytes += size;
+}
+
+/* stat and cmdline of every pid, through io_uring and through plain syscalls */
+static void bench_batch(const struct bench_config* config)
+{
+    struct bench_result result;
+    procfs_batch_t batch = NULL;
+    unsigned int flags[2] = { 0, PROCFS_BATCH_NO_URING };
+    int pid;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        batch = create_procfs_batch(256, 4096, flags[i]);
+        if (batch == NULL) {
+            return;
+        }
+
+        for (pid = FIXTURE_FIRST_PID; pid < FIXTURE_FIRST_PID + config->pid_count; pid++) {
+            add_procfs_batch_file(batch, pid, "stat");
+            add_procfs_batch_file(batch, pid, "cmdline");
+        }
+
+        bench_begin(&result, is_procfs_batch_uring(batch) ? "run_procfs_batch/uring" : "run_procfs_batch/syscall");
+
+        if (run_procfs_batch(batch, batch_completed, &result) == false) {
+            result.failures++;
+        }
+
+        bench_end(&result);
+        print_result(&result);
+
+        destroy_procfs_batch(batch);
+    }
+}
+
+static void bench_memory(const struct bench_config* config)
+{
+    struct bench_result result;
+    unsigned char* target = NULL;
+    unsigned char* buffer = NULL;
+    pid_t child;
+    int i;
+
+    target = __libc_malloc(MEMORY_READ_SIZE);
+    buffer = __libc_malloc(MEMORY_READ_SIZE);
+    if (target == NULL || buffer == NULL) {
+        goto done;
+    }
+    memset(target, 0xcc, MEMORY_READ_SIZE);
+
+    child = fork();
+    if (child == 0) {
+        for (;;) {
+            pause();
+        }
+    }
+
+    if (child < 0) {
+        goto done;
+    }
+
+    set_procfs_root(NULL);
+
+    bench_begin(&result, "read_process_memory");
+
+    for (i = 0; i < config->iterations; i++) {
+        int rsz;
+
+        result.calls++;
+        rsz = read_process_memory(child, (unsigned long long)target, buffer, MEMORY_READ_SIZE);
+        if (rsz < MEMORY_READ_SIZE) {
+            result.failures++;
+            continue;
+        }
+
+        result.bytes += rsz;
+    }
+
+    bench_end(&result);
+    print_result(&result);
+
+    bench_begin(&result, "dump_process_memory");
+
+    for (i = 0; i < config->iterations; i++) {
+        unsigned char* memory = NULL;
+
+        result.calls++;
+        memory = dump_process_memory(child, (unsigned long long)target, MEMORY_READ_SIZE);
+        if (memory == NULL) {
+            result.failures++;
+            continue;
+        }
+
+        result.bytes += MEMORY_READ_SIZE;
+        free(memory);
+    }
+
+    bench_end(&result);
+    print_result(&result);
+
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+
+    set_procfs_root(config->root);
+
+done:
+
+    __libc_free(target);
+    __libc_free(buffer);
+}
+
+static void usage(const char* program)
+{
+    fprintf(stderr,
+        "usage: %s [-g | -G] [-s] [-r root] [-p pids] [-m maps lines] [-c cmdline bytes] [-i iterations]\n"
+        "  -g  generate the fixture tree before running\n"
+        "  -G  generate the fixture tree and exit\n"
+        "  -s  enable instrumentation and print the per-API counters\n",
+        program);
+}
+
+int main(int argc, char* argv[])
+{
+    struct bench_config config = {
+        DEFAULT_FIXTURE_ROOT,
+        false,
+        false,
+        false,
+        DEFAULT_PID_COUNT,
+        DEFAULT_MAPS_LINES,
+        DEFAULT_CMDLINE_SIZE,
+        DEFAULT_ITERATIONS,
+    };
+    int option;
+
+    while ((option = getopt(argc, argv, "gGsr:p:m:c:i:")) != -1) {
+        switch (option) {
+        case 'g':
+            config.generate = true;
+            break;
+        case 'G':
+            config.generate = true;
+            config.generate_only = true;
+            break;
+        case 's':
+            config.instrument = true;
+            break;
+        case 'r':
+            config.root = optarg;
+            break;
+        case 'p':
+            config.pid_count = atoi(optarg);
+            break;
+        case 'm':
+            config.maps_lines = atoi(optarg);
+            break;
+        case 'c':
+            config.cmdline_size = atoi(optarg);
+            break;
+        case 'i':
+            config.iterations = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (config.pid_count < 1 || config.maps_lines < 1 || config.cmdline_size < 64 || config.iterations < 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (config.generate && generate_fixture(&config) == false) {
+        fprintf(stderr, "failed to generate fixture in %s\n", config.root);
+        exit(EXIT_FAILURE);
+    }
+
+    if (config.generate_only) {
+        exit(EXIT_SUCCESS);
+    }
+
+    if (set_procfs_root(config.root) == false) {
+        fprintf(stderr, "invalid procfs root %s\n", config.root);
+        exit(EXIT_FAILURE);
+    }
+
+    enable_instrumentation(config.instrument);
+
+    bench_maps(&config);
+    bench_stat(&config);
+    bench_status(&config);
+    bench_cmdline(&config);
+    bench_argv(&config);
+    bench_batch(&config);
+    bench_memory(&config);
+
+    if (config.instrument) {
+        export_instrumentation(stdout);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,454 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+#include "pp_stats.h"
+
+/* status is the largest file read per process */
+#define CGROUP_BATCH_DEPTH  64
+#define CGROUP_BATCH_BUFFER 4096
+
+#define SZ_CGROUP_BUFFER (4096)
+
+struct cgroup_member
+{
+    pid_t pid;
+    int cgroup;
+};
+
+struct cgroup_walk
+{
+    const char* file; // cgroup.procs or cgroup.threads
+    bool recursive;
+
+    /* usages are collected for aggregation only */
+    struct CgroupUsage* usages;
+    int usage_count;
+    int usage_capacity;
+    bool with_usages;
+
+    struct cgroup_member* members;
+    int member_count;
+    int member_capacity;
+};
+
+struct cgroup_reader
+{
+    struct cgroup_walk* walk;
+    long page_kb;
+};
+
+static int compare_member_pid(const void* a, const void* b)
+{
+    pid_t left = ((const struct cgroup_member*)a)->pid;
+    pid_t right = ((const struct cgroup_member*)b)->pid;
+
+    return (left > right) - (left < right);
+}
+
+static bool add_member(struct cgroup_walk* walk, pid_t pid, int cgroup)
+{
+    if (walk->member_count == walk->member_capacity) {
+        int capacity = walk->member_capacity ? walk->member_capacity * 2 : 256;
+        struct cgroup_member* grown = realloc(walk->members, capacity * sizeof(struct cgroup_member));
+
+        if (grown == NULL) {
+            return false;
+        }
+
+        walk->members = grown;
+        walk->member_capacity = capacity;
+    }
+
+    walk->members[walk->member_count].pid = pid;
+    walk->members[walk->member_count].cgroup = cgroup;
+    walk->member_count++;
+
+    return true;
+}
+
+/* ids of "[path]/[walk->file]", one decimal per line */
+static bool read_cgroup_members(struct cgroup_walk* walk, const char* path, int cgroup)
+{
+    bool result = true;
+
+    char file[PATH_MAX];
+    unsigned char* buffer = NULL;
+    size_t buffer_size = SZ_CGROUP_BUFFER;
+    size_t size = 0;
+    const char* cursor = NULL;
+    ssize_t rsz;
+    int fd = -1;
+
+    if (snprintf(file, sizeof(file), "%s/%s", path, walk->file) >= (int)sizeof(file)) {
+        PP_ERROR(ENAMETOOLONG, "cgroup path %s is too long", path);
+        SETERRGOTO(result, done);
+    }
+
+    fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        PP_ERROR(errno, "cannot open %s", file);
+        SETERRGOTO(result, done);
+    }
+
+    buffer = pp_context_buffer(buffer_size);
+    NULLERRGOTO(buffer, result, done);
+
+    for (;;) {
+        /* keep a byte for the terminating NUL */
+        if (size + 1 == buffer_size) {
+            buffer_size *= 2;
+            buffer = pp_context_buffer(buffer_size);
+            NULLERRGOTO(buffer, result, done);
+        }
+
+        rsz = read(fd, buffer + size, buffer_size - size - 1);
+        pp_stats_io(rsz > 0 ? rsz : 0, 1);
+
+        if (rsz < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (rsz < 0) {
+            PP_ERROR(errno, "cannot read %s", file);
+            SETERRGOTO(result, done);
+        }
+
+        if (rsz == 0) {
+            break;
+        }
+
+        size += rsz;
+    }
+
+    buffer[size] = '\0';
+
+    for (cursor = (const char*)buffer; *cursor; ) {
+        char* end = NULL;
+        long id = strtol(cursor, &end, 10);
+
+        if (end == cursor) {
+            break;
+        }
+
+        if (id > 0) {
+            result = add_member(walk, (pid_t)id, cgroup);
+            IFERRGOTO(result, done);
+        }
+
+        cursor = end;
+        while (*cursor == '\n') {
+            cursor++;
+        }
+    }
+
+done:
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    return result;
+}
+
+static int add_usage(struct cgroup_walk* walk, const char* path, int parent)
+{
+    struct CgroupUsage* usage = NULL;
+
+    if (walk->usage_count == walk->usage_capacity) {
+        int capacity = walk->usage_capacity ? walk->usage_capacity * 2 : 16;
+        struct CgroupUsage* grown = realloc(walk->usages, capacity * sizeof(struct CgroupUsage));
+
+        if (grown == NULL) {
+            return -1;
+        }
+
+        walk->usages = grown;
+        walk->usage_capacity = capacity;
+    }
+
+    usage = &walk->usages[walk->usage_count];
+    memset(usage, 0x00, sizeof(struct CgroupUsage));
+    snprintf(usage->path, sizeof(usage->path), "%s", path);
+    usage->parent = parent;
+
+    return walk->usage_count++;
+}
+
+static bool is_directory(const char* parent, const struct dirent* entry)
+{
+    char path[PATH_MAX];
+    struct stat st;
+
+    if (entry->d_type != DT_UNKNOWN) {
+        return entry->d_type == DT_DIR;
+    }
+
+    if (snprintf(path, sizeof(path), "%s/%s", parent, entry->d_name) >= (int)sizeof(path)) {
+        return false;
+    }
+
+    return lstat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* preorder, so a cgroup is always added before its children */
+static bool walk_cgroup(struct cgroup_walk* walk, const char* path, int parent)
+{
+    bool result = true;
+
+    DIR* dir = NULL;
+    struct dirent* entry = NULL;
+    int cgroup = -1;
+
+    if (walk->with_usages) {
+        cgroup = add_usage(walk, path, parent);
+        if (cgroup < 0) {
+            SETERRGOTO(result, done);
+        }
+    }
+
+    result = read_cgroup_members(walk, path, cgroup);
+    IFERRGOTO(result, done);
+
+    if (walk->recursive == false) {
+        goto done;
+    }
+
+    dir = opendir(path);
+    if (dir == NULL) {
+        PP_ERROR(errno, "cannot open %s", path);
+        SETERRGOTO(result, done);
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        char child[PATH_MAX];
+
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0 ||
+            is_directory(path, entry) == false) {
+            continue;
+        }
+
+        if (snprintf(child, sizeof(child), "%s/%s", path, entry->d_name) >= (int)sizeof(child)) {
+            continue;
+        }
+
+        /* a child removed meanwhile is skipped, other errors are not */
+        if (walk_cgroup(walk, child, cgroup) == false) {
+            struct ProcfsError error;
+
+            if (get_procfs_last_error(NULL, &error) == false || error.code != ENOENT) {
+                SETERRGOTO(result, done);
+            }
+        }
+    }
+
+done:
+
+    if (dir) {
+        closedir(dir);
+    }
+
+    return result;
+}
+
+static void free_walk(struct cgroup_walk* walk)
+{
+    if (walk->usages) {
+        free(walk->usages);
+    }
+
+    if (walk->members) {
+        free(walk->members);
+    }
+}
+
+bool list_cgroup_pids(const char* cgroup_path, unsigned int flags, pid_t** pids, int* pid_count)
+{
+    bool result = true;
+
+    struct pp_stats_scope scope;
+    struct cgroup_walk walk;
+    pid_t* unique = NULL;
+    int count = 0;
+    int i;
+
+    pp_stats_begin(&scope, API_LIST_CGROUP_PIDS);
+
+    memset(&walk, 0x00, sizeof(walk));
+    walk.file = (flags & CGROUP_THREADS) ? "cgroup.threads" : "cgroup.procs";
+    walk.recursive = (flags & CGROUP_RECURSIVE) != 0;
+
+    result = walk_cgroup(&walk, cgroup_path, -1);
+    IFERRGOTO(result, done);
+
+    qsort(walk.members, walk.member_count, sizeof(struct cgroup_member), compare_member_pid);
+
+    unique = malloc((walk.member_count + 1) * sizeof(pid_t));
+    NULLERRGOTO(unique, result, done);
+
+    for (i = 0; i < walk.member_count; i++) {
+        if (count == 0 || unique[count - 1] != walk.members[i].pid) {
+            unique[count++] = walk.members[i].pid;
+        }
+    }
+
+    *pids = unique;
+    *pid_count = count;
+
+done:
+
+    free_walk(&walk);
+
+    pp_stats_end(&scope, result);
+
+    return result;
+}
+
+static void add_counters(struct CgroupCounters* total, const struct CgroupCounters* counters)
+{
+    total->process_count += counters->process_count;
+    total->thread_count += counters->thread_count;
+    total->cpu_time += counters->cpu_time;
+    total->rss += counters->rss;
+    total->rss_anon += counters->rss_anon;
+    total->rss_file += counters->rss_file;
+    total->rss_shmem += counters->rss_shmem;
+    total->swap += counters->swap;
+    total->pss += counters->pss;
+    total->pss_anon += counters->pss_anon;
+    total->pss_file += counters->pss_file;
+    total->pss_shmem += counters->pss_shmem;
+    total->swap_pss += counters->swap_pss;
+}
+
+static void read_member_file(int pid, const char* name, const char* data, size_t size, int error, void* arg)
+{
+    struct cgroup_reader* reader = arg;
+    struct cgroup_member key = { pid, 0 };
+    struct cgroup_member* member = NULL;
+    struct CgroupCounters* counters = NULL;
+
+    /* the process exited or moved meanwhile */
+    if (error) {
+        return;
+    }
+
+    member = bsearch(&key, reader->walk->members, reader->walk->member_count,
+        sizeof(struct cgroup_member), compare_member_pid);
+    if (member == NULL) {
+        return;
+    }
+
+    counters = &reader->walk->usages[member->cgroup].self;
+
+    if (strcmp(name, "stat") == 0) {
+        struct ProcessStat stat;
+
+        if (parse_process_stat_data(data, &stat)) {
+            counters->process_count++;
+            counters->thread_count += (int)stat.num_threads;
+            counters->cpu_time += stat.utime + stat.stime;
+            counters->rss += (unsigned long long)stat.rss * reader->page_kb;
+        }
+    }
+    else if (strcmp(name, "status") == 0) {
+        struct ProcessStatus status;
+        unsigned long long mask = STATUS_FIELD(STATUS_RSS_ANON) | STATUS_FIELD(STATUS_RSS_FILE) |
+            STATUS_FIELD(STATUS_RSS_SHMEM) | STATUS_FIELD(STATUS_VM_SWAP);
+
+        if (parse_process_status_data(data, size, mask, &status)) {
+            counters->rss_anon += status.rss_anon;
+            counters->rss_file += status.rss_file;
+            counters->rss_shmem += status.rss_shmem;
+            counters->swap += status.vm_swap;
+        }
+    }
+    else if (strcmp(name, "smaps_rollup") == 0) {
+        struct SmapsRollup rollup;
+
+        if (parse_smaps_rollup_data(data, size, &rollup)) {
+            counters->pss += rollup.pss;
+            counters->pss_anon += rollup.pss_anon;
+            counters->pss_file += rollup.pss_file;
+            counters->pss_shmem += rollup.pss_shmem;
+            counters->swap_pss += rollup.swap_pss;
+        }
+    }
+}
+
+bool aggregate_cgroup_usage(const char* cgroup_path, unsigned int flags, struct CgroupUsage** usages, int* usage_count)
+{
+    bool result = true;
+
+    struct cgroup_walk walk;
+    struct cgroup_reader reader;
+    procfs_batch_t batch = NULL;
+    int i;
+
+    memset(&walk, 0x00, sizeof(walk));
+    walk.file = "cgroup.procs";
+    walk.recursive = (flags & CGROUP_RECURSIVE) != 0;
+    walk.with_usages = true;
+
+    result = walk_cgroup(&walk, cgroup_path, -1);
+    IFERRGOTO(result, done);
+
+    qsort(walk.members, walk.member_count, sizeof(struct cgroup_member), compare_member_pid);
+
+    /* only the members are read, whatever else runs on the host */
+    batch = create_procfs_batch(CGROUP_BATCH_DEPTH, CGROUP_BATCH_BUFFER, 0);
+    NULLERRGOTO(batch, result, done);
+
+    for (i = 0; i < walk.member_count; i++) {
+        result = add_procfs_batch_file(batch, walk.members[i].pid, "stat");
+        IFERRGOTO(result, done);
+
+        if (flags & CGROUP_READ_STATUS) {
+            result = add_procfs_batch_file(batch, walk.members[i].pid, "status");
+            IFERRGOTO(result, done);
+        }
+
+        if (flags & CGROUP_READ_SMAPS) {
+            result = add_procfs_batch_file(batch, walk.members[i].pid, "smaps_rollup");
+            IFERRGOTO(result, done);
+        }
+    }
+
+    reader.walk = &walk;
+    reader.page_kb = sysconf(_SC_PAGESIZE) / 1024;
+
+    result = run_procfs_batch(batch, read_member_file, &reader);
+    IFERRGOTO(result, done);
+
+    /* children follow their parents, so a reverse pass rolls totals up */
+    for (i = 0; i < walk.usage_count; i++) {
+        walk.usages[i].total = walk.usages[i].self;
+    }
+
+    for (i = walk.usage_count - 1; i > 0; i--) {
+        if (walk.usages[i].parent >= 0) {
+            add_counters(&walk.usages[walk.usages[i].parent].total, &walk.usages[i].total);
+        }
+    }
+
+    *usages = walk.usages;
+    *usage_count = walk.usage_count;
+    walk.usages = NULL;
+
+done:
+
+    if (batch) {
+        destroy_procfs_batch(batch);
+    }
+
+    free_walk(&walk);
+
+    return result;
+}
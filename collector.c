@@ -0,0 +1,1027 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+
+#define COLLECTOR_BATCH_DEPTH  64
+#define COLLECTOR_BATCH_BUFFER 4096
+
+#define COLLECTOR_MAX_CLIENTS  64
+#define COLLECTOR_IO_TIMEOUT   1 // seconds a client may stall the daemon
+
+#define COLLECTOR_STATUS_FIELDS \
+    (STATUS_FIELD(STATUS_UID) | STATUS_FIELD(STATUS_RSS_ANON) | STATUS_FIELD(STATUS_RSS_FILE) | \
+     STATUS_FIELD(STATUS_RSS_SHMEM) | STATUS_FIELD(STATUS_VM_SWAP) | \
+     STATUS_FIELD(STATUS_VOLUNTARY_CTXT_SWITCHES) | STATUS_FIELD(STATUS_NONVOLUNTARY_CTXT_SWITCHES))
+
+struct collector_entry
+{
+    struct CollectorProcess process;
+    int cgroup; // index into cgroups, -1 until read
+    bool known; // carried over from the previous refresh
+    bool alive;
+    bool status_read; // this refresh, stat and status complete in any order
+    bool read_maps;
+    bool read_cgroup;
+};
+
+/* entry indices by metric, largest first, and grouped by cgroup */
+struct collector_indexes
+{
+    int* top[COLLECTOR_METRIC_COUNT];
+    int* by_cgroup;
+    int* cgroup_first;
+    int* cgroup_size;
+    int cgroup_count; // cgroups cgroup_first and cgroup_size cover
+};
+
+struct ranked_entry
+{
+    unsigned long long value;
+    int index;
+};
+
+struct collector
+{
+    procfs_batch_t batch;
+    long page_kb;
+
+    /* sorted by pid */
+    struct collector_entry* entries;
+    int entry_count;
+
+    /* entries being read by a refresh, swapped in once indexed */
+    struct collector_entry* next_entries;
+    int next_entry_count;
+
+    /* interned cgroup paths, never removed */
+    char** cgroups;
+    int cgroup_count;
+    int cgroup_capacity;
+
+    /* built over entries */
+    struct collector_indexes indexes;
+
+    unsigned long long generation;
+    unsigned long long timestamp_ns;
+
+    /* results of the last query */
+    struct CollectorProcess* results;
+    int result_capacity;
+};
+
+static unsigned long long realtime_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long monotonic_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static struct collector_entry* find_entry(struct collector_entry* entries, int count, int pid)
+{
+    int low = 0;
+    int high = count - 1;
+
+    while (low <= high) {
+        int middle = low + (high - low) / 2;
+
+        if (entries[middle].process.pid == pid) {
+            return &entries[middle];
+        }
+
+        if (entries[middle].process.pid < pid) {
+            low = middle + 1;
+        }
+        else {
+            high = middle - 1;
+        }
+    }
+
+    return NULL;
+}
+
+static int intern_cgroup(struct collector* collector, const char* path, size_t length)
+{
+    char* copy = NULL;
+    int i;
+
+    for (i = 0; i < collector->cgroup_count; i++) {
+        if (strncmp(collector->cgroups[i], path, length) == 0 && collector->cgroups[i][length] == '\0') {
+            return i;
+        }
+    }
+
+    if (collector->cgroup_count == collector->cgroup_capacity) {
+        int capacity = collector->cgroup_capacity ? collector->cgroup_capacity * 2 : 64;
+        char** grown = realloc(collector->cgroups, capacity * sizeof(char*));
+
+        if (grown == NULL) {
+            return -1;
+        }
+
+        collector->cgroups = grown;
+        collector->cgroup_capacity = capacity;
+    }
+
+    copy = strndup(path, length);
+    if (copy == NULL) {
+        return -1;
+    }
+
+    collector->cgroups[collector->cgroup_count] = copy;
+
+    return collector->cgroup_count++;
+}
+
+/* the cgroup v2 line "0::/path" */
+static void read_cgroup(struct collector* collector, struct collector_entry* entry, const char* data)
+{
+    const char* line = data;
+
+    while (line && *line) {
+        const char* end = strchr(line, '\n');
+        size_t length = end ? (size_t)(end - line) : strlen(line);
+
+        if (length >= 3 && strncmp(line, "0::", 3) == 0) {
+            entry->cgroup = intern_cgroup(collector, line + 3, length - 3);
+            return;
+        }
+
+        line = end ? end + 1 : NULL;
+    }
+}
+
+static void reset_entry(struct collector_entry* entry)
+{
+    int pid = entry->process.pid;
+
+    memset(entry, 0x00, sizeof(struct collector_entry));
+    entry->process.pid = pid;
+    entry->cgroup = -1;
+    entry->read_maps = true;
+    entry->read_cgroup = true;
+}
+
+/* the fields read_status fills, kept when read_stat resets an entry after them */
+static void copy_status_fields(struct CollectorProcess* process, const struct CollectorProcess* from)
+{
+    process->uid = from->uid;
+    process->rss_anon = from->rss_anon;
+    process->rss_file = from->rss_file;
+    process->rss_shmem = from->rss_shmem;
+    process->swap = from->swap;
+    process->voluntary_ctxt_switches = from->voluntary_ctxt_switches;
+    process->nonvoluntary_ctxt_switches = from->nonvoluntary_ctxt_switches;
+}
+
+static void read_stat(struct collector* collector, struct collector_entry* entry, const char* data)
+{
+    struct CollectorProcess* process = &entry->process;
+    unsigned long long cpu_time;
+    struct ProcessStat stat;
+
+    if (parse_process_stat_data(data, &stat) == false) {
+        return;
+    }
+
+    /* a different process behind a known pid, its status may already be read */
+    if (entry->known && stat.starttime != process->starttime) {
+        struct CollectorProcess previous = *process;
+        bool status_read = entry->status_read;
+
+        reset_entry(entry);
+
+        if (status_read) {
+            copy_status_fields(process, &previous);
+            entry->status_read = true;
+        }
+    }
+
+    cpu_time = stat.utime + stat.stime;
+
+    process->cpu_delta = entry->known ? cpu_time - (process->utime + process->stime) : 0;
+    process->ppid = stat.ppid;
+    process->starttime = stat.starttime;
+    process->state = stat.state;
+    process->num_threads = (int)stat.num_threads;
+    process->utime = stat.utime;
+    process->stime = stat.stime;
+    process->rss = (unsigned long long)stat.rss * collector->page_kb;
+
+    /* comm is at most 15 characters, TASK_COMM_LEN */
+    strncpy(process->comm, stat.comm, sizeof(process->comm) - 1);
+    process->comm[sizeof(process->comm) - 1] = '\0';
+
+    /* mappings rarely change without vsize changing, maps are read again only then */
+    if (process->vsize != stat.vsize) {
+        entry->read_maps = true;
+    }
+
+    process->vsize = stat.vsize;
+    entry->alive = true;
+}
+
+static void read_status(struct collector_entry* entry, const char* data, size_t size)
+{
+    struct CollectorProcess* process = &entry->process;
+    struct ProcessStatus status;
+
+    if (parse_process_status_data(data, size, COLLECTOR_STATUS_FIELDS, &status) == false) {
+        return;
+    }
+
+    process->uid = status.uid[0];
+    process->rss_anon = status.rss_anon;
+    process->rss_file = status.rss_file;
+    process->rss_shmem = status.rss_shmem;
+    process->swap = status.vm_swap;
+    process->voluntary_ctxt_switches = status.voluntary_ctxt_switches;
+    process->nonvoluntary_ctxt_switches = status.nonvoluntary_ctxt_switches;
+    entry->status_read = true;
+}
+
+static void read_maps_summary(struct collector_entry* entry, const char* data, size_t size)
+{
+    struct CollectorProcess* process = &entry->process;
+    struct VirtualMemoryArea* VMAs = NULL;
+    int vma_count = 0;
+    int i;
+
+    if (parse_maps_data(data, size, &VMAs, &vma_count) == false) {
+        return;
+    }
+
+    process->vma_count = vma_count;
+    process->mapped_file = 0;
+    process->mapped_anon = 0;
+
+    for (i = 0; i < vma_count; i++) {
+        if (VMAs[i].inode) {
+            process->mapped_file += VMAs[i].end_address - VMAs[i].start_address;
+        }
+        else {
+            process->mapped_anon += VMAs[i].end_address - VMAs[i].start_address;
+        }
+    }
+
+    entry->read_maps = false;
+
+    if (VMAs) {
+        free(VMAs);
+    }
+}
+
+static void read_entry_file(int pid, const char* name, const char* data, size_t size, int error, void* arg)
+{
+    struct collector* collector = arg;
+    struct collector_entry* entry = find_entry(collector->next_entries, collector->next_entry_count, pid);
+
+    if (entry == NULL) {
+        return;
+    }
+
+    /* unreadable maps or cgroup are not retried until something changes */
+    if (error) {
+        if (strcmp(name, "maps") == 0) {
+            entry->read_maps = false;
+        }
+        else if (strcmp(name, "cgroup") == 0) {
+            entry->read_cgroup = false;
+        }
+        return;
+    }
+
+    if (strcmp(name, "stat") == 0) {
+        read_stat(collector, entry, data);
+    }
+    else if (strcmp(name, "status") == 0) {
+        read_status(entry, data, size);
+    }
+    else if (strcmp(name, "maps") == 0) {
+        read_maps_summary(entry, data, size);
+    }
+    else if (strcmp(name, "cgroup") == 0) {
+        read_cgroup(collector, entry, data);
+        entry->read_cgroup = false;
+    }
+}
+
+/* carry entries of pids still present over, in pid order, into next_entries */
+static bool merge_entries(struct collector* collector, const pid_t* pids, int pid_count)
+{
+    struct collector_entry* entries = NULL;
+    int i;
+    int j = 0;
+
+    entries = malloc((pid_count + 1) * sizeof(struct collector_entry));
+    if (entries == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < pid_count; i++) {
+        while (j < collector->entry_count && collector->entries[j].process.pid < pids[i]) {
+            j++;
+        }
+
+        if (j < collector->entry_count && collector->entries[j].process.pid == pids[i]) {
+            entries[i] = collector->entries[j];
+            entries[i].known = true;
+        }
+        else {
+            entries[i].process.pid = pids[i];
+            reset_entry(&entries[i]);
+        }
+
+        entries[i].alive = false;
+        entries[i].status_read = false;
+    }
+
+    if (collector->next_entries) {
+        free(collector->next_entries);
+    }
+
+    collector->next_entries = entries;
+    collector->next_entry_count = pid_count;
+
+    return true;
+}
+
+static unsigned long long metric_value(const struct CollectorProcess* process, int metric)
+{
+    switch (metric) {
+    case COLLECTOR_METRIC_RSS:
+        return process->rss;
+    case COLLECTOR_METRIC_CPU:
+        return process->cpu_delta;
+    case COLLECTOR_METRIC_VSIZE:
+        return process->vsize;
+    case COLLECTOR_METRIC_SWAP:
+        return process->swap;
+    case COLLECTOR_METRIC_THREADS:
+        return (unsigned long long)process->num_threads;
+    }
+
+    return 0;
+}
+
+static int compare_ranked_entry(const void* a, const void* b)
+{
+    const struct ranked_entry* left = a;
+    const struct ranked_entry* right = b;
+
+    if (left->value != right->value) {
+        return left->value < right->value ? 1 : -1;
+    }
+
+    return left->index - right->index;
+}
+
+static int compare_cgroup_entry(const void* a, const void* b)
+{
+    const struct ranked_entry* left = a;
+    const struct ranked_entry* right = b;
+
+    if (left->value != right->value) {
+        return left->value < right->value ? -1 : 1;
+    }
+
+    return left->index - right->index;
+}
+
+static void free_indexes(struct collector_indexes* indexes)
+{
+    int metric;
+
+    for (metric = 0; metric < COLLECTOR_METRIC_COUNT; metric++) {
+        if (indexes->top[metric]) {
+            free(indexes->top[metric]);
+        }
+    }
+
+    if (indexes->by_cgroup) {
+        free(indexes->by_cgroup);
+    }
+
+    if (indexes->cgroup_first) {
+        free(indexes->cgroup_first);
+    }
+
+    if (indexes->cgroup_size) {
+        free(indexes->cgroup_size);
+    }
+
+    memset(indexes, 0x00, sizeof(struct collector_indexes));
+}
+
+/* queries only walk these, they are rebuilt once per refresh over next_entries */
+static bool build_indexes(struct collector* collector, struct collector_indexes* indexes)
+{
+    bool result = true;
+
+    const struct collector_entry* entries = collector->next_entries;
+    struct ranked_entry* ranked = NULL;
+    int count = collector->next_entry_count;
+    int metric;
+    int i;
+
+    memset(indexes, 0x00, sizeof(struct collector_indexes));
+    indexes->cgroup_count = collector->cgroup_count;
+
+    ranked = malloc((count + 1) * sizeof(struct ranked_entry));
+    NULLERRGOTO(ranked, result, done);
+
+    for (metric = 0; metric < COLLECTOR_METRIC_COUNT; metric++) {
+        indexes->top[metric] = malloc((count + 1) * sizeof(int));
+        NULLERRGOTO(indexes->top[metric], result, done);
+
+        for (i = 0; i < count; i++) {
+            ranked[i].value = metric_value(&entries[i].process, metric);
+            ranked[i].index = i;
+        }
+
+        qsort(ranked, count, sizeof(struct ranked_entry), compare_ranked_entry);
+
+        for (i = 0; i < count; i++) {
+            indexes->top[metric][i] = ranked[i].index;
+        }
+    }
+
+    indexes->by_cgroup = malloc((count + 1) * sizeof(int));
+    indexes->cgroup_first = calloc(indexes->cgroup_count + 1, sizeof(int));
+    indexes->cgroup_size = calloc(indexes->cgroup_count + 1, sizeof(int));
+    if (indexes->by_cgroup == NULL || indexes->cgroup_first == NULL || indexes->cgroup_size == NULL) {
+        SETERRGOTO(result, done);
+    }
+
+    /* entries whose cgroup is unknown sort last and belong to none */
+    for (i = 0; i < count; i++) {
+        ranked[i].value = (unsigned int)entries[i].cgroup;
+        ranked[i].index = i;
+    }
+
+    qsort(ranked, count, sizeof(struct ranked_entry), compare_cgroup_entry);
+
+    for (i = 0; i < count; i++) {
+        int cgroup = entries[ranked[i].index].cgroup;
+
+        indexes->by_cgroup[i] = ranked[i].index;
+
+        if (cgroup >= 0) {
+            if (indexes->cgroup_size[cgroup] == 0) {
+                indexes->cgroup_first[cgroup] = i;
+            }
+            indexes->cgroup_size[cgroup]++;
+        }
+    }
+
+done:
+
+    if (ranked) {
+        free(ranked);
+    }
+
+    if (result == false) {
+        free_indexes(indexes);
+    }
+
+    return result;
+}
+
+collector_t create_collector()
+{
+    struct collector* collector = calloc(1, sizeof(struct collector));
+
+    if (collector == NULL) {
+        return NULL;
+    }
+
+    collector->batch = create_procfs_batch(COLLECTOR_BATCH_DEPTH, COLLECTOR_BATCH_BUFFER, 0);
+    if (collector->batch == NULL) {
+        free(collector);
+        return NULL;
+    }
+
+    collector->page_kb = sysconf(_SC_PAGESIZE) / 1024;
+
+    return collector;
+}
+
+void destroy_collector(collector_t collector_h)
+{
+    struct collector* collector = (struct collector*)collector_h;
+    int i;
+
+    if (collector == NULL) {
+        return;
+    }
+
+    free_indexes(&collector->indexes);
+
+    for (i = 0; i < collector->cgroup_count; i++) {
+        free(collector->cgroups[i]);
+    }
+
+    if (collector->cgroups) {
+        free(collector->cgroups);
+    }
+
+    if (collector->entries) {
+        free(collector->entries);
+    }
+
+    if (collector->next_entries) {
+        free(collector->next_entries);
+    }
+
+    if (collector->results) {
+        free(collector->results);
+    }
+
+    destroy_procfs_batch(collector->batch);
+    free(collector);
+}
+
+bool refresh_collector(collector_t collector_h)
+{
+    bool result = true;
+
+    struct collector* collector = (struct collector*)collector_h;
+    struct collector_indexes indexes;
+    pid_t* pids = NULL;
+    int pid_count = 0;
+    int count;
+    int i;
+
+    result = list_process_ids(&pids, &pid_count);
+    IFERRGOTO(result, done);
+
+    /* entries and indexes stay as they were until everything below succeeded */
+    result = merge_entries(collector, pids, pid_count);
+    IFERRGOTO(result, done);
+
+    /* stat and status every time, cgroup once per process */
+    for (i = 0; i < collector->next_entry_count; i++) {
+        struct collector_entry* entry = &collector->next_entries[i];
+
+        result = add_procfs_batch_file(collector->batch, entry->process.pid, "stat") &&
+            add_procfs_batch_file(collector->batch, entry->process.pid, "status");
+        IFERRGOTO(result, done);
+
+        if (entry->read_cgroup) {
+            result = add_procfs_batch_file(collector->batch, entry->process.pid, "cgroup");
+            IFERRGOTO(result, done);
+        }
+    }
+
+    result = run_procfs_batch(collector->batch, read_entry_file, collector);
+    IFERRGOTO(result, done);
+
+    /* maps of new processes and of those whose vsize changed, cgroup of reused pids */
+    for (i = 0; i < collector->next_entry_count; i++) {
+        struct collector_entry* entry = &collector->next_entries[i];
+
+        if (entry->alive && entry->read_maps) {
+            result = add_procfs_batch_file(collector->batch, entry->process.pid, "maps");
+            IFERRGOTO(result, done);
+        }
+
+        if (entry->alive && entry->read_cgroup) {
+            result = add_procfs_batch_file(collector->batch, entry->process.pid, "cgroup");
+            IFERRGOTO(result, done);
+        }
+    }
+
+    result = run_procfs_batch(collector->batch, read_entry_file, collector);
+    IFERRGOTO(result, done);
+
+    /* drop processes that exited while being read */
+    for (i = 0, count = 0; i < collector->next_entry_count; i++) {
+        if (collector->next_entries[i].alive) {
+            collector->next_entries[count++] = collector->next_entries[i];
+        }
+    }
+
+    collector->next_entry_count = count;
+
+    result = build_indexes(collector, &indexes);
+    IFERRGOTO(result, done);
+
+    free_indexes(&collector->indexes);
+    collector->indexes = indexes;
+
+    if (collector->entries) {
+        free(collector->entries);
+    }
+
+    collector->entries = collector->next_entries;
+    collector->entry_count = collector->next_entry_count;
+    collector->next_entries = NULL;
+    collector->next_entry_count = 0;
+
+    collector->generation++;
+    collector->timestamp_ns = realtime_ns();
+
+done:
+
+    if (collector->next_entries) {
+        free(collector->next_entries);
+        collector->next_entries = NULL;
+        collector->next_entry_count = 0;
+    }
+
+    if (pids) {
+        free(pids);
+    }
+
+    return result;
+}
+
+static bool add_result(struct collector* collector, int* count, const struct CollectorProcess* process)
+{
+    if (*count == collector->result_capacity) {
+        int capacity = collector->result_capacity ? collector->result_capacity * 2 : 256;
+        struct CollectorProcess* grown = realloc(collector->results, capacity * sizeof(struct CollectorProcess));
+
+        if (grown == NULL) {
+            return false;
+        }
+
+        collector->results = grown;
+        collector->result_capacity = capacity;
+    }
+
+    collector->results[(*count)++] = *process;
+
+    return true;
+}
+
+/* path itself, and below it when recursive */
+static bool match_cgroup(const char* cgroup, const char* path, size_t length, bool recursive)
+{
+    if (strncmp(cgroup, path, length) != 0) {
+        return false;
+    }
+
+    if (cgroup[length] == '\0') {
+        return true;
+    }
+
+    return recursive && (cgroup[length] == '/' || (length > 0 && path[length - 1] == '/'));
+}
+
+bool run_collector_query(collector_t collector_h, const struct CollectorQuery* query, const char* cgroup,
+    struct CollectorReply* reply, const struct CollectorProcess** processes)
+{
+    struct collector* collector = (struct collector*)collector_h;
+    unsigned int limit = query->limit ? query->limit : (unsigned int)-1;
+    int count = 0;
+    int i;
+
+    memset(reply, 0x00, sizeof(struct CollectorReply));
+    reply->generation = collector->generation;
+    reply->timestamp_ns = collector->timestamp_ns;
+
+    switch (query->type) {
+    case COLLECTOR_QUERY_PID: {
+        struct collector_entry* entry = find_entry(collector->entries, collector->entry_count, (int)query->pid);
+
+        if (entry == NULL) {
+            reply->error = ESRCH;
+            break;
+        }
+
+        if (add_result(collector, &count, &entry->process) == false) {
+            reply->error = ENOMEM;
+        }
+        break;
+    }
+    case COLLECTOR_QUERY_TOP:
+        if (query->metric >= COLLECTOR_METRIC_COUNT) {
+            reply->error = EINVAL;
+            break;
+        }
+
+        for (i = 0; i < collector->entry_count && (unsigned int)count < limit; i++) {
+            if (add_result(collector, &count, &collector->entries[collector->indexes.top[query->metric][i]].process) == false) {
+                reply->error = ENOMEM;
+                break;
+            }
+        }
+        break;
+    case COLLECTOR_QUERY_CGROUP: {
+        size_t length = cgroup ? strlen(cgroup) : 0;
+        int id;
+
+        if (length == 0) {
+            reply->error = EINVAL;
+            break;
+        }
+
+        /* cgroups interned by a refresh that failed are not indexed */
+        for (id = 0; id < collector->indexes.cgroup_count; id++) {
+            int first = collector->indexes.cgroup_first[id];
+
+            if (match_cgroup(collector->cgroups[id], cgroup, length, query->recursive != 0) == false) {
+                continue;
+            }
+
+            for (i = 0; i < collector->indexes.cgroup_size[id] && (unsigned int)count < limit; i++) {
+                if (add_result(collector, &count, &collector->entries[collector->indexes.by_cgroup[first + i]].process) == false) {
+                    reply->error = ENOMEM;
+                    break;
+                }
+            }
+        }
+        break;
+    }
+    default:
+        reply->error = EINVAL;
+        break;
+    }
+
+    reply->count = reply->error ? 0 : count;
+    *processes = collector->results;
+
+    return reply->error == 0;
+}
+
+static bool send_all(int fd, const void* data, size_t size)
+{
+    const char* cursor = data;
+
+    while (size > 0) {
+        ssize_t wsz = send(fd, cursor, size, MSG_NOSIGNAL);
+
+        if (wsz < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (wsz <= 0) {
+            return false;
+        }
+
+        cursor += wsz;
+        size -= wsz;
+    }
+
+    return true;
+}
+
+static bool recv_all(int fd, void* data, size_t size)
+{
+    char* cursor = data;
+
+    while (size > 0) {
+        ssize_t rsz = recv(fd, cursor, size, 0);
+
+        if (rsz < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (rsz <= 0) {
+            return false;
+        }
+
+        cursor += rsz;
+        size -= rsz;
+    }
+
+    return true;
+}
+
+/* false when the client is gone or misbehaves, its connection is closed then */
+static bool serve_request(struct collector* collector, int fd)
+{
+    const struct CollectorProcess* processes = NULL;
+    struct CollectorQuery query;
+    struct CollectorReply reply;
+    char cgroup[PATH_MAX];
+
+    if (recv_all(fd, &query, sizeof(query)) == false || query.path_length >= sizeof(cgroup)) {
+        return false;
+    }
+
+    if (recv_all(fd, cgroup, query.path_length) == false) {
+        return false;
+    }
+
+    cgroup[query.path_length] = '\0';
+
+    run_collector_query(collector, &query, cgroup, &reply, &processes);
+
+    return send_all(fd, &reply, sizeof(reply)) &&
+        send_all(fd, processes, reply.count * sizeof(struct CollectorProcess));
+}
+
+static int listen_collector(const char* socket_path)
+{
+    struct sockaddr_un address;
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        PP_ERROR(ENAMETOOLONG, "socket path %s is too long", socket_path);
+        return -1;
+    }
+
+    memset(&address, 0x00, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        PP_ERROR(errno, "cannot create socket");
+        return -1;
+    }
+
+    unlink(socket_path);
+
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(fd, COLLECTOR_MAX_CLIENTS) != 0) {
+        PP_ERROR(errno, "cannot listen on %s", socket_path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void set_io_timeout(int fd)
+{
+    struct timeval timeout = { COLLECTOR_IO_TIMEOUT, 0 };
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+bool serve_collector(collector_t collector_h, const char* socket_path, unsigned int interval_ms,
+    const volatile sig_atomic_t* stop)
+{
+    bool result = true;
+
+    struct collector* collector = (struct collector*)collector_h;
+    struct pollfd fds[COLLECTOR_MAX_CLIENTS + 1];
+    unsigned long long next_refresh = 0;
+    int fd_count = 1;
+    int i;
+
+    fds[0].fd = listen_collector(socket_path);
+    fds[0].events = POLLIN;
+    if (fds[0].fd < 0) {
+        return false;
+    }
+
+    while (*stop == 0) {
+        unsigned long long now = monotonic_ms();
+        int ready;
+
+        if (now >= next_refresh) {
+            result = refresh_collector(collector);
+            IFERRGOTO(result, done);
+
+            /* a refresh slower than the interval delays the next one rather than piling up */
+            next_refresh = now + interval_ms;
+            if (next_refresh <= monotonic_ms()) {
+                next_refresh = monotonic_ms() + interval_ms;
+            }
+            continue;
+        }
+
+        ready = poll(fds, fd_count, (int)(next_refresh - now));
+        if (ready < 0 && errno != EINTR) {
+            PP_ERROR(errno, "poll failed");
+            SETERRGOTO(result, done);
+        }
+
+        if (ready <= 0) {
+            continue;
+        }
+
+        for (i = fd_count - 1; i > 0; i--) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+
+            if ((fds[i].revents & POLLIN) == 0 || serve_request(collector, fds[i].fd) == false) {
+                close(fds[i].fd);
+                fds[i] = fds[--fd_count];
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int client = accept(fds[0].fd, NULL, NULL);
+
+            if (client >= 0 && fd_count == COLLECTOR_MAX_CLIENTS + 1) {
+                close(client);
+            }
+            else if (client >= 0) {
+                fcntl(client, F_SETFD, FD_CLOEXEC);
+                set_io_timeout(client);
+                fds[fd_count].fd = client;
+                fds[fd_count].events = POLLIN;
+                fds[fd_count].revents = 0;
+                fd_count++;
+            }
+        }
+    }
+
+done:
+
+    for (i = 0; i < fd_count; i++) {
+        close(fds[i].fd);
+    }
+
+    unlink(socket_path);
+
+    return result;
+}
+
+int connect_collector(const char* socket_path)
+{
+    struct sockaddr_un address;
+    int fd;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        PP_ERROR(ENAMETOOLONG, "socket path %s is too long", socket_path);
+        return -1;
+    }
+
+    memset(&address, 0x00, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        PP_ERROR(errno, "cannot create socket");
+        return -1;
+    }
+
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        PP_ERROR(errno, "cannot connect to %s", socket_path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+bool query_collector(int fd, const struct CollectorQuery* query, const char* cgroup,
+    struct CollectorReply* reply, struct CollectorProcess** processes)
+{
+    bool result = true;
+
+    struct CollectorQuery request = *query;
+    struct CollectorProcess* received = NULL;
+
+    request.path_length = cgroup ? strlen(cgroup) : 0;
+
+    if (send_all(fd, &request, sizeof(request)) == false ||
+        send_all(fd, cgroup, request.path_length) == false ||
+        recv_all(fd, reply, sizeof(struct CollectorReply)) == false) {
+        PP_ERROR(errno ? errno : EPIPE, "collector connection failed");
+        SETERRGOTO(result, done);
+    }
+
+    received = malloc((reply->count + 1) * sizeof(struct CollectorProcess));
+    NULLERRGOTO(received, result, done);
+
+    if (recv_all(fd, received, reply->count * sizeof(struct CollectorProcess)) == false) {
+        PP_ERROR(errno ? errno : EPIPE, "collector connection failed");
+        SETERRGOTO(result, done);
+    }
+
+    if (reply->error) {
+        PP_ERROR(reply->error, "collector query failed");
+        SETERRGOTO(result, done);
+    }
+
+    *processes = received;
+    received = NULL;
+
+done:
+
+    if (received) {
+        free(received);
+    }
+
+    return result;
+}
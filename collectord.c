@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "procfs_parser_api.h"
+
+/*
+ * Collector daemon: keeps a warm system snapshot and answers queries on a
+ * unix socket, see serve_collector. runs in the foreground until SIGINT or
+ * SIGTERM.
+ */
+
+#define DEFAULT_SOCKET_PATH "/run/procfs-collector.sock"
+#define DEFAULT_INTERVAL_MS 1000
+
+static volatile sig_atomic_t stop = 0;
+
+static void handle_signal(int signal_number)
+{
+    (void)signal_number;
+    stop = 1;
+}
+
+static void usage(const char* program)
+{
+    fprintf(stderr,
+        "usage: %s [-s socket] [-i interval ms] [-r root]\n"
+        "  -s  socket path, default " DEFAULT_SOCKET_PATH "\n"
+        "  -i  refresh interval, default %d ms\n"
+        "  -r  procfs root, default /proc\n",
+        program, DEFAULT_INTERVAL_MS);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* socket_path = DEFAULT_SOCKET_PATH;
+    const char* root = NULL;
+    int interval_ms = DEFAULT_INTERVAL_MS;
+    collector_t collector = NULL;
+    struct ProcfsError error;
+    struct sigaction action;
+    bool served;
+    int option;
+
+    while ((option = getopt(argc, argv, "s:i:r:")) != -1) {
+        switch (option) {
+        case 's':
+            socket_path = optarg;
+            break;
+        case 'i':
+            interval_ms = atoi(optarg);
+            break;
+        case 'r':
+            root = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (interval_ms < 1) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (root && set_procfs_root(root) == false) {
+        fprintf(stderr, "invalid procfs root %s\n", root);
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&action, 0x00, sizeof(action));
+    action.sa_handler = handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    collector = create_collector();
+    if (collector == NULL) {
+        fprintf(stderr, "cannot create the collector\n");
+        exit(EXIT_FAILURE);
+    }
+
+    served = serve_collector(collector, socket_path, (unsigned int)interval_ms, &stop);
+    if (served == false && get_procfs_last_error(NULL, &error)) {
+        fprintf(stderr, "%s: %s\n", error.function, error.message);
+    }
+
+    destroy_collector(collector);
+
+    exit(served ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -6,128 +6,259 @@
 #include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
+#include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ptrace.h>
 #include <wait.h>
+#include <pthread.h>
 
 #include "procfs_parser_api.h"
 #include "pp_internal.h"
+#include "pp_stats.h"
 
-struct kernel_version {
-    int major;
-    int minor;
-    int patch;
-};
 
-#define VERSION_PREFIX "Linux version"
-#define VERSION_PREFIX_LEN ( sizeof( "Linux version" ) - 1 )
+/* stat lines of kernel threads are short, longer ones are read again */
+#define FILTER_BATCH_DEPTH  64
+#define FILTER_BATCH_BUFFER 512
 
-static bool read_kernel_version(struct kernel_version* kversion)
+bool is_process_alive(const int pid, bool* is_alive)
 {
-    bool result = true;
+    char path[PATH_MAX];
 
-    FILE* vfile = NULL;
-    char buffer[32] = "";
-    char* cursor = NULL;
-    struct kernel_version kv = {
-        0,
-    };
-
-    vfile = fopen("/proc/version", "r");
-    if (!vfile) {
-        SETERRGOTO(result, done);
+    if (make_process_path(path, sizeof(path), pid, NULL) == false) {
+        return false;
     }
 
-    if (fread(buffer, 1, sizeof(buffer), vfile) < sizeof(buffer)) {
-        SETERRGOTO(result, done);
+    if (access(path, F_OK) == 0) {
+        *is_alive = true;
     }
-    buffer[sizeof(buffer) - 1] = '\0';
+    else {
+        *is_alive = false;
+    }
+
+    return true;
+}
+
+static int compare_pid(const void* a, const void* b)
+{
+    pid_t left = *(const pid_t*)a;
+    pid_t right = *(const pid_t*)b;
+
+    return (left > right) - (left < right);
+}
+
+bool list_process_ids(pid_t** process_ids, int* pid_count)
+{
+    bool result = true;
+
+    DIR* dir = NULL;
+    struct dirent* entry = NULL;
+    pid_t* pids = NULL;
+    int count = 0;
+    int capacity = 0;
 
-    if (strncmp(buffer, VERSION_PREFIX, VERSION_PREFIX_LEN) != 0) {
+    dir = opendir(get_context_procfs_root(NULL));
+    if (dir == NULL) {
+        PP_ERROR(errno, "cannot open %s", get_context_procfs_root(NULL));
         SETERRGOTO(result, done);
     }
 
-    cursor = buffer + VERSION_PREFIX_LEN;
-    for (int i = 0; i < 3; i++) {
-        long version;
-        cursor++; // skip ' ' or '.'
+    while ((entry = readdir(dir)) != NULL) {
+        char* end = NULL;
+        long pid = strtol(entry->d_name, &end, 10);
+
+        if (*end != '\0' || pid <= 0) {
+            continue;
+        }
+
+        if (count == capacity) {
+            pid_t* grown = NULL;
 
-        errno = 0;
-        version = strtol(cursor, &cursor, 10);
-        if (errno != 0) {
-            SETERRGOTO(result, done);
+            capacity = capacity ? capacity * 2 : 256;
+            grown = realloc(pids, capacity * sizeof(pid_t));
+            NULLERRGOTO(grown, result, done);
+            pids = grown;
         }
 
-        *((int*)&kv + i) = (int)version;
+        pids[count++] = (pid_t)pid;
     }
 
-    *kversion = kv;
-    result = true;
+    qsort(pids, count, sizeof(pid_t), compare_pid);
+
+    *process_ids = pids;
+    *pid_count = count;
+    pids = NULL;
 
 done:
 
-    if (vfile != NULL) {
-        fclose(vfile);
+    if (dir) {
+        closedir(dir);
+    }
+
+    if (pids) {
+        free(pids);
     }
 
     return result;
 }
 
-#define COMPARE_VERSION(v1, v2) \
-    if (v1 != v2) {             \
-        return v1 - v2;         \
+bool is_user_process(const int pid, bool* is_up)
+{
+    bool result = false;
+
+    result = is_kernel_process(pid, is_up);
+    if (result == true) {
+        *is_up = !*is_up;
     }
 
-static int compare_kernel_version(struct kernel_version* kversion,
-    const int major, const int minor, const int patch)
+    return result;
+}
+
+/* flags, the 9th field of a stat line */
+static bool parse_stat_flags(const char* data, unsigned int* flags)
 {
-    COMPARE_VERSION(kversion->major, major);
-    COMPARE_VERSION(kversion->minor, minor);
-    COMPARE_VERSION(kversion->patch, patch);
+    const char* cursor = strrchr(data, ')');
+    char* next = NULL;
+    int i;
+
+    if (cursor == NULL || cursor[1] != ' ') {
+        return false;
+    }
+    cursor += 3; // skip ") " and the state
+
+    /* ppid, pgrp, session, tty_nr and tpgid */
+    for (i = 0; i < 5; i++) {
+        strtol(cursor, &next, 10);
+        if (next == cursor) {
+            return false;
+        }
+        cursor = next;
+    }
+
+    *flags = (unsigned int)strtoul(cursor, &next, 10);
 
-    return 0; // same kernel version
+    return next != cursor;
 }
 
-bool is_process_alive(const int pid, bool* is_alive)
+/* PF_KTHREAD alone, pid and ppid 2 are ordinary processes inside a pid namespace */
+static bool is_kernel_thread(unsigned int flags)
 {
-    char path[32];
+    return (flags & PROCESS_FLAG_KTHREAD) != 0;
+}
 
-    if (sprintf(path, "/proc/%d", pid) < 0) {
+bool is_kernel_thread_stat(const struct ProcessStat* stat)
+{
+    return is_kernel_thread(stat->flags);
+}
+
+bool is_kernel_process(const int pid, bool* is_kp)
+{
+    char buffer[512];
+    unsigned int flags;
+    ssize_t rsz;
+    int fd;
+
+    /* stat lines of kernel threads are short, the fields needed come first */
+    fd = open_process_file(pid, "stat", O_RDONLY);
+    if (fd < 0) {
         return false;
     }
 
-    if (access(path, F_OK) == 0) {
-        *is_alive = true;
+    rsz = read(fd, buffer, sizeof(buffer) - 1);
+    pp_stats_io(rsz > 0 ? rsz : 0, 1);
+    close(fd);
+
+    if (rsz <= 0) {
+        return false;
     }
-    else {
-        *is_alive = false;
+    buffer[rsz] = '\0';
+
+    if (parse_stat_flags(buffer, &flags) == false) {
+        return false;
     }
 
+    *is_kp = is_kernel_thread(flags);
+
     return true;
 }
 
-bool is_user_process(const int pid, bool* is_up)
+struct kernel_thread_filter
 {
-    bool result = false;
+    pid_t* kernel_pids;
+    int kernel_count;
+    pid_t* gone_pids;
+    int gone_count;
+};
 
-    result = is_kernel_process(pid, is_up);
-    if (result == true) {
-        *is_up = !*is_up;
-    }
+static void classify_process(int pid, const char* name, const char* data, size_t size, int error, void* arg)
+{
+    struct kernel_thread_filter* filter = arg;
+    unsigned int flags;
 
-    return result;
+    if (error || parse_stat_flags(data, &flags) == false) {
+        filter->gone_pids[filter->gone_count++] = pid;
+    }
+    else if (is_kernel_thread(flags)) {
+        filter->kernel_pids[filter->kernel_count++] = pid;
+    }
 }
 
-bool is_kernel_process(const int pid, bool* is_kp)
+bool filter_kernel_threads(const pid_t* pids, int pid_count, pid_t* user_pids, int* user_count)
 {
-    bool result = false;
-    char buffer[2];
+    bool result = true;
 
-    /* succeed to read at least 1 byte from cmdline file => user process */
-    result = read_command_line(pid, buffer, sizeof(buffer));
-    if (result == true) {
-        *is_kp = false;
+    struct kernel_thread_filter filter = { NULL, 0, NULL, 0 };
+    procfs_batch_t batch = NULL;
+    int count = 0;
+    int i;
+
+    filter.kernel_pids = malloc((pid_count + 1) * sizeof(pid_t));
+    filter.gone_pids = malloc((pid_count + 1) * sizeof(pid_t));
+    if (filter.kernel_pids == NULL || filter.gone_pids == NULL) {
+        SETERRGOTO(result, done);
+    }
+
+    batch = create_procfs_batch(FILTER_BATCH_DEPTH, FILTER_BATCH_BUFFER, 0);
+    NULLERRGOTO(batch, result, done);
+
+    for (i = 0; i < pid_count; i++) {
+        result = add_procfs_batch_file(batch, pids[i], "stat");
+        IFERRGOTO(result, done);
+    }
+
+    result = run_procfs_batch(batch, classify_process, &filter);
+    IFERRGOTO(result, done);
+
+    qsort(filter.kernel_pids, filter.kernel_count, sizeof(pid_t), compare_pid);
+    qsort(filter.gone_pids, filter.gone_count, sizeof(pid_t), compare_pid);
+
+    /* keeps the input order, user_pids may be pids itself */
+    for (i = 0; i < pid_count; i++) {
+        pid_t pid = pids[i];
+
+        if (bsearch(&pid, filter.kernel_pids, filter.kernel_count, sizeof(pid_t), compare_pid) ||
+            bsearch(&pid, filter.gone_pids, filter.gone_count, sizeof(pid_t), compare_pid)) {
+            continue;
+        }
+
+        user_pids[count++] = pid;
+    }
+
+    *user_count = count;
+
+done:
+
+    if (batch) {
+        destroy_procfs_batch(batch);
+    }
+
+    if (filter.kernel_pids) {
+        free(filter.kernel_pids);
+    }
+
+    if (filter.gone_pids) {
+        free(filter.gone_pids);
     }
 
     return result;
@@ -137,16 +268,19 @@ bool read_command_line(const int pid, char* cmdline, unsigned int bsz)
 {
     bool result = false;
 
-    char path[32];
+    struct pp_stats_scope scope;
+    char path[PATH_MAX];
     FILE* file = NULL;
     char* buff = NULL;
     int rsz = 0;
 
-    if (sprintf(path, "/proc/%d/cmdline", pid) < 0) {
-        return false;
+    pp_stats_begin(&scope, API_READ_COMMAND_LINE);
+
+    if (make_process_path(path, sizeof(path), pid, "cmdline") == false) {
+        SETERRGOTO(result, done);
     }
 
-    buff = malloc(bsz);
+    buff = (char*)pp_context_buffer(bsz);
     if (buff == NULL) {
         SETERRGOTO(result, done);
     }
@@ -154,10 +288,12 @@ bool read_command_line(const int pid, char* cmdline, unsigned int bsz)
 
     file = fopen(path, "r");
     if (file == NULL) {
+        PP_ERROR(errno, "cannot open %s", path);
         SETERRGOTO(result, done);
     }
 
     rsz = fread(buff, 1, bsz, file);
+    pp_stats_stdio(rsz);
     if (rsz == 0) {
         SETERRGOTO(result, done);
     }
@@ -171,9 +307,7 @@ done:
         fclose(file);
     }
 
-    if (buff) {
-        free(buff);
-    }
+    pp_stats_end(&scope, result);
 
     return result;
 }
@@ -182,23 +316,27 @@ bool read_imagepath(const int pid, char* imagepath, unsigned int bsz)
 {
     bool result = false;
 
-    char exe_path[32];
+    struct pp_stats_scope scope;
+    char exe_path[PATH_MAX];
     char buffer[PATH_MAX] = "";
     int length;
 
-    if (sprintf(exe_path, "/proc/%d/exe", pid) < 0) {
-        return false;
+    pp_stats_begin(&scope, API_READ_IMAGEPATH);
+
+    if (make_process_path(exe_path, sizeof(exe_path), pid, "exe") == false) {
+        SETERRGOTO(result, done);
     }
 
     errno = 0;
     length = readlink(exe_path, buffer, sizeof(buffer));
+    pp_stats_io(length > 0 ? length : 0, 1);
     if (errno != 0 && errno != ENOENT) {
-        return false;
+        SETERRGOTO(result, done);
     }
 
     /* failed or not enough buffer size */
     if (length <= 0 || length + 1 > bsz) {
-        return false;
+        SETERRGOTO(result, done);
     }
     else {
         static const int READLINK_DELETED_STR_LEN = sizeof(" (deleted)") - 1;
@@ -218,23 +356,182 @@ bool read_imagepath(const int pid, char* imagepath, unsigned int bsz)
 
 done:
 
+    pp_stats_end(&scope, result);
+
     return result;
 }
 
-bool attach_process_by_pid(const int pid)
+/*
+ * ptrace requests must come from the tracer thread, and a second
+ * PTRACE_ATTACH to a traced process fails. threads attaching to a process
+ * another thread already stopped join that stop instead, reading memory
+ * does not require being the tracer. the tracer detaches once all of
+ * them are done.
+ */
+#define PTRACE_OWNER_BUCKETS 64
+
+enum ptrace_state {
+    TRACE_ATTACHING,
+    TRACE_ATTACHED,
+    TRACE_DETACHING,
+};
+
+struct ptrace_owner {
+    struct ptrace_owner* next;
+    int pid;
+    pthread_t tracer;
+    int tracer_refs; // nested attaches of the tracer thread
+    int users; // other threads sharing the stop
+    enum ptrace_state state;
+};
+
+static struct ptrace_owner* ptrace_owners[PTRACE_OWNER_BUCKETS];
+static pthread_mutex_t ptrace_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ptrace_cond = PTHREAD_COND_INITIALIZER;
+
+static struct ptrace_owner** find_ptrace_owner(const int pid)
+{
+    struct ptrace_owner** slot = &ptrace_owners[(unsigned int)pid % PTRACE_OWNER_BUCKETS];
+
+    while (*slot && (*slot)->pid != pid) {
+        slot = &(*slot)->next;
+    }
+
+    return slot;
+}
+
+static bool ptrace_attach_stop(const int pid)
 {
     if (ptrace(PTRACE_ATTACH, pid, NULL, NULL) == -1) {
+        PP_ERROR(errno, "PTRACE_ATTACH to %d failed", pid);
+        pp_stats_io(0, 1);
         return false;
     }
 
     waitpid(pid, NULL, 0);
+    pp_stats_io(0, 2);
 
     return true;
 }
 
+bool attach_process_by_pid(const int pid)
+{
+    struct ptrace_owner** slot = NULL;
+    struct ptrace_owner* owner = NULL;
+    bool attached = false;
+
+    pthread_mutex_lock(&ptrace_lock);
+
+    for (;;) {
+        slot = find_ptrace_owner(pid);
+        owner = *slot;
+
+        if (owner == NULL) {
+            break;
+        }
+
+        if (pthread_equal(owner->tracer, pthread_self())) {
+            owner->tracer_refs++;
+            pthread_mutex_unlock(&ptrace_lock);
+            return true;
+        }
+
+        if (owner->state == TRACE_ATTACHED) {
+            owner->users++;
+            pthread_mutex_unlock(&ptrace_lock);
+            return true;
+        }
+
+        /* wait for the other thread to finish attaching or detaching */
+        pthread_cond_wait(&ptrace_cond, &ptrace_lock);
+    }
+
+    owner = calloc(1, sizeof(struct ptrace_owner));
+    if (owner == NULL) {
+        pthread_mutex_unlock(&ptrace_lock);
+        return false;
+    }
+
+    owner->pid = pid;
+    owner->tracer = pthread_self();
+    owner->tracer_refs = 1;
+    owner->state = TRACE_ATTACHING;
+    *slot = owner;
+
+    pthread_mutex_unlock(&ptrace_lock);
+
+    attached = ptrace_attach_stop(pid);
+
+    pthread_mutex_lock(&ptrace_lock);
+
+    if (attached) {
+        owner->state = TRACE_ATTACHED;
+    }
+    else {
+        slot = find_ptrace_owner(pid);
+        *slot = owner->next;
+        free(owner);
+    }
+
+    pthread_cond_broadcast(&ptrace_cond);
+    pthread_mutex_unlock(&ptrace_lock);
+
+    if (attached) {
+        pp_stats_ptrace_attach();
+    }
+
+    return attached;
+}
+
 void detach_process_by_pid(const int pid)
 {
-    if (ptrace(PTRACE_DETACH, pid, NULL, NULL) != -1) {
+    struct ptrace_owner** slot = NULL;
+    struct ptrace_owner* owner = NULL;
+
+    pthread_mutex_lock(&ptrace_lock);
+
+    slot = find_ptrace_owner(pid);
+    owner = *slot;
+
+    if (owner == NULL) {
+        /* not attached through attach_process_by_pid */
+        pthread_mutex_unlock(&ptrace_lock);
+        ptrace(PTRACE_DETACH, pid, NULL, NULL);
+        return;
+    }
+
+    if (pthread_equal(owner->tracer, pthread_self()) == false) {
+        owner->users--;
+        pthread_cond_broadcast(&ptrace_cond);
+        pthread_mutex_unlock(&ptrace_lock);
+        return;
+    }
+
+    if (--owner->tracer_refs > 0) {
+        pthread_mutex_unlock(&ptrace_lock);
+        return;
+    }
+
+    owner->state = TRACE_DETACHING;
+    while (owner->users > 0) {
+        pthread_cond_wait(&ptrace_cond, &ptrace_lock);
+    }
+
+    pthread_mutex_unlock(&ptrace_lock);
+
+    pp_stats_ptrace_detach();
+    pp_stats_io(0, 1);
+
+    if (ptrace(PTRACE_DETACH, pid, NULL, NULL) == -1) {
         // failed to detach, but cannot do nothing
     }
+
+    pthread_mutex_lock(&ptrace_lock);
+
+    slot = find_ptrace_owner(pid);
+    *slot = owner->next;
+    free(owner);
+
+    pthread_cond_broadcast(&ptrace_cond);
+    pthread_mutex_unlock(&ptrace_lock);
 }
@@ -2,26 +2,282 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "procfs_parser_api.h"
 #include "pp_internal.h"
 #include "elf_parser.h"
 
+/*
+ * link-time symbol data, independent of the load address so that one copy
+ * serves every process mapping the same image (see elf_cache_lookup)
+ */
+struct elf_symbol_table
+{
+    int refcount;
+
+    /* dynamic symbols, indexed as in DT_SYMTAB */
+    Elf64_Sym* dynsym;
+    int dynsym_count;
+    char* dynstr;
+
+    /* DT_GNU_HASH tables */
+    unsigned int gnu_nbuckets;
+    unsigned int gnu_symoffset;
+    unsigned int gnu_bloom_size;
+    unsigned int gnu_bloom_shift;
+    unsigned int gnu_bloom_bits;
+    unsigned long long* gnu_bloom;
+    unsigned int* gnu_buckets;
+    unsigned int* gnu_chains; // from gnu_symoffset to dynsym_count
+
+    /* DT_HASH tables, used when DT_GNU_HASH is absent */
+    unsigned int sysv_nbuckets;
+    unsigned int* sysv_buckets;
+    unsigned int* sysv_chains;
+
+    /* defined symbols sorted by link-time address */
+    struct elf_symbol* symbols;
+    int symbol_count;
+};
+
 struct elf_process
 {
     int pid;
+    int mem_fd; // "/proc/[pid]/mem", read without stopping the process
 
     struct VirtualMemoryArea* VMAs;
-    unsigned char** vma_buffers;
     int vma_count;
 
     unsigned long long imagebase;
+    unsigned long long load_bias;
 
     bool is_elf32;
     Elf64_Ehdr* hdr;
     Elf64_Phdr* phdr;
+
+    /* NT_GNU_BUILD_ID, build_id_size is 0 if the image has none */
+    bool has_build_id;
+    unsigned char build_id[ELF_BUILD_ID_MAX];
+    int build_id_size;
+
+    /* dynamic segment, addresses are runtime addresses */
+    bool has_dynamic;
+    unsigned long long symtab;
+    unsigned long long strtab;
+    unsigned long long strsz;
+    unsigned long long syment;
+    unsigned long long gnu_hash;
+    unsigned long long sysv_hash;
+
+    struct elf_symbol_table* table;
+};
+
+bool read_elf_process_memory(elf_process_t e_process, unsigned long long address, unsigned char* buffer, size_t size)
+{
+    struct elf_process* process = (struct elf_process*)e_process;
+
+    if (read_memory_at(process->mem_fd, buffer, size, address) != (ssize_t)size) {
+        PP_ERROR(errno, "cannot read 0x%llx of %d", address, process->pid);
+        return false;
+    }
+
+    return true;
+}
+
+static unsigned char* read_elf_memory(struct elf_process* process, unsigned long long address, unsigned long long size)
+{
+    unsigned char* buffer = NULL;
+
+    if (size == 0 || size > INT_MAX) {
+        return NULL;
+    }
+
+    buffer = malloc((size_t)size);
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+    if (read_elf_process_memory(process, address, buffer, (size_t)size) == false) {
+        free(buffer);
+        return NULL;
+    }
+
+    return buffer;
+}
+
+/* convert a file offset inside the mapped image to its runtime address */
+static bool file_offset_to_address(struct elf_process* process, unsigned long long offset, unsigned long long* address)
+{
+    int i;
+
+    for (i = 0; i < process->vma_count; i++) {
+        struct VirtualMemoryArea* vma = &process->VMAs[i];
+
+        if (offset >= vma->file_offset && offset < vma->file_offset + (vma->end_address - vma->start_address)) {
+            *address = vma->start_address + (offset - vma->file_offset);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void release_symbol_table(struct elf_symbol_table* table)
+{
+    if (table == NULL || __atomic_sub_fetch(&table->refcount, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+
+    free(table->dynsym);
+    free(table->dynstr);
+    free(table->gnu_bloom);
+    free(table->gnu_buckets);
+    free(table->gnu_chains);
+    free(table->sysv_buckets);
+    free(table->sysv_chains);
+    free(table->symbols);
+    free(table);
+}
+
+static struct elf_symbol_table* retain_symbol_table(struct elf_symbol_table* table)
+{
+    __atomic_add_fetch(&table->refcount, 1, __ATOMIC_RELAXED);
+
+    return table;
+}
+
+/*
+ * process-wide cache of symbol tables keyed by (device, inode, build-id).
+ * only images with a build-id are cached, (device, inode) alone may be
+ * reused by a different file.
+ */
+#define ELF_CACHE_BUCKETS 256
+
+struct elf_cache_entry
+{
+    struct elf_cache_entry* next;
+
+    unsigned char device_major;
+    unsigned char device_minor;
+    unsigned long long inode;
+    unsigned char build_id[ELF_BUILD_ID_MAX];
+    int build_id_size;
+
+    struct elf_symbol_table* table;
 };
 
+static struct elf_cache_entry* elf_cache[ELF_CACHE_BUCKETS];
+static pthread_mutex_t elf_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool is_cacheable(struct elf_process* process)
+{
+    return process->build_id_size > 0 && process->VMAs[0].inode != UNKNOWN_INODE;
+}
+
+static struct elf_cache_entry** find_cache_slot(struct elf_process* process)
+{
+    struct VirtualMemoryArea* vma = &process->VMAs[0];
+    struct elf_cache_entry** slot = &elf_cache[vma->inode % ELF_CACHE_BUCKETS];
+
+    for (; *slot; slot = &(*slot)->next) {
+        struct elf_cache_entry* entry = *slot;
+
+        if (entry->inode == vma->inode
+            && entry->device_major == vma->device_major
+            && entry->device_minor == vma->device_minor
+            && entry->build_id_size == process->build_id_size
+            && memcmp(entry->build_id, process->build_id, process->build_id_size) == 0) {
+            break;
+        }
+    }
+
+    return slot;
+}
+
+static struct elf_symbol_table* elf_cache_lookup(struct elf_process* process)
+{
+    struct elf_symbol_table* table = NULL;
+    struct elf_cache_entry** slot = NULL;
+
+    if (is_cacheable(process) == false) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&elf_cache_lock);
+
+    slot = find_cache_slot(process);
+    if (*slot) {
+        table = retain_symbol_table((*slot)->table);
+    }
+
+    pthread_mutex_unlock(&elf_cache_lock);
+
+    return table;
+}
+
+/* a table inserted concurrently by another caller wins, returned retained */
+static struct elf_symbol_table* elf_cache_insert(struct elf_process* process, struct elf_symbol_table* table)
+{
+    struct elf_cache_entry** slot = NULL;
+    struct elf_cache_entry* entry = NULL;
+
+    if (is_cacheable(process) == false) {
+        return table;
+    }
+
+    pthread_mutex_lock(&elf_cache_lock);
+
+    slot = find_cache_slot(process);
+    if (*slot) {
+        release_symbol_table(table);
+        table = retain_symbol_table((*slot)->table);
+    }
+    else {
+        entry = calloc(1, sizeof(struct elf_cache_entry));
+        if (entry) {
+            entry->device_major = process->VMAs[0].device_major;
+            entry->device_minor = process->VMAs[0].device_minor;
+            entry->inode = process->VMAs[0].inode;
+            memcpy(entry->build_id, process->build_id, process->build_id_size);
+            entry->build_id_size = process->build_id_size;
+            entry->table = retain_symbol_table(table);
+            *slot = entry;
+        }
+    }
+
+    pthread_mutex_unlock(&elf_cache_lock);
+
+    return table;
+}
+
+void clear_elf_cache()
+{
+    int i;
+
+    pthread_mutex_lock(&elf_cache_lock);
+
+    for (i = 0; i < ELF_CACHE_BUCKETS; i++) {
+        struct elf_cache_entry* entry = elf_cache[i];
+
+        while (entry) {
+            struct elf_cache_entry* next = entry->next;
+
+            release_symbol_table(entry->table);
+            free(entry);
+            entry = next;
+        }
+
+        elf_cache[i] = NULL;
+    }
+
+    pthread_mutex_unlock(&elf_cache_lock);
+}
+
 elf_process_t create_elf_data(int pid, pp_list_t VMAs)
 {
     bool result = true;
@@ -30,11 +286,13 @@ elf_process_t create_elf_data(int pid, pp_list_t VMAs)
     int vma_count;
     int i;
 
-    process = malloc(sizeof(struct elf_process));
+    process = calloc(1, sizeof(struct elf_process));
     NULLERRGOTO(process, result, done);
 
+    process->mem_fd = -1;
+
     vma_count = pp_list_size(VMAs);
-    if (vma_count < 0) {
+    if (vma_count < 1) {
         SETERRGOTO(result, done);
     }
 
@@ -44,9 +302,6 @@ elf_process_t create_elf_data(int pid, pp_list_t VMAs)
     process->VMAs = malloc(vma_count * sizeof(struct VirtualMemoryArea));
     NULLERRGOTO(process->VMAs, result, done);
 
-    process->vma_buffers = malloc(vma_count * sizeof(unsigned char*));
-    NULLERRGOTO(process->vma_buffers, result, done);
-
     for (i = 0; i < vma_count; i++) {
         struct VirtualMemoryArea* vma = NULL;
 
@@ -54,13 +309,16 @@ elf_process_t create_elf_data(int pid, pp_list_t VMAs)
         IFERRGOTO(result, done);
 
         process->VMAs[i] = *vma;
-
-        process->vma_buffers[i] = dump_process_memory_by_address(pid, vma->start_address, vma->end_address);
-        NULLERRGOTO(process->vma_buffers[i], result, done);
     }
 
     process->imagebase = process->VMAs[0].start_address;
 
+    /* headers, dynamic and symbol data are read-only, no ptrace stop is needed */
+    process->mem_fd = open_process_file(pid, "mem", O_RDONLY);
+    if (process->mem_fd < 0) {
+        SETERRGOTO(result, done);
+    }
+
 done:
 
     if (result == false) {
@@ -91,17 +349,12 @@ void destroy_elf_data(elf_process_t e_process)
         free(process->VMAs);
     }
 
-    if (process->vma_buffers) {
-        int i;
-        for (i = 0; i < process->vma_count; i++) {
-            if (process->vma_buffers[i]) {
-                free(process->vma_buffers[i]);
-            }
-        }
-
-        free(process->vma_buffers);
+    if (process->mem_fd >= 0) {
+        close(process->mem_fd);
     }
 
+    release_symbol_table(process->table);
+
     free(process);
 }
 
@@ -116,7 +369,8 @@ bool parse_elf_header(elf_process_t e_process)
     hdr64 = malloc(sizeof(Elf64_Ehdr));
     NULLERRGOTO(hdr64, result, done);
 
-    elf_buffer = process->vma_buffers[0];
+    elf_buffer = read_elf_memory(process, process->imagebase, sizeof(Elf64_Ehdr));
+    NULLERRGOTO(elf_buffer, result, done);
 
     if (memcmp(elf_buffer, ELFMAG, SELFMAG) != 0) {
         /* not the frontmost ELF image VMA, invalid VMA */
@@ -150,6 +404,10 @@ done:
         free(hdr64);
     }
 
+    if (elf_buffer) {
+        free(elf_buffer);
+    }
+
     return result;
 }
 
@@ -161,8 +419,8 @@ bool parse_elf_program_header(elf_process_t e_process)
     struct elf_process* process = (struct elf_process*)e_process;
     Elf64_Phdr* phdr64 = NULL;
     unsigned char* cursor = NULL;
-    int ph_relative_offset;
-    int ph_idx;
+    unsigned long long ph_address;
+    unsigned long long lowest_vaddr = ~0ULL;
     int i;
 
     if (process->hdr == NULL) {
@@ -176,21 +434,17 @@ bool parse_elf_program_header(elf_process_t e_process)
     phdr64 = calloc(process->hdr->e_phnum, sizeof(Elf64_Phdr));
     NULLERRGOTO(phdr64, result, done);
 
-    for (i = 0; i < process->vma_count - 1; i++) {
-        if (process->VMAs[i + 1].file_offset > process->hdr->e_phoff) {
-            ph_idx = i;
-            break;
-        }
+    if (file_offset_to_address(process, process->hdr->e_phoff, &ph_address) == false) {
+        SETERRGOTO(result, done);
     }
 
-    /* convert virtual address to relative offset */
-    ph_relative_offset = process->hdr->e_phoff - process->VMAs[ph_idx].file_offset;
-    cursor = process->vma_buffers[ph_idx] + ph_relative_offset;
+    cursor = read_elf_memory(process, ph_address, (unsigned long long)process->hdr->e_phnum * process->hdr->e_phentsize);
+    NULLERRGOTO(cursor, result, done);
 
     if (process->is_elf32) {
         Elf32_Phdr* phdr32 = (Elf32_Phdr*)cursor;
 
-        for (i = 0; i < process->vma_count; i++) {
+        for (i = 0; i < process->hdr->e_phnum; i++) {
             phdr64[i].p_type   = phdr32[i].p_type;
             phdr64[i].p_flags  = phdr32[i].p_flags;
             phdr64[i].p_offset = phdr32[i].p_offset;
@@ -205,6 +459,17 @@ bool parse_elf_program_header(elf_process_t e_process)
         memcpy(phdr64, cursor, sizeof(Elf64_Phdr) * process->hdr->e_phnum);
     }
 
+    /* runtime address = load bias + p_vaddr, 0 for ET_EXEC */
+    for (i = 0; i < process->hdr->e_phnum; i++) {
+        if (phdr64[i].p_type == PT_LOAD && phdr64[i].p_vaddr < lowest_vaddr) {
+            lowest_vaddr = phdr64[i].p_vaddr;
+        }
+    }
+
+    if (lowest_vaddr != ~0ULL) {
+        process->load_bias = process->imagebase - (lowest_vaddr & ~(unsigned long long)(sysconf(_SC_PAGESIZE) - 1));
+    }
+
     process->phdr = phdr64;
     phdr64 = NULL;
 
@@ -214,6 +479,10 @@ done:
         free(phdr64);
     }
 
+    if (cursor) {
+        free(cursor);
+    }
+
     return result;
 }
 
@@ -226,3 +495,651 @@ Elf64_Phdr* get_elf_program_header(elf_process_t e_process)
 {
     return ((struct elf_process*)e_process)->phdr;
 }
+
+unsigned long long get_elf_load_bias(elf_process_t e_process)
+{
+    return ((struct elf_process*)e_process)->load_bias;
+}
+
+/*
+ * ld.so relocates most d_ptr entries in place, so the in-memory dynamic
+ * segment holds either runtime addresses or link-time ones.
+ */
+static unsigned long long resolve_dynamic_pointer(struct elf_process* process, unsigned long long value)
+{
+    struct VirtualMemoryArea* last = &process->VMAs[process->vma_count - 1];
+
+    if (value >= process->imagebase && value < last->end_address) {
+        return value;
+    }
+
+    return value + process->load_bias;
+}
+
+bool parse_elf_dynamic(elf_process_t e_process)
+{
+    bool result = true;
+
+    struct elf_process* process = (struct elf_process*)e_process;
+    Elf64_Phdr* dynamic = NULL;
+    unsigned char* buffer = NULL;
+    int entry_size;
+    int count;
+    int i;
+
+    if (process->phdr == NULL) {
+        result = parse_elf_program_header(process);
+        IFERRGOTO(result, done);
+    }
+
+    for (i = 0; i < process->hdr->e_phnum; i++) {
+        if (process->phdr[i].p_type == PT_DYNAMIC) {
+            dynamic = &process->phdr[i];
+            break;
+        }
+    }
+
+    if (dynamic == NULL) {
+        SETERRGOTO(result, done); // statically linked
+    }
+
+    buffer = read_elf_memory(process, process->load_bias + dynamic->p_vaddr, dynamic->p_memsz);
+    NULLERRGOTO(buffer, result, done);
+
+    entry_size = process->is_elf32 ? sizeof(Elf32_Dyn) : sizeof(Elf64_Dyn);
+    count = (int)(dynamic->p_memsz / entry_size);
+
+    process->syment = process->is_elf32 ? sizeof(Elf32_Sym) : sizeof(Elf64_Sym);
+
+    for (i = 0; i < count; i++) {
+        long long tag;
+        unsigned long long value;
+
+        if (process->is_elf32) {
+            Elf32_Dyn* dyn = (Elf32_Dyn*)buffer + i;
+            tag = dyn->d_tag;
+            value = dyn->d_un.d_val;
+        }
+        else {
+            Elf64_Dyn* dyn = (Elf64_Dyn*)buffer + i;
+            tag = dyn->d_tag;
+            value = dyn->d_un.d_val;
+        }
+
+        if (tag == DT_NULL) {
+            break;
+        }
+
+        switch (tag) {
+        case DT_SYMTAB:
+            process->symtab = resolve_dynamic_pointer(process, value);
+            break;
+        case DT_STRTAB:
+            process->strtab = resolve_dynamic_pointer(process, value);
+            break;
+        case DT_STRSZ:
+            process->strsz = value;
+            break;
+        case DT_SYMENT:
+            process->syment = value;
+            break;
+        case DT_GNU_HASH:
+            process->gnu_hash = resolve_dynamic_pointer(process, value);
+            break;
+        case DT_HASH:
+            process->sysv_hash = resolve_dynamic_pointer(process, value);
+            break;
+        default:
+            break;
+        }
+    }
+
+    process->has_dynamic = true;
+
+done:
+
+    if (buffer) {
+        free(buffer);
+    }
+
+    return result;
+}
+
+static unsigned int* read_elf_words(struct elf_process* process, unsigned long long address, unsigned int count)
+{
+    return (unsigned int*)read_elf_memory(process, address, (unsigned long long)count * sizeof(unsigned int));
+}
+
+/* chain words read at once past the last bucket */
+#define GNU_CHAIN_BATCH 64
+
+/* DT_GNU_HASH does not store the symbol count, walk the chain of the last bucket */
+static bool parse_gnu_hash(struct elf_process* process, struct elf_symbol_table* table)
+{
+    bool result = true;
+
+    unsigned int* header = NULL;
+    unsigned char* bloom = NULL;
+    unsigned long long address = process->gnu_hash;
+    unsigned int bloom_word_size = process->is_elf32 ? 4 : 8;
+    unsigned int max_bucket = 0;
+    unsigned int chain_count;
+    unsigned int i;
+
+    header = read_elf_words(process, address, 4);
+    NULLERRGOTO(header, result, done);
+
+    table->gnu_nbuckets = header[0];
+    table->gnu_symoffset = header[1];
+    table->gnu_bloom_size = header[2];
+    table->gnu_bloom_shift = header[3];
+    table->gnu_bloom_bits = bloom_word_size * 8;
+    address += 4 * sizeof(unsigned int);
+
+    if (table->gnu_nbuckets == 0 || table->gnu_bloom_size == 0) {
+        SETERRGOTO(result, done);
+    }
+
+    bloom = read_elf_memory(process, address, (unsigned long long)table->gnu_bloom_size * bloom_word_size);
+    NULLERRGOTO(bloom, result, done);
+    address += (unsigned long long)table->gnu_bloom_size * bloom_word_size;
+
+    table->gnu_bloom = malloc(table->gnu_bloom_size * sizeof(unsigned long long));
+    NULLERRGOTO(table->gnu_bloom, result, done);
+
+    for (i = 0; i < table->gnu_bloom_size; i++) {
+        table->gnu_bloom[i] = process->is_elf32 ? ((unsigned int*)bloom)[i] : ((unsigned long long*)bloom)[i];
+    }
+
+    table->gnu_buckets = read_elf_words(process, address, table->gnu_nbuckets);
+    NULLERRGOTO(table->gnu_buckets, result, done);
+    address += (unsigned long long)table->gnu_nbuckets * sizeof(unsigned int);
+
+    for (i = 0; i < table->gnu_nbuckets; i++) {
+        if (table->gnu_buckets[i] > max_bucket) {
+            max_bucket = table->gnu_buckets[i];
+        }
+    }
+
+    if (max_bucket < table->gnu_symoffset) {
+        /* no hashed symbols */
+        table->dynsym_count = table->gnu_symoffset;
+        goto done;
+    }
+
+    /* read chains up to the last bucket start, then until its end marker */
+    chain_count = max_bucket - table->gnu_symoffset + 1;
+    table->gnu_chains = read_elf_words(process, address, chain_count);
+    NULLERRGOTO(table->gnu_chains, result, done);
+
+    while ((table->gnu_chains[chain_count - 1] & 1) == 0) {
+        unsigned long long next_address = address + (unsigned long long)chain_count * sizeof(unsigned int);
+        unsigned int batch = GNU_CHAIN_BATCH;
+        unsigned int* next = NULL;
+        unsigned int* grown = NULL;
+        unsigned int used = 0;
+
+        /* the chain may end right at the end of a mapping */
+        next = read_elf_words(process, next_address, batch);
+        if (next == NULL) {
+            batch = 1;
+            next = read_elf_words(process, next_address, batch);
+            NULLERRGOTO(next, result, done);
+        }
+
+        while (used < batch && (used == 0 || (next[used - 1] & 1) == 0)) {
+            used++;
+        }
+
+        grown = realloc(table->gnu_chains, (chain_count + used) * sizeof(unsigned int));
+        if (grown == NULL) {
+            free(next);
+            SETERRGOTO(result, done);
+        }
+
+        memcpy(grown + chain_count, next, used * sizeof(unsigned int));
+        table->gnu_chains = grown;
+        chain_count += used;
+        free(next);
+    }
+
+    table->dynsym_count = table->gnu_symoffset + chain_count;
+
+done:
+
+    if (header) {
+        free(header);
+    }
+
+    if (bloom) {
+        free(bloom);
+    }
+
+    return result;
+}
+
+static bool parse_sysv_hash(struct elf_process* process, struct elf_symbol_table* table)
+{
+    bool result = true;
+
+    unsigned int* header = NULL;
+    unsigned long long address = process->sysv_hash;
+
+    header = read_elf_words(process, address, 2);
+    NULLERRGOTO(header, result, done);
+    address += 2 * sizeof(unsigned int);
+
+    table->sysv_nbuckets = header[0];
+    table->dynsym_count = (int)header[1]; // nchain equals the symbol count
+
+    table->sysv_buckets = read_elf_words(process, address, table->sysv_nbuckets);
+    NULLERRGOTO(table->sysv_buckets, result, done);
+    address += (unsigned long long)table->sysv_nbuckets * sizeof(unsigned int);
+
+    table->sysv_chains = read_elf_words(process, address, header[1]);
+    NULLERRGOTO(table->sysv_chains, result, done);
+
+done:
+
+    if (header) {
+        free(header);
+    }
+
+    return result;
+}
+
+static int compare_symbol_address(const void* lhs, const void* rhs)
+{
+    const struct elf_symbol* a = lhs;
+    const struct elf_symbol* b = rhs;
+
+    if (a->address != b->address) {
+        return a->address < b->address ? -1 : 1;
+    }
+
+    /* prefer sized symbols when aliases share an address */
+    if (a->size != b->size) {
+        return a->size > b->size ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/* align a note field size, 8 only for notes in 8-aligned PT_NOTE segments */
+#define NOTE_ALIGN(size, align) (((size) + (align) - 1) & ~((unsigned long long)(align) - 1))
+
+bool parse_elf_build_id(elf_process_t e_process)
+{
+    bool result = true;
+
+    struct elf_process* process = (struct elf_process*)e_process;
+    unsigned char* notes = NULL;
+    int i;
+
+    if (process->phdr == NULL) {
+        result = parse_elf_program_header(process);
+        IFERRGOTO(result, done);
+    }
+
+    for (i = 0; i < process->hdr->e_phnum && process->build_id_size == 0; i++) {
+        Elf64_Phdr* phdr = &process->phdr[i];
+        unsigned long long align = phdr->p_align == 8 ? 8 : 4;
+        unsigned long long offset = 0;
+
+        if (phdr->p_type != PT_NOTE || phdr->p_filesz < sizeof(Elf64_Nhdr)) {
+            continue;
+        }
+
+        notes = read_elf_memory(process, process->load_bias + phdr->p_vaddr, phdr->p_filesz);
+        NULLERRGOTO(notes, result, done);
+
+        /* Elf32_Nhdr and Elf64_Nhdr share the same layout */
+        while (offset + sizeof(Elf64_Nhdr) <= phdr->p_filesz) {
+            Elf64_Nhdr* nhdr = (Elf64_Nhdr*)(notes + offset);
+            unsigned long long name_offset = offset + sizeof(Elf64_Nhdr);
+            unsigned long long desc_offset = name_offset + NOTE_ALIGN(nhdr->n_namesz, align);
+
+            if (desc_offset + nhdr->n_descsz > phdr->p_filesz) {
+                break;
+            }
+
+            if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == sizeof(ELF_NOTE_GNU)
+                && memcmp(notes + name_offset, ELF_NOTE_GNU, sizeof(ELF_NOTE_GNU)) == 0
+                && nhdr->n_descsz > 0 && nhdr->n_descsz <= ELF_BUILD_ID_MAX) {
+                memcpy(process->build_id, notes + desc_offset, nhdr->n_descsz);
+                process->build_id_size = nhdr->n_descsz;
+                break;
+            }
+
+            offset = desc_offset + NOTE_ALIGN(nhdr->n_descsz, align);
+        }
+
+        free(notes);
+        notes = NULL;
+    }
+
+    process->has_build_id = true;
+
+done:
+
+    if (notes) {
+        free(notes);
+    }
+
+    return result;
+}
+
+bool get_elf_build_id(elf_process_t e_process, const unsigned char** build_id, int* build_id_size)
+{
+    struct elf_process* process = (struct elf_process*)e_process;
+
+    if (process->build_id_size == 0) {
+        return false;
+    }
+
+    *build_id = process->build_id;
+    *build_id_size = process->build_id_size;
+
+    return true;
+}
+
+static bool load_symbol_table(struct elf_process* process, struct elf_symbol_table* table)
+{
+    bool result = true;
+
+    unsigned char* buffer = NULL;
+    int i;
+
+    if (process->has_dynamic == false) {
+        result = parse_elf_dynamic(process);
+        IFERRGOTO(result, done);
+    }
+
+    if (process->symtab == 0 || process->strtab == 0 || process->strsz == 0) {
+        SETERRGOTO(result, done);
+    }
+
+    if (process->gnu_hash) {
+        result = parse_gnu_hash(process, table);
+    }
+    else if (process->sysv_hash) {
+        result = parse_sysv_hash(process, table);
+    }
+    else {
+        result = false;
+    }
+    IFERRGOTO(result, done);
+
+    table->dynstr = (char*)read_elf_memory(process, process->strtab, process->strsz + 1);
+    NULLERRGOTO(table->dynstr, result, done);
+    table->dynstr[process->strsz] = '\0';
+
+    buffer = read_elf_memory(process, process->symtab, (unsigned long long)table->dynsym_count * process->syment);
+    NULLERRGOTO(buffer, result, done);
+
+    table->dynsym = calloc(table->dynsym_count, sizeof(Elf64_Sym));
+    NULLERRGOTO(table->dynsym, result, done);
+
+    table->symbols = calloc(table->dynsym_count, sizeof(struct elf_symbol));
+    NULLERRGOTO(table->symbols, result, done);
+
+    for (i = 0; i < table->dynsym_count; i++) {
+        Elf64_Sym* sym = &table->dynsym[i];
+        unsigned char* entry = buffer + (unsigned long long)i * process->syment;
+
+        if (process->is_elf32) {
+            Elf32_Sym* sym32 = (Elf32_Sym*)entry;
+
+            sym->st_name = sym32->st_name;
+            sym->st_value = sym32->st_value;
+            sym->st_size = sym32->st_size;
+            sym->st_info = sym32->st_info;
+            sym->st_other = sym32->st_other;
+            sym->st_shndx = sym32->st_shndx;
+        }
+        else {
+            memcpy(sym, entry, sizeof(Elf64_Sym));
+        }
+
+        if (sym->st_name >= process->strsz) {
+            sym->st_name = 0;
+        }
+
+        if (sym->st_shndx == SHN_UNDEF || sym->st_value == 0) {
+            continue;
+        }
+
+        table->symbols[table->symbol_count].address = sym->st_value;
+        table->symbols[table->symbol_count].size = sym->st_size;
+        table->symbols[table->symbol_count].name = table->dynstr + sym->st_name;
+        table->symbols[table->symbol_count].type = ELF64_ST_TYPE(sym->st_info);
+        table->symbols[table->symbol_count].bind = ELF64_ST_BIND(sym->st_info);
+        table->symbol_count++;
+    }
+
+    qsort(table->symbols, table->symbol_count, sizeof(struct elf_symbol), compare_symbol_address);
+
+done:
+
+    if (buffer) {
+        free(buffer);
+    }
+
+    return result;
+}
+
+bool parse_elf_symbols(elf_process_t e_process)
+{
+    bool result = true;
+
+    struct elf_process* process = (struct elf_process*)e_process;
+    struct elf_symbol_table* table = NULL;
+
+    if (process->table) {
+        return true;
+    }
+
+    if (process->has_build_id == false) {
+        result = parse_elf_build_id(process);
+        IFERRGOTO(result, done);
+    }
+
+    /* same image already parsed for another process */
+    process->table = elf_cache_lookup(process);
+    if (process->table) {
+        goto done;
+    }
+
+    table = calloc(1, sizeof(struct elf_symbol_table));
+    NULLERRGOTO(table, result, done);
+    table->refcount = 1;
+
+    result = load_symbol_table(process, table);
+    IFERRGOTO(result, done);
+
+    process->table = elf_cache_insert(process, table);
+    table = NULL;
+
+done:
+
+    release_symbol_table(table);
+
+    return result;
+}
+
+int get_elf_symbol_count(elf_process_t e_process)
+{
+    struct elf_process* process = (struct elf_process*)e_process;
+
+    return process->table ? process->table->symbol_count : 0;
+}
+
+const struct elf_symbol* get_elf_symbols(elf_process_t e_process)
+{
+    struct elf_process* process = (struct elf_process*)e_process;
+
+    return process->table ? process->table->symbols : NULL;
+}
+
+const struct elf_symbol* find_elf_symbol_by_address(elf_process_t e_process, unsigned long long address)
+{
+    struct elf_process* process = (struct elf_process*)e_process;
+    struct elf_symbol_table* table = process->table;
+    const struct elf_symbol* symbol = NULL;
+    int low = 0;
+    int high;
+
+    if (table == NULL || address < process->load_bias) {
+        return NULL;
+    }
+
+    address -= process->load_bias;
+    high = table->symbol_count - 1;
+
+    /* last symbol starting at or below the address */
+    while (low <= high) {
+        int mid = (low + high) / 2;
+
+        if (table->symbols[mid].address <= address) {
+            symbol = &table->symbols[mid];
+            low = mid + 1;
+        }
+        else {
+            high = mid - 1;
+        }
+    }
+
+    /* walk back over aliases to the sized one sorted first */
+    while (symbol && symbol > table->symbols && (symbol - 1)->address == symbol->address) {
+        symbol--;
+    }
+
+    if (symbol == NULL) {
+        return NULL;
+    }
+
+    if (address == symbol->address || address < symbol->address + symbol->size) {
+        return symbol;
+    }
+
+    return NULL;
+}
+
+static unsigned int gnu_hash(const char* name)
+{
+    unsigned int h = 5381;
+
+    for (; *name; name++) {
+        h = (h << 5) + h + (unsigned char)*name;
+    }
+
+    return h;
+}
+
+static unsigned int sysv_hash(const char* name)
+{
+    unsigned int h = 0;
+    unsigned int g;
+
+    for (; *name; name++) {
+        h = (h << 4) + (unsigned char)*name;
+        g = h & 0xf0000000;
+        if (g) {
+            h ^= g >> 24;
+        }
+        h &= ~g;
+    }
+
+    return h;
+}
+
+static bool match_dynsym(struct elf_symbol_table* table, unsigned int index, const char* name, unsigned long long* value)
+{
+    Elf64_Sym* sym = &table->dynsym[index];
+
+    if (sym->st_shndx == SHN_UNDEF || strcmp(table->dynstr + sym->st_name, name) != 0) {
+        return false;
+    }
+
+    *value = sym->st_value;
+
+    return true;
+}
+
+static bool lookup_gnu_hash(struct elf_symbol_table* table, const char* name, unsigned long long* value)
+{
+    unsigned int bloom_bits = table->gnu_bloom_bits;
+    unsigned int h1 = gnu_hash(name);
+    unsigned int h2 = h1 >> table->gnu_bloom_shift;
+    unsigned long long word = table->gnu_bloom[(h1 / bloom_bits) % table->gnu_bloom_size];
+    unsigned long long mask = (1ULL << (h1 % bloom_bits)) | (1ULL << (h2 % bloom_bits));
+    unsigned int index;
+
+    if ((word & mask) != mask) {
+        return false;
+    }
+
+    index = table->gnu_buckets[h1 % table->gnu_nbuckets];
+    if (index < table->gnu_symoffset || table->gnu_chains == NULL) {
+        return false;
+    }
+
+    for (; index < (unsigned int)table->dynsym_count; index++) {
+        unsigned int chain = table->gnu_chains[index - table->gnu_symoffset];
+
+        if ((chain | 1) == (h1 | 1) && match_dynsym(table, index, name, value)) {
+            return true;
+        }
+
+        if (chain & 1) {
+            break;
+        }
+    }
+
+    return false;
+}
+
+static bool lookup_sysv_hash(struct elf_symbol_table* table, const char* name, unsigned long long* value)
+{
+    unsigned int index;
+
+    if (table->sysv_nbuckets == 0) {
+        return false;
+    }
+
+    index = table->sysv_buckets[sysv_hash(name) % table->sysv_nbuckets];
+    while (index != STN_UNDEF && index < (unsigned int)table->dynsym_count) {
+        if (match_dynsym(table, index, name, value)) {
+            return true;
+        }
+
+        index = table->sysv_chains[index];
+    }
+
+    return false;
+}
+
+bool find_elf_symbol_by_name(elf_process_t e_process, const char* name, unsigned long long* address)
+{
+    struct elf_process* process = (struct elf_process*)e_process;
+    struct elf_symbol_table* table = process->table;
+    unsigned long long value = 0;
+    bool found = false;
+
+    if (table == NULL || table->dynsym == NULL) {
+        return false;
+    }
+
+    if (table->gnu_bloom) {
+        found = lookup_gnu_hash(table, name, &value);
+    }
+    else {
+        found = lookup_sysv_hash(table, name, &value);
+    }
+
+    if (found) {
+        *address = process->load_bias + value;
+    }
+
+    return found;
+}
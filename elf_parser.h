@@ -2,12 +2,24 @@
 #define __ELF_PARSER__
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <elf.h>
 
 #include "pp_list.h"
 
 typedef void* elf_process_t;
 
+#define ELF_BUILD_ID_MAX 64
+
+struct elf_symbol
+{
+    unsigned long long address; // link-time address, add get_elf_load_bias() for runtime
+    unsigned long long size;
+    const char* name;
+    unsigned char type;
+    unsigned char bind;
+};
+
 elf_process_t create_elf_data(int pid, pp_list_t VMAs);
 
 void destroy_elf_data(elf_process_t e_process);
@@ -20,4 +32,37 @@ Elf64_Ehdr* get_elf_header(elf_process_t e_process);
 
 Elf64_Phdr* get_elf_program_header(elf_process_t e_process);
 
+unsigned long long get_elf_load_bias(elf_process_t e_process);
+
+/* exactly size bytes at a runtime address, through the "/proc/[pid]/mem" held by e_process */
+bool read_elf_process_memory(elf_process_t e_process, unsigned long long address, unsigned char* buffer, size_t size);
+
+/* NT_GNU_BUILD_ID from PT_NOTE segments */
+bool parse_elf_build_id(elf_process_t e_process);
+
+bool get_elf_build_id(elf_process_t e_process, const unsigned char** build_id, int* build_id_size);
+
+/* PT_DYNAMIC: DT_SYMTAB, DT_STRTAB, DT_GNU_HASH and DT_HASH */
+bool parse_elf_dynamic(elf_process_t e_process);
+
+/*
+ * dynamic symbols, sorted by address, with hash tables for name lookup.
+ * tables of images with a build-id are cached process-wide and shared by
+ * every process mapping the same (device, inode, build-id).
+ */
+bool parse_elf_symbols(elf_process_t e_process);
+
+/* drop cached symbol tables, tables still used by elf_process objects stay alive */
+void clear_elf_cache();
+
+int get_elf_symbol_count(elf_process_t e_process);
+
+const struct elf_symbol* get_elf_symbols(elf_process_t e_process);
+
+/* runtime address, O(log n) over the sorted symbols */
+const struct elf_symbol* find_elf_symbol_by_address(elf_process_t e_process, unsigned long long address);
+
+/* O(1) through DT_GNU_HASH, or DT_HASH if the image has no GNU hash */
+bool find_elf_symbol_by_name(elf_process_t e_process, const char* name, unsigned long long* address);
+
 #endif
@@ -4,18 +4,46 @@
 
 #include "procfs_parser_api.h"
 
+#define TEST_READ_SIZE 0x5000
+
+/* read the beginning of the first readable VMA */
 void test1(const int pid)
 {
+    struct VirtualMemoryArea* VMAs = NULL;
     unsigned char* memory = NULL;
+    int vma_count = 0;
     int read_size = 0;
-    memory = (unsigned char *)malloc(0x5000);
+    int size;
+    int i;
+
+    if (parse_maps_file(pid, &VMAs, &vma_count) == false) {
+        goto done;
+    }
+
+    for (i = 0; i < vma_count; i++) {
+        if (VMAs[i].permissions & VMA_READ) {
+            break;
+        }
+    }
+
+    if (i == vma_count) {
+        goto done;
+    }
+
+    size = (int)(VMAs[i].end_address - VMAs[i].start_address);
+    if (size > TEST_READ_SIZE) {
+        size = TEST_READ_SIZE;
+    }
+
+    memory = (unsigned char *)malloc(size);
     if(!memory)
     {
         goto done;
     }
-    memset(memory, 0x00, 0x5000);
+    memset(memory, 0x00, size);
 
-    read_memory(pid, 0x558018303000, 0x558018308000, memory, 0x5000, &read_size);
+    read_size = read_process_memory(pid, VMAs[i].start_address, memory, size);
+    printf("read %d bytes at 0x%llx\n", read_size, VMAs[i].start_address);
 
 done:
 
@@ -23,6 +51,10 @@ done:
     {
         free(memory);
     }
+
+    if (VMAs) {
+        free(VMAs);
+    }
 }
 
 int main(int argc, char *argv[])
@@ -54,7 +86,7 @@ int main(int argc, char *argv[])
         int count;
         result = parse_maps_file(pid, &vma, &count );
         if(result) {
-            
+            free(vma);
         }
     }
     
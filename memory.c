@@ -1,141 +1,253 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <malloc.h>
 #include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "procfs_parser_api.h"
 #include "pp_internal.h"
 #include "elf_parser.h"
 #include "pp_list.h"
+#include "pp_stats.h"
 
-static int read_memory(const int pid, FILE* memory_file, unsigned char* buffer, int size)
+ssize_t read_process_memory(const int pid, unsigned long long start_address, unsigned char* memory, size_t size)
 {
-    int rsz = -1;
+    struct pp_stats_scope scope;
+    ssize_t rsz = -1;
+    int mem_fd = -1;
 
-    if (attach_process_by_pid(pid) == true) {
-        rsz = fread(buffer, 1, size, memory_file);
-
-        detach_process_by_pid(pid);
-    }
-
-    return rsz;
-}
-
-int read_process_memory(const int pid, unsigned long long start_address, unsigned char* memory, int size)
-{
-    FILE* file = NULL;
-    char path[32] = "";
-    int rsz = -1;
+    pp_stats_begin(&scope, API_READ_PROCESS_MEMORY);
 
-    if (size <= 0) {
-        return -1;
-    }
-
-    if (sprintf(path, "/proc/%d/mem", pid) < 0) {
-        return -1;
-    }
-
-    file = fopen(path, "rb");
-    if (file == NULL) {
+    if (size == 0 || size > SSIZE_MAX) {
         goto done;
     }
 
-    if (fseek(file, (long)start_address, SEEK_SET) != 0) {
+    mem_fd = open_process_file(pid, "mem", O_RDONLY);
+    if (mem_fd < 0) {
         goto done;
     }
 
-    rsz = read_memory(pid, file, memory, size);
+    if (attach_process_by_pid(pid) == true) {
+        rsz = read_memory_at(mem_fd, memory, size, start_address);
+        if (rsz < 0) {
+            PP_ERROR(errno, "cannot read 0x%llx of %d", start_address, pid);
+        }
+
+        detach_process_by_pid(pid);
+    }
 
 done:
 
-    if (file) {
-        fclose(file);
+    if (mem_fd >= 0) {
+        close(mem_fd);
     }
 
+    pp_stats_end(&scope, rsz >= 0 && (size_t)rsz == size);
+
     return rsz;
 }
 
-int read_process_memory_by_address(const int pid, unsigned long long start_address, unsigned long long end_address, unsigned char* memory)
+ssize_t read_process_memory_by_address(const int pid, unsigned long long start_address, unsigned long long end_address, unsigned char* memory)
 {
-    return read_process_memory(pid, start_address, memory, (int)(end_address - start_address));
+    if (end_address <= start_address || end_address - start_address > SSIZE_MAX) {
+        return -1;
+    }
+
+    return read_process_memory(pid, start_address, memory, (size_t)(end_address - start_address));
 }
 
-unsigned char* dump_process_memory(const int pid, unsigned long long start_address, int size)
+unsigned char* dump_process_memory(const int pid, unsigned long long start_address, size_t size)
 {
+    struct pp_stats_scope scope;
     unsigned char* memory = NULL;
-    int rsz;
+    ssize_t rsz;
 
-    if (size <= 0) {
-        return NULL;
+    pp_stats_begin(&scope, API_DUMP_PROCESS_MEMORY);
+
+    if (size == 0 || size > SSIZE_MAX) {
+        goto done;
     }
 
     memory = malloc(size);
     if (memory == NULL) {
-        return NULL;
+        PP_ERROR(ENOMEM, "cannot allocate %zu bytes, stream_process_memory reads in bounded chunks", size);
+        goto done;
     }
 
     rsz = read_process_memory(pid, start_address, memory, size);
-    if (rsz < size) {
+    if (rsz < 0 || (size_t)rsz < size) {
         /* fail if less than the requested size is read */
         free(memory);
         memory = NULL;
     }
 
+done:
+
+    pp_stats_end(&scope, memory != NULL);
+
     return memory;
 }
 
 unsigned char* dump_process_memory_by_address(const int pid, unsigned long long start_address, unsigned long long end_address)
 {
-    return dump_process_memory(pid, start_address, (int)(end_address - start_address));
+    if (end_address <= start_address || end_address - start_address > SSIZE_MAX) {
+        return NULL;
+    }
+
+    return dump_process_memory(pid, start_address, (size_t)(end_address - start_address));
 }
 
-static bool search_inode_by_imagepath(struct VirtualMemoryArea* vma, int vma_count, const char* image_path, unsigned long long* inode)
+bool stream_process_memory(const int pid, unsigned long long start_address, unsigned long long end_address,
+    size_t chunk_size, memory_chunk_callback callback, void* arg, unsigned long long* bytes_read)
 {
-    bool found = false;
-    int i;
+    bool result = true;
+
+    struct pp_stats_scope scope;
+    unsigned char* chunk = NULL;
+    unsigned long long address = start_address;
+    int mem_fd = -1;
+
+    pp_stats_begin(&scope, API_STREAM_PROCESS_MEMORY);
+
+    *bytes_read = 0;
+
+    if (end_address < start_address) {
+        PP_ERROR(EINVAL, "0x%llx-0x%llx is not a range", start_address, end_address);
+        SETERRGOTO(result, done);
+    }
+
+    if (chunk_size == 0) {
+        chunk_size = STREAM_CHUNK_SIZE;
+    }
+
+    if (chunk_size > end_address - start_address) {
+        chunk_size = (size_t)(end_address - start_address);
+    }
+
+    chunk = malloc(chunk_size > 0 ? chunk_size : 1);
+    NULLERRGOTO(chunk, result, done);
+
+    mem_fd = open_process_file(pid, "mem", O_RDONLY);
+    if (mem_fd < 0) {
+        SETERRGOTO(result, done);
+    }
+
+    while (address < end_address) {
+        size_t size = chunk_size;
+        ssize_t rsz = -1;
 
-    for (i = 0; i < vma_count; i++) {
-        if (strcmp(vma[i].pathname, image_path) == 0) {
-            *inode = vma[i].inode;
-            found = true;
+        if (end_address - address < size) {
+            size = (size_t)(end_address - address);
+        }
+
+        /* stopped per chunk, callers wanting one consistent view attach around the call */
+        if (attach_process_by_pid(pid) == false) {
+            SETERRGOTO(result, done);
+        }
+
+        rsz = read_memory_at(mem_fd, chunk, size, address);
+        detach_process_by_pid(pid);
+
+        if (rsz <= 0) {
+            PP_ERROR(rsz < 0 ? errno : EIO, "cannot read 0x%llx of %d", address, pid);
+            SETERRGOTO(result, done);
+        }
+
+        address += rsz;
+        *bytes_read += rsz;
+
+        /* a stop requested by the callback is not an error */
+        if (callback(address - rsz, chunk, (size_t)rsz, arg) == false) {
             break;
         }
+
+        /* the range ended inside the chunk, e.g. at an unmapped page */
+        if ((size_t)rsz < size) {
+            PP_ERROR(EIO, "cannot read 0x%llx of %d", address, pid);
+            SETERRGOTO(result, done);
+        }
+    }
+
+done:
+
+    if (mem_fd >= 0) {
+        close(mem_fd);
+    }
+
+    if (chunk) {
+        free(chunk);
+    }
+
+    pp_stats_end(&scope, result);
+
+    return result;
+}
+
+static bool append_vma(struct VirtualMemoryArea** VMAs, int* count, int* capacity, const struct VirtualMemoryArea* vma)
+{
+    if (*count == *capacity) {
+        int grown_capacity = *capacity ? *capacity * 2 : 64;
+        struct VirtualMemoryArea* grown = realloc(*VMAs, grown_capacity * sizeof(struct VirtualMemoryArea));
+
+        if (grown == NULL) {
+            return false;
+        }
+
+        *VMAs = grown;
+        *capacity = grown_capacity;
     }
 
-    return found;
+    (*VMAs)[(*count)++] = *vma;
+
+    return true;
 }
 
+static bool find_stack_vma(const struct VirtualMemoryArea* vma, void* arg)
+{
+    // TODO: dump stack of each thread( VMA with pathname "[stack:\d+]" ) 
+    // only the main thread stack is being dumped
+
+    if (strcmp(vma->pathname, "[stack]") == 0) {
+        *(struct VirtualMemoryArea*)arg = *vma;
+        return false;
+    }
+
+    return true;
+}
 
 bool dump_process_stack(const int pid, unsigned char** stack, int* stack_size)
 {
     bool result = false;
 
-    struct VirtualMemoryArea* VMAs = NULL;
+    struct pp_stats_scope scope;
+    struct VirtualMemoryArea stack_vma;
     unsigned char* buffer = NULL;
-    int vma_count = 0;
     int size = 0;
-    int i;
 
-    result = parse_maps_file(pid, &VMAs, &vma_count);
-    IFERRGOTO(result, done);
+    pp_stats_begin(&scope, API_DUMP_PROCESS_STACK);
 
-    for (i = 0; i < vma_count; i++) {
-        // TODO: dump stack of each thread( VMA with pathname "[stack:\d+]" ) 
-        // only the main thread stack is being dumped
+    stack_vma.end_address = 0;
 
-        if (strcmp(VMAs[i].pathname, "[stack]") == 0) {
-            break;
-        }
-    }
+    /* the stack is near the end, but nothing after it is parsed */
+    result = visit_maps_file(pid, find_stack_vma, &stack_vma);
+    IFERRGOTO(result, done);
 
-    if (i == vma_count) {
+    if (stack_vma.end_address == 0) {
         SETERRGOTO(result, done); // failed to find stack area
     }
 
-    size = (int)(VMAs[i].end_address - VMAs[i].start_address);
+    if (stack_vma.end_address - stack_vma.start_address > INT_MAX) {
+        PP_ERROR(EFBIG, "stack of %d does not fit in an int", pid);
+        SETERRGOTO(result, done);
+    }
 
-    buffer = dump_process_memory(pid, VMAs[i].start_address, size);
+    size = (int)(stack_vma.end_address - stack_vma.start_address);
+
+    buffer = dump_process_memory(pid, stack_vma.start_address, size);
     NULLERRGOTO(buffer, result, done);
 
     *stack = buffer;
@@ -143,186 +255,183 @@ bool dump_process_stack(const int pid, unsigned char** stack, int* stack_size)
 
 done:
 
-    return result;
-}
-
-static bool select_vma_by_inode(unsigned long long inode, struct VirtualMemoryArea* VMAs, int vma_count, pp_list_t selected_VMAs)
-{
-    bool result = true;
-    int i;
-
-    for (i = 0; i < vma_count; i++) {
-        struct VirtualMemoryArea* cursor = &VMAs[i];
-
-        if (cursor->inode == inode) {
-            result = pp_list_rpush(selected_VMAs, cursor);
-            if (result == false) {
-                break;
-            }
-        }
-    }
+    pp_stats_end(&scope, result);
 
     return result;
 }
 
-static bool restore_VMA_file_offset(const int pid, pp_list_t image_VMAs)
+static bool dump_image(const int pid, pp_list_t image_VMAs, unsigned char** dumped_image, int* img_size)
 {
     bool result = true;
 
     elf_process_t process = NULL;
     Elf64_Ehdr* hdr = NULL;
     Elf64_Phdr* phdr = NULL;
+    unsigned long long load_bias;
+    unsigned long long filesize = 0;
+    unsigned char* image = NULL;
     int i;
 
     process = create_elf_data(pid, image_VMAs);
     NULLERRGOTO(process, result, done);
 
-    result = parse_elf_header(process);
-    IFERRGOTO(result, done);
-
     result = parse_elf_program_header(process);
     IFERRGOTO(result, done);
 
     hdr = get_elf_header(process);
     phdr = get_elf_program_header(process);
+    load_bias = get_elf_load_bias(process);
 
+    /* the headers come from the target, which may have rewritten them */
     for (i = 0; i < hdr->e_phnum; i++) {
-        if (phdr[i].p_type == PT_LOAD) {
-            printf("0x%08x\n", phdr[i].p_type);
-            printf("0x%016lx\n", phdr[i].p_offset);
-            printf("0x%016lx\n", phdr[i].p_vaddr);
-            printf("0x%016lx\n", phdr[i].p_paddr);
+        if (phdr[i].p_type != PT_LOAD) {
+            continue;
         }
-    }
 
-done:
+        if (phdr[i].p_filesz > phdr[i].p_memsz || phdr[i].p_filesz > ULLONG_MAX - phdr[i].p_offset) {
+            PP_ERROR(EINVAL, "bad PT_LOAD %d of %d", i, pid);
+            SETERRGOTO(result, done);
+        }
 
-    if (process) {
-        destroy_elf_data(process);
+        if (phdr[i].p_offset + phdr[i].p_filesz > filesize) {
+            filesize = phdr[i].p_offset + phdr[i].p_filesz;
+        }
     }
 
-    return result;
-}
-
-
-static bool dump_image(const int pid, pp_list_t image_VMAs, unsigned char** dumped_image, int* img_size)
-{
-    bool result = false;
-
-    FILE* tmp_file = NULL;
-    __off_t filesize;
-    unsigned char* buffer = NULL;
-    unsigned char* image = NULL;
-    int size;
-
-    size = pp_list_size(image_VMAs);
-    if (size < 1) {
-        return false;
+    if (filesize == 0 || filesize > INT_MAX) {
+        SETERRGOTO(result, done);
     }
 
-    tmp_file = tmpfile();
-    NULLERRGOTO(tmp_file, result, done);
-
-    for (int i = 0; i < size; i++) {
-        struct VirtualMemoryArea* vma = NULL;
-        int area_size = 0;
-
-        result = pp_list_get(image_VMAs, i, (void**)&vma);
-        IFERRGOTO(result, done);
-
-        area_size = (int)(vma->end_address - vma->start_address);
+    image = calloc(1, filesize);
+    NULLERRGOTO(image, result, done);
 
-        buffer = dump_process_memory(pid, vma->start_address, area_size);
-        NULLERRGOTO(buffer, result, done);
+    for (i = 0; i < hdr->e_phnum; i++) {
+        size_t size = (size_t)phdr[i].p_filesz;
 
-        if (fseeko(tmp_file, (off_t)vma->file_offset, SEEK_SET) == -1) {
-            SETERRGOTO(result, done);
+        if (phdr[i].p_type != PT_LOAD || size == 0) {
+            continue;
         }
 
-        if (fwrite(buffer, 1, area_size, tmp_file) < area_size) {
+        if (phdr[i].p_offset > filesize || phdr[i].p_filesz > filesize - phdr[i].p_offset) {
             SETERRGOTO(result, done);
         }
 
-        free(buffer);
-        buffer = NULL;
-    }
-
-    filesize = ftell(tmp_file);
-    rewind(tmp_file);
-
-    image = malloc(filesize);
-    NULLERRGOTO(image, result, done);
-
-    if (fread(image, 1, filesize, tmp_file) < filesize) {
-        SETERRGOTO(result, done);
+        result = read_elf_process_memory(process, load_bias + phdr[i].p_vaddr, image + phdr[i].p_offset, size);
+        IFERRGOTO(result, done);
     }
 
-    *img_size = filesize;
+    *img_size = (int)filesize;
     *dumped_image = image;
     image = NULL;
 
 done:
 
-    if (result == false && image != NULL) {
+    if (image) {
         free(image);
-        image = NULL;
-    }
-
-    if (buffer) {
-        free(buffer);
     }
 
-    if (tmp_file) {
-        fclose(tmp_file);
+    if (process) {
+        destroy_elf_data(process);
     }
 
     return result;
 }
 
 
+struct image_search
+{
+    const char*               image_path;
+    unsigned long long        inode;
+    struct VirtualMemoryArea* VMAs;
+    int                       vma_count;
+    int                       capacity;
+    bool                      failed;
+};
+
+/* list nodes point into an array that is freed on its own */
+static void keep_vma(void* data)
+{
+    (void)data;
+}
+
+/* the image is mapped in one run, the walk stops at the next mapped file */
+static bool collect_image_vma(const struct VirtualMemoryArea* vma, void* arg)
+{
+    struct image_search* search = arg;
+
+    if (search->inode == UNKNOWN_INODE) {
+        if (vma->inode == UNKNOWN_INODE || strcmp(vma->pathname, search->image_path) != 0) {
+            return true;
+        }
+
+        search->inode = vma->inode;
+    }
+    else if (vma->inode != search->inode) {
+        return vma->inode == UNKNOWN_INODE;
+    }
+
+    if (append_vma(&search->VMAs, &search->vma_count, &search->capacity, vma) == false) {
+        search->failed = true;
+        return false;
+    }
+
+    return true;
+}
+
 bool dump_process_image(const int pid, unsigned char** image, int* img_size)
 {
     bool result = false;
 
+    struct pp_stats_scope scope;
     char image_path[PATH_MAX] = "";
-    struct VirtualMemoryArea* VMAs = NULL;
-    int vma_count = 0;
-    unsigned long long inode = 0;
+    struct image_search search;
     pp_list_t image_VMAs = NULL;
-    bool found = false;
     int i;
 
-    result = parse_maps_file(pid, &VMAs, &vma_count);
-    IFERRGOTO(result, done);
+    pp_stats_begin(&scope, API_DUMP_PROCESS_IMAGE);
+
+    memset(&search, 0x00, sizeof(search));
 
     result = read_imagepath(pid, image_path, sizeof(image_path));
     IFERRGOTO(result, done);
 
-    found = search_inode_by_imagepath(VMAs, vma_count, image_path, &inode);
-    if (found == false || inode == UNKNOWN_INODE) {
-        fprintf(stderr, "Cannot find process image area\n");
+    search.image_path = image_path;
+
+    result = visit_maps_file(pid, collect_image_vma, &search);
+    IFERRGOTO(result, done);
+
+    if (search.failed) {
+        SETERRGOTO(result, done);
+    }
+
+    if (search.vma_count == 0) {
+        PP_ERROR(ENOENT, "cannot find image area of %s", image_path);
         SETERRGOTO(result, done);
     }
 
     image_VMAs = pp_list_create();
     NULLERRGOTO(image_VMAs, result, done);
 
-    result = select_vma_by_inode(inode, VMAs, vma_count, image_VMAs);
-    IFERRGOTO(result, done);
+    for (i = 0; i < search.vma_count; i++) {
+        result = pp_list_rpush(image_VMAs, &search.VMAs[i]);
+        IFERRGOTO(result, done);
+    }
 
     result = dump_image(pid, image_VMAs, image, img_size);
     IFERRGOTO(result, done);
 
 done:
 
-    if (VMAs) {
-        free(VMAs);
+    if (search.VMAs) {
+        free(search.VMAs);
     }
 
     if (image_VMAs) {
-        pp_list_destroy(image_VMAs);
+        pp_list_destroy_with_nodes(image_VMAs, keep_vma);
     }
 
+    pp_stats_end(&scope, result);
+
     return result;
 }
 
@@ -333,17 +442,15 @@ done:
         ptr++;                                 \
     }
 
-static bool parse_maps_line(const char* line, struct VirtualMemoryArea** parsed_vma)
+/* one NUL-terminated maps line, with or without its newline */
+static bool parse_maps_line(const char* line, struct VirtualMemoryArea* vma)
 {
     bool result = true;
 
-    struct VirtualMemoryArea* vma = NULL;
     char* cursor = NULL;
-    int remain_size;
+    size_t length;
 
-    vma = malloc(sizeof(struct VirtualMemoryArea));
-    NULLERRGOTO(vma, result, done);
-    memset(vma, 0x00, sizeof(struct VirtualMemoryArea));
+    memset(vma, 0x00, offsetof(struct VirtualMemoryArea, pathname) + 1);
 
     errno = 0;
     vma->start_address = strtoull(line, &cursor, 16);
@@ -384,101 +491,239 @@ static bool parse_maps_line(const char* line, struct VirtualMemoryArea** parsed_
     MAPS_LINE_CHK(cursor, ' ', done);
 
     vma->inode = strtoull(cursor, &cursor, 10);
-    MAPS_LINE_CHK(cursor, ' ', done);
+    if (errno != 0 || (*cursor != ' ' && *cursor != '\n' && *cursor != '\0')) {
+        SETERRGOTO(result, done);
+    }
 
     /* skip whitespace */
     while (*cursor == ' ') {
         cursor++;
     }
 
-    if (*cursor == '\n') {
-        /* end of line, this VMA has no pathname */
+    /* no pathname if the line ends here */
+    length = strcspn(cursor, "\n");
+    if (length >= sizeof(vma->pathname)) {
+        length = sizeof(vma->pathname) - 1;
+    }
+
+    memcpy(vma->pathname, cursor, length);
+    vma->pathname[length] = '\0';
+
+done:
+
+    return result;
+}
+
+bool parse_maps_data(const char* data, size_t size, struct VirtualMemoryArea** parsed_VMAs, int* vma_count)
+{
+    bool result = true;
+
+    struct VirtualMemoryArea* VMAs = NULL;
+    struct VirtualMemoryArea vma;
+    const char* cursor = data;
+    const char* end = data + size;
+    char line[PATH_MAX + 128];
+    size_t length;
+    int count = 0;
+    int capacity = 0;
+
+    while (cursor < end) {
+        const char* newline = memchr(cursor, '\n', end - cursor);
+
+        length = (newline ? newline + 1 : end) - cursor;
+        if (length >= sizeof(line)) {
+            SETERRGOTO(result, done);
+        }
+
+        memcpy(line, cursor, length);
+        line[length] = '\0';
+        cursor += length;
+
+        result = parse_maps_line(line, &vma);
+        IFERRGOTO(result, done);
+
+        result = append_vma(&VMAs, &count, &capacity, &vma);
+        IFERRGOTO(result, done);
     }
-    else {
-        int remain = strlen(cursor) - 1; // - newline
-        strncpy(vma->pathname, cursor, remain);
-        vma->pathname[remain] = '\0';
+
+    /* an empty maps still yields an array */
+    if (VMAs == NULL) {
+        VMAs = malloc(sizeof(struct VirtualMemoryArea));
+        NULLERRGOTO(VMAs, result, done);
     }
 
-    *parsed_vma = vma;
-    vma = NULL;
+    *parsed_VMAs = VMAs;
+    *vma_count = count;
+    VMAs = NULL;
 
 done:
 
-    if (vma) {
-        free(vma);
+    if (VMAs) {
+        free(VMAs);
     }
 
     return result;
 }
 
-bool parse_maps_file(const int pid, struct VirtualMemoryArea** parsed_VMAs, int* vma_count)
+bool open_maps_iterator(const int pid, struct MapsIterator* iterator)
 {
-    bool result = true;
+    memset(iterator, 0x00, offsetof(struct MapsIterator, buffer));
 
-    struct VirtualMemoryArea* VMAs = NULL;
-    struct VirtualMemoryArea* vma = NULL;
-    FILE* file = NULL;
-    pp_list_t list = NULL;
-    char path[32];
-    char buffer[512];
-    int count;
-    int i;
+    iterator->fd = open_process_file(pid, "maps", O_RDONLY);
 
-    if (sprintf(path, "/proc/%d/maps", pid) < 0) {
-        return false;
+    return iterator->fd >= 0;
+}
+
+bool next_maps_entry(struct MapsIterator* iterator, const struct VirtualMemoryArea** vma)
+{
+    for (;;) {
+        char* line = iterator->buffer + iterator->start;
+        char* newline = memchr(line, '\n', iterator->end - iterator->start);
+        ssize_t rsz;
+
+        if (newline || (iterator->eof && iterator->start < iterator->end)) {
+            if (newline) {
+                *newline = '\0';
+                iterator->start = newline + 1 - iterator->buffer;
+            }
+            else {
+                iterator->buffer[iterator->end] = '\0';
+                iterator->start = iterator->end;
+            }
+
+            if (parse_maps_line(line, &iterator->vma) == false) {
+                PP_ERROR(EINVAL, "malformed maps line %s", line);
+                iterator->failed = true;
+                return false;
+            }
+
+            *vma = &iterator->vma;
+            return true;
+        }
+
+        if (iterator->eof) {
+            return false;
+        }
+
+        /* keep the partial line, a line always fits the buffer */
+        memmove(iterator->buffer, line, iterator->end - iterator->start);
+        iterator->end -= iterator->start;
+        iterator->start = 0;
+
+        if (iterator->end + 1 >= sizeof(iterator->buffer)) {
+            PP_ERROR(E2BIG, "maps line is too long");
+            iterator->failed = true;
+            return false;
+        }
+
+        rsz = read(iterator->fd, iterator->buffer + iterator->end, sizeof(iterator->buffer) - iterator->end - 1);
+        pp_stats_io(rsz > 0 ? rsz : 0, 1);
+
+        if (rsz < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (rsz < 0) {
+            PP_ERROR(errno, "cannot read maps");
+            iterator->failed = true;
+            return false;
+        }
+
+        if (rsz == 0) {
+            iterator->eof = true;
+        }
+
+        iterator->end += rsz;
     }
+}
 
-    file = fopen(path, "r");
-    NULLERRGOTO(file, result, done);
+void close_maps_iterator(struct MapsIterator* iterator)
+{
+    if (iterator->fd >= 0) {
+        close(iterator->fd);
+        iterator->fd = -1;
+    }
+}
 
-    list = pp_list_create();
-    NULLERRGOTO(list, result, done);
+bool visit_maps_file(const int pid, maps_visitor visitor, void* arg)
+{
+    bool result = true;
 
-    /* parse maps file line by line */
-    while (fgets(buffer, sizeof(buffer), file) != NULL) {
-        result = parse_maps_line(buffer, &vma);
-        IFERRGOTO(result, done);
+    struct pp_stats_scope scope;
+    struct MapsIterator iterator;
+    const struct VirtualMemoryArea* vma = NULL;
 
-        result = pp_list_rpush(list, (void*)vma);
-        IFERRGOTO(result, done);
+    pp_stats_begin(&scope, API_VISIT_MAPS_FILE);
 
-        vma = NULL;
+    result = open_maps_iterator(pid, &iterator);
+    IFERRGOTO(result, done);
+
+    /* reading stops as soon as the visitor is done */
+    while (next_maps_entry(&iterator, &vma)) {
+        if (visitor(vma, arg) == false) {
+            break;
+        }
     }
 
-    count = pp_list_size(list);
-    VMAs = malloc(sizeof(struct VirtualMemoryArea) * count);
-    NULLERRGOTO(VMAs, result, done);
+    result = iterator.failed == false;
+
+    close_maps_iterator(&iterator);
+
+done:
+
+    pp_stats_end(&scope, result);
+
+    return result;
+}
+
+bool parse_maps_file(const int pid, struct VirtualMemoryArea** parsed_VMAs, int* vma_count)
+{
+    bool result = true;
+
+    struct pp_stats_scope scope;
+    struct MapsIterator iterator;
+    const struct VirtualMemoryArea* vma = NULL;
+    struct VirtualMemoryArea* VMAs = NULL;
+    int count = 0;
+    int capacity = 0;
+    bool opened = false;
+
+    pp_stats_begin(&scope, API_PARSE_MAPS_FILE);
 
-    for (i = 0; i < count; i++) {
-        result = pp_list_lpop(list, (void**)&vma);
+    opened = open_maps_iterator(pid, &iterator);
+    if (opened == false) {
+        SETERRGOTO(result, done);
+    }
+
+    while (next_maps_entry(&iterator, &vma)) {
+        result = append_vma(&VMAs, &count, &capacity, vma);
         IFERRGOTO(result, done);
+    }
 
-        VMAs[i] = *vma;
-        vma = NULL;
+    if (iterator.failed) {
+        SETERRGOTO(result, done);
+    }
+
+    if (VMAs == NULL) {
+        VMAs = malloc(sizeof(struct VirtualMemoryArea));
+        NULLERRGOTO(VMAs, result, done);
     }
 
-    *vma_count = count;
     *parsed_VMAs = VMAs;
+    *vma_count = count;
     VMAs = NULL;
 
 done:
 
-    if (list) {
-        pp_list_destroy_with_nodes(list, NULL);
-    }
-
-    if (file) {
-        fclose(file);
+    if (opened) {
+        close_maps_iterator(&iterator);
     }
 
     if (VMAs) {
         free(VMAs);
     }
 
-    if (vma) {
-        free(vma);
-    }
+    pp_stats_end(&scope, result);
 
     return result;
 }
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+#include "pp_stats.h"
+#include "pp_hash.h"
+
+/* bytes read from "/proc/[pid]/mem" at once */
+#define HASH_CHUNK_SIZE (256 * 1024)
+
+void free_vma_digest_set(struct VmaDigestSet* digest_set)
+{
+    int i;
+
+    if (digest_set == NULL) {
+        return;
+    }
+
+    if (digest_set->digests) {
+        for (i = 0; i < digest_set->digest_count; i++) {
+            if (digest_set->digests[i].page_digests) {
+                free(digest_set->digests[i].page_digests);
+            }
+        }
+
+        free(digest_set->digests);
+    }
+
+    free(digest_set);
+}
+
+static bool hash_vma(int mem_fd, const struct VirtualMemoryArea* vma, struct VmaDigestSet* digest_set,
+    struct VmaDigest* digest, unsigned char* chunk, bool page_digests)
+{
+    struct pp_hash_state vma_state;
+    unsigned long long address = vma->start_address;
+    int page_size = digest_set->page_size;
+    int page_index = 0;
+
+    digest->start_address = vma->start_address;
+    digest->end_address = vma->end_address;
+    /* pages count from start_address, a range that is not a page multiple ends with a short one */
+    digest->page_count = (int)((vma->end_address - vma->start_address + page_size - 1) / page_size);
+
+    if (page_digests) {
+        digest->page_digests = malloc((size_t)(digest->page_count > 0 ? digest->page_count : 1) * digest_set->digest_size);
+        if (digest->page_digests == NULL) {
+            return false;
+        }
+    }
+
+    pp_hash_init(&vma_state, digest_set->algorithm);
+
+    while (address < vma->end_address) {
+        size_t size = HASH_CHUNK_SIZE;
+        size_t offset;
+
+        if (vma->end_address - address < size) {
+            size = (size_t)(vma->end_address - address);
+        }
+
+        if (read_full_at(mem_fd, chunk, size, address) == false) {
+            return false;
+        }
+
+        pp_hash_update(&vma_state, chunk, size);
+
+        /* chunk size is a multiple of the page size, so only the last page of the range can be short */
+        for (offset = 0; page_digests && offset < size; offset += page_size) {
+            struct pp_hash_state page_state;
+            size_t page_length = size - offset < (size_t)page_size ? size - offset : (size_t)page_size;
+
+            pp_hash_init(&page_state, digest_set->algorithm);
+            pp_hash_update(&page_state, chunk + offset, page_length);
+            pp_hash_final(&page_state, digest->page_digests + (size_t)page_index * digest_set->digest_size);
+            page_index++;
+        }
+
+        address += size;
+    }
+
+    pp_hash_final(&vma_state, digest->digest);
+
+    return true;
+}
+
+bool hash_process_memory(const int pid, const struct VirtualMemoryArea* VMAs, int vma_count,
+    int algorithm, bool page_digests, struct VmaDigestSet** parsed_digest_set)
+{
+    bool result = true;
+
+    struct pp_stats_scope scope;
+    struct VmaDigestSet* digest_set = NULL;
+    unsigned char* chunk = NULL;
+    bool attached = false;
+    int mem_fd = -1;
+    int i;
+
+    pp_stats_begin(&scope, API_HASH_PROCESS_MEMORY);
+
+    if (pp_hash_digest_size(algorithm) == 0 || vma_count < 0) {
+        SETERRGOTO(result, done);
+    }
+
+    digest_set = calloc(1, sizeof(struct VmaDigestSet));
+    NULLERRGOTO(digest_set, result, done);
+
+    digest_set->pid = pid;
+    digest_set->algorithm = algorithm;
+    digest_set->digest_size = pp_hash_digest_size(algorithm);
+    digest_set->page_size = (int)sysconf(_SC_PAGESIZE);
+
+    digest_set->digests = calloc(vma_count > 0 ? vma_count : 1, sizeof(struct VmaDigest));
+    NULLERRGOTO(digest_set->digests, result, done);
+
+    chunk = malloc(HASH_CHUNK_SIZE);
+    NULLERRGOTO(chunk, result, done);
+
+    mem_fd = open_process_file(pid, "mem", O_RDONLY);
+    if (mem_fd < 0) {
+        SETERRGOTO(result, done);
+    }
+
+    attached = attach_process_by_pid(pid);
+    if (attached == false) {
+        SETERRGOTO(result, done);
+    }
+
+    for (i = 0; i < vma_count; i++) {
+        struct VmaDigest* digest = &digest_set->digests[i];
+
+        digest_set->digest_count++;
+
+        /* a VMA "/proc/[pid]/mem" cannot read (EIO) is flagged, as in the snapshot */
+        if (hash_vma(mem_fd, &VMAs[i], digest_set, digest, chunk, page_digests) == false) {
+            if (errno != EIO) {
+                SETERRGOTO(result, done);
+            }
+
+            if (digest->page_digests) {
+                free(digest->page_digests);
+                digest->page_digests = NULL;
+            }
+
+            memset(digest->digest, 0x00, sizeof(digest->digest));
+            digest->unreadable = true;
+        }
+    }
+
+    *parsed_digest_set = digest_set;
+    digest_set = NULL;
+
+done:
+
+    if (attached) {
+        detach_process_by_pid(pid);
+    }
+
+    if (mem_fd >= 0) {
+        close(mem_fd);
+    }
+
+    if (chunk) {
+        free(chunk);
+    }
+
+    free_vma_digest_set(digest_set);
+
+    pp_stats_end(&scope, result);
+
+    return result;
+}
+
+static const struct VmaDigest* find_digest(const struct VmaDigestSet* digest_set, const struct VmaDigest* digest)
+{
+    int i;
+
+    for (i = 0; i < digest_set->digest_count; i++) {
+        const struct VmaDigest* cursor = &digest_set->digests[i];
+
+        if (cursor->start_address == digest->start_address && cursor->end_address == digest->end_address) {
+            return cursor;
+        }
+    }
+
+    return NULL;
+}
+
+static bool push_changed_page(unsigned long long** pages, int* count, int* capacity, unsigned long long address)
+{
+    if (*count == *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 64;
+        unsigned long long* grown = realloc(*pages, new_capacity * sizeof(unsigned long long));
+
+        if (grown == NULL) {
+            return false;
+        }
+
+        *pages = grown;
+        *capacity = new_capacity;
+    }
+
+    (*pages)[(*count)++] = address;
+
+    return true;
+}
+
+static bool push_vma_pages(unsigned long long** pages, int* count, int* capacity,
+    const struct VmaDigest* digest, int page_size)
+{
+    int i;
+
+    for (i = 0; i < digest->page_count; i++) {
+        if (push_changed_page(pages, count, capacity, digest->start_address + (unsigned long long)i * page_size) == false) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool compare_vma_digests(const struct VmaDigestSet* previous, const struct VmaDigestSet* current,
+    unsigned long long** changed_pages, int* changed_count)
+{
+    bool result = true;
+
+    unsigned long long* pages = NULL;
+    int count = 0;
+    int capacity = 0;
+    int i, j;
+
+    if (previous->algorithm != current->algorithm || previous->page_size != current->page_size) {
+        return false;
+    }
+
+    for (i = 0; i < current->digest_count; i++) {
+        const struct VmaDigest* digest = &current->digests[i];
+        const struct VmaDigest* old = find_digest(previous, digest);
+        int digest_size = current->digest_size;
+
+        /* nothing is known about the contents on either side of an unreadable VMA */
+        if (old == NULL || old->unreadable || digest->unreadable) {
+            result = push_vma_pages(&pages, &count, &capacity, digest, current->page_size);
+            IFERRGOTO(result, done);
+            continue;
+        }
+
+        if (memcmp(old->digest, digest->digest, digest_size) == 0) {
+            continue;
+        }
+
+        for (j = 0; j < digest->page_count; j++) {
+            /* without page digests on both sides, every page of the VMA is a suspect */
+            if (old->page_digests && digest->page_digests
+                && memcmp(old->page_digests + (size_t)j * digest_size, digest->page_digests + (size_t)j * digest_size, digest_size) == 0) {
+                continue;
+            }
+
+            result = push_changed_page(&pages, &count, &capacity,
+                digest->start_address + (unsigned long long)j * current->page_size);
+            IFERRGOTO(result, done);
+        }
+    }
+
+    /* VMAs gone since previous, their pages are no longer what they were */
+    for (i = 0; i < previous->digest_count; i++) {
+        const struct VmaDigest* old = &previous->digests[i];
+
+        if (find_digest(current, old) == NULL) {
+            result = push_vma_pages(&pages, &count, &capacity, old, previous->page_size);
+            IFERRGOTO(result, done);
+        }
+    }
+
+    *changed_pages = pages;
+    *changed_count = count;
+    pages = NULL;
+
+done:
+
+    if (pages) {
+        free(pages);
+    }
+
+    return result;
+}
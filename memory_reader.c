@@ -0,0 +1,685 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+#include "pp_stats.h"
+
+#define SESSION_BUCKETS 256
+#define DEQUE_CAPACITY  64 // initial, deques grow
+
+struct read_job
+{
+    struct read_job* next;
+    unsigned long long id;
+    int pid;
+    struct MemoryRange* ranges;
+    int range_count;
+    memory_read_callback callback;
+    void* arg;
+    struct MemoryReadCompletion completion;
+};
+
+/* the jobs of one pid, taken by one worker at a time */
+struct read_session
+{
+    int pid;
+    struct read_job* head;
+    struct read_job* tail;
+    struct read_session* next; // bucket chain
+};
+
+/*
+ * sessions of one worker: the worker pops from the tail, thieves take from
+ * the head. capacity is a power of two and head/tail only grow
+ */
+struct read_worker
+{
+    struct memory_reader* reader;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    struct read_session** deque;
+    unsigned int capacity;
+    unsigned int head;
+    unsigned int tail;
+    unsigned char* buffer;
+};
+
+struct memory_reader
+{
+    unsigned int flags;
+    size_t buffer_size;
+    struct read_worker* workers;
+    unsigned int worker_count;
+    unsigned int started_count;
+    unsigned int next_worker;
+
+    /* guards everything below and the job lists of sessions */
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    struct read_session* sessions[SESSION_BUCKETS];
+    unsigned int queued_sessions; // in deques, not yet taken
+    unsigned long long pending_jobs;
+    unsigned long long next_job;
+    struct read_job* completions;
+    struct read_job* completions_tail;
+    bool stopping;
+};
+
+static struct read_session** find_session(struct memory_reader* reader, int pid)
+{
+    struct read_session** slot = &reader->sessions[(unsigned int)pid % SESSION_BUCKETS];
+
+    while (*slot && (*slot)->pid != pid) {
+        slot = &(*slot)->next;
+    }
+
+    return slot;
+}
+
+static bool push_session(struct read_worker* worker, struct read_session* session)
+{
+    pthread_mutex_lock(&worker->lock);
+
+    if (worker->tail - worker->head == worker->capacity) {
+        unsigned int capacity = worker->capacity * 2;
+        struct read_session** deque = malloc(capacity * sizeof(struct read_session*));
+        unsigned int i;
+
+        if (deque == NULL) {
+            pthread_mutex_unlock(&worker->lock);
+            return false;
+        }
+
+        for (i = worker->head; i != worker->tail; i++) {
+            deque[i & (capacity - 1)] = worker->deque[i & (worker->capacity - 1)];
+        }
+
+        free(worker->deque);
+        worker->deque = deque;
+        worker->capacity = capacity;
+    }
+
+    worker->deque[worker->tail++ & (worker->capacity - 1)] = session;
+
+    pthread_mutex_unlock(&worker->lock);
+
+    return true;
+}
+
+static struct read_session* pop_session(struct read_worker* worker, bool steal)
+{
+    struct read_session* session = NULL;
+
+    pthread_mutex_lock(&worker->lock);
+
+    if (worker->head != worker->tail) {
+        if (steal) {
+            session = worker->deque[worker->head++ & (worker->capacity - 1)];
+        }
+        else {
+            session = worker->deque[--worker->tail & (worker->capacity - 1)];
+        }
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+
+    return session;
+}
+
+/* own sessions first, then the oldest session of another worker */
+static struct read_session* take_session(struct read_worker* worker)
+{
+    struct memory_reader* reader = worker->reader;
+    struct read_session* session = NULL;
+    unsigned int self = (unsigned int)(worker - reader->workers);
+    unsigned int i;
+
+    session = pop_session(worker, false);
+
+    for (i = 1; session == NULL && i < reader->worker_count; i++) {
+        session = pop_session(&reader->workers[(self + i) % reader->worker_count], true);
+    }
+
+    return session;
+}
+
+static int last_error_code()
+{
+    struct ProcfsError error;
+
+    if (get_procfs_last_error(NULL, &error) && error.code != 0) {
+        return error.code;
+    }
+
+    return EIO;
+}
+
+static void fail_job(struct read_job* job, int error)
+{
+    if (job->completion.error == 0) {
+        job->completion.error = error;
+    }
+}
+
+/* false if the callback stopped the job */
+static bool deliver_chunk(struct read_job* job, int range, unsigned long long address,
+    const unsigned char* data, size_t size, int error)
+{
+    struct MemoryReadChunk chunk;
+
+    if (error) {
+        fail_job(job, error);
+    }
+
+    if (job->callback == NULL) {
+        return true;
+    }
+
+    chunk.job = job->id;
+    chunk.pid = job->pid;
+    chunk.range = range;
+    chunk.address = address;
+    chunk.data = data;
+    chunk.size = size;
+    chunk.error = error;
+
+    return job->callback(&chunk, job->arg);
+}
+
+/* ranges with memory are read at once, others through the worker buffer */
+static bool read_job_range(struct read_worker* worker, struct read_job* job, int range, int mem_fd)
+{
+    const struct MemoryRange* cursor = &job->ranges[range];
+    unsigned long long address = cursor->start_address;
+    unsigned long long end_address = cursor->start_address + cursor->size;
+
+    while (address < end_address) {
+        unsigned char* buffer = worker->buffer;
+        size_t size = worker->reader->buffer_size;
+        ssize_t rsz;
+
+        if (cursor->memory) {
+            buffer = cursor->memory + (address - cursor->start_address);
+            size = (size_t)(end_address - address);
+        }
+        else if (end_address - address < size) {
+            size = (size_t)(end_address - address);
+        }
+
+        rsz = read_memory_at(mem_fd, buffer, size, address);
+        if (rsz <= 0) {
+            return deliver_chunk(job, range, address, NULL, 0, rsz < 0 ? errno : EIO);
+        }
+
+        job->completion.bytes_read += rsz;
+        address += rsz;
+
+        if (deliver_chunk(job, range, address - rsz, buffer, (size_t)rsz, 0) == false) {
+            return false;
+        }
+
+        /* the range ended inside, e.g. at an unmapped page */
+        if ((size_t)rsz < size) {
+            return deliver_chunk(job, range, address, NULL, 0, EIO);
+        }
+    }
+
+    return true;
+}
+
+static void run_job(struct read_worker* worker, struct read_job* job, int mem_fd, int session_error)
+{
+    struct pp_stats_scope scope;
+    int i;
+
+    pp_stats_begin(&scope, API_MEMORY_READER_JOB);
+
+    for (i = 0; i < job->range_count; i++) {
+        bool next;
+
+        if (session_error) {
+            next = deliver_chunk(job, i, job->ranges[i].start_address, NULL, 0, session_error);
+        }
+        else {
+            next = read_job_range(worker, job, i, mem_fd);
+        }
+
+        if (next == false) {
+            break;
+        }
+    }
+
+    pp_stats_end(&scope, job->completion.error == 0);
+}
+
+static void finish_job(struct memory_reader* reader, struct read_job* job)
+{
+    pthread_mutex_lock(&reader->lock);
+
+    /* jobs with a callback leave nothing behind */
+    if (job->callback == NULL) {
+        job->next = NULL;
+
+        if (reader->completions_tail) {
+            reader->completions_tail->next = job;
+        }
+        else {
+            reader->completions = job;
+        }
+
+        reader->completions_tail = job;
+        job = NULL;
+    }
+
+    reader->pending_jobs--;
+    pthread_cond_broadcast(&reader->done_cond);
+
+    pthread_mutex_unlock(&reader->lock);
+
+    if (job) {
+        free(job->ranges);
+        free(job);
+    }
+}
+
+/* 0, or the errno value every job of the session fails with */
+static int open_session(struct memory_reader* reader, int pid, int* mem_fd, bool* attached)
+{
+    clear_procfs_last_error(NULL);
+
+    *mem_fd = open_process_file(pid, "mem", O_RDONLY);
+    if (*mem_fd < 0) {
+        return last_error_code();
+    }
+
+    if ((reader->flags & MEMORY_READER_NO_STOP) == 0) {
+        *attached = attach_process_by_pid(pid);
+        if (*attached == false) {
+            return last_error_code();
+        }
+    }
+
+    return 0;
+}
+
+static void close_session(int pid, int* mem_fd, bool* attached)
+{
+    if (*attached) {
+        detach_process_by_pid(pid);
+        *attached = false;
+    }
+
+    if (*mem_fd >= 0) {
+        close(*mem_fd);
+        *mem_fd = -1;
+    }
+}
+
+/*
+ * jobs queued while the target is stopped run in the same stop. the
+ * session is dropped only once the target runs again, so a later job of
+ * the pid starts a new session instead of joining one that is detaching
+ */
+static void run_session(struct read_worker* worker, struct read_session* session)
+{
+    struct memory_reader* reader = worker->reader;
+    struct read_job* job = NULL;
+    int mem_fd = -1;
+    bool attached = false;
+    bool opened = false;
+    int error = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&reader->lock);
+
+        job = session->head;
+        if (job) {
+            session->head = job->next;
+            if (session->head == NULL) {
+                session->tail = NULL;
+            }
+        }
+        else if (opened == false) {
+            *find_session(reader, session->pid) = session->next;
+        }
+
+        pthread_mutex_unlock(&reader->lock);
+
+        if (job == NULL) {
+            if (opened == false) {
+                break;
+            }
+
+            close_session(session->pid, &mem_fd, &attached);
+            opened = false;
+            continue;
+        }
+
+        if (opened == false) {
+            error = open_session(reader, session->pid, &mem_fd, &attached);
+            opened = true;
+        }
+
+        run_job(worker, job, mem_fd, error);
+        finish_job(reader, job);
+    }
+
+    free(session);
+}
+
+static void* run_worker(void* arg)
+{
+    struct read_worker* worker = arg;
+    struct memory_reader* reader = worker->reader;
+    struct read_session* session = NULL;
+
+    for (;;) {
+        pthread_mutex_lock(&reader->lock);
+
+        while (reader->queued_sessions == 0 && reader->stopping == false) {
+            pthread_cond_wait(&reader->work_cond, &reader->lock);
+        }
+
+        if (reader->queued_sessions == 0) {
+            pthread_mutex_unlock(&reader->lock);
+            break;
+        }
+
+        pthread_mutex_unlock(&reader->lock);
+
+        session = take_session(worker);
+        if (session == NULL) {
+            /* another worker got there first */
+            continue;
+        }
+
+        pthread_mutex_lock(&reader->lock);
+        reader->queued_sessions--;
+        pthread_mutex_unlock(&reader->lock);
+
+        run_session(worker, session);
+    }
+
+    return NULL;
+}
+
+memory_reader_t create_memory_reader(unsigned int worker_count, size_t buffer_size, unsigned int flags)
+{
+    bool result = true;
+
+    struct memory_reader* reader = NULL;
+    unsigned int i;
+
+    if (worker_count == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        worker_count = online > 0 ? (unsigned int)online : 1;
+    }
+
+    if (buffer_size == 0) {
+        buffer_size = STREAM_CHUNK_SIZE;
+    }
+
+    reader = calloc(1, sizeof(struct memory_reader));
+    NULLERRGOTO(reader, result, done);
+
+    reader->flags = flags;
+    reader->buffer_size = buffer_size;
+    reader->next_job = 1;
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->work_cond, NULL);
+    pthread_cond_init(&reader->done_cond, NULL);
+
+    reader->workers = calloc(worker_count, sizeof(struct read_worker));
+    NULLERRGOTO(reader->workers, result, done);
+
+    reader->worker_count = worker_count;
+
+    for (i = 0; i < worker_count; i++) {
+        struct read_worker* worker = &reader->workers[i];
+
+        worker->reader = reader;
+        pthread_mutex_init(&worker->lock, NULL);
+        worker->capacity = DEQUE_CAPACITY;
+
+        worker->deque = malloc(worker->capacity * sizeof(struct read_session*));
+        NULLERRGOTO(worker->deque, result, done);
+
+        worker->buffer = malloc(buffer_size);
+        NULLERRGOTO(worker->buffer, result, done);
+    }
+
+    for (i = 0; i < worker_count; i++) {
+        int error = pthread_create(&reader->workers[i].thread, NULL, run_worker, &reader->workers[i]);
+
+        if (error != 0) {
+            PP_ERROR(error, "cannot start memory reader worker %u", i);
+            SETERRGOTO(result, done);
+        }
+
+        reader->started_count++;
+    }
+
+done:
+
+    if (result == false && reader) {
+        destroy_memory_reader(reader);
+        reader = NULL;
+    }
+
+    return reader;
+}
+
+void destroy_memory_reader(memory_reader_t reader_h)
+{
+    struct memory_reader* reader = (struct memory_reader*)reader_h;
+    struct read_job* job = NULL;
+    unsigned int i;
+
+    if (reader == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+    reader->stopping = true;
+    pthread_cond_broadcast(&reader->work_cond);
+    pthread_mutex_unlock(&reader->lock);
+
+    /* workers leave once every queued session has run */
+    for (i = 0; i < reader->started_count; i++) {
+        pthread_join(reader->workers[i].thread, NULL);
+    }
+
+    for (i = 0; reader->workers && i < reader->worker_count; i++) {
+        struct read_worker* worker = &reader->workers[i];
+
+        if (worker->deque) {
+            free(worker->deque);
+        }
+
+        if (worker->buffer) {
+            free(worker->buffer);
+        }
+
+        pthread_mutex_destroy(&worker->lock);
+    }
+
+    while (reader->completions) {
+        job = reader->completions;
+        reader->completions = job->next;
+        free(job->ranges);
+        free(job);
+    }
+
+    if (reader->workers) {
+        free(reader->workers);
+    }
+
+    pthread_cond_destroy(&reader->done_cond);
+    pthread_cond_destroy(&reader->work_cond);
+    pthread_mutex_destroy(&reader->lock);
+
+    free(reader);
+}
+
+bool submit_memory_read(memory_reader_t reader_h, const int pid, const struct MemoryRange* ranges, int range_count,
+    memory_read_callback callback, void* arg, unsigned long long* job_id)
+{
+    bool result = true;
+
+    struct memory_reader* reader = (struct memory_reader*)reader_h;
+    struct read_job* job = NULL;
+    struct read_session* session = NULL;
+    struct read_session** slot = NULL;
+    bool queued = false;
+    int i;
+
+    for (i = 0; i < range_count; i++) {
+        if (ranges[i].start_address + ranges[i].size < ranges[i].start_address) {
+            PP_ERROR(EINVAL, "range %d of %d wraps around", i, pid);
+            SETERRGOTO(result, done);
+        }
+
+        if (callback == NULL && ranges[i].memory == NULL) {
+            PP_ERROR(EINVAL, "range %d of %d has nowhere to be read to", i, pid);
+            SETERRGOTO(result, done);
+        }
+    }
+
+    job = calloc(1, sizeof(struct read_job));
+    NULLERRGOTO(job, result, done);
+
+    job->ranges = malloc((range_count > 0 ? range_count : 1) * sizeof(struct MemoryRange));
+    NULLERRGOTO(job->ranges, result, done);
+
+    memcpy(job->ranges, ranges, range_count * sizeof(struct MemoryRange));
+    job->range_count = range_count;
+    job->pid = pid;
+    job->callback = callback;
+    job->arg = arg;
+    job->completion.pid = pid;
+
+    pthread_mutex_lock(&reader->lock);
+
+    /* a pid with a session in progress or queued gets the job appended */
+    slot = find_session(reader, pid);
+    session = *slot;
+
+    if (session == NULL) {
+        session = calloc(1, sizeof(struct read_session));
+        if (session == NULL || push_session(&reader->workers[reader->next_worker], session) == false) {
+            pthread_mutex_unlock(&reader->lock);
+            if (session) {
+                free(session);
+            }
+            SETERRGOTO(result, done);
+        }
+
+        session->pid = pid;
+        *slot = session;
+        reader->next_worker = (reader->next_worker + 1) % reader->worker_count;
+        reader->queued_sessions++;
+        pthread_cond_signal(&reader->work_cond);
+    }
+
+    job->id = reader->next_job++;
+    job->completion.job = job->id;
+
+    if (session->tail) {
+        session->tail->next = job;
+    }
+    else {
+        session->head = job;
+    }
+    session->tail = job;
+
+    reader->pending_jobs++;
+    queued = true;
+
+    if (job_id) {
+        *job_id = job->id;
+    }
+
+    pthread_mutex_unlock(&reader->lock);
+
+done:
+
+    if (queued == false && job) {
+        if (job->ranges) {
+            free(job->ranges);
+        }
+        free(job);
+    }
+
+    return result;
+}
+
+bool next_memory_completion(memory_reader_t reader_h, int timeout_ms, struct MemoryReadCompletion* completion)
+{
+    struct memory_reader* reader = (struct memory_reader*)reader_h;
+    struct read_job* job = NULL;
+    struct timespec deadline;
+
+    if (timeout_ms > 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&reader->lock);
+
+    while (reader->completions == NULL && timeout_ms != 0) {
+        if (timeout_ms < 0) {
+            pthread_cond_wait(&reader->done_cond, &reader->lock);
+        }
+        else if (pthread_cond_timedwait(&reader->done_cond, &reader->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+
+    job = reader->completions;
+    if (job) {
+        reader->completions = job->next;
+        if (reader->completions == NULL) {
+            reader->completions_tail = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&reader->lock);
+
+    if (job == NULL) {
+        PP_ERROR(ETIMEDOUT, "no memory read completed");
+        return false;
+    }
+
+    *completion = job->completion;
+
+    free(job->ranges);
+    free(job);
+
+    return true;
+}
+
+void wait_memory_reader(memory_reader_t reader_h)
+{
+    struct memory_reader* reader = (struct memory_reader*)reader_h;
+
+    pthread_mutex_lock(&reader->lock);
+
+    while (reader->pending_jobs > 0) {
+        pthread_cond_wait(&reader->done_cond, &reader->lock);
+    }
+
+    pthread_mutex_unlock(&reader->lock);
+}
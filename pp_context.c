@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+
+#define DEFAULT_PROCFS_ROOT "/proc"
+
+/*
+ * settings, last error and scratch buffer of a caller. a thread works on
+ * the context given to set_thread_procfs_context, so a context must not be
+ * used by two threads at the same time. threads without one share the
+ * settings of the default context but keep their error and buffer in
+ * thread-local storage.
+ */
+struct pp_context
+{
+    char procfs_root[PATH_MAX];
+
+    struct ProcfsError error;
+
+    unsigned char* buffer;
+    size_t buffer_size;
+};
+
+static struct pp_context default_context = {
+    DEFAULT_PROCFS_ROOT,
+};
+
+static __thread struct pp_context* thread_context = NULL;
+
+static __thread struct ProcfsError thread_error;
+static __thread unsigned char* thread_buffer = NULL;
+static __thread size_t thread_buffer_size = 0;
+
+static pthread_key_t buffer_key;
+static pthread_once_t buffer_key_once = PTHREAD_ONCE_INIT;
+
+struct pp_context* pp_current_context()
+{
+    return thread_context ? thread_context : &default_context;
+}
+
+static struct ProcfsError* current_error(struct pp_context* context)
+{
+    if (context == NULL) {
+        context = thread_context;
+    }
+
+    if (context == NULL || context == &default_context) {
+        return &thread_error;
+    }
+
+    return &context->error;
+}
+
+static void create_buffer_key()
+{
+    pthread_key_create(&buffer_key, free);
+}
+
+procfs_context_t create_procfs_context()
+{
+    struct pp_context* context = calloc(1, sizeof(struct pp_context));
+
+    if (context == NULL) {
+        return NULL;
+    }
+
+    /* inherit the default settings */
+    strcpy(context->procfs_root, default_context.procfs_root);
+
+    return context;
+}
+
+void destroy_procfs_context(procfs_context_t context_h)
+{
+    struct pp_context* context = (struct pp_context*)context_h;
+
+    if (context == NULL || context == &default_context) {
+        return;
+    }
+
+    if (thread_context == context) {
+        thread_context = NULL;
+    }
+
+    if (context->buffer) {
+        free(context->buffer);
+    }
+
+    free(context);
+}
+
+void set_thread_procfs_context(procfs_context_t context_h)
+{
+    thread_context = (struct pp_context*)context_h;
+}
+
+procfs_context_t get_thread_procfs_context()
+{
+    return pp_current_context();
+}
+
+bool set_context_procfs_root(procfs_context_t context_h, const char* root)
+{
+    struct pp_context* context = context_h ? (struct pp_context*)context_h : pp_current_context();
+    size_t length;
+
+    if (root == NULL) {
+        root = DEFAULT_PROCFS_ROOT;
+    }
+
+    length = strlen(root);
+    while (length > 1 && root[length - 1] == '/') {
+        length--;
+    }
+
+    if (length == 0 || length >= sizeof(context->procfs_root)) {
+        return false;
+    }
+
+    memcpy(context->procfs_root, root, length);
+    context->procfs_root[length] = '\0';
+
+    return true;
+}
+
+const char* get_context_procfs_root(procfs_context_t context_h)
+{
+    struct pp_context* context = context_h ? (struct pp_context*)context_h : pp_current_context();
+
+    return context->procfs_root;
+}
+
+bool set_procfs_root(const char* root)
+{
+    return set_context_procfs_root(&default_context, root);
+}
+
+const char* get_procfs_root()
+{
+    return default_context.procfs_root;
+}
+
+bool get_procfs_last_error(procfs_context_t context_h, struct ProcfsError* error)
+{
+    struct ProcfsError* last = current_error((struct pp_context*)context_h);
+
+    if (last->function == NULL) {
+        return false;
+    }
+
+    *error = *last;
+
+    return true;
+}
+
+void clear_procfs_last_error(procfs_context_t context_h)
+{
+    memset(current_error((struct pp_context*)context_h), 0x00, sizeof(struct ProcfsError));
+}
+
+void pp_set_error(const char* function, int code, const char* format, ...)
+{
+    struct ProcfsError* error = current_error(NULL);
+    va_list args;
+
+    error->function = function;
+    error->code = code;
+
+    va_start(args, format);
+    vsnprintf(error->message, sizeof(error->message), format, args);
+    va_end(args);
+}
+
+unsigned char* pp_context_buffer(size_t size)
+{
+    struct pp_context* context = thread_context;
+    unsigned char** buffer = context ? &context->buffer : &thread_buffer;
+    size_t* buffer_size = context ? &context->buffer_size : &thread_buffer_size;
+
+    if (*buffer_size < size) {
+        unsigned char* grown = realloc(*buffer, size);
+
+        if (grown == NULL) {
+            return NULL;
+        }
+
+        /* thread-local buffers are released at thread exit */
+        if (context == NULL) {
+            pthread_once(&buffer_key_once, create_buffer_key);
+            pthread_setspecific(buffer_key, grown);
+        }
+
+        *buffer = grown;
+        *buffer_size = size;
+    }
+
+    return *buffer;
+}
@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pp_hash.h"
+
+/* XXH64, https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md */
+
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t read64_le(const unsigned char* p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap64(value);
+#endif
+    return value;
+}
+
+static inline uint32_t read32_le(const unsigned char* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = ROTL64(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+static inline uint64_t xxh64_merge_round(uint64_t acc, uint64_t value)
+{
+    acc ^= xxh64_round(0, value);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+void pp_xxh64_init(struct pp_xxh64_state* state, uint64_t seed)
+{
+    memset(state, 0x00, sizeof(struct pp_xxh64_state));
+
+    state->seed = seed;
+    state->v[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    state->v[1] = seed + XXH_PRIME64_2;
+    state->v[2] = seed;
+    state->v[3] = seed - XXH_PRIME64_1;
+}
+
+static inline void xxh64_consume_stripe(struct pp_xxh64_state* state, const unsigned char* p)
+{
+    state->v[0] = xxh64_round(state->v[0], read64_le(p));
+    state->v[1] = xxh64_round(state->v[1], read64_le(p + 8));
+    state->v[2] = xxh64_round(state->v[2], read64_le(p + 16));
+    state->v[3] = xxh64_round(state->v[3], read64_le(p + 24));
+}
+
+void pp_xxh64_update(struct pp_xxh64_state* state, const void* data, size_t size)
+{
+    const unsigned char* p = data;
+    const unsigned char* end = p + size;
+
+    state->total_len += size;
+
+    if (state->mem_size + size < 32) {
+        memcpy(state->mem + state->mem_size, p, size);
+        state->mem_size += size;
+        return;
+    }
+
+    if (state->mem_size) {
+        size_t fill = 32 - state->mem_size;
+
+        memcpy(state->mem + state->mem_size, p, fill);
+        xxh64_consume_stripe(state, state->mem);
+        p += fill;
+        state->mem_size = 0;
+    }
+
+    while (p + 32 <= end) {
+        xxh64_consume_stripe(state, p);
+        p += 32;
+    }
+
+    if (p < end) {
+        memcpy(state->mem, p, end - p);
+        state->mem_size = end - p;
+    }
+}
+
+uint64_t pp_xxh64_digest(const struct pp_xxh64_state* state)
+{
+    const unsigned char* p = state->mem;
+    const unsigned char* end = p + state->mem_size;
+    uint64_t h64;
+
+    if (state->total_len >= 32) {
+        h64 = ROTL64(state->v[0], 1) + ROTL64(state->v[1], 7) + ROTL64(state->v[2], 12) + ROTL64(state->v[3], 18);
+        h64 = xxh64_merge_round(h64, state->v[0]);
+        h64 = xxh64_merge_round(h64, state->v[1]);
+        h64 = xxh64_merge_round(h64, state->v[2]);
+        h64 = xxh64_merge_round(h64, state->v[3]);
+    }
+    else {
+        h64 = state->seed + XXH_PRIME64_5;
+    }
+
+    h64 += state->total_len;
+
+    while (p + 8 <= end) {
+        h64 ^= xxh64_round(0, read64_le(p));
+        h64 = ROTL64(h64, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+        p += 8;
+    }
+
+    if (p + 4 <= end) {
+        h64 ^= (uint64_t)read32_le(p) * XXH_PRIME64_1;
+        h64 = ROTL64(h64, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+
+    while (p < end) {
+        h64 ^= (*p) * XXH_PRIME64_5;
+        h64 = ROTL64(h64, 11) * XXH_PRIME64_1;
+        p++;
+    }
+
+    h64 ^= h64 >> 33;
+    h64 *= XXH_PRIME64_2;
+    h64 ^= h64 >> 29;
+    h64 *= XXH_PRIME64_3;
+    h64 ^= h64 >> 32;
+
+    return h64;
+}
+
+/* SHA-256, FIPS 180-4 */
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR32(x, r) (((x) >> (r)) | ((x) << (32 - (r))))
+
+static void sha256_transform(struct pp_sha256_state* state, const unsigned char* block)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16)
+            | ((uint32_t)block[i * 4 + 2] << 8) | (uint32_t)block[i * 4 + 3];
+    }
+
+    for (i = 16; i < 64; i++) {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = state->h[0];
+    b = state->h[1];
+    c = state->h[2];
+    d = state->h[3];
+    e = state->h[4];
+    f = state->h[5];
+    g = state->h[6];
+    h = state->h[7];
+
+    for (i = 0; i < 64; i++) {
+        uint32_t s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+        uint32_t s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state->h[0] += a;
+    state->h[1] += b;
+    state->h[2] += c;
+    state->h[3] += d;
+    state->h[4] += e;
+    state->h[5] += f;
+    state->h[6] += g;
+    state->h[7] += h;
+}
+
+void pp_sha256_init(struct pp_sha256_state* state)
+{
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    memset(state, 0x00, sizeof(struct pp_sha256_state));
+    memcpy(state->h, initial, sizeof(initial));
+}
+
+void pp_sha256_update(struct pp_sha256_state* state, const void* data, size_t size)
+{
+    const unsigned char* p = data;
+
+    state->length += size;
+
+    if (state->block_size) {
+        size_t fill = 64 - state->block_size;
+
+        if (size < fill) {
+            memcpy(state->block + state->block_size, p, size);
+            state->block_size += size;
+            return;
+        }
+
+        memcpy(state->block + state->block_size, p, fill);
+        sha256_transform(state, state->block);
+        state->block_size = 0;
+        p += fill;
+        size -= fill;
+    }
+
+    while (size >= 64) {
+        sha256_transform(state, p);
+        p += 64;
+        size -= 64;
+    }
+
+    if (size) {
+        memcpy(state->block, p, size);
+        state->block_size = size;
+    }
+}
+
+void pp_sha256_final(struct pp_sha256_state* state, unsigned char digest[PP_SHA256_DIGEST_SIZE])
+{
+    uint64_t bit_length = state->length * 8;
+    int i;
+
+    state->block[state->block_size++] = 0x80;
+
+    if (state->block_size > 56) {
+        memset(state->block + state->block_size, 0x00, 64 - state->block_size);
+        sha256_transform(state, state->block);
+        state->block_size = 0;
+    }
+
+    memset(state->block + state->block_size, 0x00, 56 - state->block_size);
+    for (i = 0; i < 8; i++) {
+        state->block[63 - i] = (unsigned char)(bit_length >> (i * 8));
+    }
+    sha256_transform(state, state->block);
+
+    for (i = 0; i < 8; i++) {
+        digest[i * 4]     = (unsigned char)(state->h[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(state->h[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(state->h[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)(state->h[i]);
+    }
+}
+
+int pp_hash_digest_size(int algorithm)
+{
+    switch (algorithm) {
+    case PP_HASH_XXH64:
+        return PP_XXH64_DIGEST_SIZE;
+    case PP_HASH_SHA256:
+        return PP_SHA256_DIGEST_SIZE;
+    default:
+        return 0;
+    }
+}
+
+bool pp_hash_init(struct pp_hash_state* state, int algorithm)
+{
+    state->algorithm = algorithm;
+
+    switch (algorithm) {
+    case PP_HASH_XXH64:
+        pp_xxh64_init(&state->u.xxh64, 0);
+        return true;
+    case PP_HASH_SHA256:
+        pp_sha256_init(&state->u.sha256);
+        return true;
+    default:
+        return false;
+    }
+}
+
+void pp_hash_update(struct pp_hash_state* state, const void* data, size_t size)
+{
+    if (state->algorithm == PP_HASH_XXH64) {
+        pp_xxh64_update(&state->u.xxh64, data, size);
+    }
+    else {
+        pp_sha256_update(&state->u.sha256, data, size);
+    }
+}
+
+void pp_hash_final(struct pp_hash_state* state, unsigned char* digest)
+{
+    if (state->algorithm == PP_HASH_XXH64) {
+        uint64_t h64 = pp_xxh64_digest(&state->u.xxh64);
+        int i;
+
+        for (i = 0; i < PP_XXH64_DIGEST_SIZE; i++) {
+            digest[i] = (unsigned char)(h64 >> (56 - i * 8));
+        }
+    }
+    else {
+        pp_sha256_final(&state->u.sha256, digest);
+    }
+}
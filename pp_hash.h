@@ -0,0 +1,58 @@
+#ifndef __PP_HASH__
+#define __PP_HASH__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define PP_HASH_XXH64  0
+#define PP_HASH_SHA256 1
+
+#define PP_XXH64_DIGEST_SIZE  8
+#define PP_SHA256_DIGEST_SIZE 32
+#define PP_HASH_DIGEST_MAX    PP_SHA256_DIGEST_SIZE
+
+struct pp_xxh64_state
+{
+    uint64_t total_len;
+    uint64_t v[4];
+    unsigned char mem[32];
+    unsigned int mem_size;
+    uint64_t seed;
+};
+
+struct pp_sha256_state
+{
+    uint32_t h[8];
+    uint64_t length;
+    unsigned char block[64];
+    unsigned int block_size;
+};
+
+struct pp_hash_state
+{
+    int algorithm;
+    union {
+        struct pp_xxh64_state xxh64;
+        struct pp_sha256_state sha256;
+    } u;
+};
+
+void pp_xxh64_init(struct pp_xxh64_state* state, uint64_t seed);
+void pp_xxh64_update(struct pp_xxh64_state* state, const void* data, size_t size);
+uint64_t pp_xxh64_digest(const struct pp_xxh64_state* state);
+
+void pp_sha256_init(struct pp_sha256_state* state);
+void pp_sha256_update(struct pp_sha256_state* state, const void* data, size_t size);
+void pp_sha256_final(struct pp_sha256_state* state, unsigned char digest[PP_SHA256_DIGEST_SIZE]);
+
+/* returns digest size of the algorithm, 0 if unknown */
+int pp_hash_digest_size(int algorithm);
+
+bool pp_hash_init(struct pp_hash_state* state, int algorithm);
+void pp_hash_update(struct pp_hash_state* state, const void* data, size_t size);
+
+/* XXH64 digest is stored big-endian, as its canonical representation */
+void pp_hash_final(struct pp_hash_state* state, unsigned char* digest);
+
+#endif /* __PP_HASH__ */
@@ -18,6 +18,35 @@
 
 #define UNKNOWN_INODE 0
 
+struct pp_context* pp_current_context();
+
+/* record the last error in the context of the calling thread */
+void pp_set_error(const char* function, int code, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#define PP_ERROR(code, ...) pp_set_error(__func__, code, __VA_ARGS__)
+
+/* scratch buffer of the calling thread's context, valid until the next call */
+unsigned char* pp_context_buffer(size_t size);
+
 long long get_file_size(FILE* file);
 
+/* pread until size bytes are read, false on error or EOF */
+bool read_full_at(int fd, unsigned char* buffer, size_t size, unsigned long long offset);
+
+/* pread of "/proc/[pid]/mem" until size bytes are read or the range ends, -1 if nothing could be read */
+ssize_t read_memory_at(int mem_fd, unsigned char* buffer, size_t size, unsigned long long address);
+
+/* readable and backed by memory that "/proc/[pid]/mem" can read, unlike [vvar] and [vsyscall] */
+bool is_dumpable_vma(const struct VirtualMemoryArea* vma);
+
+/* "[procfs root]/[name]", false if it does not fit */
+bool make_procfs_path(char* path, size_t size, const char* name);
+
+/* "[procfs root]/[pid]/[name]", or the pid directory if name is NULL */
+bool make_process_path(char* path, size_t size, const int pid, const char* name);
+
+/* open "[procfs root]/[pid]/[name]", returns fd or -1 */
+int open_process_file(const int pid, const char* name, int flags);
+
 #endif
@@ -229,7 +229,7 @@ bool pp_list_rpop(pp_list_t list_h, void** data)
     }
 
     node = list->tail;
-    if (node = NULL) {
+    if (node == NULL) {
         return false;
     }
 
@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "procfs_parser_api.h"
+#include "pp_stats.h"
+
+#define NO_API (-1)
+
+/*
+ * every thread owns one block and is its only writer, so counters are
+ * updated with plain relaxed stores. readers sum all blocks under
+ * block_lock, which only thread start/exit and snapshots take.
+ */
+struct pp_thread_stats
+{
+    struct pp_thread_stats* prev;
+    struct pp_thread_stats* next;
+
+    int current_api;
+    unsigned long long attach_ns;
+
+    struct ApiStats apis[API_COUNT];
+};
+
+bool pp_stats_enabled = false;
+
+static struct pp_thread_stats* block_head = NULL;
+static pthread_mutex_t block_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* counters of exited threads, and the values at the last reset */
+static struct ApiStats retired[API_COUNT];
+static struct ApiStats baseline[API_COUNT];
+
+static pthread_key_t block_key;
+static pthread_once_t block_key_once = PTHREAD_ONCE_INIT;
+
+static __thread struct pp_thread_stats* thread_block = NULL;
+
+static const char* api_names[API_COUNT] = {
+    "parse_maps_file",
+    "parse_process_stat",
+    "read_command_line",
+    "read_imagepath",
+    "read_process_memory",
+    "dump_process_memory",
+    "dump_process_image",
+    "dump_process_stack",
+    "take_memory_snapshot",
+    "take_memory_delta",
+    "hash_process_memory",
+    "run_procfs_batch",
+    "parse_process_status",
+    "read_process_argv",
+    "read_process_environ",
+    "parse_smaps_rollup",
+    "list_cgroup_pids",
+    "stream_process_memory",
+    "visit_maps_file",
+    "query_vma",
+    "memory_reader_job",
+};
+
+#define COUNTER_ADD(counter, value) \
+    __atomic_store_n(&(counter), __atomic_load_n(&(counter), __ATOMIC_RELAXED) + (value), __ATOMIC_RELAXED)
+
+#define COUNTER_LOAD(counter) __atomic_load_n(&(counter), __ATOMIC_RELAXED)
+
+static unsigned long long now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void add_stats(struct ApiStats* sum, struct ApiStats* stats)
+{
+    int i;
+
+    sum->calls += COUNTER_LOAD(stats->calls);
+    sum->failures += COUNTER_LOAD(stats->failures);
+    sum->bytes_read += COUNTER_LOAD(stats->bytes_read);
+    sum->syscalls += COUNTER_LOAD(stats->syscalls);
+    sum->ptrace_stops += COUNTER_LOAD(stats->ptrace_stops);
+    sum->ptrace_stop_ns += COUNTER_LOAD(stats->ptrace_stop_ns);
+    sum->total_ns += COUNTER_LOAD(stats->total_ns);
+
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        sum->latency[i] += COUNTER_LOAD(stats->latency[i]);
+    }
+}
+
+static void sub_stats(struct ApiStats* stats, const struct ApiStats* base)
+{
+    int i;
+
+    stats->calls -= base->calls;
+    stats->failures -= base->failures;
+    stats->bytes_read -= base->bytes_read;
+    stats->syscalls -= base->syscalls;
+    stats->ptrace_stops -= base->ptrace_stops;
+    stats->ptrace_stop_ns -= base->ptrace_stop_ns;
+    stats->total_ns -= base->total_ns;
+
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        stats->latency[i] -= base->latency[i];
+    }
+}
+
+/* thread exit: fold the block into the retired counters */
+static void retire_block(void* data)
+{
+    struct pp_thread_stats* block = data;
+    int i;
+
+    pthread_mutex_lock(&block_lock);
+
+    for (i = 0; i < API_COUNT; i++) {
+        add_stats(&retired[i], &block->apis[i]);
+    }
+
+    if (block->prev) {
+        block->prev->next = block->next;
+    }
+    else {
+        block_head = block->next;
+    }
+
+    if (block->next) {
+        block->next->prev = block->prev;
+    }
+
+    pthread_mutex_unlock(&block_lock);
+
+    free(block);
+}
+
+static void create_block_key()
+{
+    pthread_key_create(&block_key, retire_block);
+}
+
+static struct pp_thread_stats* get_thread_block()
+{
+    struct pp_thread_stats* block = thread_block;
+
+    if (block) {
+        return block;
+    }
+
+    pthread_once(&block_key_once, create_block_key);
+
+    block = calloc(1, sizeof(struct pp_thread_stats));
+    if (block == NULL) {
+        return NULL;
+    }
+    block->current_api = NO_API;
+
+    pthread_mutex_lock(&block_lock);
+
+    block->next = block_head;
+    if (block_head) {
+        block_head->prev = block;
+    }
+    block_head = block;
+
+    pthread_mutex_unlock(&block_lock);
+
+    pthread_setspecific(block_key, block);
+    thread_block = block;
+
+    return block;
+}
+
+static int latency_bucket(unsigned long long ns)
+{
+    int bucket = 63 - __builtin_clzll(ns | 1);
+
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+void pp_stats_begin_slow(struct pp_stats_scope* scope, int api)
+{
+    struct pp_thread_stats* block = get_thread_block();
+
+    if (block == NULL) {
+        return;
+    }
+
+    scope->api = api;
+    scope->previous_api = block->current_api;
+    scope->start_ns = now_ns();
+    scope->active = true;
+
+    block->current_api = api;
+}
+
+void pp_stats_end_slow(struct pp_stats_scope* scope, bool success)
+{
+    struct pp_thread_stats* block = thread_block;
+    struct ApiStats* stats = &block->apis[scope->api];
+    unsigned long long elapsed = now_ns() - scope->start_ns;
+
+    COUNTER_ADD(stats->calls, 1);
+    COUNTER_ADD(stats->total_ns, elapsed);
+    COUNTER_ADD(stats->latency[latency_bucket(elapsed)], 1);
+
+    if (success == false) {
+        COUNTER_ADD(stats->failures, 1);
+    }
+
+    block->current_api = scope->previous_api;
+}
+
+void pp_stats_io_slow(unsigned long long bytes, unsigned long long syscalls)
+{
+    struct pp_thread_stats* block = thread_block;
+
+    if (block == NULL || block->current_api == NO_API) {
+        return;
+    }
+
+    COUNTER_ADD(block->apis[block->current_api].bytes_read, bytes);
+    COUNTER_ADD(block->apis[block->current_api].syscalls, syscalls);
+}
+
+void pp_stats_ptrace_attach_slow()
+{
+    struct pp_thread_stats* block = thread_block;
+
+    if (block == NULL || block->current_api == NO_API) {
+        return;
+    }
+
+    block->attach_ns = now_ns();
+}
+
+void pp_stats_ptrace_detach_slow()
+{
+    struct pp_thread_stats* block = thread_block;
+    struct ApiStats* stats = NULL;
+
+    if (block == NULL || block->current_api == NO_API || block->attach_ns == 0) {
+        return;
+    }
+
+    stats = &block->apis[block->current_api];
+
+    COUNTER_ADD(stats->ptrace_stops, 1);
+    COUNTER_ADD(stats->ptrace_stop_ns, now_ns() - block->attach_ns);
+    block->attach_ns = 0;
+}
+
+void enable_instrumentation(bool enable)
+{
+    __atomic_store_n(&pp_stats_enabled, enable, __ATOMIC_RELAXED);
+}
+
+bool is_instrumentation_enabled()
+{
+    return PP_STATS_ON();
+}
+
+static void sum_all(struct ApiStats* stats)
+{
+    struct pp_thread_stats* block = NULL;
+    int i;
+
+    memcpy(stats, retired, sizeof(retired));
+
+    for (block = block_head; block; block = block->next) {
+        for (i = 0; i < API_COUNT; i++) {
+            add_stats(&stats[i], &block->apis[i]);
+        }
+    }
+}
+
+void snapshot_instrumentation(struct ApiStats* stats)
+{
+    int i;
+
+    pthread_mutex_lock(&block_lock);
+
+    sum_all(stats);
+    for (i = 0; i < API_COUNT; i++) {
+        sub_stats(&stats[i], &baseline[i]);
+    }
+
+    pthread_mutex_unlock(&block_lock);
+}
+
+/* writers are never stopped, a reset only moves the baseline */
+void reset_instrumentation()
+{
+    pthread_mutex_lock(&block_lock);
+
+    sum_all(baseline);
+
+    pthread_mutex_unlock(&block_lock);
+}
+
+const char* get_api_name(int api)
+{
+    if (api < 0 || api >= API_COUNT) {
+        return NULL;
+    }
+
+    return api_names[api];
+}
+
+bool export_instrumentation(FILE* file)
+{
+    struct ApiStats stats[API_COUNT];
+    int i, j;
+
+    snapshot_instrumentation(stats);
+
+    for (i = 0; i < API_COUNT; i++) {
+        if (stats[i].calls == 0) {
+            continue;
+        }
+
+        if (fprintf(file, "%s calls=%llu failures=%llu bytes_read=%llu syscalls=%llu ptrace_stops=%llu ptrace_stop_ns=%llu total_ns=%llu latency_log2_ns=",
+                api_names[i], stats[i].calls, stats[i].failures, stats[i].bytes_read, stats[i].syscalls,
+                stats[i].ptrace_stops, stats[i].ptrace_stop_ns, stats[i].total_ns) < 0) {
+            return false;
+        }
+
+        for (j = 0; j < LATENCY_BUCKETS; j++) {
+            if (stats[i].latency[j]) {
+                fprintf(file, "%d:%llu,", j, stats[i].latency[j]);
+            }
+        }
+
+        if (fputc('\n', file) == EOF) {
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,67 @@
+#ifndef __PP_STATS__
+#define __PP_STATS__
+
+#include <stdbool.h>
+
+#include "procfs_parser_api.h"
+
+struct pp_stats_scope
+{
+    int api;
+    int previous_api;
+    unsigned long long start_ns;
+    bool active;
+};
+
+extern bool pp_stats_enabled;
+
+void pp_stats_begin_slow(struct pp_stats_scope* scope, int api);
+void pp_stats_end_slow(struct pp_stats_scope* scope, bool success);
+void pp_stats_io_slow(unsigned long long bytes, unsigned long long syscalls);
+void pp_stats_ptrace_attach_slow();
+void pp_stats_ptrace_detach_slow();
+
+/* single relaxed load when instrumentation is off */
+#define PP_STATS_ON() __atomic_load_n(&pp_stats_enabled, __ATOMIC_RELAXED)
+
+static inline void pp_stats_begin(struct pp_stats_scope* scope, int api)
+{
+    scope->active = false;
+    if (PP_STATS_ON()) {
+        pp_stats_begin_slow(scope, api);
+    }
+}
+
+static inline void pp_stats_end(struct pp_stats_scope* scope, bool success)
+{
+    if (scope->active) {
+        pp_stats_end_slow(scope, success);
+    }
+}
+
+/* bytes read and syscalls issued on behalf of the innermost API in progress */
+static inline void pp_stats_io(unsigned long long bytes, unsigned long long syscalls)
+{
+    if (PP_STATS_ON()) {
+        pp_stats_io_slow(bytes, syscalls);
+    }
+}
+
+/* stdio files: open + close, and one read per BUFSIZ consumed */
+#define pp_stats_stdio(bytes) pp_stats_io((bytes), 2 + (bytes) / BUFSIZ + 1)
+
+static inline void pp_stats_ptrace_attach()
+{
+    if (PP_STATS_ON()) {
+        pp_stats_ptrace_attach_slow();
+    }
+}
+
+static inline void pp_stats_ptrace_detach()
+{
+    if (PP_STATS_ON()) {
+        pp_stats_ptrace_detach_slow();
+    }
+}
+
+#endif /* __PP_STATS__ */
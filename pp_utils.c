@@ -1,6 +1,14 @@
 #include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <linux/limits.h>
 
+#include "procfs_parser_api.h"
 #include "pp_internal.h"
+#include "pp_stats.h"
 
 long long get_file_size(FILE* file)
 {
@@ -19,3 +27,101 @@ long long get_file_size(FILE* file)
     return offset;
 }
 
+
+bool read_full_at(int fd, unsigned char* buffer, size_t size, unsigned long long offset)
+{
+    size_t total = 0;
+
+    while (total < size) {
+        ssize_t rsz = pread(fd, buffer + total, size - total, (off_t)(offset + total));
+        pp_stats_io(rsz > 0 ? rsz : 0, 1);
+        if (rsz < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (rsz <= 0) {
+            return false;
+        }
+
+        total += rsz;
+    }
+
+    return true;
+}
+
+bool is_dumpable_vma(const struct VirtualMemoryArea* vma)
+{
+    if ((vma->permissions & VMA_READ) == 0) {
+        return false;
+    }
+
+    return strncmp(vma->pathname, "[vvar", 5) != 0 && strcmp(vma->pathname, "[vsyscall]") != 0;
+}
+
+ssize_t read_memory_at(int mem_fd, unsigned char* buffer, size_t size, unsigned long long address)
+{
+    size_t total = 0;
+
+    while (total < size) {
+        ssize_t rsz = pread(mem_fd, buffer + total, size - total, (off_t)(address + total));
+
+        pp_stats_io(rsz > 0 ? rsz : 0, 1);
+
+        if (rsz < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (rsz <= 0) {
+            if (total == 0) {
+                return rsz < 0 ? -1 : 0;
+            }
+            break;
+        }
+
+        total += rsz;
+    }
+
+    return (ssize_t)total;
+}
+
+bool make_procfs_path(char* path, size_t size, const char* name)
+{
+    int length = snprintf(path, size, "%s/%s", get_context_procfs_root(NULL), name);
+
+    return length >= 0 && (size_t)length < size;
+}
+
+bool make_process_path(char* path, size_t size, const int pid, const char* name)
+{
+    const char* root = get_context_procfs_root(NULL);
+    int length;
+
+    if (name) {
+        length = snprintf(path, size, "%s/%d/%s", root, pid, name);
+    }
+    else {
+        length = snprintf(path, size, "%s/%d", root, pid);
+    }
+
+    return length >= 0 && (size_t)length < size;
+}
+
+int open_process_file(const int pid, const char* name, int flags)
+{
+    char path[PATH_MAX];
+    int fd;
+
+    if (make_process_path(path, sizeof(path), pid, name) == false) {
+        return -1;
+    }
+
+    /* open and the matching close */
+    pp_stats_io(0, 2);
+
+    fd = open(path, flags | O_CLOEXEC);
+    if (fd < 0) {
+        PP_ERROR(errno, "cannot open %s", path);
+    }
+
+    return fd;
+}
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+#include "pp_stats.h"
+
+#define SZ_ARGS_BUFFER (4096)
+
+/* whole file into args->buffer, which only ever grows */
+static bool read_args_file(const int pid, const char* name, struct ProcessArgs* args)
+{
+    bool result = true;
+
+    size_t length = 0;
+    ssize_t rsz;
+    int fd = -1;
+
+    fd = open_process_file(pid, name, O_RDONLY);
+    if (fd < 0) {
+        SETERRGOTO(result, done);
+    }
+
+    for (;;) {
+        /* keep a byte for the terminating NUL */
+        if (args->buffer_size < length + 2) {
+            size_t size = args->buffer_size ? args->buffer_size * 2 : SZ_ARGS_BUFFER;
+            char* grown = realloc(args->buffer, size);
+
+            NULLERRGOTO(grown, result, done);
+            args->buffer = grown;
+            args->buffer_size = size;
+        }
+
+        rsz = read(fd, args->buffer + length, args->buffer_size - length - 1);
+        pp_stats_io(rsz > 0 ? rsz : 0, 1);
+
+        if (rsz < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (rsz < 0) {
+            PP_ERROR(errno, "cannot read %s of %d", name, pid);
+            SETERRGOTO(result, done);
+        }
+
+        if (rsz == 0) {
+            break;
+        }
+
+        length += rsz;
+    }
+
+    args->buffer[length] = '\0';
+    args->length = length;
+
+done:
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    return result;
+}
+
+/* one view per NUL-separated string, the view array is NULL-terminated like argv */
+static bool split_args(struct ProcessArgs* args)
+{
+    const char* cursor = args->buffer;
+    const char* end = args->buffer + args->length;
+
+    args->count = 0;
+
+    while (cursor < end) {
+        size_t length = strlen(cursor);
+
+        if (args->count + 1 >= args->view_capacity) {
+            int capacity = args->view_capacity ? args->view_capacity * 2 : 64;
+            const char** grown = realloc(args->views, capacity * sizeof(const char*));
+
+            if (grown == NULL) {
+                return false;
+            }
+
+            args->views = grown;
+            args->view_capacity = capacity;
+        }
+
+        args->views[args->count++] = cursor;
+        cursor += length + 1;
+    }
+
+    if (args->views == NULL) {
+        args->views = malloc(sizeof(const char*));
+        if (args->views == NULL) {
+            return false;
+        }
+        args->view_capacity = 1;
+    }
+
+    args->views[args->count] = NULL;
+
+    return true;
+}
+
+/* "KEY=value" strings ordered by KEY */
+static int compare_environ_key(const void* a, const void* b)
+{
+    const char* left = *(const char* const*)a;
+    const char* right = *(const char* const*)b;
+
+    while (*left && *left != '=' && *left == *right) {
+        left++;
+        right++;
+    }
+
+    return (unsigned char)(*left == '=' ? '\0' : *left) - (unsigned char)(*right == '=' ? '\0' : *right);
+}
+
+static bool index_environ(struct ProcessArgs* args)
+{
+    if (args->count > args->index_capacity) {
+        const char** grown = realloc(args->index, args->count * sizeof(const char*));
+
+        if (grown == NULL) {
+            return false;
+        }
+
+        args->index = grown;
+        args->index_capacity = args->count;
+    }
+
+    if (args->count > 0) {
+        memcpy(args->index, args->views, args->count * sizeof(const char*));
+        qsort(args->index, args->count, sizeof(const char*), compare_environ_key);
+    }
+
+    args->index_count = args->count;
+
+    return true;
+}
+
+bool read_process_argv(const int pid, struct ProcessArgs* args)
+{
+    bool result = true;
+
+    struct pp_stats_scope scope;
+
+    pp_stats_begin(&scope, API_READ_PROCESS_ARGV);
+
+    result = read_args_file(pid, "cmdline", args);
+    IFERRGOTO(result, done);
+
+    result = split_args(args);
+    IFERRGOTO(result, done);
+
+    args->index_count = 0;
+
+done:
+
+    pp_stats_end(&scope, result);
+
+    return result;
+}
+
+bool read_process_environ(const int pid, struct ProcessArgs* args)
+{
+    bool result = true;
+
+    struct pp_stats_scope scope;
+
+    pp_stats_begin(&scope, API_READ_PROCESS_ENVIRON);
+
+    result = read_args_file(pid, "environ", args);
+    IFERRGOTO(result, done);
+
+    result = split_args(args);
+    IFERRGOTO(result, done);
+
+    result = index_environ(args);
+    IFERRGOTO(result, done);
+
+done:
+
+    pp_stats_end(&scope, result);
+
+    return result;
+}
+
+const char* find_process_environ(const struct ProcessArgs* args, const char* key)
+{
+    int low = 0;
+    int high = args->index_count - 1;
+
+    while (low <= high) {
+        int middle = low + (high - low) / 2;
+        const char* entry = args->index[middle];
+        const char* cursor = key;
+        int compare;
+
+        /* same ordering as compare_environ_key, the key ends at '\0' */
+        while (*entry && *entry != '=' && *entry == *cursor) {
+            entry++;
+            cursor++;
+        }
+
+        compare = (unsigned char)(*entry == '=' ? '\0' : *entry) - (unsigned char)*cursor;
+        if (compare == 0) {
+            return *entry == '=' ? entry + 1 : entry;
+        }
+
+        if (compare < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle - 1;
+        }
+    }
+
+    return NULL;
+}
+
+void free_process_args(struct ProcessArgs* args)
+{
+    if (args->buffer) {
+        free(args->buffer);
+    }
+
+    if (args->views) {
+        free((void*)args->views);
+    }
+
+    if (args->index) {
+        free((void*)args->index);
+    }
+
+    memset(args, 0x00, sizeof(struct ProcessArgs));
+}
@@ -0,0 +1,546 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+#include "pp_stats.h"
+
+#define PROCESS_CACHE_BUCKETS 4096
+#define PROCESS_CACHE_EXE_MS  1000 // exe checked for an exec at most this often
+#define PROCESS_CACHE_DIR_FDS 256 // "/proc/[pid]" held open by this many entries at most
+
+/* populated fields, and fields whose read failed (kernel threads have no exe) */
+#define CACHED_IMAGEPATH 0x1
+#define CACHED_ARGV      0x2
+#define CACHED_MAPS      0x4
+
+struct cache_entry
+{
+    struct cache_entry* next;
+
+    /*
+     * identity: pid and starttime. "/proc/[pid]" opened once stays bound to
+     * this process, lookups in it fail after it was reaped. only the most
+     * recently used entries hold one, the others, and all once out of
+     * descriptors, check the inode of "/proc/[pid]" as the cheap proxy
+     */
+    int pid;
+    unsigned long long starttime;
+    int dir_fd;
+    struct cache_entry* fd_prev; // entries holding dir_fd, most recently used first
+    struct cache_entry* fd_next;
+    dev_t dir_dev;
+    ino_t dir_ino;
+
+    /* exec detection, unknown when exe cannot be stat'ed */
+    bool exe_known;
+    dev_t exe_dev;
+    ino_t exe_ino;
+    unsigned long long exe_checked_ns;
+
+    unsigned int cached;
+    unsigned int failed;
+
+    char imagepath[PATH_MAX];
+    struct ProcessArgs args;
+    struct VirtualMemoryArea* VMAs;
+    int vma_count;
+    unsigned long long maps_ns;
+};
+
+struct process_cache
+{
+    struct cache_entry* buckets[PROCESS_CACHE_BUCKETS];
+    struct ProcessCacheStats stats;
+
+    /* entries holding dir_fd, at most PROCESS_CACHE_DIR_FDS */
+    struct cache_entry* fd_first;
+    struct cache_entry* fd_last;
+    int fd_count;
+};
+
+static unsigned long long now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool stat_process_file(const int pid, const char* name, struct stat* st)
+{
+    char path[PATH_MAX];
+
+    if (make_process_path(path, sizeof(path), pid, name) == false) {
+        return false;
+    }
+
+    pp_stats_io(0, 1);
+
+    return stat(path, st) == 0;
+}
+
+/* through the entry's "/proc/[pid]" when it is open */
+static bool stat_entry_file(const struct cache_entry* entry, const char* name, struct stat* st)
+{
+    if (entry->dir_fd < 0) {
+        return stat_process_file(entry->pid, name, st);
+    }
+
+    pp_stats_io(0, 1);
+
+    return fstatat(entry->dir_fd, name, st, 0) == 0;
+}
+
+static bool read_starttime(const int pid, unsigned long long* starttime)
+{
+    struct ProcessStat stat;
+
+    if (parse_process_stat(pid, &stat) == false) {
+        return false;
+    }
+
+    *starttime = stat.starttime;
+
+    return true;
+}
+
+static void drop_fields(struct cache_entry* entry)
+{
+    if (entry->VMAs) {
+        free(entry->VMAs);
+        entry->VMAs = NULL;
+    }
+
+    entry->vma_count = 0;
+    entry->cached = 0;
+    entry->failed = 0;
+}
+
+static void unlink_dir_fd(struct process_cache* cache, struct cache_entry* entry)
+{
+    if (entry->fd_prev) {
+        entry->fd_prev->fd_next = entry->fd_next;
+    }
+    else {
+        cache->fd_first = entry->fd_next;
+    }
+
+    if (entry->fd_next) {
+        entry->fd_next->fd_prev = entry->fd_prev;
+    }
+    else {
+        cache->fd_last = entry->fd_prev;
+    }
+
+    entry->fd_prev = NULL;
+    entry->fd_next = NULL;
+}
+
+static void link_dir_fd(struct process_cache* cache, struct cache_entry* entry)
+{
+    entry->fd_next = cache->fd_first;
+
+    if (cache->fd_first) {
+        cache->fd_first->fd_prev = entry;
+    }
+    else {
+        cache->fd_last = entry;
+    }
+
+    cache->fd_first = entry;
+}
+
+/* the entry goes on with the inode and starttime check */
+static void release_dir_fd(struct process_cache* cache, struct cache_entry* entry)
+{
+    if (entry->dir_fd < 0) {
+        return;
+    }
+
+    unlink_dir_fd(cache, entry);
+    cache->fd_count--;
+
+    pp_stats_io(0, 1);
+    close(entry->dir_fd);
+    entry->dir_fd = -1;
+}
+
+static void touch_dir_fd(struct process_cache* cache, struct cache_entry* entry)
+{
+    if (entry->dir_fd >= 0 && cache->fd_first != entry) {
+        unlink_dir_fd(cache, entry);
+        link_dir_fd(cache, entry);
+    }
+}
+
+static void free_entry(struct process_cache* cache, struct cache_entry* entry)
+{
+    release_dir_fd(cache, entry);
+    drop_fields(entry);
+    free_process_args(&entry->args);
+    free(entry);
+}
+
+static void update_exe_identity(struct cache_entry* entry)
+{
+    struct stat st;
+
+    entry->exe_known = stat_entry_file(entry, "exe", &st);
+    entry->exe_checked_ns = now_ns();
+    if (entry->exe_known) {
+        entry->exe_dev = st.st_dev;
+        entry->exe_ino = st.st_ino;
+    }
+}
+
+/*
+ * false if the cached process is gone. "/proc/[pid]" gets a new inode for
+ * every process instance, and also when its dentry was evicted, so a
+ * changed inode is settled by comparing starttime
+ */
+static bool is_same_process(struct cache_entry* entry)
+{
+    unsigned long long starttime;
+    struct stat st;
+
+    if (entry->dir_fd >= 0) {
+        pp_stats_io(0, 1);
+        return faccessat(entry->dir_fd, "stat", F_OK, 0) == 0;
+    }
+
+    if (stat_process_file(entry->pid, NULL, &st) == false) {
+        return false;
+    }
+
+    if (st.st_dev == entry->dir_dev && st.st_ino == entry->dir_ino) {
+        return true;
+    }
+
+    if (read_starttime(entry->pid, &starttime) == false || starttime != entry->starttime) {
+        return false;
+    }
+
+    entry->dir_dev = st.st_dev;
+    entry->dir_ino = st.st_ino;
+
+    return true;
+}
+
+/* identity of the process behind pid now, false if it is gone */
+static bool identify_process(struct process_cache* cache, const int pid, struct cache_entry* entry)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    bool found;
+
+    entry->pid = pid;
+    entry->dir_fd = -1;
+
+    if (make_process_path(path, sizeof(path), pid, NULL) == false) {
+        return false;
+    }
+
+    /* the descriptors of the caller are not used up by the cache */
+    if (cache->fd_count == PROCESS_CACHE_DIR_FDS) {
+        release_dir_fd(cache, cache->fd_last);
+    }
+
+    /* open and fstat, or the failed open and stat */
+    pp_stats_io(0, 2);
+
+    entry->dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (entry->dir_fd >= 0) {
+        link_dir_fd(cache, entry);
+        cache->fd_count++;
+        found = fstat(entry->dir_fd, &st) == 0;
+    }
+    else {
+        found = stat(path, &st) == 0;
+    }
+
+    if (found == false) {
+        return false;
+    }
+
+    entry->dir_dev = st.st_dev;
+    entry->dir_ino = st.st_ino;
+
+    /* read by pid, it belongs to this process as long as the process is still there after */
+    if (read_starttime(pid, &entry->starttime) == false || is_same_process(entry) == false) {
+        return false;
+    }
+
+    update_exe_identity(entry);
+
+    return true;
+}
+
+/* a changed exe means an exec, cached fields are dropped then. exe is checked at a limited rate */
+static bool validate_entry(struct process_cache* cache, struct cache_entry* entry)
+{
+    unsigned long long now;
+    struct stat st;
+
+    if (is_same_process(entry) == false) {
+        return false;
+    }
+
+    if (entry->exe_known == false) {
+        return true;
+    }
+
+    now = now_ns();
+    if (now - entry->exe_checked_ns < PROCESS_CACHE_EXE_MS * 1000000ULL) {
+        return true;
+    }
+
+    entry->exe_checked_ns = now;
+
+    if (stat_entry_file(entry, "exe", &st) == false || st.st_dev != entry->exe_dev || st.st_ino != entry->exe_ino) {
+        cache->stats.execs++;
+        drop_fields(entry);
+        update_exe_identity(entry);
+    }
+
+    return true;
+}
+
+/* valid entry of pid, created or recreated as needed */
+static struct cache_entry* get_entry(struct process_cache* cache, const int pid)
+{
+    struct cache_entry** slot = &cache->buckets[(unsigned int)pid % PROCESS_CACHE_BUCKETS];
+    struct cache_entry* entry = NULL;
+
+    while (*slot && (*slot)->pid != pid) {
+        slot = &(*slot)->next;
+    }
+
+    entry = *slot;
+
+    if (entry && validate_entry(cache, entry)) {
+        touch_dir_fd(cache, entry);
+        return entry;
+    }
+
+    if (entry) {
+        /* the process exited, pid may already be reused */
+        cache->stats.reuses++;
+        *slot = entry->next;
+        free_entry(cache, entry);
+    }
+
+    entry = calloc(1, sizeof(struct cache_entry));
+    if (entry == NULL) {
+        return NULL;
+    }
+
+    if (identify_process(cache, pid, entry) == false) {
+        free_entry(cache, entry);
+        return NULL;
+    }
+
+    entry->next = cache->buckets[(unsigned int)pid % PROCESS_CACHE_BUCKETS];
+    cache->buckets[(unsigned int)pid % PROCESS_CACHE_BUCKETS] = entry;
+
+    return entry;
+}
+
+process_cache_t create_process_cache()
+{
+    return calloc(1, sizeof(struct process_cache));
+}
+
+void destroy_process_cache(process_cache_t cache_h)
+{
+    struct process_cache* cache = (struct process_cache*)cache_h;
+    int i;
+
+    if (cache == NULL) {
+        return;
+    }
+
+    for (i = 0; i < PROCESS_CACHE_BUCKETS; i++) {
+        while (cache->buckets[i]) {
+            struct cache_entry* entry = cache->buckets[i];
+
+            cache->buckets[i] = entry->next;
+            free_entry(cache, entry);
+        }
+    }
+
+    free(cache);
+}
+
+bool get_cached_imagepath(process_cache_t cache_h, const int pid, const char** imagepath)
+{
+    struct process_cache* cache = (struct process_cache*)cache_h;
+    struct cache_entry* entry = get_entry(cache, pid);
+
+    if (entry == NULL) {
+        return false;
+    }
+
+    if ((entry->cached & CACHED_IMAGEPATH) == 0) {
+        cache->stats.misses++;
+
+        if (read_imagepath(pid, entry->imagepath, sizeof(entry->imagepath)) == false) {
+            entry->failed |= CACHED_IMAGEPATH;
+        }
+
+        /* what was read by pid may belong to a process that replaced this one */
+        if (is_same_process(entry) == false) {
+            return false;
+        }
+
+        entry->cached |= CACHED_IMAGEPATH;
+    }
+    else {
+        cache->stats.hits++;
+    }
+
+    if (entry->failed & CACHED_IMAGEPATH) {
+        return false;
+    }
+
+    *imagepath = entry->imagepath;
+
+    return true;
+}
+
+bool get_cached_argv(process_cache_t cache_h, const int pid, const struct ProcessArgs** args)
+{
+    struct process_cache* cache = (struct process_cache*)cache_h;
+    struct cache_entry* entry = get_entry(cache, pid);
+
+    if (entry == NULL) {
+        return false;
+    }
+
+    if ((entry->cached & CACHED_ARGV) == 0) {
+        cache->stats.misses++;
+
+        if (read_process_argv(pid, &entry->args) == false) {
+            entry->failed |= CACHED_ARGV;
+        }
+
+        if (is_same_process(entry) == false) {
+            return false;
+        }
+
+        entry->cached |= CACHED_ARGV;
+    }
+    else {
+        cache->stats.hits++;
+    }
+
+    if (entry->failed & CACHED_ARGV) {
+        return false;
+    }
+
+    *args = &entry->args;
+
+    return true;
+}
+
+bool get_cached_maps(process_cache_t cache_h, const int pid, unsigned int max_age_ms,
+    const struct VirtualMemoryArea** VMAs, int* vma_count)
+{
+    struct process_cache* cache = (struct process_cache*)cache_h;
+    struct cache_entry* entry = get_entry(cache, pid);
+    unsigned long long now = now_ns();
+
+    if (entry == NULL) {
+        return false;
+    }
+
+    if ((entry->cached & CACHED_MAPS) && now - entry->maps_ns > max_age_ms * 1000000ULL) {
+        if (entry->VMAs) {
+            free(entry->VMAs);
+            entry->VMAs = NULL;
+        }
+
+        entry->cached &= ~CACHED_MAPS;
+        entry->failed &= ~CACHED_MAPS;
+    }
+
+    if ((entry->cached & CACHED_MAPS) == 0) {
+        cache->stats.misses++;
+
+        if (parse_maps_file(pid, &entry->VMAs, &entry->vma_count) == false) {
+            entry->failed |= CACHED_MAPS;
+        }
+
+        if (is_same_process(entry) == false) {
+            return false;
+        }
+
+        entry->cached |= CACHED_MAPS;
+        entry->maps_ns = now;
+    }
+    else {
+        cache->stats.hits++;
+    }
+
+    if (entry->failed & CACHED_MAPS) {
+        return false;
+    }
+
+    *VMAs = entry->VMAs;
+    *vma_count = entry->vma_count;
+
+    return true;
+}
+
+void invalidate_process_cache(process_cache_t cache_h, const int pid)
+{
+    struct process_cache* cache = (struct process_cache*)cache_h;
+    struct cache_entry* entry = cache->buckets[(unsigned int)pid % PROCESS_CACHE_BUCKETS];
+
+    while (entry && entry->pid != pid) {
+        entry = entry->next;
+    }
+
+    if (entry) {
+        drop_fields(entry);
+        update_exe_identity(entry);
+    }
+}
+
+int prune_process_cache(process_cache_t cache_h)
+{
+    struct process_cache* cache = (struct process_cache*)cache_h;
+    int removed = 0;
+    int i;
+
+    for (i = 0; i < PROCESS_CACHE_BUCKETS; i++) {
+        struct cache_entry** slot = &cache->buckets[i];
+
+        while (*slot) {
+            struct cache_entry* entry = *slot;
+
+            if (is_same_process(entry)) {
+                slot = &entry->next;
+                continue;
+            }
+
+            *slot = entry->next;
+            free_entry(cache, entry);
+            removed++;
+        }
+    }
+
+    return removed;
+}
+
+void get_process_cache_stats(process_cache_t cache_h, struct ProcessCacheStats* stats)
+{
+    *stats = ((struct process_cache*)cache_h)->stats;
+}
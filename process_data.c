@@ -1,10 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "procfs_parser_api.h"
 #include "pp_internal.h"
+#include "pp_stats.h"
 
 #define SZ_STATUS_RB (4096)
 
@@ -36,31 +40,59 @@ bool parse_process_stat(const int pid, struct ProcessStat* stat)
 {
     bool result = true;
 
+    struct pp_stats_scope scope;
     FILE* file = NULL;
     char buffer[SZ_STATUS_RB] = "";
-    char path[32] = "";
+    char path[PATH_MAX] = "";
     char* cursor = NULL;
-    char* next = NULL;
-    int len;
 
-    if (sprintf(path, "/proc/%d/stat", pid) < 0) {
+    pp_stats_begin(&scope, API_PARSE_PROCESS_STAT);
+
+    if (make_process_path(path, sizeof(path), pid, "stat") == false) {
         SETERRGOTO(result, done);
     }
 
     file = fopen(path, "r");
-    NULLERRGOTO(file, result, done);
+    if (file == NULL) {
+        PP_ERROR(errno, "cannot open %s", path);
+        SETERRGOTO(result, done);
+    }
 
     cursor = fgets(buffer, sizeof(buffer), file);
     NULLERRGOTO(cursor, result, done);
+    pp_stats_stdio(strlen(buffer));
+
+    result = parse_process_stat_data(buffer, stat);
 
-    fclose(file);
-    file = NULL;
+done:
+
+    if (file) {
+        fclose(file);
+    }
+
+    pp_stats_end(&scope, result);
+
+    return result;
+}
+
+bool parse_process_stat_data(const char* data, struct ProcessStat* stat)
+{
+    bool result = true;
+
+    char* cursor = (char*)data;
+    char* next = NULL;
+    int len;
 
     stat->pid = (pid_t)atoi(cursor);
 
     cursor = strchr(cursor, '(');
+    NULLERRGOTO(cursor, result, done);
     cursor++;
+
     next = strrchr(cursor, ')');
+    if (next == NULL || next - cursor >= NAME_MAX) {
+        SETERRGOTO(result, done);
+    }
 
     len = (unsigned long long)next - (unsigned long long)cursor;
     strncpy(stat->comm, cursor, len);
@@ -219,9 +251,467 @@ bool parse_process_stat(const int pid, struct ProcessStat* stat)
 
 done:
 
-    if (file) {
-        fclose(file);
+    return result;
+}
+/*
+ * status keys that map to a field. slot = STATUS_KEY_HASH(key) is perfect
+ * over these keys, a line with any other key fails the length or memcmp
+ * check of its slot and is skipped.
+ */
+#define STATUS_KEY_SLOTS 64
+#define STATUS_KEY_HASH(key, length) \
+    (((unsigned char)(key)[0] * 39 + (unsigned char)(key)[2] * 31 + (unsigned char)(key)[(length) - 1] * 12 + (length)) & (STATUS_KEY_SLOTS - 1))
+
+#define SZ_STATUS_BUFFER (4096)
+
+struct status_key
+{
+    const char* key;
+    unsigned char length;
+    signed char field;
+};
+
+static const struct status_key status_keys[STATUS_KEY_SLOTS] = {
+    [2] = { "Uid", 3, STATUS_UID },
+    [4] = { "TracerPid", 9, STATUS_TRACER_PID },
+    [5] = { "Threads", 7, STATUS_THREADS },
+    [9] = { "voluntary_ctxt_switches", 23, STATUS_VOLUNTARY_CTXT_SWITCHES },
+    [11] = { "VmPTE", 5, STATUS_VM_PTE },
+    [15] = { "RssShmem", 8, STATUS_RSS_SHMEM },
+    [18] = { "nonvoluntary_ctxt_switches", 26, STATUS_NONVOLUNTARY_CTXT_SWITCHES },
+    [20] = { "VmPeak", 6, STATUS_VM_PEAK },
+    [21] = { "Name", 4, STATUS_NAME },
+    [23] = { "VmLck", 5, STATUS_VM_LCK },
+    [26] = { "RssAnon", 7, STATUS_RSS_ANON },
+    [27] = { "PPid", 4, STATUS_PPID },
+    [32] = { "Gid", 3, STATUS_GID },
+    [33] = { "Cpus_allowed_list", 17, STATUS_CPUS_ALLOWED_LIST },
+    [36] = { "NStgid", 6, STATUS_NS_TGID },
+    [37] = { "State", 5, STATUS_STATE },
+    [39] = { "NSpid", 5, STATUS_NS_PID },
+    [40] = { "VmData", 6, STATUS_VM_DATA },
+    [41] = { "VmSize", 6, STATUS_VM_SIZE },
+    [43] = { "VmLib", 5, STATUS_VM_LIB },
+    [45] = { "VmSwap", 6, STATUS_VM_SWAP },
+    [46] = { "RssFile", 7, STATUS_RSS_FILE },
+    [47] = { "Mems_allowed_list", 17, STATUS_MEMS_ALLOWED_LIST },
+    [48] = { "VmStk", 5, STATUS_VM_STK },
+    [49] = { "VmRSS", 5, STATUS_VM_RSS },
+    [51] = { "VmHWM", 5, STATUS_VM_HWM },
+    [54] = { "VmExe", 5, STATUS_VM_EXE },
+    [55] = { "Tgid", 4, STATUS_TGID },
+    [57] = { "FDSize", 6, STATUS_FD_SIZE },
+    [59] = { "Umask", 5, STATUS_UMASK },
+    [60] = { "Kthread", 7, STATUS_KTHREAD },
+    [63] = { "Pid", 3, STATUS_PID },
+};
+
+static int lookup_status_key(const char* key, size_t length)
+{
+    const struct status_key* entry = NULL;
+
+    if (length < 3) {
+        return -1;
+    }
+
+    entry = &status_keys[STATUS_KEY_HASH(key, length)];
+    if (entry->length != length || memcmp(entry->key, key, length) != 0) {
+        return -1;
+    }
+
+    return entry->field;
+}
+
+static const char* skip_blanks(const char* cursor, const char* end)
+{
+    while (cursor < end && (*cursor == ' ' || *cursor == '\t')) {
+        cursor++;
+    }
+
+    return cursor;
+}
+
+/* unsigned number in base 8 or 10, no locale or errno handling as strtoull */
+static unsigned long long parse_number(const char** cursor, const char* end, unsigned int base)
+{
+    const char* current = skip_blanks(*cursor, end);
+    unsigned long long value = 0;
+
+    while (current < end && *current >= '0' && *current < '0' + (int)base) {
+        value = value * base + (*current - '0');
+        current++;
+    }
+
+    *cursor = current;
+
+    return value;
+}
+
+static int parse_numbers(const char* cursor, const char* end, unsigned int* values, int max_count)
+{
+    int count = 0;
+
+    while (count < max_count) {
+        cursor = skip_blanks(cursor, end);
+        if (cursor == end) {
+            break;
+        }
+
+        values[count++] = (unsigned int)parse_number(&cursor, end, 10);
+    }
+
+    return count;
+}
+
+static void copy_value(char* destination, size_t size, const char* cursor, const char* end)
+{
+    size_t length = end - cursor;
+
+    if (length >= size) {
+        length = size - 1;
+    }
+
+    memcpy(destination, cursor, length);
+    destination[length] = '\0';
+}
+
+static void parse_status_value(struct ProcessStatus* status, int field, const char* cursor, const char* end)
+{
+    unsigned int ids[4];
+    int i;
+
+    switch (field) {
+    case STATUS_NAME:
+        copy_value(status->name, sizeof(status->name), skip_blanks(cursor, end), end);
+        break;
+    case STATUS_UMASK:
+        status->umask = (unsigned int)parse_number(&cursor, end, 8);
+        break;
+    case STATUS_STATE:
+        cursor = skip_blanks(cursor, end);
+        status->state = cursor < end ? *cursor : '\0';
+        break;
+    case STATUS_TGID:
+        status->tgid = (pid_t)parse_number(&cursor, end, 10);
+        break;
+    case STATUS_PID:
+        status->pid = (pid_t)parse_number(&cursor, end, 10);
+        break;
+    case STATUS_PPID:
+        status->ppid = (pid_t)parse_number(&cursor, end, 10);
+        break;
+    case STATUS_TRACER_PID:
+        status->tracer_pid = (pid_t)parse_number(&cursor, end, 10);
+        break;
+    case STATUS_UID:
+        parse_numbers(cursor, end, ids, 4);
+        for (i = 0; i < 4; i++) {
+            status->uid[i] = (uid_t)ids[i];
+        }
+        break;
+    case STATUS_GID:
+        parse_numbers(cursor, end, ids, 4);
+        for (i = 0; i < 4; i++) {
+            status->gid[i] = (gid_t)ids[i];
+        }
+        break;
+    case STATUS_FD_SIZE:
+        status->fd_size = (int)parse_number(&cursor, end, 10);
+        break;
+    case STATUS_NS_TGID:
+        status->ns_tgid_count = parse_numbers(cursor, end, (unsigned int*)status->ns_tgid, STATUS_NS_LEVELS_MAX);
+        break;
+    case STATUS_NS_PID:
+        status->ns_pid_count = parse_numbers(cursor, end, (unsigned int*)status->ns_pid, STATUS_NS_LEVELS_MAX);
+        break;
+    case STATUS_KTHREAD:
+        status->kthread = parse_number(&cursor, end, 10) != 0;
+        break;
+    case STATUS_VM_PEAK:
+        status->vm_peak = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_VM_SIZE:
+        status->vm_size = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_VM_LCK:
+        status->vm_lck = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_VM_HWM:
+        status->vm_hwm = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_VM_RSS:
+        status->vm_rss = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_RSS_ANON:
+        status->rss_anon = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_RSS_FILE:
+        status->rss_file = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_RSS_SHMEM:
+        status->rss_shmem = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_VM_DATA:
+        status->vm_data = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_VM_STK:
+        status->vm_stk = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_VM_EXE:
+        status->vm_exe = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_VM_LIB:
+        status->vm_lib = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_VM_PTE:
+        status->vm_pte = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_VM_SWAP:
+        status->vm_swap = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_THREADS:
+        status->threads = (int)parse_number(&cursor, end, 10);
+        break;
+    case STATUS_CPUS_ALLOWED_LIST:
+        copy_value(status->cpus_allowed_list, sizeof(status->cpus_allowed_list), skip_blanks(cursor, end), end);
+        break;
+    case STATUS_MEMS_ALLOWED_LIST:
+        copy_value(status->mems_allowed_list, sizeof(status->mems_allowed_list), skip_blanks(cursor, end), end);
+        break;
+    case STATUS_VOLUNTARY_CTXT_SWITCHES:
+        status->voluntary_ctxt_switches = parse_number(&cursor, end, 10);
+        break;
+    case STATUS_NONVOLUNTARY_CTXT_SWITCHES:
+        status->nonvoluntary_ctxt_switches = parse_number(&cursor, end, 10);
+        break;
+    }
+}
+
+bool parse_process_status_data(const char* data, size_t size, unsigned long long field_mask, struct ProcessStatus* status)
+{
+    const char* cursor = data;
+    const char* end = data + size;
+    const char* first_colon = memchr(data, ':', size);
+    const char* first_newline = memchr(data, '\n', size);
+
+    memset(status, 0x00, sizeof(struct ProcessStatus));
+
+    /* every line is "Key:\tvalue", starting with Name */
+    if (first_colon == NULL || (first_newline && first_newline < first_colon)) {
+        return false;
+    }
+
+    /* stop as soon as every requested field is found */
+    while (cursor < end && (status->fields & field_mask) != field_mask) {
+        const char* colon = memchr(cursor, ':', end - cursor);
+        const char* line_end = NULL;
+        int field;
+
+        if (colon == NULL) {
+            break;
+        }
+
+        line_end = memchr(colon, '\n', end - colon);
+        if (line_end == NULL) {
+            line_end = end;
+        }
+
+        field = lookup_status_key(cursor, colon - cursor);
+        if (field >= 0 && (field_mask & STATUS_FIELD(field))) {
+            parse_status_value(status, field, colon + 1, line_end);
+            status->fields |= STATUS_FIELD(field);
+        }
+
+        cursor = line_end + 1;
+    }
+
+    /* a missing field is not an error, kernel threads have no memory lines */
+    return true;
+}
+
+/* whole "/proc/[pid]/[name]" into the context buffer */
+static bool read_process_file(const int pid, const char* name, unsigned char** data, size_t* data_size)
+{
+    bool result = true;
+
+    unsigned char* buffer = NULL;
+    size_t buffer_size = SZ_STATUS_BUFFER;
+    size_t size = 0;
+    ssize_t rsz;
+    int fd = -1;
+
+    fd = open_process_file(pid, name, O_RDONLY);
+    if (fd < 0) {
+        SETERRGOTO(result, done);
+    }
+
+    buffer = pp_context_buffer(buffer_size);
+    NULLERRGOTO(buffer, result, done);
+
+    for (;;) {
+        if (size == buffer_size) {
+            buffer_size *= 2;
+            buffer = pp_context_buffer(buffer_size);
+            NULLERRGOTO(buffer, result, done);
+        }
+
+        rsz = read(fd, buffer + size, buffer_size - size);
+        pp_stats_io(rsz > 0 ? rsz : 0, 1);
+
+        if (rsz < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (rsz < 0) {
+            PP_ERROR(errno, "cannot read %s of %d", name, pid);
+            SETERRGOTO(result, done);
+        }
+
+        if (rsz == 0) {
+            break;
+        }
+
+        size += rsz;
+    }
+
+    *data = buffer;
+    *data_size = size;
+
+done:
+
+    if (fd >= 0) {
+        close(fd);
     }
 
     return result;
-}
\ No newline at end of file
+}
+
+bool parse_process_status(const int pid, unsigned long long field_mask, struct ProcessStatus* status)
+{
+    bool result = true;
+
+    struct pp_stats_scope scope;
+    unsigned char* buffer = NULL;
+    size_t size = 0;
+
+    pp_stats_begin(&scope, API_PARSE_PROCESS_STATUS);
+
+    result = read_process_file(pid, "status", &buffer, &size);
+    IFERRGOTO(result, done);
+
+    result = parse_process_status_data((const char*)buffer, size, field_mask, status);
+    if (result == false) {
+        PP_ERROR(EINVAL, "malformed status of %d", pid);
+    }
+
+done:
+
+    pp_stats_end(&scope, result);
+
+    return result;
+}
+
+struct rollup_key
+{
+    const char* key;
+    size_t offset;
+};
+
+/* in file order, lines not listed are skipped */
+static const struct rollup_key rollup_keys[] = {
+    { "Rss", offsetof(struct SmapsRollup, rss) },
+    { "Pss", offsetof(struct SmapsRollup, pss) },
+    { "Pss_Dirty", offsetof(struct SmapsRollup, pss_dirty) },
+    { "Pss_Anon", offsetof(struct SmapsRollup, pss_anon) },
+    { "Pss_File", offsetof(struct SmapsRollup, pss_file) },
+    { "Pss_Shmem", offsetof(struct SmapsRollup, pss_shmem) },
+    { "Shared_Clean", offsetof(struct SmapsRollup, shared_clean) },
+    { "Shared_Dirty", offsetof(struct SmapsRollup, shared_dirty) },
+    { "Private_Clean", offsetof(struct SmapsRollup, private_clean) },
+    { "Private_Dirty", offsetof(struct SmapsRollup, private_dirty) },
+    { "Referenced", offsetof(struct SmapsRollup, referenced) },
+    { "Anonymous", offsetof(struct SmapsRollup, anonymous) },
+    { "Swap", offsetof(struct SmapsRollup, swap) },
+    { "SwapPss", offsetof(struct SmapsRollup, swap_pss) },
+    { "Locked", offsetof(struct SmapsRollup, locked) },
+};
+
+#define ROLLUP_KEY_COUNT (int)(sizeof(rollup_keys) / sizeof(rollup_keys[0]))
+
+bool parse_smaps_rollup_data(const char* data, size_t size, struct SmapsRollup* rollup)
+{
+    const char* cursor = data;
+    const char* end = data + size;
+    int found = 0;
+    int next = 0;
+
+    memset(rollup, 0x00, sizeof(struct SmapsRollup));
+
+    /* the first line is the "[rollup]" VMA header */
+    cursor = memchr(cursor, '\n', end - cursor);
+    if (cursor == NULL) {
+        return false;
+    }
+    cursor++;
+
+    while (cursor < end) {
+        const char* colon = memchr(cursor, ':', end - cursor);
+        const char* line_end = NULL;
+        size_t length;
+        int i;
+
+        if (colon == NULL) {
+            break;
+        }
+
+        line_end = memchr(colon, '\n', end - colon);
+        if (line_end == NULL) {
+            line_end = end;
+        }
+
+        length = colon - cursor;
+
+        /* keys come in order, the search starts after the last match */
+        for (i = 0; i < ROLLUP_KEY_COUNT; i++) {
+            const struct rollup_key* key = &rollup_keys[(next + i) % ROLLUP_KEY_COUNT];
+
+            if (strlen(key->key) == length && memcmp(key->key, cursor, length) == 0) {
+                const char* value = colon + 1;
+
+                *(unsigned long long*)((char*)rollup + key->offset) = parse_number(&value, line_end, 10);
+                next = (next + i + 1) % ROLLUP_KEY_COUNT;
+                found++;
+                break;
+            }
+        }
+
+        cursor = line_end + 1;
+    }
+
+    return found > 0;
+}
+
+bool parse_smaps_rollup(const int pid, struct SmapsRollup* rollup)
+{
+    bool result = true;
+
+    struct pp_stats_scope scope;
+    unsigned char* buffer = NULL;
+    size_t size = 0;
+
+    pp_stats_begin(&scope, API_PARSE_SMAPS_ROLLUP);
+
+    result = read_process_file(pid, "smaps_rollup", &buffer, &size);
+    IFERRGOTO(result, done);
+
+    result = parse_smaps_rollup_data((const char*)buffer, size, rollup);
+    if (result == false) {
+        PP_ERROR(EINVAL, "malformed smaps_rollup of %d", pid);
+    }
+
+done:
+
+    pp_stats_end(&scope, result);
+
+    return result;
+}
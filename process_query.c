@@ -0,0 +1,495 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+
+#define QUERY_BATCH_DEPTH  64
+#define QUERY_BATCH_BUFFER 4096
+
+/* files in the order they are read, cheapest first */
+enum query_source
+{
+    SOURCE_STAT,
+    SOURCE_STATUS,
+    SOURCE_CMDLINE,
+    SOURCE_SMAPS_ROLLUP,
+    SOURCE_COUNT
+};
+
+static const char* source_files[SOURCE_COUNT] = { "stat", "status", "cmdline", "smaps_rollup" };
+
+struct query_condition
+{
+    int field; // QueryField, or QUERY_MATCH_ for patterns
+    int op;
+    long long value;
+    char* pattern;
+    int source;
+};
+
+struct process_query
+{
+    struct query_condition* conditions;
+    int condition_count;
+    int condition_capacity;
+
+    unsigned long long status_mask;
+    bool sources[SOURCE_COUNT];
+};
+
+struct query_candidate
+{
+    struct ProcessQueryResult result;
+    struct SmapsRollup rollup;
+    bool passed; // every condition of the current source holds
+};
+
+struct query_run
+{
+    struct process_query* query;
+    struct query_candidate* candidates;
+    int count;
+    long page_size;
+    int source;
+
+    /* cmdline with NUL separators turned to spaces */
+    char* line;
+    size_t line_size;
+};
+
+static int field_source(int field)
+{
+    if (field <= QUERY_STARTTIME) {
+        return SOURCE_STAT;
+    }
+
+    if (field <= QUERY_NONVOLUNTARY_CTXT_SWITCHES) {
+        return SOURCE_STATUS;
+    }
+
+    return SOURCE_SMAPS_ROLLUP;
+}
+
+static unsigned long long field_status_mask(int field)
+{
+    switch (field) {
+    case QUERY_UID:
+        return STATUS_FIELD(STATUS_UID);
+    case QUERY_GID:
+        return STATUS_FIELD(STATUS_GID);
+    case QUERY_RSS_ANON:
+        return STATUS_FIELD(STATUS_RSS_ANON);
+    case QUERY_RSS_FILE:
+        return STATUS_FIELD(STATUS_RSS_FILE);
+    case QUERY_RSS_SHMEM:
+        return STATUS_FIELD(STATUS_RSS_SHMEM);
+    case QUERY_SWAP:
+        return STATUS_FIELD(STATUS_VM_SWAP);
+    case QUERY_VOLUNTARY_CTXT_SWITCHES:
+        return STATUS_FIELD(STATUS_VOLUNTARY_CTXT_SWITCHES);
+    case QUERY_NONVOLUNTARY_CTXT_SWITCHES:
+        return STATUS_FIELD(STATUS_NONVOLUNTARY_CTXT_SWITCHES);
+    }
+
+    return 0;
+}
+
+static struct query_condition* add_condition(struct process_query* query)
+{
+    struct query_condition* condition = NULL;
+
+    if (query->condition_count == query->condition_capacity) {
+        int capacity = query->condition_capacity ? query->condition_capacity * 2 : 8;
+        struct query_condition* grown = realloc(query->conditions, capacity * sizeof(struct query_condition));
+
+        if (grown == NULL) {
+            return NULL;
+        }
+
+        query->conditions = grown;
+        query->condition_capacity = capacity;
+    }
+
+    condition = &query->conditions[query->condition_count++];
+    memset(condition, 0x00, sizeof(struct query_condition));
+
+    return condition;
+}
+
+process_query_t create_process_query()
+{
+    return calloc(1, sizeof(struct process_query));
+}
+
+void destroy_process_query(process_query_t query_h)
+{
+    struct process_query* query = (struct process_query*)query_h;
+    int i;
+
+    if (query == NULL) {
+        return;
+    }
+
+    for (i = 0; i < query->condition_count; i++) {
+        if (query->conditions[i].pattern) {
+            free(query->conditions[i].pattern);
+        }
+    }
+
+    if (query->conditions) {
+        free(query->conditions);
+    }
+
+    free(query);
+}
+
+bool add_query_condition(process_query_t query_h, int field, int op, long long value)
+{
+    struct process_query* query = (struct process_query*)query_h;
+    struct query_condition* condition = NULL;
+
+    if (field < 0 || field >= QUERY_FIELD_COUNT || op < QUERY_LT || op > QUERY_GT) {
+        PP_ERROR(EINVAL, "invalid condition on field %d", field);
+        return false;
+    }
+
+    condition = add_condition(query);
+    if (condition == NULL) {
+        return false;
+    }
+
+    condition->field = field;
+    condition->op = op;
+    condition->value = value;
+    condition->source = field_source(field);
+
+    query->sources[condition->source] = true;
+    query->status_mask |= field_status_mask(field);
+
+    return true;
+}
+
+bool add_query_match(process_query_t query_h, int target, const char* pattern)
+{
+    struct process_query* query = (struct process_query*)query_h;
+    struct query_condition* condition = NULL;
+    char* copy = NULL;
+
+    if (target != QUERY_MATCH_COMM && target != QUERY_MATCH_CMDLINE) {
+        PP_ERROR(EINVAL, "invalid match target %d", target);
+        return false;
+    }
+
+    copy = strdup(pattern);
+    if (copy == NULL) {
+        return false;
+    }
+
+    condition = add_condition(query);
+    if (condition == NULL) {
+        free(copy);
+        return false;
+    }
+
+    condition->field = target;
+    condition->pattern = copy;
+    condition->source = target == QUERY_MATCH_COMM ? SOURCE_STAT : SOURCE_CMDLINE;
+
+    query->sources[condition->source] = true;
+
+    return true;
+}
+
+/* memory fields in bytes */
+static long long field_value(const struct query_run* run, const struct query_candidate* candidate, int field)
+{
+    const struct ProcessStat* stat = &candidate->result.stat;
+    const struct ProcessStatus* status = &candidate->result.status;
+
+    switch (field) {
+    case QUERY_PPID:
+        return stat->ppid;
+    case QUERY_STATE:
+        return stat->state;
+    case QUERY_UTIME:
+        return (long long)stat->utime;
+    case QUERY_STIME:
+        return (long long)stat->stime;
+    case QUERY_CPU_TIME:
+        return (long long)(stat->utime + stat->stime);
+    case QUERY_MINFLT:
+        return (long long)stat->minflt;
+    case QUERY_MAJFLT:
+        return (long long)stat->majflt;
+    case QUERY_PRIORITY:
+        return stat->priority;
+    case QUERY_NICE:
+        return stat->nice;
+    case QUERY_NUM_THREADS:
+        return stat->num_threads;
+    case QUERY_VSIZE:
+        return (long long)stat->vsize;
+    case QUERY_RSS:
+        return stat->rss * run->page_size;
+    case QUERY_STARTTIME:
+        return (long long)stat->starttime;
+    case QUERY_UID:
+        return status->uid[0];
+    case QUERY_GID:
+        return status->gid[0];
+    case QUERY_RSS_ANON:
+        return (long long)status->rss_anon * 1024;
+    case QUERY_RSS_FILE:
+        return (long long)status->rss_file * 1024;
+    case QUERY_RSS_SHMEM:
+        return (long long)status->rss_shmem * 1024;
+    case QUERY_SWAP:
+        return (long long)status->vm_swap * 1024;
+    case QUERY_VOLUNTARY_CTXT_SWITCHES:
+        return (long long)status->voluntary_ctxt_switches;
+    case QUERY_NONVOLUNTARY_CTXT_SWITCHES:
+        return (long long)status->nonvoluntary_ctxt_switches;
+    case QUERY_PSS:
+        return (long long)candidate->rollup.pss * 1024;
+    case QUERY_PSS_ANON:
+        return (long long)candidate->rollup.pss_anon * 1024;
+    case QUERY_SWAP_PSS:
+        return (long long)candidate->rollup.swap_pss * 1024;
+    }
+
+    return 0;
+}
+
+static bool compare_value(long long value, int op, long long operand)
+{
+    switch (op) {
+    case QUERY_LT:
+        return value < operand;
+    case QUERY_LE:
+        return value <= operand;
+    case QUERY_EQ:
+        return value == operand;
+    case QUERY_NE:
+        return value != operand;
+    case QUERY_GE:
+        return value >= operand;
+    case QUERY_GT:
+        return value > operand;
+    }
+
+    return false;
+}
+
+static bool join_cmdline(struct query_run* run, const char* data, size_t size)
+{
+    size_t i;
+
+    if (run->line_size < size + 1) {
+        char* grown = realloc(run->line, size + 1);
+
+        if (grown == NULL) {
+            return false;
+        }
+
+        run->line = grown;
+        run->line_size = size + 1;
+    }
+
+    /* "a\0b\0" becomes "a b" */
+    for (i = 0; i < size; i++) {
+        run->line[i] = data[i] ? data[i] : ' ';
+    }
+
+    while (size > 0 && run->line[size - 1] == ' ') {
+        size--;
+    }
+
+    run->line[size] = '\0';
+
+    return true;
+}
+
+/* conditions of the current source, in the order they were added */
+static bool evaluate_source(struct query_run* run, struct query_candidate* candidate)
+{
+    int i;
+
+    for (i = 0; i < run->query->condition_count; i++) {
+        const struct query_condition* condition = &run->query->conditions[i];
+
+        if (condition->source != run->source) {
+            continue;
+        }
+
+        if (condition->field == QUERY_MATCH_COMM) {
+            if (fnmatch(condition->pattern, candidate->result.stat.comm, 0) != 0) {
+                return false;
+            }
+        }
+        else if (condition->field == QUERY_MATCH_CMDLINE) {
+            if (fnmatch(condition->pattern, run->line, 0) != 0) {
+                return false;
+            }
+        }
+        else if (compare_value(field_value(run, candidate, condition->field), condition->op, condition->value) == false) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int compare_candidate_pid(const void* a, const void* b)
+{
+    pid_t left = ((const struct query_candidate*)a)->result.stat.pid;
+    pid_t right = ((const struct query_candidate*)b)->result.stat.pid;
+
+    return (left > right) - (left < right);
+}
+
+static void read_candidate_file(int pid, const char* name, const char* data, size_t size, int error, void* arg)
+{
+    struct query_run* run = arg;
+    struct query_candidate key;
+    struct query_candidate* candidate = NULL;
+    bool parsed = false;
+
+    (void)name;
+
+    key.result.stat.pid = pid;
+    candidate = bsearch(&key, run->candidates, run->count, sizeof(struct query_candidate), compare_candidate_pid);
+
+    /* the process exited meanwhile, it is dropped */
+    if (candidate == NULL || error) {
+        return;
+    }
+
+    switch (run->source) {
+    case SOURCE_STAT:
+        parsed = parse_process_stat_data(data, &candidate->result.stat);
+        candidate->result.stat.pid = pid;
+        break;
+    case SOURCE_STATUS:
+        /* only the lines of fields that conditions refer to are parsed */
+        parsed = parse_process_status_data(data, size, run->query->status_mask, &candidate->result.status);
+        break;
+    case SOURCE_CMDLINE:
+        parsed = join_cmdline(run, data, size);
+        break;
+    case SOURCE_SMAPS_ROLLUP:
+        parsed = parse_smaps_rollup_data(data, size, &candidate->rollup);
+        break;
+    }
+
+    candidate->passed = parsed && evaluate_source(run, candidate);
+}
+
+static bool run_source(struct query_run* run, procfs_batch_t batch, int source)
+{
+    bool result = true;
+    int count = 0;
+    int i;
+
+    run->source = source;
+
+    for (i = 0; i < run->count; i++) {
+        run->candidates[i].passed = false;
+
+        result = add_procfs_batch_file(batch, run->candidates[i].result.stat.pid, source_files[source]);
+        IFERRGOTO(result, done);
+    }
+
+    result = run_procfs_batch(batch, read_candidate_file, run);
+    IFERRGOTO(result, done);
+
+    /* survivors stay in pid order for the next source */
+    for (i = 0; i < run->count; i++) {
+        if (run->candidates[i].passed) {
+            run->candidates[count++] = run->candidates[i];
+        }
+    }
+
+    run->count = count;
+
+done:
+
+    return result;
+}
+
+bool run_process_query(process_query_t query_h, const pid_t* pids, int pid_count,
+    struct ProcessQueryResult** results, int* result_count)
+{
+    bool result = true;
+
+    struct process_query* query = (struct process_query*)query_h;
+    struct query_run run;
+    procfs_batch_t batch = NULL;
+    pid_t* all_pids = NULL;
+    int source;
+    int i;
+
+    memset(&run, 0x00, sizeof(run));
+    run.query = query;
+    run.page_size = sysconf(_SC_PAGESIZE);
+
+    if (pids == NULL) {
+        result = list_process_ids(&all_pids, &pid_count);
+        IFERRGOTO(result, done);
+        pids = all_pids;
+    }
+
+    run.candidates = calloc(pid_count + 1, sizeof(struct query_candidate));
+    NULLERRGOTO(run.candidates, result, done);
+
+    for (i = 0; i < pid_count; i++) {
+        run.candidates[i].result.stat.pid = pids[i];
+    }
+
+    run.count = pid_count;
+    qsort(run.candidates, run.count, sizeof(struct query_candidate), compare_candidate_pid);
+
+    batch = create_procfs_batch(QUERY_BATCH_DEPTH, QUERY_BATCH_BUFFER, 0);
+    NULLERRGOTO(batch, result, done);
+
+    /* stat is always read, results carry it. each later file is read for survivors only */
+    for (source = SOURCE_STAT; source < SOURCE_COUNT && run.count > 0; source++) {
+        if (source == SOURCE_STAT || query->sources[source]) {
+            result = run_source(&run, batch, source);
+            IFERRGOTO(result, done);
+        }
+    }
+
+    *results = malloc((run.count + 1) * sizeof(struct ProcessQueryResult));
+    NULLERRGOTO(*results, result, done);
+
+    for (i = 0; i < run.count; i++) {
+        (*results)[i] = run.candidates[i].result;
+    }
+
+    *result_count = run.count;
+
+done:
+
+    if (batch) {
+        destroy_procfs_batch(batch);
+    }
+
+    if (run.candidates) {
+        free(run.candidates);
+    }
+
+    if (run.line) {
+        free(run.line);
+    }
+
+    if (all_pids) {
+        free(all_pids);
+    }
+
+    return result;
+}
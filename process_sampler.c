@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+
+/* the longest of statm, io and schedstat is well below this */
+#define SZ_SAMPLE_BUFFER 256
+
+enum sample_file {
+    SAMPLE_FILE_STATM,
+    SAMPLE_FILE_IO,
+    SAMPLE_FILE_SCHEDSTAT,
+    SAMPLE_FILE_COUNT,
+};
+
+static const char* sample_file_names[SAMPLE_FILE_COUNT] = {
+    "statm",
+    "io",
+    "schedstat",
+};
+
+/*
+ * fds stay open between samples, they are bound to the process so a
+ * reused pid never shows up: reads fail with ESRCH once it is gone.
+ */
+struct process_sampler
+{
+    int pid;
+    int fds[SAMPLE_FILE_COUNT];
+};
+
+process_sampler_t open_process_sampler(const int pid, unsigned int files)
+{
+    struct process_sampler* sampler = NULL;
+    int i;
+
+    sampler = malloc(sizeof(struct process_sampler));
+    if (sampler == NULL) {
+        return NULL;
+    }
+
+    sampler->pid = pid;
+
+    for (i = 0; i < SAMPLE_FILE_COUNT; i++) {
+        sampler->fds[i] = -1;
+    }
+
+    for (i = 0; i < SAMPLE_FILE_COUNT; i++) {
+        if ((files & (1U << i)) == 0) {
+            continue;
+        }
+
+        sampler->fds[i] = open_process_file(pid, sample_file_names[i], O_RDONLY);
+        if (sampler->fds[i] < 0) {
+            close_process_sampler(sampler);
+            return NULL;
+        }
+    }
+
+    return sampler;
+}
+
+void close_process_sampler(process_sampler_t sampler_h)
+{
+    struct process_sampler* sampler = (struct process_sampler*)sampler_h;
+    int i;
+
+    if (sampler == NULL) {
+        return;
+    }
+
+    for (i = 0; i < SAMPLE_FILE_COUNT; i++) {
+        if (sampler->fds[i] >= 0) {
+            close(sampler->fds[i]);
+        }
+    }
+
+    free(sampler);
+}
+
+/*
+ * read the file again from offset 0 and pick the first count decimal
+ * numbers, skipping whatever text is in between. none of the key names
+ * of these files contain digits
+ */
+static bool sample_numbers(struct process_sampler* sampler, int file, unsigned long long* values, int count)
+{
+    char buffer[SZ_SAMPLE_BUFFER];
+    const char* cursor = buffer;
+    const char* end = NULL;
+    ssize_t rsz;
+    int found = 0;
+
+    if (sampler->fds[file] < 0) {
+        errno = EBADF;
+        return false;
+    }
+
+    do {
+        rsz = pread(sampler->fds[file], buffer, sizeof(buffer), 0);
+    } while (rsz < 0 && errno == EINTR);
+
+    if (rsz <= 0) {
+        PP_ERROR(rsz < 0 ? errno : ENODATA, "cannot sample %s of %d", sample_file_names[file], sampler->pid);
+        return false;
+    }
+
+    end = buffer + rsz;
+
+    while (found < count) {
+        unsigned long long value = 0;
+
+        while (cursor < end && (*cursor < '0' || *cursor > '9')) {
+            cursor++;
+        }
+
+        if (cursor == end) {
+            break;
+        }
+
+        while (cursor < end && *cursor >= '0' && *cursor <= '9') {
+            value = value * 10 + (*cursor - '0');
+            cursor++;
+        }
+
+        values[found++] = value;
+    }
+
+    return found == count;
+}
+
+bool sample_process_statm(process_sampler_t sampler_h, struct ProcessStatm* statm)
+{
+    unsigned long long values[7];
+
+    if (sample_numbers((struct process_sampler*)sampler_h, SAMPLE_FILE_STATM, values, 7) == false) {
+        return false;
+    }
+
+    statm->size = values[0];
+    statm->resident = values[1];
+    statm->shared = values[2];
+    statm->text = values[3];
+    statm->lib = values[4];
+    statm->data = values[5];
+    statm->dirty = values[6];
+
+    return true;
+}
+
+bool sample_process_io(process_sampler_t sampler_h, struct ProcessIo* io)
+{
+    unsigned long long values[7];
+
+    /* rchar, wchar, syscr, syscw, read_bytes, write_bytes, cancelled_write_bytes */
+    if (sample_numbers((struct process_sampler*)sampler_h, SAMPLE_FILE_IO, values, 7) == false) {
+        return false;
+    }
+
+    io->rchar = values[0];
+    io->wchar = values[1];
+    io->syscr = values[2];
+    io->syscw = values[3];
+    io->read_bytes = values[4];
+    io->write_bytes = values[5];
+    io->cancelled_write_bytes = values[6];
+
+    return true;
+}
+
+bool sample_process_schedstat(process_sampler_t sampler_h, struct ProcessSchedstat* schedstat)
+{
+    unsigned long long values[3];
+
+    if (sample_numbers((struct process_sampler*)sampler_h, SAMPLE_FILE_SCHEDSTAT, values, 3) == false) {
+        return false;
+    }
+
+    schedstat->run_ns = values[0];
+    schedstat->wait_ns = values[1];
+    schedstat->timeslices = values[2];
+
+    return true;
+}
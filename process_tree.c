@@ -0,0 +1,551 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+
+/* stat lines are a few hundred bytes, longer ones are read again */
+#define TREE_BATCH_DEPTH  64
+#define TREE_BATCH_BUFFER 1024
+
+struct node_reader
+{
+    struct ProcessNode* nodes;
+    int count;
+};
+
+struct session_key
+{
+    int session;
+    int index;
+};
+
+static int compare_node_pid(const void* a, const void* b)
+{
+    pid_t left = ((const struct ProcessNode*)a)->pid;
+    pid_t right = ((const struct ProcessNode*)b)->pid;
+
+    return (left > right) - (left < right);
+}
+
+static int compare_session_key(const void* a, const void* b)
+{
+    const struct session_key* left = a;
+    const struct session_key* right = b;
+
+    if (left->session != right->session) {
+        return (left->session > right->session) - (left->session < right->session);
+    }
+
+    return left->index - right->index;
+}
+
+static void read_node(int pid, const char* name, const char* data, size_t size, int error, void* arg)
+{
+    struct node_reader* reader = arg;
+    struct ProcessNode* node = NULL;
+    struct ProcessStat stat;
+
+    /* the process exited in the meantime */
+    if (error || parse_process_stat_data(data, &stat) == false) {
+        return;
+    }
+
+    node = &reader->nodes[reader->count++];
+    memset(node, 0x00, sizeof(struct ProcessNode));
+
+    node->pid = stat.pid;
+    node->ppid = stat.ppid;
+    node->pgrp = stat.pgrp;
+    node->session = stat.session;
+    node->starttime = stat.starttime;
+    node->cpu_time = stat.utime + stat.stime;
+    node->rss = stat.rss;
+    node->kernel_thread = is_kernel_thread_stat(&stat);
+}
+
+/* stat of every pid through one batch, nodes come back sorted by pid */
+static bool read_nodes(const pid_t* pids, int pid_count, struct ProcessNode** nodes, int* node_count)
+{
+    bool result = true;
+
+    procfs_batch_t batch = NULL;
+    struct node_reader reader = { NULL, 0 };
+    int i;
+
+    reader.nodes = malloc((pid_count + 1) * sizeof(struct ProcessNode));
+    NULLERRGOTO(reader.nodes, result, done);
+
+    batch = create_procfs_batch(TREE_BATCH_DEPTH, TREE_BATCH_BUFFER, 0);
+    NULLERRGOTO(batch, result, done);
+
+    for (i = 0; i < pid_count; i++) {
+        result = add_procfs_batch_file(batch, pids[i], "stat");
+        IFERRGOTO(result, done);
+    }
+
+    result = run_procfs_batch(batch, read_node, &reader);
+    IFERRGOTO(result, done);
+
+    qsort(reader.nodes, reader.count, sizeof(struct ProcessNode), compare_node_pid);
+
+    *nodes = reader.nodes;
+    *node_count = reader.count;
+    reader.nodes = NULL;
+
+done:
+
+    if (batch) {
+        destroy_procfs_batch(batch);
+    }
+
+    if (reader.nodes) {
+        free(reader.nodes);
+    }
+
+    return result;
+}
+
+int find_process_node(const struct ProcessTree* tree, pid_t pid)
+{
+    int low = 0;
+    int high = tree->node_count - 1;
+
+    while (low <= high) {
+        int middle = low + (high - low) / 2;
+
+        if (tree->nodes[middle].pid == pid) {
+            return middle;
+        }
+
+        if (tree->nodes[middle].pid < pid) {
+            low = middle + 1;
+        }
+        else {
+            high = middle - 1;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * index arrays of nodes from pid/ppid/session, O(n log n) without any I/O.
+ * nodes and the arrays replace those of tree only if everything succeeded,
+ * nodes are the caller's to free otherwise
+ */
+static bool link_process_tree(struct ProcessTree* tree, struct ProcessNode* nodes, int count)
+{
+    bool result = true;
+
+    struct ProcessTree linked;
+    struct session_key* keys = NULL;
+    int* stack = NULL;
+    int* sizes = NULL;
+    int position = 0;
+    int offset = 0;
+    int i;
+
+    memset(&linked, 0x00, sizeof(linked));
+    linked.nodes = nodes;
+    linked.node_count = count;
+
+    linked.children = malloc((count + 1) * sizeof(int));
+    linked.preorder = malloc((count + 1) * sizeof(int));
+    linked.sessions = malloc((count + 1) * sizeof(int));
+    stack = malloc((count + 1) * sizeof(int));
+    sizes = malloc((count + 1) * sizeof(int));
+    keys = malloc((count + 1) * sizeof(struct session_key));
+
+    if (linked.children == NULL || linked.preorder == NULL || linked.sessions == NULL ||
+        stack == NULL || sizes == NULL || keys == NULL) {
+        SETERRGOTO(result, done);
+    }
+
+    for (i = 0; i < count; i++) {
+        nodes[i].parent = nodes[i].ppid != nodes[i].pid ? find_process_node(&linked, nodes[i].ppid) : -1;
+        nodes[i].child_count = 0;
+        nodes[i].preorder = -1;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (nodes[i].parent >= 0) {
+            nodes[nodes[i].parent].child_count++;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        nodes[i].first_child = offset;
+        offset += nodes[i].child_count;
+        nodes[i].child_count = 0;
+    }
+
+    /* children end up in pid order */
+    for (i = 0; i < count; i++) {
+        if (nodes[i].parent >= 0) {
+            struct ProcessNode* parent = &nodes[nodes[i].parent];
+            linked.children[parent->first_child + parent->child_count++] = i;
+        }
+    }
+
+    /*
+     * depth-first from every root. a ppid cycle, only possible with stale
+     * data, has no root; its first node is cut off and becomes one
+     */
+    for (i = 0; i < 2 * count; i++) {
+        int root = i % count;
+        int depth = 0;
+
+        if (nodes[root].preorder >= 0 || (i < count && nodes[root].parent >= 0)) {
+            continue;
+        }
+
+        nodes[root].parent = -1;
+        stack[depth++] = root;
+
+        while (depth > 0) {
+            int node = stack[--depth];
+            int child;
+
+            nodes[node].preorder = position;
+            linked.preorder[position++] = node;
+
+            /* reversed so that the first child is visited first */
+            for (child = nodes[node].child_count - 1; child >= 0; child--) {
+                int index = linked.children[nodes[node].first_child + child];
+
+                if (nodes[index].preorder < 0 && nodes[index].parent == node) {
+                    stack[depth++] = index;
+                }
+            }
+        }
+    }
+
+    /* a subtree is its root plus the subtrees of its children, bottom-up */
+    for (i = 0; i < count; i++) {
+        sizes[i] = 1;
+    }
+
+    for (i = count - 1; i >= 0; i--) {
+        int node = linked.preorder[i];
+
+        nodes[node].subtree_end = nodes[node].preorder + sizes[node];
+        if (nodes[node].parent >= 0) {
+            sizes[nodes[node].parent] += sizes[node];
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        keys[i].session = nodes[i].session;
+        keys[i].index = i;
+    }
+
+    qsort(keys, count, sizeof(struct session_key), compare_session_key);
+
+    for (i = 0; i < count; i++) {
+        linked.sessions[i] = keys[i].index;
+    }
+
+    if (tree->nodes && tree->nodes != nodes) {
+        free(tree->nodes);
+    }
+
+    if (tree->children) {
+        free(tree->children);
+    }
+
+    if (tree->preorder) {
+        free(tree->preorder);
+    }
+
+    if (tree->sessions) {
+        free(tree->sessions);
+    }
+
+    *tree = linked;
+    memset(&linked, 0x00, sizeof(linked));
+
+done:
+
+    if (linked.children) {
+        free(linked.children);
+    }
+
+    if (linked.preorder) {
+        free(linked.preorder);
+    }
+
+    if (linked.sessions) {
+        free(linked.sessions);
+    }
+
+    if (stack) {
+        free(stack);
+    }
+
+    if (sizes) {
+        free(sizes);
+    }
+
+    if (keys) {
+        free(keys);
+    }
+
+    return result;
+}
+
+bool build_process_tree(struct ProcessTree** process_tree)
+{
+    bool result = true;
+
+    struct ProcessTree* tree = NULL;
+    struct ProcessNode* nodes = NULL;
+    int node_count = 0;
+    pid_t* pids = NULL;
+    int pid_count = 0;
+
+    tree = calloc(1, sizeof(struct ProcessTree));
+    NULLERRGOTO(tree, result, done);
+
+    result = list_process_ids(&pids, &pid_count);
+    IFERRGOTO(result, done);
+
+    result = read_nodes(pids, pid_count, &nodes, &node_count);
+    IFERRGOTO(result, done);
+
+    result = link_process_tree(tree, nodes, node_count);
+    IFERRGOTO(result, done);
+
+    nodes = NULL;
+
+    *process_tree = tree;
+    tree = NULL;
+
+done:
+
+    if (pids) {
+        free(pids);
+    }
+
+    if (nodes) {
+        free(nodes);
+    }
+
+    if (tree) {
+        free_process_tree(tree);
+    }
+
+    return result;
+}
+
+bool update_process_tree(struct ProcessTree* tree, const pid_t* added, int added_count,
+    const pid_t* exited, int exited_count)
+{
+    bool result = true;
+
+    struct ProcessNode* merged = NULL;
+    struct ProcessNode* fresh = NULL;
+    bool* removed = NULL;
+    pid_t* pids = NULL;
+    int fresh_count = 0;
+    int pid_count = 0;
+    int count = 0;
+    int i, j;
+
+    removed = calloc(tree->node_count + 1, sizeof(bool));
+    pids = malloc((added_count + tree->node_count + 1) * sizeof(pid_t));
+    if (removed == NULL || pids == NULL) {
+        SETERRGOTO(result, done);
+    }
+
+    for (i = 0; i < added_count; i++) {
+        pids[pid_count++] = added[i];
+    }
+
+    /* orphans are reparented, their ppid has to be read again */
+    for (i = 0; i < exited_count; i++) {
+        int index = find_process_node(tree, exited[i]);
+        struct ProcessNode* node = NULL;
+
+        if (index < 0) {
+            continue;
+        }
+
+        removed[index] = true;
+        node = &tree->nodes[index];
+
+        for (j = 0; j < node->child_count; j++) {
+            pids[pid_count++] = tree->nodes[tree->children[node->first_child + j]].pid;
+        }
+    }
+
+    result = read_nodes(pids, pid_count, &fresh, &fresh_count);
+    IFERRGOTO(result, done);
+
+    merged = malloc((tree->node_count + fresh_count + 1) * sizeof(struct ProcessNode));
+    NULLERRGOTO(merged, result, done);
+
+    /* both sides are sorted by pid, a fresh node replaces an old one */
+    i = 0;
+    j = 0;
+    while (i < tree->node_count || j < fresh_count) {
+        if (i < tree->node_count && removed[i]) {
+            i++;
+        }
+        else if (j >= fresh_count || (i < tree->node_count && tree->nodes[i].pid < fresh[j].pid)) {
+            merged[count++] = tree->nodes[i++];
+        }
+        else {
+            if (i < tree->node_count && tree->nodes[i].pid == fresh[j].pid) {
+                i++;
+            }
+
+            /* the same pid may be queued twice */
+            if (count == 0 || merged[count - 1].pid != fresh[j].pid) {
+                merged[count++] = fresh[j];
+            }
+            j++;
+        }
+    }
+
+    result = link_process_tree(tree, merged, count);
+    IFERRGOTO(result, done);
+
+    merged = NULL;
+
+done:
+
+    if (merged) {
+        free(merged);
+    }
+
+    if (fresh) {
+        free(fresh);
+    }
+
+    if (removed) {
+        free(removed);
+    }
+
+    if (pids) {
+        free(pids);
+    }
+
+    return result;
+}
+
+bool refresh_process_tree_usage(struct ProcessTree* tree)
+{
+    bool result = true;
+
+    struct ProcessNode* fresh = NULL;
+    pid_t* pids = NULL;
+    int fresh_count = 0;
+    int i;
+
+    pids = malloc((tree->node_count + 1) * sizeof(pid_t));
+    NULLERRGOTO(pids, result, done);
+
+    for (i = 0; i < tree->node_count; i++) {
+        pids[i] = tree->nodes[i].pid;
+    }
+
+    result = read_nodes(pids, tree->node_count, &fresh, &fresh_count);
+    IFERRGOTO(result, done);
+
+    result = link_process_tree(tree, fresh, fresh_count);
+    IFERRGOTO(result, done);
+
+    fresh = NULL;
+
+done:
+
+    if (fresh) {
+        free(fresh);
+    }
+
+    if (pids) {
+        free(pids);
+    }
+
+    return result;
+}
+
+static void add_usage(struct ProcessUsage* usage, const struct ProcessNode* node)
+{
+    usage->process_count++;
+    usage->cpu_time += node->cpu_time;
+    usage->rss += node->rss;
+}
+
+bool aggregate_process_subtree(const struct ProcessTree* tree, pid_t pid, struct ProcessUsage* usage)
+{
+    int index = find_process_node(tree, pid);
+    int i;
+
+    if (index < 0) {
+        return false;
+    }
+
+    memset(usage, 0x00, sizeof(struct ProcessUsage));
+
+    for (i = tree->nodes[index].preorder; i < tree->nodes[index].subtree_end; i++) {
+        add_usage(usage, &tree->nodes[tree->preorder[i]]);
+    }
+
+    return true;
+}
+
+bool aggregate_process_session(const struct ProcessTree* tree, int session, struct ProcessUsage* usage)
+{
+    int low = 0;
+    int high = tree->node_count;
+    int i;
+
+    /* first node of the session */
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+
+        if (tree->nodes[tree->sessions[middle]].session < session) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    memset(usage, 0x00, sizeof(struct ProcessUsage));
+
+    for (i = low; i < tree->node_count && tree->nodes[tree->sessions[i]].session == session; i++) {
+        add_usage(usage, &tree->nodes[tree->sessions[i]]);
+    }
+
+    return usage->process_count > 0;
+}
+
+void free_process_tree(struct ProcessTree* tree)
+{
+    if (tree == NULL) {
+        return;
+    }
+
+    if (tree->nodes) {
+        free(tree->nodes);
+    }
+
+    if (tree->children) {
+        free(tree->children);
+    }
+
+    if (tree->preorder) {
+        free(tree->preorder);
+    }
+
+    if (tree->sessions) {
+        free(tree->sessions);
+    }
+
+    free(tree);
+}
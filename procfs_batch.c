@@ -0,0 +1,688 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+#include "pp_stats.h"
+
+#define BATCH_NAME_MAX 32
+
+/* openat, read, probe and close per file */
+#define SQES_PER_FILE 4
+
+enum batch_op {
+    BATCH_OPEN,
+    BATCH_READ,
+    BATCH_PROBE,
+    BATCH_CLOSE,
+};
+
+#define BATCH_USER_DATA(slot, op) (((unsigned long long)(slot) << 2) | (op))
+#define BATCH_SLOT(user_data) ((unsigned int)((user_data) >> 2))
+#define BATCH_OP(user_data) ((int)((user_data) & 0x3))
+
+struct batch_request
+{
+    int pid;
+    char name[BATCH_NAME_MAX];
+};
+
+/* one file in flight, reads land in the slot's pooled buffer */
+struct batch_slot
+{
+    struct batch_request* request;
+    char path[PATH_MAX];
+    unsigned char* buffer;
+    unsigned char probe;
+    int open_result;
+    int read_result;
+    int probe_result;
+    int pending; // CQEs still expected
+};
+
+struct batch_ring
+{
+    int fd;
+
+    void* sq_map;
+    size_t sq_map_size;
+    void* cq_map;
+    size_t cq_map_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+};
+
+struct procfs_batch
+{
+    unsigned int depth;
+    size_t buffer_size;
+    unsigned char* pool; // depth * (buffer_size + 1) bytes
+
+    struct batch_request* requests;
+    int request_count;
+    int request_capacity;
+
+    struct batch_slot* slots;
+
+    bool use_uring;
+    struct batch_ring ring;
+
+    /* files longer than one read are read again into this one */
+    unsigned char* large_buffer;
+    size_t large_size;
+};
+
+static int uring_setup(unsigned int entries, struct io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned int opcode, void* arg, unsigned int nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void close_ring(struct batch_ring* ring)
+{
+    if (ring->sqes && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+
+    if (ring->cq_map && ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map) {
+        munmap(ring->cq_map, ring->cq_map_size);
+    }
+
+    if (ring->sq_map && ring->sq_map != MAP_FAILED) {
+        munmap(ring->sq_map, ring->sq_map_size);
+    }
+
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+
+    memset(ring, 0x00, sizeof(struct batch_ring));
+    ring->fd = -1;
+}
+
+static struct io_uring_sqe* next_sqe(struct batch_ring* ring, unsigned int* tail)
+{
+    unsigned int index = *tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+
+    ring->sq_array[index] = index;
+    (*tail)++;
+
+    memset(sqe, 0x00, sizeof(struct io_uring_sqe));
+
+    return sqe;
+}
+
+/*
+ * IORING_REGISTER_FILES2 is in 5.13, openat and close of direct descriptors
+ * only in 5.15. one open of "/" into slot 0 and its close tell them apart,
+ * 5.13 and 5.14 ignore file_index and return a plain descriptor instead
+ */
+static bool probe_direct_open(struct batch_ring* ring)
+{
+    struct io_uring_sqe* sqe = NULL;
+    unsigned int tail = *ring->sq_tail;
+    unsigned int head;
+    int results[2] = { -1, -1 };
+    int completed = 0;
+
+    sqe = next_sqe(ring, &tail);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long long)"/";
+    sqe->open_flags = O_RDONLY | O_DIRECTORY;
+    sqe->file_index = 1;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = 0;
+
+    sqe = next_sqe(ring, &tail);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = 1;
+    sqe->user_data = 1;
+
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    while (completed < 2) {
+        if (uring_enter(ring->fd, completed == 0 ? 2 : 0, 2 - completed, IORING_ENTER_GETEVENTS) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        head = *ring->cq_head;
+
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+
+            results[cqe->user_data & 1] = cqe->res;
+            completed++;
+            head++;
+        }
+
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    if (results[0] > 0) {
+        close(results[0]);
+    }
+
+    return results[0] == 0 && results[1] == 0;
+}
+
+/*
+ * a ring with a sparse table of depth direct descriptors, so that
+ * openat/read/close of a file can be linked without a round trip to
+ * user space. needs 5.15 or later, the caller falls back otherwise.
+ */
+static bool open_ring(struct batch_ring* ring, unsigned int depth)
+{
+    bool result = true;
+
+    struct io_uring_params params;
+    struct io_uring_rsrc_register files;
+
+    memset(&params, 0x00, sizeof(params));
+    memset(&files, 0x00, sizeof(files));
+
+    ring->fd = uring_setup(depth * SQES_PER_FILE, &params);
+    if (ring->fd < 0) {
+        SETERRGOTO(result, done);
+    }
+
+    ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_map_size > ring->sq_map_size) {
+            ring->sq_map_size = ring->cq_map_size;
+        }
+    }
+
+    ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_map == MAP_FAILED) {
+        SETERRGOTO(result, done);
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_map = ring->sq_map;
+    }
+    else {
+        ring->cq_map = mmap(NULL, ring->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            SETERRGOTO(result, done);
+        }
+    }
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        SETERRGOTO(result, done);
+    }
+
+    ring->sq_head = (unsigned int*)((char*)ring->sq_map + params.sq_off.head);
+    ring->sq_tail = (unsigned int*)((char*)ring->sq_map + params.sq_off.tail);
+    ring->sq_mask = (unsigned int*)((char*)ring->sq_map + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*)((char*)ring->sq_map + params.sq_off.array);
+    ring->cq_head = (unsigned int*)((char*)ring->cq_map + params.cq_off.head);
+    ring->cq_tail = (unsigned int*)((char*)ring->cq_map + params.cq_off.tail);
+    ring->cq_mask = (unsigned int*)((char*)ring->cq_map + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_map + params.cq_off.cqes);
+
+    files.nr = depth;
+    files.flags = IORING_RSRC_REGISTER_SPARSE;
+    if (uring_register(ring->fd, IORING_REGISTER_FILES2, &files, sizeof(files)) < 0) {
+        SETERRGOTO(result, done);
+    }
+
+    result = probe_direct_open(ring);
+    IFERRGOTO(result, done);
+
+done:
+
+    if (result == false) {
+        close_ring(ring);
+    }
+
+    return result;
+}
+
+static bool alloc_slots(struct procfs_batch* batch)
+{
+    unsigned int i;
+
+    batch->pool = malloc(batch->depth * (batch->buffer_size + 1));
+    batch->slots = calloc(batch->depth, sizeof(struct batch_slot));
+    if (batch->pool == NULL || batch->slots == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < batch->depth; i++) {
+        batch->slots[i].buffer = batch->pool + i * (batch->buffer_size + 1);
+    }
+
+    return true;
+}
+
+procfs_batch_t create_procfs_batch(unsigned int depth, size_t buffer_size, unsigned int flags)
+{
+    struct procfs_batch* batch = NULL;
+
+    if (depth == 0 || buffer_size == 0) {
+        return NULL;
+    }
+
+    batch = calloc(1, sizeof(struct procfs_batch));
+    if (batch == NULL) {
+        return NULL;
+    }
+
+    batch->depth = depth;
+    batch->buffer_size = buffer_size;
+    batch->ring.fd = -1;
+
+    if (alloc_slots(batch) == false) {
+        destroy_procfs_batch(batch);
+        return NULL;
+    }
+
+    if ((flags & PROCFS_BATCH_NO_URING) == 0) {
+        batch->use_uring = open_ring(&batch->ring, depth);
+    }
+
+    return batch;
+}
+
+void destroy_procfs_batch(procfs_batch_t batch_h)
+{
+    struct procfs_batch* batch = (struct procfs_batch*)batch_h;
+
+    if (batch == NULL) {
+        return;
+    }
+
+    close_ring(&batch->ring);
+
+    if (batch->requests) {
+        free(batch->requests);
+    }
+
+    if (batch->slots) {
+        free(batch->slots);
+    }
+
+    if (batch->pool) {
+        free(batch->pool);
+    }
+
+    if (batch->large_buffer) {
+        free(batch->large_buffer);
+    }
+
+    free(batch);
+}
+
+bool is_procfs_batch_uring(procfs_batch_t batch_h)
+{
+    return ((struct procfs_batch*)batch_h)->use_uring;
+}
+
+bool add_procfs_batch_file(procfs_batch_t batch_h, const int pid, const char* name)
+{
+    struct procfs_batch* batch = (struct procfs_batch*)batch_h;
+    struct batch_request* request = NULL;
+
+    if (strlen(name) >= BATCH_NAME_MAX) {
+        return false;
+    }
+
+    if (batch->request_count == batch->request_capacity) {
+        int capacity = batch->request_capacity ? batch->request_capacity * 2 : 64;
+        struct batch_request* grown = realloc(batch->requests, capacity * sizeof(struct batch_request));
+
+        if (grown == NULL) {
+            return false;
+        }
+
+        batch->requests = grown;
+        batch->request_capacity = capacity;
+    }
+
+    request = &batch->requests[batch->request_count++];
+    request->pid = pid;
+    strcpy(request->name, name);
+
+    return true;
+}
+
+/* whole file through plain syscalls into the large buffer, -errno on failure */
+static ssize_t read_whole_file(struct procfs_batch* batch, struct batch_request* request)
+{
+    ssize_t total = 0;
+    ssize_t rsz;
+    int fd;
+
+    fd = open_process_file(request->pid, request->name, O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    for (;;) {
+        if (batch->large_size < (size_t)total + batch->buffer_size + 1) {
+            size_t size = batch->large_size ? batch->large_size * 2 : batch->buffer_size * 4;
+            unsigned char* grown = NULL;
+
+            while (size < (size_t)total + batch->buffer_size + 1) {
+                size *= 2;
+            }
+
+            grown = realloc(batch->large_buffer, size);
+            if (grown == NULL) {
+                total = -ENOMEM;
+                break;
+            }
+
+            batch->large_buffer = grown;
+            batch->large_size = size;
+        }
+
+        rsz = read(fd, batch->large_buffer + total, batch->large_size - total - 1);
+        pp_stats_io(rsz > 0 ? rsz : 0, 1);
+
+        if (rsz < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            total = -errno;
+            break;
+        }
+
+        if (rsz == 0) {
+            batch->large_buffer[total] = '\0';
+            break;
+        }
+
+        total += rsz;
+    }
+
+    close(fd);
+
+    return total;
+}
+
+static void complete_file(struct procfs_batch* batch, struct batch_request* request,
+    unsigned char* buffer, ssize_t size, bool truncated, procfs_batch_callback callback, void* arg)
+{
+    if (truncated) {
+        size = read_whole_file(batch, request);
+        buffer = batch->large_buffer;
+    }
+
+    if (size < 0) {
+        callback(request->pid, request->name, NULL, 0, (int)-size, arg);
+        return;
+    }
+
+    buffer[size] = '\0';
+    callback(request->pid, request->name, (const char*)buffer, (size_t)size, 0, arg);
+}
+
+static bool run_batch_syscalls(struct procfs_batch* batch, procfs_batch_callback callback, void* arg)
+{
+    unsigned char* buffer = batch->slots[0].buffer;
+    int i;
+
+    for (i = 0; i < batch->request_count; i++) {
+        struct batch_request* request = &batch->requests[i];
+        ssize_t size = 0;
+        ssize_t rsz;
+        int fd;
+
+        fd = open_process_file(request->pid, request->name, O_RDONLY);
+        if (fd < 0) {
+            callback(request->pid, request->name, NULL, 0, errno, arg);
+            continue;
+        }
+
+        while ((size_t)size < batch->buffer_size) {
+            rsz = read(fd, buffer + size, batch->buffer_size - size);
+            pp_stats_io(rsz > 0 ? rsz : 0, 1);
+
+            if (rsz < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (rsz <= 0) {
+                if (rsz < 0) {
+                    size = -errno;
+                }
+                break;
+            }
+
+            size += rsz;
+        }
+
+        close(fd);
+
+        /* a full buffer may be a truncated file */
+        complete_file(batch, request, buffer, size, size == (ssize_t)batch->buffer_size, callback, arg);
+    }
+
+    return true;
+}
+
+/* queue the linked openat/read/close chain of a slot */
+static void queue_slot(struct procfs_batch* batch, unsigned int slot_index, unsigned int* tail)
+{
+    struct batch_slot* slot = &batch->slots[slot_index];
+    struct io_uring_sqe* sqe = NULL;
+
+    sqe = next_sqe(&batch->ring, tail);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (unsigned long long)slot->path;
+    sqe->open_flags = O_RDONLY;
+    sqe->file_index = slot_index + 1;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = BATCH_USER_DATA(slot_index, BATCH_OPEN);
+
+    /* procfs reads are short, hard links keep the rest of the chain from being cancelled */
+    sqe = next_sqe(&batch->ring, tail);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot_index;
+    sqe->addr = (unsigned long long)slot->buffer;
+    sqe->len = batch->buffer_size;
+    sqe->off = -1;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+    sqe->user_data = BATCH_USER_DATA(slot_index, BATCH_READ);
+
+    /*
+     * seq_file reads stop at the last record that fits, so a short read is
+     * no EOF. one more byte from the file position tells if anything is left
+     */
+    sqe = next_sqe(&batch->ring, tail);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = slot_index;
+    sqe->addr = (unsigned long long)&slot->probe;
+    sqe->len = 1;
+    sqe->off = -1;
+    sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+    sqe->user_data = BATCH_USER_DATA(slot_index, BATCH_PROBE);
+
+    sqe = next_sqe(&batch->ring, tail);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = slot_index + 1;
+    sqe->user_data = BATCH_USER_DATA(slot_index, BATCH_CLOSE);
+
+    slot->open_result = 0;
+    slot->read_result = 0;
+    slot->probe_result = 0;
+    slot->pending = SQES_PER_FILE;
+}
+
+static bool run_batch_uring(struct procfs_batch* batch, procfs_batch_callback callback, void* arg)
+{
+    bool result = true;
+
+    struct batch_ring* ring = &batch->ring;
+    unsigned int* free_slots = NULL;
+    unsigned int free_count = 0;
+    unsigned int in_flight = 0;
+    unsigned int tail;
+    unsigned int head;
+    int next_request = 0;
+    unsigned int i;
+
+    free_slots = malloc(batch->depth * sizeof(unsigned int));
+    NULLERRGOTO(free_slots, result, done);
+
+    for (i = 0; i < batch->depth; i++) {
+        free_slots[free_count++] = batch->depth - 1 - i;
+    }
+
+    while (next_request < batch->request_count || in_flight > 0) {
+        unsigned int queued = 0;
+
+        tail = *ring->sq_tail;
+
+        while (free_count > 0 && next_request < batch->request_count) {
+            struct batch_request* request = &batch->requests[next_request++];
+            unsigned int slot_index = free_slots[--free_count];
+            struct batch_slot* slot = &batch->slots[slot_index];
+
+            slot->request = request;
+
+            if (make_process_path(slot->path, sizeof(slot->path), request->pid, request->name) == false) {
+                free_slots[free_count++] = slot_index;
+                callback(request->pid, request->name, NULL, 0, ENAMETOOLONG, arg);
+                continue;
+            }
+
+            queue_slot(batch, slot_index, &tail);
+            queued++;
+            in_flight++;
+        }
+
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+        if (in_flight == 0) {
+            continue;
+        }
+
+        if (uring_enter(ring->fd, queued * SQES_PER_FILE, 1, IORING_ENTER_GETEVENTS) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            PP_ERROR(errno, "io_uring_enter failed");
+            /* reads in flight may still land in the pool and slots, they are leaked */
+            batch->pool = NULL;
+            batch->slots = NULL;
+            close_ring(ring);
+            batch->use_uring = false;
+            alloc_slots(batch);
+            SETERRGOTO(result, done);
+        }
+        pp_stats_io(0, 1);
+
+        head = *ring->cq_head;
+
+        while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            unsigned int slot_index = BATCH_SLOT(cqe->user_data);
+            struct batch_slot* slot = &batch->slots[slot_index];
+
+            if (BATCH_OP(cqe->user_data) == BATCH_OPEN) {
+                slot->open_result = cqe->res;
+            }
+            else if (BATCH_OP(cqe->user_data) == BATCH_READ) {
+                slot->read_result = cqe->res;
+            }
+            else if (BATCH_OP(cqe->user_data) == BATCH_PROBE) {
+                slot->probe_result = cqe->res;
+            }
+
+            head++;
+
+            if (--slot->pending > 0) {
+                continue;
+            }
+
+            if (slot->read_result > 0) {
+                pp_stats_io(slot->read_result, 0);
+            }
+
+            /* the read of a failed open is cancelled, report the open error */
+            complete_file(batch, slot->request, slot->buffer,
+                slot->open_result < 0 ? slot->open_result : slot->read_result,
+                slot->open_result >= 0 && slot->probe_result > 0, callback, arg);
+
+            free_slots[free_count++] = slot_index;
+            in_flight--;
+        }
+
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+done:
+
+    if (free_slots) {
+        free(free_slots);
+    }
+
+    return result;
+}
+
+bool run_procfs_batch(procfs_batch_t batch_h, procfs_batch_callback callback, void* arg)
+{
+    bool result = false;
+
+    struct procfs_batch* batch = (struct procfs_batch*)batch_h;
+    struct pp_stats_scope scope;
+
+    pp_stats_begin(&scope, API_RUN_PROCFS_BATCH);
+
+    /* slots leaked after a ring failure could not be allocated again */
+    if (batch->slots == NULL || batch->pool == NULL) {
+        PP_ERROR(ENOMEM, "procfs batch has no buffers");
+    }
+    else if (batch->use_uring) {
+        result = run_batch_uring(batch, callback, arg);
+    }
+    else {
+        result = run_batch_syscalls(batch, callback, arg);
+    }
+
+    batch->request_count = 0;
+
+    pp_stats_end(&scope, result);
+
+    return result;
+}
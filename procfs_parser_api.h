@@ -2,24 +2,181 @@
 #define __PROCFS_PARSER_API__
 
 #include <stdbool.h>
+#include <stdio.h>
+#include <signal.h>
 #include <linux/limits.h>
 #include <sys/types.h>
 
+/*
+ * Context: settings, last error and scratch buffer of a caller.
+ * a thread uses the context set by set_thread_procfs_context, or the
+ * default one. all functions are reentrant; a context must be used by one
+ * thread at a time, and the default settings should be changed before
+ * concurrent calls start.
+ */
+typedef void* procfs_context_t;
+
+struct ProcfsError
+{
+    int code; // errno value
+    const char* function;
+    char message[256];
+};
+
+procfs_context_t create_procfs_context();
+void destroy_procfs_context(procfs_context_t context);
+
+/* NULL switches the calling thread back to the default context */
+void set_thread_procfs_context(procfs_context_t context);
+procfs_context_t get_thread_procfs_context();
+
+/* context NULL means the context of the calling thread */
+bool set_context_procfs_root(procfs_context_t context, const char* root);
+const char* get_context_procfs_root(procfs_context_t context);
+
+bool get_procfs_last_error(procfs_context_t context, struct ProcfsError* error);
+void clear_procfs_last_error(procfs_context_t context);
+
+/* procfs mount point of the default context, "/proc" by default. NULL restores the default */
+bool set_procfs_root(const char* root);
+const char* get_procfs_root();
+
+/* pids of "[procfs root]", ascending */
+bool list_process_ids(pid_t** pids, int* pid_count);
+
 bool is_process_alive(const int pid, bool* is_alive);
+
+/* PF_KTHREAD of the stat flags word, also right inside pid namespaces */
 bool is_kernel_process(const int pid, bool* is_kp);
 bool is_user_process(const int pid, bool* is_up);
 
+/*
+ * drop kernel threads and exited processes from pids with one batched stat
+ * read, before any other parsing. input order is kept, user_pids may be pids
+ */
+bool filter_kernel_threads(const pid_t* pids, int pid_count, pid_t* user_pids, int* user_count);
+
 bool read_command_line(const int pid, char* cmdline, unsigned int bsz);
 bool read_imagepath(const int pid, char* imagepath, unsigned int bsz);
 
+/*
+ * Complete argv or environ of a process. strings stay in buffer, views
+ * point into it; everything is reused and grown across calls, zero-init
+ * before the first one.
+ */
+struct ProcessArgs
+{
+    char* buffer;
+    size_t buffer_size;
+    size_t length; // bytes read
+    const char** views; // NULL-terminated like argv
+    int count;
+    int view_capacity;
+    const char** index; // environ entries ordered by key
+    int index_count;
+    int index_capacity;
+};
+
+/* "/proc/[pid]/cmdline", kernel threads have no arguments */
+bool read_process_argv(const int pid, struct ProcessArgs* args);
+
+/* "/proc/[pid]/environ", indexed for find_process_environ */
+bool read_process_environ(const int pid, struct ProcessArgs* args);
+
+/* value of key in an environ read by read_process_environ, NULL if not set */
+const char* find_process_environ(const struct ProcessArgs* args, const char* key);
+
+void free_process_args(struct ProcessArgs* args);
+
+/*
+ * ptrace ownership is coordinated per pid: while one thread has a process
+ * stopped, other threads attaching to it share the stop, and the tracer
+ * detaches once the last of them has detached.
+ */
 bool attach_process_by_pid(const int pid);
 void detach_process_by_pid(const int pid);
 
-int read_process_memory(const int pid, unsigned long long start_address, unsigned char* memory, int size);
-int read_process_memory_by_address(const int pid, unsigned long long start_address, unsigned long long end_address, unsigned char* memory);
-unsigned char* dump_process_memory(const int pid, unsigned long long start_address, int size);
+/* bytes read, fewer than size if the range ends early, -1 on failure */
+ssize_t read_process_memory(const int pid, unsigned long long start_address, unsigned char* memory, size_t size);
+ssize_t read_process_memory_by_address(const int pid, unsigned long long start_address, unsigned long long end_address, unsigned char* memory);
+unsigned char* dump_process_memory(const int pid, unsigned long long start_address, size_t size);
 unsigned char* dump_process_memory_by_address(const int pid, unsigned long long start_address, unsigned long long end_address);
 
+/* bytes read at once by stream_process_memory unless told otherwise */
+#define STREAM_CHUNK_SIZE (1024 * 1024)
+
+/* data is valid during the call, return false to stop the stream */
+typedef bool (*memory_chunk_callback)(unsigned long long address, const unsigned char* data, size_t size, void* arg);
+
+/*
+ * read [start_address, end_address) of any size through one buffer of
+ * chunk_size bytes, 0 for STREAM_CHUNK_SIZE. bytes_read counts the bytes
+ * passed to callback, also on failure, so a stream can be resumed there
+ */
+bool stream_process_memory(const int pid, unsigned long long start_address, unsigned long long end_address,
+    size_t chunk_size, memory_chunk_callback callback, void* arg, unsigned long long* bytes_read);
+
+/*
+ * Concurrent memory reader: jobs of (pid, ranges) run on worker threads
+ * that steal queued work from each other. the jobs of a pid share one
+ * session, so a target is stopped once for all of its jobs queued by
+ * then, and never by two workers at a time.
+ */
+typedef void* memory_reader_t;
+
+#define MEMORY_READER_NO_STOP 0x1 // read without ptrace stops, a range may be torn by the running target
+
+struct MemoryRange
+{
+    unsigned long long start_address;
+    size_t size;
+    unsigned char* memory; // size bytes to read into, NULL to read through the buffer of a worker
+};
+
+/* a chunk of a range, data is valid during the call */
+struct MemoryReadChunk
+{
+    unsigned long long job;
+    int pid;
+    int range; // index in the ranges of the job
+    unsigned long long address;
+    const unsigned char* data; // NULL on error, the rest of the range is skipped
+    size_t size;
+    int error; // errno value
+};
+
+/* called on a worker thread, return false to skip the rest of the job */
+typedef bool (*memory_read_callback)(const struct MemoryReadChunk* chunk, void* arg);
+
+struct MemoryReadCompletion
+{
+    unsigned long long job;
+    int pid;
+    int error; // of the first range that failed, 0 if every range was read in full
+    unsigned long long bytes_read;
+};
+
+/* worker_count 0 for one per online cpu, buffer_size 0 for STREAM_CHUNK_SIZE */
+memory_reader_t create_memory_reader(unsigned int worker_count, size_t buffer_size, unsigned int flags);
+
+/* runs the jobs submitted so far first */
+void destroy_memory_reader(memory_reader_t reader);
+
+/*
+ * ranges are copied. with a callback, ranges without memory are passed to
+ * it in chunks of up to buffer_size bytes and ranges with memory at once.
+ * without one every range needs memory, and the job is reported through
+ * next_memory_completion instead
+ */
+bool submit_memory_read(memory_reader_t reader, const int pid, const struct MemoryRange* ranges, int range_count,
+    memory_read_callback callback, void* arg, unsigned long long* job);
+
+/* a finished job without callback, waits up to timeout_ms, -1 for ever. false with ETIMEDOUT */
+bool next_memory_completion(memory_reader_t reader, int timeout_ms, struct MemoryReadCompletion* completion);
+
+/* until every job submitted so far has finished */
+void wait_memory_reader(memory_reader_t reader);
+
 bool dump_process_image(const int pid, unsigned char** image, int* img_size);
 bool dump_process_stack(const int pid, unsigned char** stack, int* stack_size);
 
@@ -43,6 +200,90 @@ struct VirtualMemoryArea
 
 /* parse "/proc/[pid]/maps" */
 bool parse_maps_file(const int pid, struct VirtualMemoryArea** VMAs, int* vma_count);
+bool parse_maps_data(const char* data, size_t size, struct VirtualMemoryArea** VMAs, int* vma_count);
+
+/*
+ * Allocation-free walk of "/proc/[pid]/maps", one entry at a time. the
+ * iterator lives on the caller's stack and the entry it hands out is
+ * overwritten by the next call, copy it to keep it.
+ */
+struct MapsIterator
+{
+    int                      fd;
+    bool                     eof;
+    bool                     failed;
+    size_t                   start;
+    size_t                   end;
+    char                     buffer[2 * PATH_MAX];
+    struct VirtualMemoryArea vma;
+};
+
+bool open_maps_iterator(const int pid, struct MapsIterator* iterator);
+/* false at the end of the maps, or on error if iterator->failed is set */
+bool next_maps_entry(struct MapsIterator* iterator, const struct VirtualMemoryArea** vma);
+void close_maps_iterator(struct MapsIterator* iterator);
+
+/* return false to stop the walk, the maps are not read any further */
+typedef bool (*maps_visitor)(const struct VirtualMemoryArea* vma, void* arg);
+
+bool visit_maps_file(const int pid, maps_visitor visitor, void* arg);
+
+/* VMA selection, a zeroed filter matches every VMA */
+#define VMA_ANY_BACKING 0
+#define VMA_ANONYMOUS   1 // no inode, e.g. "[heap]" and private anonymous mappings
+#define VMA_FILE_BACKED 2
+
+struct VmaFilter
+{
+    unsigned char permissions; // VMA_ bits that must be set among those of permissions_mask
+    unsigned char permissions_mask; // VMA_ bits compared, rw-p is VMA_READ | VMA_WRITE under all four
+    int backing;
+    const char* pathname; // fnmatch pattern, NULL for any
+    unsigned long long inode; // 0 for any
+    unsigned long long min_size;
+    unsigned long long max_size; // 0 for no limit
+    unsigned long long start_address; // VMAs overlapping [start_address, end_address),
+    unsigned long long end_address; // 0 for any
+};
+
+bool match_vma_filter(const struct VmaFilter* filter, const struct VirtualMemoryArea* vma);
+
+/*
+ * VMAs matching any of filters, clipped to the address range of the first
+ * filter matched, widened to whole pages. selected VMAs are to be freed by
+ * the caller, and can be given to hash_process_memory as they are
+ */
+bool select_vmas(const struct VirtualMemoryArea* VMAs, int vma_count, const struct VmaFilter* filters, int filter_count,
+    struct VirtualMemoryArea** selected_VMAs, int* selected_count);
+bool select_process_vmas(const int pid, const struct VmaFilter* filters, int filter_count,
+    struct VirtualMemoryArea** selected_VMAs, int* selected_count);
+
+/*
+ * Address to VMA lookups without reading the whole maps, through the
+ * PROCMAP_QUERY ioctl of linux 6.11 or the maps text up to the VMA found
+ * before that. a query holds "/proc/[pid]/maps" open between lookups.
+ */
+typedef void* vma_query_t;
+
+/* flags of query_vma, along with VMA_ permission bits the VMA must have */
+#define VMA_QUERY_NEXT        0x10 // the covering VMA, or the first one above address
+#define VMA_QUERY_FILE_BACKED 0x20
+
+#define VMA_BUILD_ID_SIZE 20 // sha1, the largest GNU build id
+
+vma_query_t open_vma_query(const int pid);
+void close_vma_query(vma_query_t query);
+
+/* false if lookups go through the maps text */
+bool is_vma_query_ioctl(vma_query_t query);
+
+/*
+ * false with ENOENT if no VMA matches. build_id may be NULL, otherwise
+ * *build_id_size is its size on input and the build id size on output,
+ * 0 for none or without the ioctl
+ */
+bool query_vma(vma_query_t query, unsigned long long address, unsigned int flags, struct VirtualMemoryArea* vma,
+    unsigned char* build_id, unsigned int* build_id_size);
 
 struct ProcessStat
 {
@@ -102,6 +343,736 @@ struct ProcessStat
 
 /* parse "/proc/[pid]/stat" */
 bool parse_process_stat(const int pid, struct ProcessStat* process_stat);
+bool parse_process_stat_data(const char* data, struct ProcessStat* process_stat);
+
+/* PF_KTHREAD in ProcessStat.flags */
+#define PROCESS_FLAG_KTHREAD 0x00200000
+
+bool is_kernel_thread_stat(const struct ProcessStat* process_stat);
+
+/* fields of "/proc/[pid]/status", one bit each in a field mask */
+enum StatusField
+{
+    STATUS_NAME,
+    STATUS_UMASK,
+    STATUS_STATE,
+    STATUS_TGID,
+    STATUS_PID,
+    STATUS_PPID,
+    STATUS_TRACER_PID,
+    STATUS_UID,
+    STATUS_GID,
+    STATUS_FD_SIZE,
+    STATUS_NS_TGID,
+    STATUS_NS_PID,
+    STATUS_KTHREAD,
+    STATUS_VM_PEAK,
+    STATUS_VM_SIZE,
+    STATUS_VM_LCK,
+    STATUS_VM_HWM,
+    STATUS_VM_RSS,
+    STATUS_RSS_ANON,
+    STATUS_RSS_FILE,
+    STATUS_RSS_SHMEM,
+    STATUS_VM_DATA,
+    STATUS_VM_STK,
+    STATUS_VM_EXE,
+    STATUS_VM_LIB,
+    STATUS_VM_PTE,
+    STATUS_VM_SWAP,
+    STATUS_THREADS,
+    STATUS_CPUS_ALLOWED_LIST,
+    STATUS_MEMS_ALLOWED_LIST,
+    STATUS_VOLUNTARY_CTXT_SWITCHES,
+    STATUS_NONVOLUNTARY_CTXT_SWITCHES,
+    STATUS_FIELD_COUNT
+};
+
+#define STATUS_FIELD(field) (1ULL << (field))
+#define STATUS_ALL_FIELDS   ((1ULL << STATUS_FIELD_COUNT) - 1)
+
+#define STATUS_NS_LEVELS_MAX 8
+
+struct ProcessStatus
+{
+    unsigned long long fields; // STATUS_FIELD bits of the fields found
+    char name[64];
+    unsigned int umask;
+    char state;
+    pid_t tgid;
+    pid_t pid;
+    pid_t ppid;
+    pid_t tracer_pid;
+    uid_t uid[4]; // real, effective, saved set, filesystem
+    gid_t gid[4];
+    int fd_size;
+    pid_t ns_tgid[STATUS_NS_LEVELS_MAX]; // outermost namespace first
+    int ns_tgid_count;
+    pid_t ns_pid[STATUS_NS_LEVELS_MAX];
+    int ns_pid_count;
+    bool kthread; // "Kthread" line, 6.x kernels only
+
+    /* kB */
+    unsigned long long vm_peak;
+    unsigned long long vm_size;
+    unsigned long long vm_lck;
+    unsigned long long vm_hwm;
+    unsigned long long vm_rss;
+    unsigned long long rss_anon;
+    unsigned long long rss_file;
+    unsigned long long rss_shmem;
+    unsigned long long vm_data;
+    unsigned long long vm_stk;
+    unsigned long long vm_exe;
+    unsigned long long vm_lib;
+    unsigned long long vm_pte;
+    unsigned long long vm_swap;
+
+    int threads;
+    char cpus_allowed_list[256]; // truncated if longer
+    char mems_allowed_list[256];
+    unsigned long long voluntary_ctxt_switches;
+    unsigned long long nonvoluntary_ctxt_switches;
+};
+
+/*
+ * parse "/proc/[pid]/status", lines of fields not in field_mask are skipped.
+ * true for a well-formed file, fields tells which requested ones it had
+ */
+bool parse_process_status(const int pid, unsigned long long field_mask, struct ProcessStatus* status);
+bool parse_process_status_data(const char* data, size_t size, unsigned long long field_mask, struct ProcessStatus* status);
+
+/* "/proc/[pid]/smaps_rollup", kB */
+struct SmapsRollup
+{
+    unsigned long long rss;
+    unsigned long long pss;
+    unsigned long long pss_dirty;
+    unsigned long long pss_anon;
+    unsigned long long pss_file;
+    unsigned long long pss_shmem;
+    unsigned long long shared_clean;
+    unsigned long long shared_dirty;
+    unsigned long long private_clean;
+    unsigned long long private_dirty;
+    unsigned long long referenced;
+    unsigned long long anonymous;
+    unsigned long long swap;
+    unsigned long long swap_pss;
+    unsigned long long locked;
+};
+
+/* fields missing from older kernels are left 0 */
+bool parse_smaps_rollup(const int pid, struct SmapsRollup* rollup);
+bool parse_smaps_rollup_data(const char* data, size_t size, struct SmapsRollup* rollup);
+
+/*
+ * Cgroup v2 scoping: processes are found through cgroup.procs of a cgroup
+ * directory such as "/sys/fs/cgroup/system.slice", so the cost follows the
+ * size of the cgroup rather than of the host.
+ */
+#define CGROUP_RECURSIVE   0x1 // descendant cgroups too
+#define CGROUP_THREADS     0x2 // thread ids from cgroup.threads, list_cgroup_pids only
+#define CGROUP_READ_STATUS 0x4 // rss split and swap from status
+#define CGROUP_READ_SMAPS  0x8 // pss from smaps_rollup, which walks page tables
+
+/* sorted and unique */
+bool list_cgroup_pids(const char* cgroup_path, unsigned int flags, pid_t** pids, int* pid_count);
+
+struct CgroupCounters
+{
+    int process_count;
+    int thread_count;
+    unsigned long long cpu_time; // ticks
+
+    /* kB */
+    unsigned long long rss;
+    unsigned long long rss_anon; // CGROUP_READ_STATUS
+    unsigned long long rss_file;
+    unsigned long long rss_shmem;
+    unsigned long long swap;
+    unsigned long long pss; // CGROUP_READ_SMAPS
+    unsigned long long pss_anon;
+    unsigned long long pss_file;
+    unsigned long long pss_shmem;
+    unsigned long long swap_pss;
+};
+
+struct CgroupUsage
+{
+    char path[PATH_MAX];
+    int parent; // index in usages, -1 for cgroup_path itself
+    struct CgroupCounters self; // processes of this cgroup
+    struct CgroupCounters total; // with descendant cgroups
+};
+
+/* one usage per cgroup, parents before their children. usages is to be freed by the caller */
+bool aggregate_cgroup_usage(const char* cgroup_path, unsigned int flags, struct CgroupUsage** usages, int* usage_count);
+
+/*
+ * Process queries: a conjunction of conditions evaluated as files are
+ * read, cheapest first: stat, status, cmdline, smaps_rollup. a process is
+ * dropped by the first file whose conditions fail, later files are read
+ * only for the processes left, and status lines no condition needs are
+ * not parsed.
+ */
+typedef void* process_query_t;
+
+enum QueryOperator
+{
+    QUERY_LT,
+    QUERY_LE,
+    QUERY_EQ,
+    QUERY_NE,
+    QUERY_GE,
+    QUERY_GT
+};
+
+/* memory in bytes, times in clock ticks */
+enum QueryField
+{
+    /* stat */
+    QUERY_PPID,
+    QUERY_STATE,
+    QUERY_UTIME,
+    QUERY_STIME,
+    QUERY_CPU_TIME,
+    QUERY_MINFLT,
+    QUERY_MAJFLT,
+    QUERY_PRIORITY,
+    QUERY_NICE,
+    QUERY_NUM_THREADS,
+    QUERY_VSIZE,
+    QUERY_RSS,
+    QUERY_STARTTIME,
+
+    /* status */
+    QUERY_UID,
+    QUERY_GID,
+    QUERY_RSS_ANON,
+    QUERY_RSS_FILE,
+    QUERY_RSS_SHMEM,
+    QUERY_SWAP,
+    QUERY_VOLUNTARY_CTXT_SWITCHES,
+    QUERY_NONVOLUNTARY_CTXT_SWITCHES,
+
+    /* smaps_rollup */
+    QUERY_PSS,
+    QUERY_PSS_ANON,
+    QUERY_SWAP_PSS,
+    QUERY_FIELD_COUNT
+};
+
+/* fnmatch patterns, cmdline arguments are joined by spaces */
+#define QUERY_MATCH_COMM    (QUERY_FIELD_COUNT + 1)
+#define QUERY_MATCH_CMDLINE (QUERY_FIELD_COUNT + 2)
+
+/* status has only the fields that conditions refer to, status.fields tells which */
+struct ProcessQueryResult
+{
+    struct ProcessStat stat;
+    struct ProcessStatus status;
+};
+
+process_query_t create_process_query();
+void destroy_process_query(process_query_t query);
+
+/* field op value, e.g. QUERY_RSS, QUERY_GT, 1 << 30 */
+bool add_query_condition(process_query_t query, int field, int op, long long value);
+bool add_query_match(process_query_t query, int target, const char* pattern);
+
+/* over pids, or every process if pids is NULL. results are in pid order, to be freed by the caller */
+bool run_process_query(process_query_t query, const pid_t* pids, int pid_count,
+    struct ProcessQueryResult** results, int* result_count);
+
+/*
+ * Samplers for high-frequency polling: statm, io and schedstat stay open
+ * and are re-read with pread at offset 0, a sample neither allocates nor
+ * reopens. a sampler is used by one thread at a time.
+ */
+typedef void* process_sampler_t;
+
+#define SAMPLE_STATM     0x1
+#define SAMPLE_IO        0x2
+#define SAMPLE_SCHEDSTAT 0x4
+
+/* pages */
+struct ProcessStatm
+{
+    unsigned long long size;
+    unsigned long long resident;
+    unsigned long long shared;
+    unsigned long long text;
+    unsigned long long lib; // always 0 since 2.6
+    unsigned long long data;
+    unsigned long long dirty; // always 0 since 2.6
+};
+
+struct ProcessIo
+{
+    unsigned long long rchar;
+    unsigned long long wchar;
+    unsigned long long syscr;
+    unsigned long long syscw;
+    unsigned long long read_bytes;
+    unsigned long long write_bytes;
+    unsigned long long cancelled_write_bytes;
+};
+
+struct ProcessSchedstat
+{
+    unsigned long long run_ns;
+    unsigned long long wait_ns;
+    unsigned long long timeslices;
+};
+
+/* files is a mask of SAMPLE_ flags, NULL if any of them cannot be opened */
+process_sampler_t open_process_sampler(const int pid, unsigned int files);
+void close_process_sampler(process_sampler_t sampler);
+
+/* false with ESRCH once the process is gone */
+bool sample_process_statm(process_sampler_t sampler, struct ProcessStatm* statm);
+bool sample_process_io(process_sampler_t sampler, struct ProcessIo* io);
+bool sample_process_schedstat(process_sampler_t sampler, struct ProcessSchedstat* schedstat);
+
+/*
+ * Process tree over flat arrays, links are indices into nodes.
+ * a subtree is a contiguous range of preorder, so rollups are linear scans.
+ */
+struct ProcessNode
+{
+    pid_t pid;
+    pid_t ppid;
+    gid_t pgrp;
+    int session;
+    unsigned long long starttime;
+    unsigned long long cpu_time; // utime + stime, clock ticks
+    long long rss; // pages
+    bool kernel_thread;
+
+    int parent; // node index, -1 for roots
+    int first_child; // children[first_child .. first_child + child_count)
+    int child_count;
+    int preorder; // the subtree is preorder[preorder .. subtree_end)
+    int subtree_end;
+};
+
+struct ProcessTree
+{
+    struct ProcessNode* nodes; // ascending pid
+    int node_count;
+    int* children; // child node indices grouped by parent
+    int* preorder; // node indices in depth-first order
+    int* sessions; // node indices ordered by session
+};
+
+struct ProcessUsage
+{
+    int process_count;
+    unsigned long long cpu_time;
+    long long rss;
+};
+
+bool build_process_tree(struct ProcessTree** tree);
+
+/* read stat of added pids and of orphans of exited ones, then relink */
+bool update_process_tree(struct ProcessTree* tree, const pid_t* added, int added_count,
+    const pid_t* exited, int exited_count);
+
+/* read stat of every node again, processes gone are dropped and new ones are not picked up */
+bool refresh_process_tree_usage(struct ProcessTree* tree);
+
+/* node index of pid, -1 if not in the tree */
+int find_process_node(const struct ProcessTree* tree, pid_t pid);
+
+bool aggregate_process_subtree(const struct ProcessTree* tree, pid_t pid, struct ProcessUsage* usage);
+bool aggregate_process_session(const struct ProcessTree* tree, int session, struct ProcessUsage* usage);
+
+void free_process_tree(struct ProcessTree* tree);
+
+/*
+ * Process metadata cache keyed by pid and starttime. fields are read on
+ * first use and kept until the process exits or execs. up to 256 recently
+ * used entries hold their "/proc/[pid]" open, one syscall per access checks
+ * the process is still there, two for the others. an exec is looked for at
+ * most once a second. one thread at a time per cache.
+ */
+typedef void* process_cache_t;
+
+struct ProcessCacheStats
+{
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long execs; // exe changed, fields dropped
+    unsigned long long reuses; // process gone, entry replaced
+};
+
+process_cache_t create_process_cache();
+void destroy_process_cache(process_cache_t cache);
+
+/* results belong to the cache, valid until the next call for the same pid */
+bool get_cached_imagepath(process_cache_t cache, const int pid, const char** imagepath);
+bool get_cached_argv(process_cache_t cache, const int pid, const struct ProcessArgs** args);
+
+/* maps change without an exec, they are read again when older than max_age_ms */
+bool get_cached_maps(process_cache_t cache, const int pid, unsigned int max_age_ms,
+    const struct VirtualMemoryArea** VMAs, int* vma_count);
+
+/* drop cached fields of pid, e.g. on a proc connector exec event, seen sooner than by the exe check */
+void invalidate_process_cache(process_cache_t cache, const int pid);
+
+/* remove entries of exited processes, returns how many */
+int prune_process_cache(process_cache_t cache);
+
+void get_process_cache_stats(process_cache_t cache, struct ProcessCacheStats* stats);
+
+/*
+ * Columnar snapshot file of stat samples: one fixed-width array per column
+ * and sample, a (pid, starttime) dictionary and a time index. the file is
+ * mapped by readers and columns are used in place, in native byte order.
+ */
+typedef void* snapshot_writer_t;
+typedef void* snapshot_reader_t;
+
+enum SnapshotColumn
+{
+    SNAPSHOT_PPID,
+    SNAPSHOT_STATE,
+    SNAPSHOT_MINFLT,
+    SNAPSHOT_MAJFLT,
+    SNAPSHOT_UTIME,
+    SNAPSHOT_STIME,
+    SNAPSHOT_CUTIME,
+    SNAPSHOT_CSTIME,
+    SNAPSHOT_PRIORITY,
+    SNAPSHOT_NICE,
+    SNAPSHOT_NUM_THREADS,
+    SNAPSHOT_VSIZE,
+    SNAPSHOT_RSS,
+    SNAPSHOT_PROCESSOR,
+    SNAPSHOT_BLKIO_TICKS,
+    SNAPSHOT_COLUMN_COUNT
+};
+
+/* the time index is sized for max_samples, e.g. 3600 for an hour at 1 Hz */
+snapshot_writer_t create_snapshot_file(const char* path, unsigned int max_samples);
+void close_snapshot_file(snapshot_writer_t writer);
+
+/* timestamps must not decrease, fails with ENOSPC once max_samples are written */
+bool append_snapshot_sample(snapshot_writer_t writer, unsigned long long timestamp_ns,
+    const struct ProcessStat* stats, int count);
+
+/* samples written later than open are not seen */
+snapshot_reader_t open_snapshot_reader(const char* path);
+void close_snapshot_reader(snapshot_reader_t reader);
+
+int get_snapshot_sample_count(snapshot_reader_t reader);
+
+/* last sample at or before timestamp_ns, -1 if there is none */
+int find_snapshot_sample(snapshot_reader_t reader, unsigned long long timestamp_ns);
+
+bool get_snapshot_sample(snapshot_reader_t reader, int sample, unsigned long long* timestamp_ns, int* row_count);
+
+/* row_count entries each, pointing into the mapping. signed columns are stored as two's complement */
+const unsigned int* get_snapshot_ids(snapshot_reader_t reader, int sample);
+const unsigned long long* get_snapshot_column(snapshot_reader_t reader, int sample, int column);
+
+/* process behind a dictionary id from get_snapshot_ids */
+bool get_snapshot_process(snapshot_reader_t reader, unsigned int id, pid_t* pid, unsigned long long* starttime);
+
+/*
+ * Shared-memory ring of samples, one producer and any number of consumer
+ * processes. consumers map the ring read-only and read without syscalls
+ * or locks, one that falls behind by more than the ring loses records.
+ */
+typedef void* sample_ring_t;
+
+#define SAMPLE_RECORD_STAT        1
+#define SAMPLE_RECORD_VMA_ADDED   2
+#define SAMPLE_RECORD_VMA_REMOVED 3
+#define SAMPLE_RECORD_VMA_CHANGED 4
+
+struct SampleRecord
+{
+    unsigned int type;
+    int pid;
+    unsigned int size;
+    unsigned long long sequence;
+    unsigned long long timestamp_ns;
+    union {
+        struct ProcessStat stat;
+        struct VirtualMemoryArea vma;
+    };
+};
+
+/* path is usually on /dev/shm, slot_count a power of two */
+sample_ring_t create_sample_ring(const char* path, unsigned int slot_count);
+void destroy_sample_ring(sample_ring_t ring);
+
+/* producer side, from one thread */
+void publish_process_stat(sample_ring_t ring, unsigned long long timestamp_ns, const struct ProcessStat* stat);
+void publish_vma_change(sample_ring_t ring, unsigned long long timestamp_ns, const int pid,
+    unsigned int type, const struct VirtualMemoryArea* vma);
+
+/* diff two maps of pid, returns the number of records published */
+int publish_vma_changes(sample_ring_t ring, unsigned long long timestamp_ns, const int pid,
+    const struct VirtualMemoryArea* previous, int previous_count,
+    const struct VirtualMemoryArea* current, int current_count);
+
+/* consumer side, reading starts at records published after open */
+sample_ring_t open_sample_ring(const char* path);
+void close_sample_ring(sample_ring_t ring);
+
+/* false if there is no new record, records overwritten before being read are added to lost */
+bool read_sample_ring(sample_ring_t ring, struct SampleRecord* record, unsigned long long* lost);
+
+/*
+ * Collector: an always-warm system snapshot refreshed incrementally, stat
+ * and status every time, maps only when vsize changed and cgroup once per
+ * process. queries are answered from indexes built at refresh, in process
+ * or over a unix socket by serve_collector. one thread per collector.
+ */
+typedef void* collector_t;
+
+#define COLLECTOR_QUERY_PID    1 // the process pid
+#define COLLECTOR_QUERY_CGROUP 2 // processes of a cgroup v2 path, with its descendants if recursive
+#define COLLECTOR_QUERY_TOP    3 // largest first by metric
+
+enum CollectorMetric
+{
+    COLLECTOR_METRIC_RSS,
+    COLLECTOR_METRIC_CPU, // ticks since the previous refresh
+    COLLECTOR_METRIC_VSIZE,
+    COLLECTOR_METRIC_SWAP,
+    COLLECTOR_METRIC_THREADS,
+    COLLECTOR_METRIC_COUNT
+};
+
+/* records on the socket are fixed-width and in native byte order */
+struct CollectorProcess
+{
+    int pid;
+    int ppid;
+    unsigned long long starttime;
+    char comm[16];
+    char state;
+    unsigned int uid;
+    int num_threads;
+    unsigned long long utime;
+    unsigned long long stime;
+    unsigned long long cpu_delta;
+    unsigned long long vsize; // bytes
+
+    /* kB */
+    unsigned long long rss;
+    unsigned long long rss_anon;
+    unsigned long long rss_file;
+    unsigned long long rss_shmem;
+    unsigned long long swap;
+
+    unsigned long long voluntary_ctxt_switches;
+    unsigned long long nonvoluntary_ctxt_switches;
+
+    /* maps summary, bytes */
+    int vma_count;
+    unsigned long long mapped_file;
+    unsigned long long mapped_anon;
+};
+
+/* a query is followed by path_length bytes of cgroup path */
+struct CollectorQuery
+{
+    unsigned int type;
+    unsigned int pid;
+    unsigned int metric;
+    unsigned int limit; // 0 for all
+    unsigned int recursive;
+    unsigned int path_length;
+};
+
+/* a reply is followed by count CollectorProcess records */
+struct CollectorReply
+{
+    int error; // errno value
+    unsigned int count;
+    unsigned long long generation; // refreshes so far
+    unsigned long long timestamp_ns; // CLOCK_REALTIME of the last refresh
+};
+
+collector_t create_collector();
+void destroy_collector(collector_t collector);
+
+bool refresh_collector(collector_t collector);
+
+/* processes belong to the collector, valid until the next query or refresh */
+bool run_collector_query(collector_t collector, const struct CollectorQuery* query, const char* cgroup,
+    struct CollectorReply* reply, const struct CollectorProcess** processes);
+
+/* refresh every interval_ms and answer queries on socket_path until *stop is set */
+bool serve_collector(collector_t collector, const char* socket_path, unsigned int interval_ms,
+    const volatile sig_atomic_t* stop);
+
+/* client side, processes is to be freed by the caller */
+int connect_collector(const char* socket_path);
+bool query_collector(int fd, const struct CollectorQuery* query, const char* cgroup,
+    struct CollectorReply* reply, struct CollectorProcess** processes);
+
+/*
+ * Batched procfs reader: openat/read/close of many files go through
+ * io_uring, or plain syscalls when it is unavailable. files are read into
+ * depth pooled buffers of buffer_size bytes, larger ones are read again.
+ */
+typedef void* procfs_batch_t;
+
+#define PROCFS_BATCH_NO_URING 0x1
+
+/* data is NUL-terminated and valid during the call, NULL with an errno value in error */
+typedef void (*procfs_batch_callback)(int pid, const char* name, const char* data, size_t size, int error, void* arg);
+
+procfs_batch_t create_procfs_batch(unsigned int depth, size_t buffer_size, unsigned int flags);
+void destroy_procfs_batch(procfs_batch_t batch);
+
+bool is_procfs_batch_uring(procfs_batch_t batch);
+
+/* queue "/proc/[pid]/[name]" */
+bool add_procfs_batch_file(procfs_batch_t batch, const int pid, const char* name);
+
+/* read the queued files, completion order is unspecified. the queue is emptied */
+bool run_procfs_batch(procfs_batch_t batch, procfs_batch_callback callback, void* arg);
+
+/* Soft-dirty based incremental memory snapshot */
+struct MemoryRegion
+{
+    struct VirtualMemoryArea vma;
+    unsigned char* data; // NULL if none of it could be read
+    bool unreadable; // "/proc/[pid]/mem" could not read all of it, e.g. device memory. unknown bytes are zero
+};
+
+struct MemorySnapshot
+{
+    int pid;
+    int page_size;
+    struct MemoryRegion* regions;
+    int region_count;
+};
+
+struct MemoryDelta
+{
+    int pid;
+    int page_size;
+    struct VirtualMemoryArea* VMAs; // memory layout when the delta was taken
+    bool* unreadable; // per VMA, its dirty pages could not be read
+    int vma_count;
+    unsigned long long* page_addresses;
+    unsigned char* pages; // page_count * page_size bytes
+    int page_count;
+};
+
+/* write "4" to "/proc/[pid]/clear_refs" */
+bool clear_soft_dirty_bits(const int pid);
+
+/* full snapshot of readable VMAs, soft-dirty bits are cleared afterwards. see MemoryRegion.unreadable */
+bool take_memory_snapshot(const int pid, struct MemorySnapshot** snapshot);
+
+/* pages written since the last snapshot or delta, found via "/proc/[pid]/pagemap" */
+bool take_memory_delta(const int pid, struct MemoryDelta** delta);
+
+/* contents of the selected VMAs, unreadable ones are flagged. freed by free_memory_snapshot */
+bool dump_process_vmas(const int pid, const struct VmaFilter* filters, int filter_count, struct MemorySnapshot** dump);
+
+bool apply_memory_delta(struct MemorySnapshot* snapshot, const struct MemoryDelta* delta);
+
+void free_memory_snapshot(struct MemorySnapshot* snapshot);
+void free_memory_delta(struct MemoryDelta* delta);
+
+/* Streaming VMA content hashing */
+#define VMA_HASH_XXH64  0
+#define VMA_HASH_SHA256 1
+
+#define VMA_DIGEST_MAX 32
+
+struct VmaDigest
+{
+    unsigned long long start_address;
+    unsigned long long end_address;
+    unsigned char digest[VMA_DIGEST_MAX];
+    unsigned char* page_digests; // page_count * digest_size bytes, NULL if not requested
+    int page_count; // pages from start_address, the last one short if the range is not a page multiple
+    bool unreadable; // "/proc/[pid]/mem" could not read it, digest is zero and page_digests NULL
+};
+
+struct VmaDigestSet
+{
+    int pid;
+    int algorithm;
+    int digest_size;
+    int page_size;
+    struct VmaDigest* digests;
+    int digest_count;
+};
+
+/* hash VMAs through a bounded buffer, memory contents are not retained */
+bool hash_process_memory(const int pid, const struct VirtualMemoryArea* VMAs, int vma_count,
+    int algorithm, bool page_digests, struct VmaDigestSet** digest_set);
+
+/* addresses of pages that differ from previous, new, removed and unreadable VMAs are reported entirely */
+bool compare_vma_digests(const struct VmaDigestSet* previous, const struct VmaDigestSet* current,
+    unsigned long long** changed_pages, int* changed_count);
+
+void free_vma_digest_set(struct VmaDigestSet* digest_set);
+
+/* Instrumentation, opt-in per-API counters and latency histograms */
+enum ApiId
+{
+    API_PARSE_MAPS_FILE,
+    API_PARSE_PROCESS_STAT,
+    API_READ_COMMAND_LINE,
+    API_READ_IMAGEPATH,
+    API_READ_PROCESS_MEMORY,
+    API_DUMP_PROCESS_MEMORY,
+    API_DUMP_PROCESS_IMAGE,
+    API_DUMP_PROCESS_STACK,
+    API_TAKE_MEMORY_SNAPSHOT,
+    API_TAKE_MEMORY_DELTA,
+    API_HASH_PROCESS_MEMORY,
+    API_RUN_PROCFS_BATCH,
+    API_PARSE_PROCESS_STATUS,
+    API_READ_PROCESS_ARGV,
+    API_READ_PROCESS_ENVIRON,
+    API_PARSE_SMAPS_ROLLUP,
+    API_LIST_CGROUP_PIDS,
+    API_STREAM_PROCESS_MEMORY,
+    API_VISIT_MAPS_FILE,
+    API_QUERY_VMA,
+    API_MEMORY_READER_JOB,
+    API_COUNT
+};
+
+/* bucket i counts calls of [2^i, 2^(i+1)) ns, the last one everything above */
+#define LATENCY_BUCKETS 32
+
+struct ApiStats
+{
+    unsigned long long calls;
+    unsigned long long failures;
+    unsigned long long bytes_read;
+    unsigned long long syscalls; // stdio reads are estimated from the bytes consumed
+    unsigned long long ptrace_stops;
+    unsigned long long ptrace_stop_ns;
+    unsigned long long total_ns;
+    unsigned long long latency[LATENCY_BUCKETS];
+};
+
+void enable_instrumentation(bool enable);
+bool is_instrumentation_enabled();
+
+/* sum of all threads since the last reset, stats must hold API_COUNT entries */
+void snapshot_instrumentation(struct ApiStats* stats);
+void reset_instrumentation();
+
+const char* get_api_name(int api);
 
+/* one line per API with calls, text key=value pairs */
+bool export_instrumentation(FILE* file);
 
-#endif // __PROCFS_PARSER_API__
\ No newline at end of file
+#endif // __PROCFS_PARSER_API__
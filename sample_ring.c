@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+
+/*
+ * one producer, any number of consumers mapping the ring read-only.
+ *
+ * record n goes to slot n % slot_count. each slot carries a sequence: 0
+ * while the producer writes it, n + 1 once record n is complete. a
+ * consumer copies the record out and checks the sequence did not change
+ * meanwhile, a consumer lapped by the producer loses records but never
+ * sees a torn one. consumers never write, so they cannot stall the
+ * producer or each other.
+ */
+#define SAMPLE_RING_MAGIC   "PPRING\0\1"
+#define SAMPLE_RING_VERSION 1
+
+#define CACHE_LINE 64
+
+struct ring_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t slot_count;
+    uint64_t slot_size;
+    uint8_t padding[CACHE_LINE - 24];
+
+    /* records published so far, on its own cache line */
+    uint64_t head;
+    uint8_t head_padding[CACHE_LINE - 8];
+};
+
+struct ring_slot
+{
+    uint64_t sequence;
+    uint64_t reserved;
+    struct SampleRecord record;
+} __attribute__((aligned(CACHE_LINE)));
+
+struct sample_ring
+{
+    char path[PATH_MAX];
+    unsigned char* map;
+    size_t map_size;
+    struct ring_header* header;
+    struct ring_slot* slots;
+    uint64_t mask;
+
+    /* producer: next sequence, consumer: next record to read */
+    uint64_t cursor;
+};
+
+#define RECORD_SIZE(payload) (offsetof(struct SampleRecord, stat) + (payload))
+
+static struct sample_ring* map_ring(const char* path, int fd, size_t size, int prot)
+{
+    struct sample_ring* ring = calloc(1, sizeof(struct sample_ring));
+
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    ring->map = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+    if (ring->map == MAP_FAILED) {
+        PP_ERROR(errno, "cannot map sample ring %s", path);
+        free(ring);
+        return NULL;
+    }
+
+    snprintf(ring->path, sizeof(ring->path), "%s", path);
+    ring->map_size = size;
+    ring->header = (struct ring_header*)ring->map;
+    ring->slots = (struct ring_slot*)(ring->map + sizeof(struct ring_header));
+
+    return ring;
+}
+
+static void unmap_ring(struct sample_ring* ring)
+{
+    if (ring->map) {
+        munmap(ring->map, ring->map_size);
+    }
+
+    free(ring);
+}
+
+sample_ring_t create_sample_ring(const char* path, unsigned int slot_count)
+{
+    struct sample_ring* ring = NULL;
+    size_t size;
+    int fd;
+
+    if (slot_count == 0 || (slot_count & (slot_count - 1)) != 0) {
+        PP_ERROR(EINVAL, "slot count %u is not a power of two", slot_count);
+        return NULL;
+    }
+
+    size = sizeof(struct ring_header) + (size_t)slot_count * sizeof(struct ring_slot);
+
+    /* a new file each time, consumers of an old ring keep their own mapping */
+    unlink(path);
+
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        PP_ERROR(errno, "cannot create sample ring %s", path);
+        return NULL;
+    }
+
+    if (ftruncate(fd, (off_t)size) != 0) {
+        PP_ERROR(errno, "cannot size sample ring %s", path);
+        close(fd);
+        unlink(path);
+        return NULL;
+    }
+
+    ring = map_ring(path, fd, size, PROT_READ | PROT_WRITE);
+    close(fd);
+
+    if (ring == NULL) {
+        unlink(path);
+        return NULL;
+    }
+
+    ring->mask = slot_count - 1;
+    ring->header->version = SAMPLE_RING_VERSION;
+    ring->header->slot_count = slot_count;
+    ring->header->slot_size = sizeof(struct ring_slot);
+
+    /* the magic goes last, a consumer opening the ring early sees no ring yet */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(ring->header->magic, SAMPLE_RING_MAGIC, sizeof(ring->header->magic));
+
+    return ring;
+}
+
+void destroy_sample_ring(sample_ring_t ring_h)
+{
+    struct sample_ring* ring = (struct sample_ring*)ring_h;
+
+    if (ring == NULL) {
+        return;
+    }
+
+    unlink(ring->path);
+    unmap_ring(ring);
+}
+
+static void publish_record(struct sample_ring* ring, unsigned int type, int pid,
+    unsigned long long timestamp_ns, const void* payload, size_t size)
+{
+    struct ring_slot* slot = &ring->slots[ring->cursor & ring->mask];
+
+    __atomic_store_n(&slot->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->record.type = type;
+    slot->record.pid = pid;
+    slot->record.size = (unsigned int)RECORD_SIZE(size);
+    slot->record.sequence = ring->cursor;
+    slot->record.timestamp_ns = timestamp_ns;
+    memcpy(&slot->record.stat, payload, size);
+
+    ring->cursor++;
+
+    __atomic_store_n(&slot->sequence, ring->cursor, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->header->head, ring->cursor, __ATOMIC_RELEASE);
+}
+
+void publish_process_stat(sample_ring_t ring_h, unsigned long long timestamp_ns, const struct ProcessStat* stat)
+{
+    publish_record((struct sample_ring*)ring_h, SAMPLE_RECORD_STAT, stat->pid, timestamp_ns,
+        stat, sizeof(struct ProcessStat));
+}
+
+void publish_vma_change(sample_ring_t ring_h, unsigned long long timestamp_ns, const int pid,
+    unsigned int type, const struct VirtualMemoryArea* vma)
+{
+    /* the pathname is cut at its NUL, most of the record is never copied */
+    size_t size = offsetof(struct VirtualMemoryArea, pathname) + strnlen(vma->pathname, PATH_MAX - 1) + 1;
+
+    publish_record((struct sample_ring*)ring_h, type, pid, timestamp_ns, vma, size);
+}
+
+static bool is_same_vma(const struct VirtualMemoryArea* a, const struct VirtualMemoryArea* b)
+{
+    return a->end_address == b->end_address && a->permissions == b->permissions &&
+        a->file_offset == b->file_offset && a->inode == b->inode &&
+        a->device_major == b->device_major && a->device_minor == b->device_minor &&
+        strcmp(a->pathname, b->pathname) == 0;
+}
+
+int publish_vma_changes(sample_ring_t ring_h, unsigned long long timestamp_ns, const int pid,
+    const struct VirtualMemoryArea* previous, int previous_count,
+    const struct VirtualMemoryArea* current, int current_count)
+{
+    int published = 0;
+    int i = 0;
+    int j = 0;
+
+    /* both are in maps order, sorted by start address */
+    while (i < previous_count || j < current_count) {
+        if (j == current_count || (i < previous_count && previous[i].start_address < current[j].start_address)) {
+            publish_vma_change(ring_h, timestamp_ns, pid, SAMPLE_RECORD_VMA_REMOVED, &previous[i++]);
+            published++;
+        }
+        else if (i == previous_count || current[j].start_address < previous[i].start_address) {
+            publish_vma_change(ring_h, timestamp_ns, pid, SAMPLE_RECORD_VMA_ADDED, &current[j++]);
+            published++;
+        }
+        else {
+            if (is_same_vma(&previous[i], &current[j]) == false) {
+                publish_vma_change(ring_h, timestamp_ns, pid, SAMPLE_RECORD_VMA_CHANGED, &current[j]);
+                published++;
+            }
+            i++;
+            j++;
+        }
+    }
+
+    return published;
+}
+
+sample_ring_t open_sample_ring(const char* path)
+{
+    struct sample_ring* ring = NULL;
+    struct ring_header header;
+    struct stat st;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        PP_ERROR(errno, "cannot open sample ring %s", path);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct ring_header)) {
+        PP_ERROR(EINVAL, "%s is not a sample ring", path);
+        close(fd);
+        return NULL;
+    }
+
+    ring = map_ring(path, fd, st.st_size, PROT_READ);
+    close(fd);
+
+    if (ring == NULL) {
+        return NULL;
+    }
+
+    memcpy(&header, ring->header, sizeof(header));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    if (memcmp(header.magic, SAMPLE_RING_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SAMPLE_RING_VERSION ||
+        header.slot_size != sizeof(struct ring_slot) ||
+        header.slot_count == 0 || (header.slot_count & (header.slot_count - 1)) != 0 ||
+        sizeof(struct ring_header) + (size_t)header.slot_count * sizeof(struct ring_slot) > ring->map_size) {
+        PP_ERROR(EINVAL, "%s is not a sample ring", path);
+        unmap_ring(ring);
+        return NULL;
+    }
+
+    ring->mask = header.slot_count - 1;
+    ring->cursor = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+
+    return ring;
+}
+
+void close_sample_ring(sample_ring_t ring_h)
+{
+    if (ring_h) {
+        unmap_ring((struct sample_ring*)ring_h);
+    }
+}
+
+bool read_sample_ring(sample_ring_t ring_h, struct SampleRecord* record, unsigned long long* lost)
+{
+    struct sample_ring* ring = (struct sample_ring*)ring_h;
+    uint64_t head = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+
+    while (ring->cursor < head) {
+        struct ring_slot* slot = NULL;
+        uint64_t sequence;
+        size_t size;
+
+        /* overwritten already, skip to the oldest record still in the ring */
+        if (head - ring->cursor > ring->mask + 1) {
+            *lost += head - (ring->mask + 1) - ring->cursor;
+            ring->cursor = head - (ring->mask + 1);
+        }
+
+        slot = &ring->slots[ring->cursor & ring->mask];
+
+        sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (sequence == ring->cursor + 1) {
+            size = slot->record.size;
+            if (size > sizeof(struct SampleRecord)) {
+                size = sizeof(struct SampleRecord);
+            }
+
+            memcpy(record, &slot->record, size);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+            if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence) {
+                ring->cursor++;
+                return true;
+            }
+        }
+
+        /* the producer lapped us on this slot */
+        (*lost)++;
+        ring->cursor++;
+        head = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+    }
+
+    return false;
+}
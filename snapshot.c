@@ -0,0 +1,541 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+#include "pp_stats.h"
+
+/* "/proc/[pid]/pagemap" entry bits (Documentation/admin-guide/mm/pagemap.rst) */
+#define PM_SOFT_DIRTY (1ULL << 55)
+#define PM_SWAPPED    (1ULL << 62)
+#define PM_PRESENT    (1ULL << 63)
+
+/* pagemap entries read at once */
+#define PAGEMAP_BATCH 512
+
+/* "4" clears soft-dirty bits of all pages of the process */
+#define CLEAR_REFS_SOFT_DIRTY "4"
+
+/*
+ * kernels built without CONFIG_MEM_SOFT_DIRTY never report the bit,
+ * which would make every delta look empty. probe with a freshly written page.
+ */
+static bool is_soft_dirty_supported()
+{
+    static int supported = -1;
+
+    unsigned long long entry = 0;
+    int probed = -1;
+    unsigned char* page = NULL;
+    long page_size;
+    int fd;
+
+    probed = __atomic_load_n(&supported, __ATOMIC_ACQUIRE);
+    if (probed >= 0) {
+        return probed == 1;
+    }
+
+    page_size = sysconf(_SC_PAGESIZE);
+
+    page = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) {
+        return false;
+    }
+    page[0] = 1;
+
+    fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (read_full_at(fd, (unsigned char*)&entry, sizeof(entry), ((unsigned long long)page / page_size) * sizeof(entry))) {
+            probed = (entry & PM_SOFT_DIRTY) ? 1 : 0;
+            /* racing probes store the same answer */
+            __atomic_store_n(&supported, probed, __ATOMIC_RELEASE);
+        }
+        close(fd);
+    }
+
+    munmap(page, page_size);
+
+    return probed == 1;
+}
+
+bool clear_soft_dirty_bits(const int pid)
+{
+    bool result = true;
+    int fd;
+
+    if (is_soft_dirty_supported() == false) {
+        errno = ENOTSUP;
+        return false;
+    }
+
+    fd = open_process_file(pid, "clear_refs", O_WRONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    if (write(fd, CLEAR_REFS_SOFT_DIRTY, sizeof(CLEAR_REFS_SOFT_DIRTY) - 1) < 0) {
+        result = false;
+    }
+
+    close(fd);
+
+    return result;
+}
+
+void free_memory_snapshot(struct MemorySnapshot* snapshot)
+{
+    int i;
+
+    if (snapshot == NULL) {
+        return;
+    }
+
+    if (snapshot->regions) {
+        for (i = 0; i < snapshot->region_count; i++) {
+            if (snapshot->regions[i].data) {
+                free(snapshot->regions[i].data);
+            }
+        }
+
+        free(snapshot->regions);
+    }
+
+    free(snapshot);
+}
+
+void free_memory_delta(struct MemoryDelta* delta)
+{
+    if (delta == NULL) {
+        return;
+    }
+
+    if (delta->VMAs) {
+        free(delta->VMAs);
+    }
+
+    if (delta->unreadable) {
+        free(delta->unreadable);
+    }
+
+    if (delta->page_addresses) {
+        free(delta->page_addresses);
+    }
+
+    if (delta->pages) {
+        free(delta->pages);
+    }
+
+    free(delta);
+}
+
+bool take_memory_snapshot(const int pid, struct MemorySnapshot** parsed_snapshot)
+{
+    bool result = true;
+
+    struct pp_stats_scope scope;
+    struct MemorySnapshot* snapshot = NULL;
+    struct VirtualMemoryArea* VMAs = NULL;
+    int vma_count = 0;
+    bool attached = false;
+    int mem_fd = -1;
+    int i;
+
+    pp_stats_begin(&scope, API_TAKE_MEMORY_SNAPSHOT);
+
+    if (is_soft_dirty_supported() == false) {
+        errno = ENOTSUP;
+        SETERRGOTO(result, done);
+    }
+
+    result = parse_maps_file(pid, &VMAs, &vma_count);
+    IFERRGOTO(result, done);
+
+    snapshot = calloc(1, sizeof(struct MemorySnapshot));
+    NULLERRGOTO(snapshot, result, done);
+
+    snapshot->pid = pid;
+    snapshot->page_size = (int)sysconf(_SC_PAGESIZE);
+
+    snapshot->regions = calloc(vma_count > 0 ? vma_count : 1, sizeof(struct MemoryRegion));
+    NULLERRGOTO(snapshot->regions, result, done);
+
+    mem_fd = open_process_file(pid, "mem", O_RDONLY);
+    if (mem_fd < 0) {
+        SETERRGOTO(result, done);
+    }
+
+    /* keep the process stopped so that the dump and clearing are consistent */
+    attached = attach_process_by_pid(pid);
+    if (attached == false) {
+        SETERRGOTO(result, done);
+    }
+
+    for (i = 0; i < vma_count; i++) {
+        struct MemoryRegion* region = &snapshot->regions[snapshot->region_count];
+        size_t size = (size_t)(VMAs[i].end_address - VMAs[i].start_address);
+
+        if (is_dumpable_vma(&VMAs[i]) == false) {
+            continue;
+        }
+
+        region->vma = VMAs[i];
+        region->data = malloc(size);
+        NULLERRGOTO(region->data, result, done);
+        snapshot->region_count++;
+
+        /* e.g. device memory, one such VMA does not fail the snapshot */
+        if (read_full_at(mem_fd, region->data, size, VMAs[i].start_address) == false) {
+            free(region->data);
+            region->data = NULL;
+            region->unreadable = true;
+        }
+    }
+
+    result = clear_soft_dirty_bits(pid);
+    IFERRGOTO(result, done);
+
+    *parsed_snapshot = snapshot;
+    snapshot = NULL;
+
+done:
+
+    if (attached) {
+        detach_process_by_pid(pid);
+    }
+
+    if (mem_fd >= 0) {
+        close(mem_fd);
+    }
+
+    if (VMAs) {
+        free(VMAs);
+    }
+
+    free_memory_snapshot(snapshot);
+
+    pp_stats_end(&scope, result);
+
+    return result;
+}
+
+static bool reserve_delta_pages(struct MemoryDelta* delta, int* capacity, int count)
+{
+    unsigned long long* addresses = NULL;
+    unsigned char* pages = NULL;
+    int new_capacity = *capacity;
+
+    if (delta->page_count + count <= *capacity) {
+        return true;
+    }
+
+    if (new_capacity == 0) {
+        new_capacity = 64;
+    }
+
+    while (new_capacity < delta->page_count + count) {
+        new_capacity *= 2;
+    }
+
+    addresses = realloc(delta->page_addresses, new_capacity * sizeof(unsigned long long));
+    if (addresses == NULL) {
+        return false;
+    }
+    delta->page_addresses = addresses;
+
+    pages = realloc(delta->pages, (size_t)new_capacity * delta->page_size);
+    if (pages == NULL) {
+        return false;
+    }
+    delta->pages = pages;
+
+    *capacity = new_capacity;
+
+    return true;
+}
+
+/* read a run of contiguous dirty pages into the delta */
+static bool append_dirty_run(struct MemoryDelta* delta, int* capacity, int mem_fd,
+    unsigned long long address, int count)
+{
+    unsigned char* destination = NULL;
+    int i;
+
+    if (reserve_delta_pages(delta, capacity, count) == false) {
+        return false;
+    }
+
+    destination = delta->pages + (size_t)delta->page_count * delta->page_size;
+    if (read_full_at(mem_fd, destination, (size_t)count * delta->page_size, address) == false) {
+        return false;
+    }
+
+    for (i = 0; i < count; i++) {
+        delta->page_addresses[delta->page_count++] = address + (unsigned long long)i * delta->page_size;
+    }
+
+    return true;
+}
+
+static bool collect_dirty_pages(struct MemoryDelta* delta, int* capacity, int pagemap_fd, int mem_fd,
+    const struct VirtualMemoryArea* vma)
+{
+    unsigned long long entries[PAGEMAP_BATCH];
+    unsigned long long page_size = delta->page_size;
+    unsigned long long first_page = vma->start_address / page_size;
+    unsigned long long last_page = vma->end_address / page_size;
+    unsigned long long run_start = 0;
+    int run_length = 0;
+    unsigned long long page;
+
+    for (page = first_page; page < last_page; page += PAGEMAP_BATCH) {
+        int batch = (int)(last_page - page < PAGEMAP_BATCH ? last_page - page : PAGEMAP_BATCH);
+        int i;
+
+        if (read_full_at(pagemap_fd, (unsigned char*)entries, batch * sizeof(entries[0]),
+                page * sizeof(entries[0])) == false) {
+            return false;
+        }
+
+        for (i = 0; i < batch; i++) {
+            bool dirty = (entries[i] & PM_SOFT_DIRTY) != 0;
+
+            /* untouched anonymous pages are zero-filled when the delta is applied */
+            if (dirty && (entries[i] & (PM_PRESENT | PM_SWAPPED)) == 0 && vma->inode == UNKNOWN_INODE) {
+                dirty = false;
+            }
+
+            if (dirty) {
+                if (run_length == 0) {
+                    run_start = (page + i) * page_size;
+                }
+                run_length++;
+            }
+            else if (run_length > 0) {
+                if (append_dirty_run(delta, capacity, mem_fd, run_start, run_length) == false) {
+                    return false;
+                }
+                run_length = 0;
+            }
+        }
+    }
+
+    if (run_length > 0) {
+        return append_dirty_run(delta, capacity, mem_fd, run_start, run_length);
+    }
+
+    return true;
+}
+
+bool take_memory_delta(const int pid, struct MemoryDelta** parsed_delta)
+{
+    bool result = true;
+
+    struct pp_stats_scope scope;
+    struct MemoryDelta* delta = NULL;
+    struct VirtualMemoryArea* VMAs = NULL;
+    int vma_count = 0;
+    int capacity = 0;
+    bool attached = false;
+    int pagemap_fd = -1;
+    int mem_fd = -1;
+    int i;
+
+    pp_stats_begin(&scope, API_TAKE_MEMORY_DELTA);
+
+    if (is_soft_dirty_supported() == false) {
+        errno = ENOTSUP;
+        SETERRGOTO(result, done);
+    }
+
+    result = parse_maps_file(pid, &VMAs, &vma_count);
+    IFERRGOTO(result, done);
+
+    delta = calloc(1, sizeof(struct MemoryDelta));
+    NULLERRGOTO(delta, result, done);
+
+    delta->pid = pid;
+    delta->page_size = (int)sysconf(_SC_PAGESIZE);
+
+    delta->VMAs = malloc((vma_count > 0 ? vma_count : 1) * sizeof(struct VirtualMemoryArea));
+    NULLERRGOTO(delta->VMAs, result, done);
+
+    delta->unreadable = calloc(vma_count > 0 ? vma_count : 1, sizeof(bool));
+    NULLERRGOTO(delta->unreadable, result, done);
+
+    for (i = 0; i < vma_count; i++) {
+        if (is_dumpable_vma(&VMAs[i])) {
+            delta->VMAs[delta->vma_count++] = VMAs[i];
+        }
+    }
+
+    pagemap_fd = open_process_file(pid, "pagemap", O_RDONLY);
+    if (pagemap_fd < 0) {
+        SETERRGOTO(result, done);
+    }
+
+    mem_fd = open_process_file(pid, "mem", O_RDONLY);
+    if (mem_fd < 0) {
+        SETERRGOTO(result, done);
+    }
+
+    attached = attach_process_by_pid(pid);
+    if (attached == false) {
+        SETERRGOTO(result, done);
+    }
+
+    for (i = 0; i < delta->vma_count; i++) {
+        int page_count = delta->page_count;
+
+        /* a VMA "/proc/[pid]/mem" cannot read (EIO) is flagged, as in the snapshot */
+        if (collect_dirty_pages(delta, &capacity, pagemap_fd, mem_fd, &delta->VMAs[i]) == false) {
+            if (errno != EIO) {
+                SETERRGOTO(result, done);
+            }
+            delta->page_count = page_count;
+            delta->unreadable[i] = true;
+        }
+    }
+
+    result = clear_soft_dirty_bits(pid);
+    IFERRGOTO(result, done);
+
+    *parsed_delta = delta;
+    delta = NULL;
+
+done:
+
+    if (attached) {
+        detach_process_by_pid(pid);
+    }
+
+    if (mem_fd >= 0) {
+        close(mem_fd);
+    }
+
+    if (pagemap_fd >= 0) {
+        close(pagemap_fd);
+    }
+
+    if (VMAs) {
+        free(VMAs);
+    }
+
+    free_memory_delta(delta);
+
+    pp_stats_end(&scope, result);
+
+    return result;
+}
+
+static struct MemoryRegion* find_region(struct MemoryRegion* regions, int region_count, unsigned long long address)
+{
+    int low = 0;
+    int high = region_count - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+
+        if (address < regions[mid].vma.start_address) {
+            high = mid - 1;
+        }
+        else if (address >= regions[mid].vma.end_address) {
+            low = mid + 1;
+        }
+        else {
+            return &regions[mid];
+        }
+    }
+
+    return NULL;
+}
+
+bool apply_memory_delta(struct MemorySnapshot* snapshot, const struct MemoryDelta* delta)
+{
+    bool result = true;
+
+    struct MemoryRegion* regions = NULL;
+    int region_count = 0;
+    int i, j;
+
+    if (snapshot->pid != delta->pid || snapshot->page_size != delta->page_size) {
+        return false;
+    }
+
+    regions = calloc(delta->vma_count > 0 ? delta->vma_count : 1, sizeof(struct MemoryRegion));
+    NULLERRGOTO(regions, result, done);
+
+    /* rebuild the layout of the delta, carrying over unchanged bytes from the snapshot */
+    for (i = 0; i < delta->vma_count; i++) {
+        struct MemoryRegion* region = &regions[region_count];
+        size_t size = (size_t)(delta->VMAs[i].end_address - delta->VMAs[i].start_address);
+
+        region->vma = delta->VMAs[i];
+        region_count++;
+
+        /* what the snapshot held of it is stale now */
+        if (delta->unreadable[i]) {
+            region->unreadable = true;
+            continue;
+        }
+
+        region->data = calloc(1, size);
+        NULLERRGOTO(region->data, result, done);
+
+        /* pages nobody could read stay zero unless the delta has them */
+        for (j = 0; j < snapshot->region_count; j++) {
+            const struct MemoryRegion* old = &snapshot->regions[j];
+            unsigned long long start = old->vma.start_address > region->vma.start_address ? old->vma.start_address : region->vma.start_address;
+            unsigned long long end = old->vma.end_address < region->vma.end_address ? old->vma.end_address : region->vma.end_address;
+
+            if (start < end && old->unreadable) {
+                region->unreadable = true;
+            }
+
+            if (start < end && old->data) {
+                memcpy(region->data + (start - region->vma.start_address),
+                    old->data + (start - old->vma.start_address), (size_t)(end - start));
+            }
+        }
+    }
+
+    for (i = 0; i < delta->page_count; i++) {
+        unsigned long long address = delta->page_addresses[i];
+        struct MemoryRegion* region = find_region(regions, region_count, address);
+
+        if (region == NULL) {
+            SETERRGOTO(result, done); // delta does not match its own layout
+        }
+
+        if (region->data == NULL) {
+            continue;
+        }
+
+        memcpy(region->data + (address - region->vma.start_address),
+            delta->pages + (size_t)i * delta->page_size, delta->page_size);
+    }
+
+    for (j = 0; j < snapshot->region_count; j++) {
+        free(snapshot->regions[j].data);
+    }
+    free(snapshot->regions);
+
+    snapshot->regions = regions;
+    snapshot->region_count = region_count;
+    regions = NULL;
+
+done:
+
+    if (regions) {
+        for (i = 0; i < region_count; i++) {
+            free(regions[i].data);
+        }
+        free(regions);
+    }
+
+    return result;
+}
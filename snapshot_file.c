@@ -0,0 +1,641 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+
+/*
+ * file layout, native byte order:
+ *
+ *   header
+ *   time index, max_samples entries of { timestamp, block offset }
+ *   blocks, one per sample:
+ *     block header
+ *     dictionary entries first seen in this sample
+ *     ids, row_count dictionary ids, padded to 8 bytes
+ *     SNAPSHOT_COLUMN_COUNT columns of row_count 64-bit values
+ *
+ * blocks are written first and published by their index entry and then
+ * by the sample count in the header, so a reader sees whole samples only
+ */
+#define SNAPSHOT_MAGIC       "PPSNAP\0\1"
+#define SNAPSHOT_VERSION     1
+#define SNAPSHOT_BLOCK_MAGIC 0x4b4c4253 // "SBLK"
+
+#define ALIGN8(size) (((size) + 7) & ~(size_t)7)
+
+struct snapshot_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t column_count;
+    uint32_t max_samples;
+    uint32_t sample_count;
+    uint32_t dictionary_size;
+    uint32_t reserved;
+    uint64_t data_offset;
+    uint8_t padding[24];
+};
+
+struct snapshot_index_entry
+{
+    uint64_t timestamp_ns;
+    uint64_t offset;
+};
+
+struct snapshot_block_header
+{
+    uint32_t magic;
+    uint32_t row_count;
+    uint64_t timestamp_ns;
+    uint32_t dictionary_first;
+    uint32_t dictionary_count;
+    uint64_t block_size;
+};
+
+struct snapshot_dictionary_entry
+{
+    uint64_t starttime;
+    uint32_t pid;
+    uint32_t reserved;
+};
+
+struct snapshot_writer
+{
+    int fd;
+    struct snapshot_file_header header;
+    uint64_t end_offset;
+
+    /* (pid, starttime) -> id, open addressing, slots hold id + 1 */
+    uint32_t* slots;
+    uint32_t slot_count;
+    struct snapshot_dictionary_entry* entries;
+    uint32_t entry_capacity;
+
+    unsigned char* block;
+    size_t block_capacity;
+};
+
+struct snapshot_reader
+{
+    unsigned char* map;
+    size_t map_size;
+    const struct snapshot_file_header* header;
+    const struct snapshot_index_entry* index;
+    int sample_count;
+
+    /* dictionary gathered from the blocks */
+    struct snapshot_dictionary_entry* entries;
+    uint32_t entry_count;
+};
+
+static uint32_t hash_process_key(uint32_t pid, uint64_t starttime)
+{
+    uint64_t key = ((uint64_t)pid << 32) ^ starttime;
+
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+
+    return (uint32_t)key;
+}
+
+static bool grow_dictionary(struct snapshot_writer* writer)
+{
+    uint32_t slot_count = writer->slot_count ? writer->slot_count * 2 : 1024;
+    uint32_t* slots = calloc(slot_count, sizeof(uint32_t));
+    uint32_t i;
+
+    if (slots == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < writer->header.dictionary_size; i++) {
+        uint32_t slot = hash_process_key(writer->entries[i].pid, writer->entries[i].starttime) & (slot_count - 1);
+
+        while (slots[slot]) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = i + 1;
+    }
+
+    free(writer->slots);
+    writer->slots = slots;
+    writer->slot_count = slot_count;
+
+    return true;
+}
+
+/* forget entries from first on, after the block introducing them was not written */
+static void truncate_dictionary(struct snapshot_writer* writer, uint32_t first)
+{
+    uint32_t i;
+
+    if (writer->header.dictionary_size == first) {
+        return;
+    }
+
+    writer->header.dictionary_size = first;
+
+    /* slots are probed linearly, the remaining entries are inserted again */
+    memset(writer->slots, 0x00, writer->slot_count * sizeof(uint32_t));
+
+    for (i = 0; i < first; i++) {
+        uint32_t slot = hash_process_key(writer->entries[i].pid, writer->entries[i].starttime) & (writer->slot_count - 1);
+
+        while (writer->slots[slot]) {
+            slot = (slot + 1) & (writer->slot_count - 1);
+        }
+        writer->slots[slot] = i + 1;
+    }
+}
+
+/* id of (pid, starttime), new ones are appended to the dictionary */
+static bool lookup_process_id(struct snapshot_writer* writer, uint32_t pid, uint64_t starttime, uint32_t* id)
+{
+    uint32_t slot;
+
+    if (writer->header.dictionary_size * 2 >= writer->slot_count && grow_dictionary(writer) == false) {
+        return false;
+    }
+
+    slot = hash_process_key(pid, starttime) & (writer->slot_count - 1);
+
+    while (writer->slots[slot]) {
+        struct snapshot_dictionary_entry* entry = &writer->entries[writer->slots[slot] - 1];
+
+        if (entry->pid == pid && entry->starttime == starttime) {
+            *id = writer->slots[slot] - 1;
+            return true;
+        }
+
+        slot = (slot + 1) & (writer->slot_count - 1);
+    }
+
+    if (writer->header.dictionary_size == writer->entry_capacity) {
+        uint32_t capacity = writer->entry_capacity ? writer->entry_capacity * 2 : 1024;
+        struct snapshot_dictionary_entry* grown = realloc(writer->entries, capacity * sizeof(*grown));
+
+        if (grown == NULL) {
+            return false;
+        }
+
+        writer->entries = grown;
+        writer->entry_capacity = capacity;
+    }
+
+    *id = writer->header.dictionary_size++;
+    writer->entries[*id].pid = pid;
+    writer->entries[*id].starttime = starttime;
+    writer->entries[*id].reserved = 0;
+    writer->slots[slot] = *id + 1;
+
+    return true;
+}
+
+static unsigned long long column_value(const struct ProcessStat* stat, int column)
+{
+    switch (column) {
+    case SNAPSHOT_PPID:
+        return (unsigned long long)stat->ppid;
+    case SNAPSHOT_STATE:
+        return (unsigned long long)(unsigned char)stat->state;
+    case SNAPSHOT_MINFLT:
+        return stat->minflt;
+    case SNAPSHOT_MAJFLT:
+        return stat->majflt;
+    case SNAPSHOT_UTIME:
+        return stat->utime;
+    case SNAPSHOT_STIME:
+        return stat->stime;
+    case SNAPSHOT_CUTIME:
+        return stat->cutime;
+    case SNAPSHOT_CSTIME:
+        return stat->cstime;
+    case SNAPSHOT_PRIORITY:
+        return (unsigned long long)stat->priority;
+    case SNAPSHOT_NICE:
+        return (unsigned long long)stat->nice;
+    case SNAPSHOT_NUM_THREADS:
+        return (unsigned long long)stat->num_threads;
+    case SNAPSHOT_VSIZE:
+        return stat->vsize;
+    case SNAPSHOT_RSS:
+        return (unsigned long long)stat->rss;
+    case SNAPSHOT_PROCESSOR:
+        return (unsigned long long)stat->processor;
+    case SNAPSHOT_BLKIO_TICKS:
+        return stat->delayacct_blkio_ticks;
+    }
+
+    return 0;
+}
+
+static bool write_at(int fd, const void* data, size_t size, uint64_t offset)
+{
+    const unsigned char* cursor = data;
+
+    while (size > 0) {
+        ssize_t wsz = pwrite(fd, cursor, size, (off_t)offset);
+
+        if (wsz < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (wsz <= 0) {
+            PP_ERROR(errno, "cannot write snapshot file");
+            return false;
+        }
+
+        cursor += wsz;
+        size -= wsz;
+        offset += wsz;
+    }
+
+    return true;
+}
+
+snapshot_writer_t create_snapshot_file(const char* path, unsigned int max_samples)
+{
+    struct snapshot_writer* writer = NULL;
+
+    if (max_samples == 0) {
+        return NULL;
+    }
+
+    writer = calloc(1, sizeof(struct snapshot_writer));
+    if (writer == NULL) {
+        return NULL;
+    }
+
+    writer->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (writer->fd < 0) {
+        PP_ERROR(errno, "cannot create %s", path);
+        free(writer);
+        return NULL;
+    }
+
+    memcpy(writer->header.magic, SNAPSHOT_MAGIC, sizeof(writer->header.magic));
+    writer->header.version = SNAPSHOT_VERSION;
+    writer->header.column_count = SNAPSHOT_COLUMN_COUNT;
+    writer->header.max_samples = max_samples;
+    writer->header.data_offset = sizeof(struct snapshot_file_header) + (uint64_t)max_samples * sizeof(struct snapshot_index_entry);
+    writer->end_offset = writer->header.data_offset;
+
+    if (write_at(writer->fd, &writer->header, sizeof(writer->header), 0) == false) {
+        close_snapshot_file(writer);
+        return NULL;
+    }
+
+    /* the index region is reserved up front, zero filled */
+    if (ftruncate(writer->fd, (off_t)writer->header.data_offset) != 0) {
+        PP_ERROR(errno, "cannot reserve the time index of %s", path);
+        close_snapshot_file(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+bool append_snapshot_sample(snapshot_writer_t writer_h, unsigned long long timestamp_ns,
+    const struct ProcessStat* stats, int count)
+{
+    bool result = true;
+
+    struct snapshot_writer* writer = (struct snapshot_writer*)writer_h;
+    struct snapshot_block_header* block = NULL;
+    struct snapshot_index_entry entry;
+    uint32_t dictionary_first = writer->header.dictionary_size;
+    bool written = false;
+    uint32_t* ids = NULL;
+    uint64_t* columns = NULL;
+    size_t ids_size = ALIGN8((size_t)count * sizeof(uint32_t));
+    size_t columns_size = (size_t)count * SNAPSHOT_COLUMN_COUNT * sizeof(uint64_t);
+    size_t size;
+    size_t dictionary_size;
+    int column;
+    int i;
+
+    if (writer->header.sample_count == writer->header.max_samples) {
+        PP_ERROR(ENOSPC, "snapshot file holds %u samples at most", writer->header.max_samples);
+        return false;
+    }
+
+    /* ids first, they tell how many dictionary entries are new */
+    ids = malloc(ids_size + sizeof(uint32_t));
+    NULLERRGOTO(ids, result, done);
+
+    for (i = 0; i < count; i++) {
+        result = lookup_process_id(writer, (uint32_t)stats[i].pid, stats[i].starttime, &ids[i]);
+        IFERRGOTO(result, done);
+    }
+
+    dictionary_size = (writer->header.dictionary_size - dictionary_first) * sizeof(struct snapshot_dictionary_entry);
+    size = sizeof(struct snapshot_block_header) + dictionary_size + ids_size + columns_size;
+
+    if (writer->block_capacity < size) {
+        unsigned char* grown = realloc(writer->block, size);
+
+        NULLERRGOTO(grown, result, done);
+
+        writer->block = grown;
+        writer->block_capacity = size;
+    }
+
+    memset(writer->block, 0x00, size);
+
+    block = (struct snapshot_block_header*)writer->block;
+    block->magic = SNAPSHOT_BLOCK_MAGIC;
+    block->row_count = (uint32_t)count;
+    block->timestamp_ns = timestamp_ns;
+    block->dictionary_first = dictionary_first;
+    block->dictionary_count = writer->header.dictionary_size - dictionary_first;
+    block->block_size = size;
+
+    memcpy(writer->block + sizeof(*block), &writer->entries[dictionary_first], dictionary_size);
+    memcpy(writer->block + sizeof(*block) + dictionary_size, ids, (size_t)count * sizeof(uint32_t));
+
+    /* transpose rows into columns */
+    columns = (uint64_t*)(writer->block + sizeof(*block) + dictionary_size + ids_size);
+    for (column = 0; column < SNAPSHOT_COLUMN_COUNT; column++) {
+        uint64_t* values = columns + (size_t)column * count;
+
+        for (i = 0; i < count; i++) {
+            values[i] = column_value(&stats[i], column);
+        }
+    }
+
+    result = write_at(writer->fd, writer->block, size, writer->end_offset);
+    IFERRGOTO(result, done);
+
+    entry.timestamp_ns = timestamp_ns;
+    entry.offset = writer->end_offset;
+
+    result = write_at(writer->fd, &entry, sizeof(entry),
+        sizeof(writer->header) + (uint64_t)writer->header.sample_count * sizeof(entry));
+    IFERRGOTO(result, done);
+
+    writer->end_offset += size;
+    writer->header.sample_count++;
+    written = true;
+
+    /* the sample is in the file, an outdated header is rewritten by the next one */
+    result = write_at(writer->fd, &writer->header, sizeof(writer->header), 0);
+
+done:
+
+    /* later blocks must not refer to entries no written block introduced */
+    if (result == false && written == false) {
+        truncate_dictionary(writer, dictionary_first);
+    }
+
+    if (ids) {
+        free(ids);
+    }
+
+    return result;
+}
+
+void close_snapshot_file(snapshot_writer_t writer_h)
+{
+    struct snapshot_writer* writer = (struct snapshot_writer*)writer_h;
+
+    if (writer == NULL) {
+        return;
+    }
+
+    if (writer->fd >= 0) {
+        close(writer->fd);
+    }
+
+    if (writer->slots) {
+        free(writer->slots);
+    }
+
+    if (writer->entries) {
+        free(writer->entries);
+    }
+
+    if (writer->block) {
+        free(writer->block);
+    }
+
+    free(writer);
+}
+
+static const struct snapshot_block_header* get_block(const struct snapshot_reader* reader, int sample)
+{
+    if (sample < 0 || sample >= reader->sample_count) {
+        return NULL;
+    }
+
+    return (const struct snapshot_block_header*)(reader->map + reader->index[sample].offset);
+}
+
+static bool check_block(const struct snapshot_reader* reader, uint64_t offset)
+{
+    const struct snapshot_block_header* block = NULL;
+    uint64_t size;
+
+    if (offset < reader->header->data_offset || offset + sizeof(*block) > reader->map_size) {
+        return false;
+    }
+
+    block = (const struct snapshot_block_header*)(reader->map + offset);
+    size = sizeof(*block) + (uint64_t)block->dictionary_count * sizeof(struct snapshot_dictionary_entry) +
+        ALIGN8((uint64_t)block->row_count * sizeof(uint32_t)) +
+        (uint64_t)block->row_count * SNAPSHOT_COLUMN_COUNT * sizeof(uint64_t);
+
+    return block->magic == SNAPSHOT_BLOCK_MAGIC && block->block_size == size && offset + size <= reader->map_size;
+}
+
+snapshot_reader_t open_snapshot_reader(const char* path)
+{
+    struct snapshot_reader* reader = NULL;
+    struct stat st;
+    int fd = -1;
+    int i;
+
+    reader = calloc(1, sizeof(struct snapshot_reader));
+    if (reader == NULL) {
+        return NULL;
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct snapshot_file_header)) {
+        PP_ERROR(errno, "cannot open snapshot file %s", path);
+        goto error;
+    }
+
+    reader->map_size = st.st_size;
+    reader->map = mmap(NULL, reader->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (reader->map == MAP_FAILED) {
+        reader->map = NULL;
+        PP_ERROR(errno, "cannot map snapshot file %s", path);
+        goto error;
+    }
+
+    close(fd);
+    fd = -1;
+
+    reader->header = (const struct snapshot_file_header*)reader->map;
+    reader->index = (const struct snapshot_index_entry*)(reader->map + sizeof(struct snapshot_file_header));
+
+    if (memcmp(reader->header->magic, SNAPSHOT_MAGIC, sizeof(reader->header->magic)) != 0 ||
+        reader->header->version != SNAPSHOT_VERSION ||
+        reader->header->column_count != SNAPSHOT_COLUMN_COUNT ||
+        reader->header->data_offset > reader->map_size ||
+        reader->header->sample_count > reader->header->max_samples) {
+        PP_ERROR(EINVAL, "%s is not a snapshot file", path);
+        goto error;
+    }
+
+    /* samples published when the file was mapped, every block checked once */
+    reader->sample_count = reader->header->sample_count;
+
+    for (i = 0; i < reader->sample_count; i++) {
+        const struct snapshot_block_header* block = NULL;
+
+        if (check_block(reader, reader->index[i].offset) == false) {
+            reader->sample_count = i;
+            break;
+        }
+
+        block = get_block(reader, i);
+        if (block->dictionary_first != reader->entry_count) {
+            reader->sample_count = i;
+            break;
+        }
+
+        reader->entry_count += block->dictionary_count;
+    }
+
+    reader->entries = malloc((reader->entry_count + 1) * sizeof(struct snapshot_dictionary_entry));
+    if (reader->entries == NULL) {
+        goto error;
+    }
+
+    for (i = 0; i < reader->sample_count; i++) {
+        const struct snapshot_block_header* block = get_block(reader, i);
+
+        memcpy(&reader->entries[block->dictionary_first], block + 1,
+            block->dictionary_count * sizeof(struct snapshot_dictionary_entry));
+    }
+
+    return reader;
+
+error:
+
+    if (fd >= 0) {
+        close(fd);
+    }
+
+    close_snapshot_reader(reader);
+
+    return NULL;
+}
+
+void close_snapshot_reader(snapshot_reader_t reader_h)
+{
+    struct snapshot_reader* reader = (struct snapshot_reader*)reader_h;
+
+    if (reader == NULL) {
+        return;
+    }
+
+    if (reader->map) {
+        munmap(reader->map, reader->map_size);
+    }
+
+    if (reader->entries) {
+        free(reader->entries);
+    }
+
+    free(reader);
+}
+
+int get_snapshot_sample_count(snapshot_reader_t reader_h)
+{
+    return ((struct snapshot_reader*)reader_h)->sample_count;
+}
+
+int find_snapshot_sample(snapshot_reader_t reader_h, unsigned long long timestamp_ns)
+{
+    struct snapshot_reader* reader = (struct snapshot_reader*)reader_h;
+    int low = 0;
+    int high = reader->sample_count;
+
+    /* first sample after timestamp_ns */
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+
+        if (reader->index[middle].timestamp_ns <= timestamp_ns) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    return low - 1;
+}
+
+bool get_snapshot_sample(snapshot_reader_t reader_h, int sample, unsigned long long* timestamp_ns, int* row_count)
+{
+    const struct snapshot_block_header* block = get_block((struct snapshot_reader*)reader_h, sample);
+
+    if (block == NULL) {
+        return false;
+    }
+
+    *timestamp_ns = block->timestamp_ns;
+    *row_count = (int)block->row_count;
+
+    return true;
+}
+
+const unsigned int* get_snapshot_ids(snapshot_reader_t reader_h, int sample)
+{
+    const struct snapshot_block_header* block = get_block((struct snapshot_reader*)reader_h, sample);
+
+    if (block == NULL) {
+        return NULL;
+    }
+
+    return (const unsigned int*)((const unsigned char*)(block + 1) +
+        block->dictionary_count * sizeof(struct snapshot_dictionary_entry));
+}
+
+const unsigned long long* get_snapshot_column(snapshot_reader_t reader_h, int sample, int column)
+{
+    const struct snapshot_block_header* block = get_block((struct snapshot_reader*)reader_h, sample);
+
+    if (block == NULL || column < 0 || column >= SNAPSHOT_COLUMN_COUNT) {
+        return NULL;
+    }
+
+    return (const unsigned long long*)((const unsigned char*)(block + 1) +
+        block->dictionary_count * sizeof(struct snapshot_dictionary_entry) +
+        ALIGN8(block->row_count * sizeof(uint32_t))) + (size_t)column * block->row_count;
+}
+
+bool get_snapshot_process(snapshot_reader_t reader_h, unsigned int id, pid_t* pid, unsigned long long* starttime)
+{
+    struct snapshot_reader* reader = (struct snapshot_reader*)reader_h;
+
+    if (id >= reader->entry_count) {
+        return false;
+    }
+
+    *pid = (pid_t)reader->entries[id].pid;
+    *starttime = reader->entries[id].starttime;
+
+    return true;
+}
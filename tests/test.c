@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <sys/stat.h>
+
+#include "test.h"
+
+static int check_count;
+static int failure_count;
+
+bool check_condition(bool condition, const char* text, const char* file, int line)
+{
+    check_count++;
+
+    if (condition == false) {
+        failure_count++;
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, text);
+    }
+
+    return condition;
+}
+
+const char* get_fixture_root(int argc, char* argv[])
+{
+    struct stat st;
+
+    if (argc < 2 || stat(argv[1], &st) != 0 || S_ISDIR(st.st_mode) == false) {
+        fprintf(stderr, "usage: %s fixture-root, see \"benchmark -G\"\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    return argv[1];
+}
+
+bool create_test_root(char* root, size_t size)
+{
+    const char* tmpdir = getenv("TMPDIR");
+    int length = snprintf(root, size, "%s/pp_test.XXXXXX", tmpdir ? tmpdir : "/tmp");
+
+    if (length < 0 || (size_t)length >= size) {
+        return false;
+    }
+
+    return mkdtemp(root) != NULL;
+}
+
+/* the roots are two levels deep, "[root]/[pid]/[name]" */
+static void remove_directory(const char* path, int depth)
+{
+    struct dirent* entry = NULL;
+    DIR* dir = opendir(path);
+
+    if (dir == NULL) {
+        return;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        char child[PATH_MAX];
+
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+
+        if (unlink(child) != 0 && errno == EISDIR && depth > 0) {
+            remove_directory(child, depth - 1);
+        }
+    }
+
+    closedir(dir);
+    rmdir(path);
+}
+
+void remove_test_root(const char* root)
+{
+    remove_directory(root, 1);
+}
+
+bool write_test_file(const char* root, int pid, const char* name, const char* data, size_t size)
+{
+    char path[PATH_MAX];
+    FILE* file = NULL;
+    bool result;
+
+    snprintf(path, sizeof(path), "%s/%d", root, pid);
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "%s/%d/%s", root, pid, name);
+    file = fopen(path, "w");
+    if (file == NULL) {
+        return false;
+    }
+
+    result = fwrite(data, 1, size, file) == size;
+    fclose(file);
+
+    return result;
+}
+
+bool remove_test_pid(const char* root, int pid)
+{
+    char path[PATH_MAX];
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s/%d", root, pid);
+    remove_directory(path, 0);
+
+    return stat(path, &st) != 0;
+}
+
+bool write_test_stat(const char* root, int pid, int ppid, int session, unsigned long long utime, long long rss)
+{
+    char line[1024];
+    int length;
+
+    length = snprintf(line, sizeof(line),
+        "%d (worker %d) S %d %d %d 0 -1 4194560 %d 0 12 0 %llu %d 0 0 20 0 %d 0 %d %llu %lld "
+        "18446744073709551615 94000000000000 94000000100000 140700000000000 0 0 0 0 0 0 0 0 0 17 %d 0 0 0 0 0 "
+        "94000000200000 94000000300000 94000000400000 140700000001000 140700000002000 140700000002000 140700000003000 0\n",
+        pid, pid, ppid, pid, session, pid % 5000, utime, pid % 700, 1 + pid % 16, 1000 + pid,
+        (unsigned long long)pid * 4096 * 100, rss, pid % 64);
+
+    return write_test_file(root, pid, "stat", line, length);
+}
+
+char* read_test_file(const char* path, size_t* size)
+{
+    FILE* file = fopen(path, "r");
+    char* data = NULL;
+    size_t capacity = 4096;
+    size_t length = 0;
+    size_t rsz;
+
+    if (file == NULL) {
+        return NULL;
+    }
+
+    data = malloc(capacity + 1);
+
+    while (data && (rsz = fread(data + length, 1, capacity - length, file)) > 0) {
+        length += rsz;
+
+        if (length == capacity) {
+            char* grown = realloc(data, capacity * 2 + 1);
+
+            if (grown == NULL) {
+                free(data);
+                data = NULL;
+                break;
+            }
+
+            data = grown;
+            capacity *= 2;
+        }
+    }
+
+    fclose(file);
+
+    if (data) {
+        data[length] = '\0';
+        *size = length;
+    }
+
+    return data;
+}
+
+int finish_tests(const char* name)
+{
+    printf("%s: %d checks, %d failed\n", name, check_count, failure_count);
+
+    return failure_count ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,43 @@
+#ifndef __PROCFS_PARSER_TEST__
+#define __PROCFS_PARSER_TEST__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Behavior tests run against the fixture tree of "benchmark -G", whose
+ * path is the first argument, and against files they write themselves
+ * under a temporary procfs root. "make test" builds and runs them all.
+ */
+
+/* the generated tree, see generate_fixture of benchmark.c */
+#define FIXTURE_PID_COUNT    64
+#define FIXTURE_MAPS_LINES   4096
+#define FIXTURE_CMDLINE_SIZE 8192
+
+/* a failed check is reported and counted, the test goes on */
+#define CHECK(condition) check_condition((condition), #condition, __FILE__, __LINE__)
+
+bool check_condition(bool condition, const char* text, const char* file, int line);
+
+/* fixture root from the arguments, exits if there is none */
+const char* get_fixture_root(int argc, char* argv[]);
+
+/* empty directory to be used as a procfs root, removed by remove_test_root */
+bool create_test_root(char* root, size_t size);
+void remove_test_root(const char* root);
+
+/* "[root]/[pid]/[name]", the pid directory is created if missing */
+bool write_test_file(const char* root, int pid, const char* name, const char* data, size_t size);
+bool remove_test_pid(const char* root, int pid);
+
+/* a stat line in the kernel format, fields not given are those of the fixture generator */
+bool write_test_stat(const char* root, int pid, int ppid, int session, unsigned long long utime, long long rss);
+
+/* whole file into a malloc'ed NUL-terminated buffer */
+char* read_test_file(const char* path, size_t* size);
+
+/* summary line, the exit status of main */
+int finish_tests(const char* name);
+
+#endif // __PROCFS_PARSER_TEST__
@@ -0,0 +1,126 @@
+/*
+ * argv and environ readers: views over the fixture cmdlines, buffers
+ * reused across calls, and the environ index
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/limits.h>
+
+#include "procfs_parser_api.h"
+#include "test.h"
+
+/* the generator writes "--option-[offset]=value" at each offset */
+static bool check_fixture_argv(const struct ProcessArgs* args, int size)
+{
+    char expected[64];
+    int i;
+
+    if (args->count < 2 || (int)args->length > size || strcmp(args->views[0], "/usr/bin/worker") != 0) {
+        return false;
+    }
+
+    for (i = 1; i < args->count; i++) {
+        snprintf(expected, sizeof(expected), "--option-%d=value", (int)(args->views[i] - args->buffer));
+        if (strcmp(args->views[i], expected) != 0) {
+            return false;
+        }
+    }
+
+    return args->views[args->count] == NULL;
+}
+
+static void test_argv(const char* fixture)
+{
+    struct ProcessArgs args;
+    char path[PATH_MAX];
+    char* cmdline = NULL;
+    size_t size = 0;
+    size_t buffer_size;
+
+    memset(&args, 0x00, sizeof(args));
+
+    /* larger than the first buffer */
+    CHECK(read_process_argv(1, &args));
+    CHECK(check_fixture_argv(&args, FIXTURE_CMDLINE_SIZE));
+
+    snprintf(path, sizeof(path), "%s/1/cmdline", fixture);
+    cmdline = read_test_file(path, &size);
+    CHECK(cmdline != NULL && args.length == size && memcmp(args.buffer, cmdline, size) == 0);
+    free(cmdline);
+
+    /* a shorter one reuses the buffer */
+    buffer_size = args.buffer_size;
+    CHECK(read_process_argv(9, &args));
+    CHECK(check_fixture_argv(&args, 64 + 9 % 512));
+    CHECK(args.buffer_size == buffer_size);
+    CHECK(args.index_count == 0);
+
+    CHECK(read_process_argv(FIXTURE_PID_COUNT + 1, &args) == false);
+
+    free_process_args(&args);
+    CHECK(args.buffer == NULL && args.views == NULL && args.count == 0);
+}
+
+static void test_environ(const char* root)
+{
+    static const char environ[] = "PATH=/bin\0HOME=/root\0LANG=C\0EMPTY=\0NOVALUE\0A=1=2\0Z=last";
+    struct ProcessArgs args;
+    procfs_context_t context = create_procfs_context();
+
+    memset(&args, 0x00, sizeof(args));
+
+    CHECK(write_test_file(root, 500, "environ", environ, sizeof(environ) - 1));
+    CHECK(write_test_file(root, 501, "environ", "", 0));
+    CHECK(write_test_file(root, 502, "cmdline", "", 0));
+
+    CHECK(set_context_procfs_root(context, root));
+    set_thread_procfs_context(context);
+
+    CHECK(read_process_environ(500, &args));
+    CHECK(args.count == 7 && args.index_count == 7);
+    CHECK(strcmp(args.views[0], "PATH=/bin") == 0 && strcmp(args.views[6], "Z=last") == 0);
+    CHECK(args.views[7] == NULL);
+
+    CHECK(find_process_environ(&args, "PATH") && strcmp(find_process_environ(&args, "PATH"), "/bin") == 0);
+    CHECK(find_process_environ(&args, "LANG") && strcmp(find_process_environ(&args, "LANG"), "C") == 0);
+    CHECK(find_process_environ(&args, "EMPTY") && strcmp(find_process_environ(&args, "EMPTY"), "") == 0);
+    CHECK(find_process_environ(&args, "A") && strcmp(find_process_environ(&args, "A"), "1=2") == 0);
+    CHECK(find_process_environ(&args, "Z") && strcmp(find_process_environ(&args, "Z"), "last") == 0);
+    CHECK(find_process_environ(&args, "PAT") == NULL);
+    CHECK(find_process_environ(&args, "PATHS") == NULL);
+    CHECK(find_process_environ(&args, "USER") == NULL);
+
+    /* an empty environ, and argv of a kernel thread */
+    CHECK(read_process_environ(501, &args));
+    CHECK(args.count == 0 && args.views[0] == NULL);
+    CHECK(find_process_environ(&args, "PATH") == NULL);
+
+    CHECK(read_process_environ(500, &args));
+    CHECK(read_process_argv(502, &args));
+    CHECK(args.count == 0 && args.views[0] == NULL);
+
+    /* argv is not indexed */
+    CHECK(find_process_environ(&args, "PATH") == NULL);
+
+    free_process_args(&args);
+
+    set_thread_procfs_context(NULL);
+    destroy_procfs_context(context);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* fixture = get_fixture_root(argc, argv);
+    char root[PATH_MAX];
+
+    CHECK(set_procfs_root(fixture));
+    CHECK(create_test_root(root, sizeof(root)));
+
+    test_argv(fixture);
+    test_environ(root);
+
+    remove_test_root(root);
+
+    return finish_tests("args");
+}
@@ -0,0 +1,304 @@
+/*
+ * maps: the text parser, the iterator and visitor over the fixture maps,
+ * and VMA queries through the maps text and through PROCMAP_QUERY
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include "procfs_parser_api.h"
+#include "test.h"
+
+struct visit_count
+{
+    int count;
+    int limit;
+};
+
+static bool same_vma(const struct VirtualMemoryArea* a, const struct VirtualMemoryArea* b)
+{
+    return a->start_address == b->start_address && a->end_address == b->end_address &&
+        a->permissions == b->permissions && a->file_offset == b->file_offset && a->inode == b->inode &&
+        a->device_major == b->device_major && a->device_minor == b->device_minor &&
+        strcmp(a->pathname, b->pathname) == 0;
+}
+
+static bool count_vma(const struct VirtualMemoryArea* vma, void* arg)
+{
+    struct visit_count* visit = arg;
+
+    (void)vma;
+
+    return ++visit->count != visit->limit;
+}
+
+static void test_maps_data()
+{
+    static const char maps[] =
+        "00400000-00452000 r-xp 00000000 fd:01 173521                             /usr/bin/dbus-daemon\n"
+        "7f2c4a000000-7f2c4a021000 rw-s 00001000 00:05 4711                       /tmp/a b (deleted)\n"
+        "7f2c4c000000-7f2c4c021000 ---p 00000000 00:00 0 \n"
+        "7ffd3b1d0000-7ffd3b1f1000 rw-p 00000000 00:00 0                          [stack]\n"
+        "ffffffffff600000-ffffffffff601000 --xp 00000000 00:00 0                  [vsyscall]";
+    struct VirtualMemoryArea* VMAs = NULL;
+    int count = 0;
+
+    CHECK(parse_maps_data(maps, sizeof(maps) - 1, &VMAs, &count));
+    if (CHECK(count == 5) == false) {
+        free(VMAs);
+        return;
+    }
+
+    CHECK(VMAs[0].start_address == 0x400000 && VMAs[0].end_address == 0x452000);
+    CHECK(VMAs[0].permissions == (VMA_READ | VMA_EXEC));
+    CHECK(VMAs[0].device_major == 0xfd && VMAs[0].device_minor == 1 && VMAs[0].inode == 173521);
+    CHECK(strcmp(VMAs[0].pathname, "/usr/bin/dbus-daemon") == 0);
+
+    CHECK(VMAs[1].permissions == (VMA_READ | VMA_WRITE | VMA_MAYSHARE) && VMAs[1].file_offset == 0x1000);
+    CHECK(strcmp(VMAs[1].pathname, "/tmp/a b (deleted)") == 0);
+
+    CHECK(VMAs[2].permissions == 0 && VMAs[2].inode == 0 && VMAs[2].pathname[0] == '\0');
+    CHECK(strcmp(VMAs[3].pathname, "[stack]") == 0);
+
+    /* the last line needs no newline */
+    CHECK(VMAs[4].start_address == 0xffffffffff600000ULL && strcmp(VMAs[4].pathname, "[vsyscall]") == 0);
+
+    free(VMAs);
+
+    CHECK(parse_maps_data("", 0, &VMAs, &count) && count == 0);
+    free(VMAs);
+
+    CHECK(parse_maps_data("00400000 r-xp 00000000 fd:01 1 /bin/sh\n", 39, &VMAs, &count) == false);
+}
+
+static void test_fixture_maps(const char* fixture)
+{
+    struct VirtualMemoryArea* parsed = NULL;
+    struct VirtualMemoryArea* VMAs = NULL;
+    const struct VirtualMemoryArea* vma = NULL;
+    struct MapsIterator iterator;
+    struct visit_count visit = { 0, 0 };
+    char path[PATH_MAX];
+    char* maps = NULL;
+    size_t size = 0;
+    int parsed_count = 0;
+    int count = 0;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/1/maps", fixture);
+    maps = read_test_file(path, &size);
+    CHECK(maps != NULL && parse_maps_data(maps, size, &parsed, &parsed_count));
+    CHECK(parsed_count == FIXTURE_MAPS_LINES);
+    free(maps);
+
+    CHECK(parse_maps_file(1, &VMAs, &count));
+    CHECK(count == parsed_count);
+    for (i = 0; i < count && i < parsed_count; i++) {
+        if (CHECK(same_vma(&VMAs[i], &parsed[i])) == false) {
+            break;
+        }
+    }
+    free(VMAs);
+
+    /* the iterator goes through many reads of its buffer */
+    count = 0;
+    CHECK(open_maps_iterator(1, &iterator));
+    while (next_maps_entry(&iterator, &vma)) {
+        if (count >= parsed_count || CHECK(same_vma(vma, &parsed[count])) == false) {
+            break;
+        }
+        count++;
+    }
+    CHECK(count == parsed_count && iterator.failed == false);
+    close_maps_iterator(&iterator);
+
+    /* the visitor sees every entry, or stops the walk */
+    CHECK(visit_maps_file(1, count_vma, &visit) && visit.count == parsed_count);
+
+    visit.count = 0;
+    visit.limit = 10;
+    CHECK(visit_maps_file(1, count_vma, &visit) && visit.count == 10);
+
+    CHECK(open_maps_iterator(FIXTURE_PID_COUNT + 1, &iterator) == false);
+
+    free(parsed);
+}
+
+static void test_written_maps(const char* root)
+{
+    struct VirtualMemoryArea* VMAs = NULL;
+    struct visit_count visit = { 0, 0 };
+    procfs_context_t context = NULL;
+    char* maps = NULL;
+    char pathname[PATH_MAX - 96];
+    size_t length = 0;
+    int count = 0;
+    int i;
+
+    /* lines near the longest there can be, across the buffer of the iterator */
+    maps = malloc(16 * PATH_MAX);
+    if (CHECK(maps != NULL) == false) {
+        return;
+    }
+
+    memset(pathname, 'p', sizeof(pathname) - 1);
+    pathname[0] = '/';
+    pathname[sizeof(pathname) - 1] = '\0';
+
+    for (i = 0; i < 12; i++) {
+        length += sprintf(maps + length, "%x-%x r--p 00000000 08:01 %d %s\n",
+            0x10000 * (i + 1), 0x10000 * (i + 2), i + 1, pathname + (i % 3) * 700);
+    }
+
+    CHECK(write_test_file(root, 800, "maps", maps, length));
+
+    /* a malformed line ends the walk with a failure */
+    CHECK(write_test_file(root, 801, "maps", maps, strchr(strchr(maps, '\n') + 1, '\n') + 1 - maps));
+    strcpy(maps + length, "00400000 r-xp 00000000 fd:01 1 /bin/sh\n");
+    CHECK(write_test_file(root, 802, "maps", maps, strlen(maps)));
+
+    context = create_procfs_context();
+    CHECK(set_context_procfs_root(context, root));
+    set_thread_procfs_context(context);
+
+    CHECK(parse_maps_file(800, &VMAs, &count) && count == 12);
+    for (i = 0; i < count; i++) {
+        CHECK(VMAs[i].inode == (unsigned long long)i + 1 && strcmp(VMAs[i].pathname, pathname + (i % 3) * 700) == 0);
+    }
+    free(VMAs);
+
+    CHECK(visit_maps_file(801, count_vma, &visit) && visit.count == 2);
+
+    visit.count = 0;
+    CHECK(visit_maps_file(802, count_vma, &visit) == false && visit.count == 12);
+    CHECK(parse_maps_file(802, &VMAs, &count) == false);
+
+    set_thread_procfs_context(NULL);
+    destroy_procfs_context(context);
+
+    free(maps);
+}
+
+/* the generator maps 1 + i % 32 pages at each line i, every fourth one anonymous rw-p */
+static void test_query_by_maps()
+{
+    struct VirtualMemoryArea* VMAs = NULL;
+    struct VirtualMemoryArea vma;
+    struct ProcfsError error;
+    unsigned char build_id[VMA_BUILD_ID_SIZE];
+    unsigned int build_id_size = sizeof(build_id);
+    vma_query_t query = NULL;
+    int count = 0;
+
+    CHECK(parse_maps_file(2, &VMAs, &count) && count == 32);
+
+    query = open_vma_query(2);
+    if (CHECK(query != NULL) == false) {
+        free(VMAs);
+        return;
+    }
+
+    CHECK(query_vma(query, VMAs[1].start_address + 0x10, 0, &vma, build_id, &build_id_size));
+    CHECK(same_vma(&vma, &VMAs[1]) && build_id_size == 0);
+
+    /* a fixture maps is a regular file, lookups go through the text from the first one on */
+    CHECK(is_vma_query_ioctl(query) == false);
+
+    CHECK(query_vma(query, VMAs[0].start_address - 1, 0, &vma, NULL, NULL) == false);
+    CHECK(get_procfs_last_error(NULL, &error) && error.code == ENOENT);
+    CHECK(query_vma(query, VMAs[0].start_address - 1, VMA_QUERY_NEXT, &vma, NULL, NULL) && same_vma(&vma, &VMAs[0]));
+
+    CHECK(query_vma(query, VMAs[0].start_address, VMA_QUERY_FILE_BACKED, &vma, NULL, NULL) == false);
+    CHECK(query_vma(query, VMAs[0].start_address, VMA_QUERY_FILE_BACKED | VMA_QUERY_NEXT, &vma, NULL, NULL));
+    CHECK(same_vma(&vma, &VMAs[1]));
+
+    CHECK(query_vma(query, VMAs[1].start_address, VMA_WRITE | VMA_QUERY_NEXT, &vma, NULL, NULL));
+    CHECK(same_vma(&vma, &VMAs[4]));
+
+    CHECK(query_vma(query, VMAs[count - 1].end_address, VMA_QUERY_NEXT, &vma, NULL, NULL) == false);
+
+    CHECK(query_vma(query, VMAs[1].start_address, 0x100, &vma, NULL, NULL) == false);
+    CHECK(get_procfs_last_error(NULL, &error) && error.code == EINVAL);
+
+    close_vma_query(query);
+    free(VMAs);
+
+    CHECK(open_vma_query(FIXTURE_PID_COUNT + 1) == NULL);
+}
+
+/* the real "/proc", through PROCMAP_QUERY on linux 6.11 and later */
+static void test_query_self()
+{
+    struct VirtualMemoryArea* VMAs = NULL;
+    struct VirtualMemoryArea vma;
+    unsigned char build_id[VMA_BUILD_ID_SIZE];
+    unsigned int build_id_size;
+    procfs_context_t context = NULL;
+    vma_query_t query = NULL;
+    int count = 0;
+    int i;
+
+    context = create_procfs_context();
+    CHECK(set_context_procfs_root(context, NULL));
+    set_thread_procfs_context(context);
+
+    query = open_vma_query(getpid());
+    CHECK(query != NULL && parse_maps_file(getpid(), &VMAs, &count) && count > 0);
+
+    /* only the heap may change from here on */
+    for (i = 0; query && i < count; i++) {
+        if (strcmp(VMAs[i].pathname, "[vsyscall]") == 0) {
+            continue;
+        }
+
+        build_id_size = sizeof(build_id);
+        if (CHECK(query_vma(query, VMAs[i].start_address, 0, &vma, build_id, &build_id_size)) == false) {
+            break;
+        }
+
+        /* stdio buffers may still move the break */
+        if (strcmp(vma.pathname, "[heap]") == 0 && vma.end_address >= VMAs[i].end_address) {
+            vma.end_address = VMAs[i].end_address;
+        }
+
+        if (CHECK(same_vma(&vma, &VMAs[i])) == false) {
+            fprintf(stderr, "  %llx-%llx %s, queried %llx-%llx %s\n", VMAs[i].start_address, VMAs[i].end_address,
+                VMAs[i].pathname, vma.start_address, vma.end_address, vma.pathname);
+            break;
+        }
+
+        CHECK(build_id_size <= VMA_BUILD_ID_SIZE);
+    }
+
+    if (query) {
+        printf("maps: queries of %d through %s\n", getpid(), is_vma_query_ioctl(query) ? "PROCMAP_QUERY" : "the maps text");
+    }
+
+    close_vma_query(query);
+    free(VMAs);
+
+    set_thread_procfs_context(NULL);
+    destroy_procfs_context(context);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* fixture = get_fixture_root(argc, argv);
+    char root[PATH_MAX];
+
+    CHECK(set_procfs_root(fixture));
+    CHECK(create_test_root(root, sizeof(root)));
+
+    test_maps_data();
+    test_fixture_maps(fixture);
+    test_written_maps(root);
+    test_query_by_maps();
+    test_query_self();
+
+    remove_test_root(root);
+
+    return finish_tests("maps");
+}
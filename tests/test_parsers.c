@@ -0,0 +1,202 @@
+/*
+ * stat, status and smaps_rollup parsers, the _data variants on literal
+ * text and the file variants on the fixture tree
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/limits.h>
+
+#include "procfs_parser_api.h"
+#include "test.h"
+
+static void test_stat_data()
+{
+    struct ProcessStat stat;
+    const char* line =
+        "4242 (a (b) c) R 17 4242 4200 34816 4242 4194560 100 7 3 1 250 125 9 8 20 -5 4 0 123456 8192000 321 "
+        "18446744073709551615 1 2 3 0 0 0 0 0 0 0 0 0 17 3 0 0 11 0 0 4 5 6 7 8 9 10 42\n";
+
+    memset(&stat, 0x00, sizeof(stat));
+    CHECK(parse_process_stat_data(line, &stat));
+    CHECK(stat.pid == 4242);
+    CHECK(strcmp(stat.comm, "a (b) c") == 0);
+    CHECK(stat.state == 'R');
+    CHECK(stat.ppid == 17);
+    CHECK(stat.session == 4200);
+    CHECK(stat.tty_nr == 34816);
+    CHECK(stat.flags == 4194560);
+    CHECK(stat.minflt == 100 && stat.cminflt == 7 && stat.majflt == 3 && stat.cmajflt == 1);
+    CHECK(stat.utime == 250 && stat.stime == 125 && stat.cutime == 9 && stat.cstime == 8);
+    CHECK(stat.priority == 20 && stat.nice == -5);
+    CHECK(stat.num_threads == 4);
+    CHECK(stat.starttime == 123456);
+    CHECK(stat.vsize == 8192000 && stat.rss == 321);
+    CHECK(stat.processor == 3);
+    CHECK(stat.delayacct_blkio_ticks == 11);
+    CHECK(stat.exit_code == 42);
+    CHECK(is_kernel_thread_stat(&stat) == false);
+
+    /* a truncated line or a comm that does not end fails */
+    CHECK(parse_process_stat_data("4242 (worker) S 1 4242 4242 0 -1\n", &stat) == false);
+    CHECK(parse_process_stat_data("4242 (worker S 1\n", &stat) == false);
+}
+
+static void test_stat_file()
+{
+    struct ProcessStat stat;
+    struct ProcfsError error;
+    int pid = 7;
+
+    CHECK(parse_process_stat(pid, &stat));
+    CHECK(stat.pid == pid);
+    CHECK(strcmp(stat.comm, "worker 7") == 0);
+    CHECK(stat.ppid == 1 && stat.pgrp == (gid_t)pid && stat.session == pid);
+    CHECK(stat.utime == (unsigned long long)pid % 1000 && stat.stime == (unsigned long long)pid % 700);
+    CHECK(stat.num_threads == 1 + pid % 16);
+    CHECK(stat.starttime == 1000ULL + pid);
+    CHECK(stat.vsize == (unsigned long long)pid * 4096 * 100);
+    CHECK(stat.rss == pid % 2048);
+
+    /* a pid that is not in the tree */
+    CHECK(parse_process_stat(FIXTURE_PID_COUNT + 1, &stat) == false);
+    CHECK(get_procfs_last_error(NULL, &error) && error.code == ENOENT);
+}
+
+static void test_status_data()
+{
+    struct ProcessStatus status;
+    const char* odd =
+        "Name:\tsh\nPi:\t3\nPidd:\t9\nVmRSS:\t     12 kB\nUid:\t1\t2\t3\t4\nNSpid:\t90\t7\nPid:\t90";
+    const char* kernel_thread = "Name:\tkworker/0:1\nState:\tI (idle)\nTgid:\t8\nPid:\t8\nKthread:\t1\nThreads:\t1\n";
+    const char* malformed = "no key here\nName:\tsh\n";
+
+    /* keys that are no field, or collide with the slot of one, are skipped */
+    CHECK(parse_process_status_data(odd, strlen(odd), STATUS_ALL_FIELDS, &status));
+    CHECK(status.fields == (STATUS_FIELD(STATUS_NAME) | STATUS_FIELD(STATUS_VM_RSS) | STATUS_FIELD(STATUS_UID) |
+        STATUS_FIELD(STATUS_NS_PID) | STATUS_FIELD(STATUS_PID)));
+    CHECK(strcmp(status.name, "sh") == 0);
+    CHECK(status.vm_rss == 12);
+    CHECK(status.uid[0] == 1 && status.uid[1] == 2 && status.uid[2] == 3 && status.uid[3] == 4);
+    CHECK(status.ns_pid_count == 2 && status.ns_pid[0] == 90 && status.ns_pid[1] == 7);
+
+    /* the last line needs no newline */
+    CHECK(status.pid == 90);
+
+    /* lines of fields outside the mask are not parsed */
+    CHECK(parse_process_status_data(odd, strlen(odd), STATUS_FIELD(STATUS_UID), &status));
+    CHECK(status.fields == STATUS_FIELD(STATUS_UID));
+    CHECK(status.name[0] == '\0' && status.vm_rss == 0 && status.pid == 0);
+
+    /* no memory lines is well-formed */
+    CHECK(parse_process_status_data(kernel_thread, strlen(kernel_thread), STATUS_ALL_FIELDS, &status));
+    CHECK(status.kthread && status.state == 'I' && status.threads == 1);
+    CHECK((status.fields & STATUS_FIELD(STATUS_VM_RSS)) == 0);
+
+    CHECK(parse_process_status_data(malformed, strlen(malformed), STATUS_ALL_FIELDS, &status) == false);
+    CHECK(parse_process_status_data("", 0, STATUS_ALL_FIELDS, &status) == false);
+}
+
+static void test_status_file()
+{
+    struct ProcessStatus status;
+    int pid = 5;
+    int field;
+
+    CHECK(parse_process_status(pid, STATUS_ALL_FIELDS, &status));
+    CHECK(status.fields == STATUS_ALL_FIELDS);
+    CHECK(strcmp(status.name, "worker 5") == 0);
+    CHECK(status.umask == 022);
+    CHECK(status.state == 'S');
+    CHECK(status.tgid == pid && status.pid == pid && status.ppid == 1 && status.tracer_pid == 0);
+    CHECK(status.uid[0] == (uid_t)pid && status.uid[3] == (uid_t)pid && status.gid[2] == (gid_t)pid);
+    CHECK(status.fd_size == 64);
+    CHECK(status.ns_tgid_count == 1 && status.ns_tgid[0] == pid);
+    CHECK(status.kthread == false);
+    CHECK(status.vm_peak == 1000ULL + pid && status.vm_rss == 500ULL + pid && status.rss_anon == 400ULL + pid);
+    CHECK(status.rss_file == 1312 && status.vm_pte == 44);
+    CHECK(status.vm_swap == (unsigned long long)pid);
+    CHECK(status.threads == 1 + pid);
+    CHECK(strcmp(status.cpus_allowed_list, "0-7") == 0 && strcmp(status.mems_allowed_list, "0") == 0);
+    CHECK(status.voluntary_ctxt_switches == (unsigned long long)pid);
+    CHECK(status.nonvoluntary_ctxt_switches == (unsigned long long)pid);
+
+    /* every key reaches its field through the hash table on its own */
+    for (field = 0; field < STATUS_FIELD_COUNT; field++) {
+        CHECK(parse_process_status(pid, STATUS_FIELD(field), &status));
+        if (CHECK(status.fields == STATUS_FIELD(field)) == false) {
+            fprintf(stderr, "  status field %d\n", field);
+        }
+    }
+}
+
+static void test_smaps_rollup(const char* root)
+{
+    struct SmapsRollup rollup;
+    const char* rollup_6x =
+        "55d0c0a00000-7ffd3b1f1000 ---p 00000000 00:00 0                          [rollup]\n"
+        "Rss:                2000 kB\nPss:                1000 kB\nPss_Dirty:           300 kB\n"
+        "Pss_Anon:            400 kB\nPss_File:            500 kB\nPss_Shmem:           100 kB\n"
+        "Shared_Clean:        600 kB\nShared_Dirty:          0 kB\nPrivate_Clean:       200 kB\n"
+        "Private_Dirty:       300 kB\nReferenced:         1900 kB\nAnonymous:           400 kB\n"
+        "KSM:                   0 kB\nLazyFree:              0 kB\nAnonHugePages:         0 kB\n"
+        "Swap:                  7 kB\nSwapPss:               3 kB\nLocked:                1 kB\n";
+    const char* rollup_4x =
+        "00400000-7ffd3b1f1000 ---p 00000000 00:00 0                          [rollup]\n"
+        "Rss:                  64 kB\nPss:                  32 kB\nShared_Clean:          32 kB\n"
+        "Swap:                  0 kB\nSwapPss:               0 kB\nLocked:                0 kB\n";
+    const char* header_only = "00400000-00401000 ---p 00000000 00:00 0 [rollup]\n";
+    procfs_context_t context = NULL;
+
+    CHECK(parse_smaps_rollup_data(rollup_6x, strlen(rollup_6x), &rollup));
+    CHECK(rollup.rss == 2000 && rollup.pss == 1000 && rollup.pss_dirty == 300);
+    CHECK(rollup.pss_anon == 400 && rollup.pss_file == 500 && rollup.pss_shmem == 100);
+    CHECK(rollup.shared_clean == 600 && rollup.private_clean == 200 && rollup.private_dirty == 300);
+    CHECK(rollup.referenced == 1900 && rollup.anonymous == 400);
+    CHECK(rollup.swap == 7 && rollup.swap_pss == 3 && rollup.locked == 1);
+
+    /* fields of later kernels stay 0 */
+    CHECK(parse_smaps_rollup_data(rollup_4x, strlen(rollup_4x), &rollup));
+    CHECK(rollup.rss == 64 && rollup.pss == 32 && rollup.shared_clean == 32);
+    CHECK(rollup.pss_anon == 0 && rollup.pss_dirty == 0);
+
+    CHECK(parse_smaps_rollup_data(header_only, strlen(header_only), &rollup) == false);
+
+    /* the file variant through a context of its own */
+    CHECK(write_test_file(root, 300, "smaps_rollup", rollup_6x, strlen(rollup_6x)));
+
+    context = create_procfs_context();
+    CHECK(context != NULL);
+    CHECK(set_context_procfs_root(context, root));
+    set_thread_procfs_context(context);
+
+    CHECK(parse_smaps_rollup(300, &rollup));
+    CHECK(rollup.pss == 1000 && rollup.swap_pss == 3);
+    CHECK(parse_smaps_rollup(301, &rollup) == false);
+
+    set_thread_procfs_context(NULL);
+    destroy_procfs_context(context);
+
+    /* the default context is left at the fixture */
+    CHECK(parse_smaps_rollup(300, &rollup) == false);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* fixture = get_fixture_root(argc, argv);
+    char root[PATH_MAX];
+
+    CHECK(set_procfs_root(fixture));
+    CHECK(create_test_root(root, sizeof(root)));
+
+    test_stat_data();
+    test_stat_file();
+    test_status_data();
+    test_status_file();
+    test_smaps_rollup(root);
+
+    remove_test_root(root);
+
+    return finish_tests("parsers");
+}
@@ -0,0 +1,173 @@
+/*
+ * process tree: the flat fixture tree, then a hierarchy of its own that
+ * loses a process, gains one and has its usage refreshed
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/limits.h>
+
+#include "procfs_parser_api.h"
+#include "test.h"
+
+/* a subtree is its preorder range, and the range of a child lies in that of its parent */
+static bool check_links(const struct ProcessTree* tree)
+{
+    int i;
+
+    for (i = 0; i < tree->node_count; i++) {
+        const struct ProcessNode* node = &tree->nodes[i];
+
+        if (tree->preorder[node->preorder] != i || node->subtree_end <= node->preorder) {
+            return false;
+        }
+
+        if (node->parent >= 0) {
+            const struct ProcessNode* parent = &tree->nodes[node->parent];
+
+            if (node->preorder <= parent->preorder || node->subtree_end > parent->subtree_end) {
+                return false;
+            }
+        }
+
+        if (i > 0 && tree->nodes[i - 1].pid >= node->pid) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool check_subtree(const struct ProcessTree* tree, pid_t pid, int count, unsigned long long cpu_time, long long rss)
+{
+    struct ProcessUsage usage;
+
+    if (aggregate_process_subtree(tree, pid, &usage) == false) {
+        return false;
+    }
+
+    if (usage.process_count != count || usage.cpu_time != cpu_time || usage.rss != rss) {
+        fprintf(stderr, "  subtree of %d: %d processes, %llu ticks, %lld pages\n",
+            pid, usage.process_count, usage.cpu_time, usage.rss);
+        return false;
+    }
+
+    return true;
+}
+
+static void test_fixture_tree()
+{
+    struct ProcessTree* tree = NULL;
+    struct ProcessUsage usage;
+    int count = FIXTURE_PID_COUNT;
+
+    if (CHECK(build_process_tree(&tree)) == false) {
+        return;
+    }
+
+    /* every process is a child of 1, with utime and stime of pid and rss of pid pages */
+    CHECK(tree->node_count == count);
+    CHECK(check_links(tree));
+    CHECK(find_process_node(tree, 1) == 0 && tree->nodes[0].parent == -1);
+    CHECK(tree->nodes[0].child_count == count - 1);
+    CHECK(find_process_node(tree, count + 1) == -1);
+
+    CHECK(check_subtree(tree, 1, count, (unsigned long long)count * (count + 1), (long long)count * (count + 1) / 2));
+    CHECK(check_subtree(tree, 5, 1, 10, 5));
+    CHECK(aggregate_process_subtree(tree, count + 1, &usage) == false);
+
+    /* each process leads its own session */
+    CHECK(aggregate_process_session(tree, 7, &usage) && usage.process_count == 1 && usage.rss == 7);
+    CHECK(aggregate_process_session(tree, count + 1, &usage) == false);
+
+    free_process_tree(tree);
+}
+
+/* utime of pid * 10 and stime of pid, so a process has 11 * pid ticks */
+static bool write_node(const char* root, int pid, int ppid, int session)
+{
+    return write_test_stat(root, pid, ppid, session, pid * 10ULL, pid);
+}
+
+static void test_updates(const char* root)
+{
+    static const pid_t added[] = { 7 };
+    static const pid_t exited[] = { 3 };
+    struct ProcessTree* tree = NULL;
+    struct ProcessUsage usage;
+    procfs_context_t context = NULL;
+
+    /*
+     * 1 ─┬─ 2 ─┬─ 3 ── 5
+     *    │     └─ 4
+     *    └─ 6
+     */
+    CHECK(write_node(root, 1, 0, 1));
+    CHECK(write_node(root, 2, 1, 2));
+    CHECK(write_node(root, 3, 2, 2));
+    CHECK(write_node(root, 4, 2, 2));
+    CHECK(write_node(root, 5, 3, 2));
+    CHECK(write_node(root, 6, 1, 6));
+
+    context = create_procfs_context();
+    CHECK(set_context_procfs_root(context, root));
+    set_thread_procfs_context(context);
+
+    if (CHECK(build_process_tree(&tree)) == false) {
+        goto done;
+    }
+
+    CHECK(tree->node_count == 6 && check_links(tree));
+    CHECK(check_subtree(tree, 1, 6, 11 * 21, 21));
+    CHECK(check_subtree(tree, 2, 4, 11 * 14, 14));
+    CHECK(check_subtree(tree, 3, 2, 11 * 8, 8));
+    CHECK(aggregate_process_session(tree, 2, &usage) && usage.process_count == 4 && usage.rss == 14);
+    CHECK(aggregate_process_session(tree, 6, &usage) && usage.process_count == 1);
+
+    /* 3 exits and 5 is reparented to 1, 7 is forked by 6 */
+    CHECK(remove_test_pid(root, 3));
+    CHECK(write_node(root, 5, 1, 2));
+    CHECK(write_node(root, 7, 6, 6));
+
+    CHECK(update_process_tree(tree, added, 1, exited, 1));
+    CHECK(tree->node_count == 6 && check_links(tree));
+    CHECK(find_process_node(tree, 3) == -1);
+    CHECK(tree->nodes[find_process_node(tree, 5)].parent == find_process_node(tree, 1));
+    CHECK(check_subtree(tree, 2, 2, 11 * 6, 6));
+    CHECK(check_subtree(tree, 6, 2, 11 * 13, 13));
+    CHECK(check_subtree(tree, 1, 6, 11 * 25, 25));
+    CHECK(aggregate_process_session(tree, 6, &usage) && usage.process_count == 2);
+
+    /* 4 used more cpu and 7 exited, a refresh picks up both */
+    CHECK(write_test_stat(root, 4, 2, 2, 1000, 4));
+    CHECK(remove_test_pid(root, 7));
+
+    CHECK(refresh_process_tree_usage(tree));
+    CHECK(tree->node_count == 5 && check_links(tree));
+    CHECK(find_process_node(tree, 7) == -1);
+    CHECK(check_subtree(tree, 2, 2, 22 + 1000 + 4, 6));
+    CHECK(check_subtree(tree, 6, 1, 66, 6));
+
+    free_process_tree(tree);
+
+done:
+
+    set_thread_procfs_context(NULL);
+    destroy_procfs_context(context);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* fixture = get_fixture_root(argc, argv);
+    char root[PATH_MAX];
+
+    CHECK(set_procfs_root(fixture));
+    CHECK(create_test_root(root, sizeof(root)));
+
+    test_fixture_tree();
+    test_updates(root);
+
+    remove_test_root(root);
+
+    return finish_tests("process_tree");
+}
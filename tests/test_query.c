@@ -0,0 +1,230 @@
+/*
+ * query engine: conditions on each file of the fixture tree, conjunctions
+ * across files, pid lists, and processes without the file a condition needs
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/limits.h>
+
+#include "procfs_parser_api.h"
+#include "test.h"
+
+/* pids of the results are those of expected, in order */
+static bool check_results(const struct ProcessQueryResult* results, int count, const pid_t* expected, int expected_count)
+{
+    int i;
+
+    if (count != expected_count) {
+        fprintf(stderr, "  %d results, %d expected\n", count, expected_count);
+        return false;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (results[i].stat.pid != expected[i]) {
+            fprintf(stderr, "  result %d is pid %d, %d expected\n", i, results[i].stat.pid, expected[i]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* pids from first to last whose pid % modulo is at least remainder */
+static int select_pids(pid_t* pids, int first, int last, int modulo, int remainder)
+{
+    int count = 0;
+    int pid;
+
+    for (pid = first; pid <= last; pid++) {
+        if (pid % modulo >= remainder) {
+            pids[count++] = pid;
+        }
+    }
+
+    return count;
+}
+
+static bool run_query(process_query_t query, const pid_t* pids, int pid_count, const pid_t* expected, int expected_count,
+    struct ProcessQueryResult** kept)
+{
+    struct ProcessQueryResult* results = NULL;
+    int count = 0;
+    bool result;
+
+    if (run_process_query(query, pids, pid_count, &results, &count) == false) {
+        return false;
+    }
+
+    result = check_results(results, count, expected, expected_count);
+
+    if (kept) {
+        *kept = results;
+    }
+    else {
+        free(results);
+    }
+
+    return result;
+}
+
+static void test_stat_conditions()
+{
+    struct ProcessQueryResult* results = NULL;
+    process_query_t query = NULL;
+    pid_t expected[FIXTURE_PID_COUNT];
+    int count;
+
+    /* no condition, every process with its stat */
+    query = create_process_query();
+    count = select_pids(expected, 1, FIXTURE_PID_COUNT, 1, 0);
+    CHECK(run_query(query, NULL, 0, expected, count, &results));
+    CHECK(results && results[6].stat.vsize == 7ULL * 4096 * 100 && strcmp(results[6].stat.comm, "worker 7") == 0);
+    free(results);
+    destroy_process_query(query);
+
+    /* num_threads is 1 + pid % 16 */
+    query = create_process_query();
+    CHECK(add_query_condition(query, QUERY_NUM_THREADS, QUERY_GE, 15));
+    count = select_pids(expected, 1, FIXTURE_PID_COUNT, 16, 14);
+    CHECK(run_query(query, NULL, 0, expected, count, NULL));
+    destroy_process_query(query);
+
+    /* rss is in bytes */
+    query = create_process_query();
+    CHECK(add_query_condition(query, QUERY_RSS, QUERY_EQ, 3 * sysconf(_SC_PAGESIZE)));
+    expected[0] = 3;
+    CHECK(run_query(query, NULL, 0, expected, 1, NULL));
+    destroy_process_query(query);
+
+    query = create_process_query();
+    CHECK(add_query_condition(query, QUERY_FIELD_COUNT, QUERY_EQ, 0) == false);
+    CHECK(add_query_condition(query, QUERY_PPID, QUERY_GT + 1, 0) == false);
+    CHECK(add_query_match(query, QUERY_PPID, "*") == false);
+    destroy_process_query(query);
+}
+
+static void test_status_conditions()
+{
+    struct ProcessQueryResult* results = NULL;
+    process_query_t query = NULL;
+    pid_t expected[FIXTURE_PID_COUNT];
+    int count;
+    int i;
+
+    /* cpu time is 2 * pid, uid is pid */
+    query = create_process_query();
+    CHECK(add_query_condition(query, QUERY_CPU_TIME, QUERY_GT, 100));
+    CHECK(add_query_condition(query, QUERY_UID, QUERY_LT, 60));
+    count = select_pids(expected, 51, 59, 1, 0);
+    CHECK(run_query(query, NULL, 0, expected, count, &results));
+
+    /* status holds the fields conditions refer to */
+    for (i = 0; results && i < count; i++) {
+        CHECK(results[i].status.fields == STATUS_FIELD(STATUS_UID));
+        CHECK(results[i].status.uid[0] == (uid_t)results[i].stat.pid);
+    }
+
+    free(results);
+    destroy_process_query(query);
+
+    /* swap is in bytes */
+    query = create_process_query();
+    CHECK(add_query_condition(query, QUERY_SWAP, QUERY_EQ, 10 * 1024));
+    expected[0] = 10;
+    CHECK(run_query(query, NULL, 0, expected, 1, NULL));
+    destroy_process_query(query);
+}
+
+static void test_matches()
+{
+    process_query_t query = NULL;
+    pid_t expected[FIXTURE_PID_COUNT];
+    int count;
+
+    query = create_process_query();
+    CHECK(add_query_match(query, QUERY_MATCH_COMM, "worker 1?"));
+    count = select_pids(expected, 10, 19, 1, 0);
+    CHECK(run_query(query, NULL, 0, expected, count, NULL));
+    destroy_process_query(query);
+
+    /* arguments are joined by spaces, the cmdline of pid 2 is too short for a second option */
+    query = create_process_query();
+    CHECK(add_query_match(query, QUERY_MATCH_CMDLINE, "/usr/bin/worker --option-16=value --option-34=value*"));
+    expected[0] = 1;
+    count = 1 + select_pids(expected + 1, 3, FIXTURE_PID_COUNT, 1, 0);
+    CHECK(run_query(query, NULL, 0, expected, count, NULL));
+    destroy_process_query(query);
+}
+
+static void test_pid_list()
+{
+    static const pid_t pids[] = { 40, 5, FIXTURE_PID_COUNT + 100, 3, 41 };
+    static const pid_t expected[] = { 3, 5, 40 };
+    process_query_t query = create_process_query();
+
+    /* pids that do not exist are dropped, results come in pid order */
+    CHECK(add_query_condition(query, QUERY_STARTTIME, QUERY_LT, 1041));
+    CHECK(run_query(query, pids, 5, expected, 3, NULL));
+
+    destroy_process_query(query);
+}
+
+static void test_smaps_rollup(const char* root)
+{
+    static const pid_t expected[] = { 701, 703 };
+    process_query_t query = NULL;
+    procfs_context_t context = NULL;
+    char rollup[256];
+    int length;
+    int pid;
+
+    query = create_process_query();
+    CHECK(add_query_condition(query, QUERY_PSS, QUERY_GT, 1024 * 1024));
+    CHECK(add_query_condition(query, QUERY_PSS_ANON, QUERY_EQ, 12 * 1024));
+
+    /* the fixture has no smaps_rollup, processes without it are dropped */
+    CHECK(run_query(query, NULL, 0, NULL, 0, NULL));
+
+    for (pid = 700; pid < 704; pid++) {
+        length = snprintf(rollup, sizeof(rollup),
+            "00400000-7ffd3b1f1000 ---p 00000000 00:00 0 [rollup]\nRss: 2048 kB\nPss: %d kB\nPss_Anon: 12 kB\n",
+            pid % 2 ? 1024 + pid : 1000);
+
+        CHECK(write_test_stat(root, pid, 1, pid, pid, pid));
+        CHECK(write_test_file(root, pid, "smaps_rollup", rollup, length));
+    }
+
+    /* one without smaps_rollup, e.g. a kernel thread */
+    CHECK(write_test_stat(root, 705, 1, 705, 705, 705));
+
+    context = create_procfs_context();
+    CHECK(set_context_procfs_root(context, root));
+    set_thread_procfs_context(context);
+
+    CHECK(run_query(query, NULL, 0, expected, 2, NULL));
+
+    set_thread_procfs_context(NULL);
+    destroy_procfs_context(context);
+    destroy_process_query(query);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* fixture = get_fixture_root(argc, argv);
+    char root[PATH_MAX];
+
+    CHECK(set_procfs_root(fixture));
+    CHECK(create_test_root(root, sizeof(root)));
+
+    test_stat_conditions();
+    test_status_conditions();
+    test_matches();
+    test_pid_list();
+    test_smaps_rollup(root);
+
+    remove_test_root(root);
+
+    return finish_tests("query");
+}
@@ -0,0 +1,156 @@
+/*
+ * sample ring: fixture stats and maps changes through a producer and
+ * independent consumers, and records lost by a consumer that fell behind
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/limits.h>
+
+#include "procfs_parser_api.h"
+#include "test.h"
+
+#define RING_SLOTS 8
+
+static const char previous_maps[] =
+    "00400000-00452000 r-xp 00000000 08:02 173521      /usr/bin/dbus-daemon\n"
+    "00651000-00652000 rw-p 00051000 08:02 173521      /usr/bin/dbus-daemon\n"
+    "00e03000-00e24000 rw-p 00000000 00:00 0           [heap]\n"
+    "35b1800000-35b1820000 r-xp 00000000 08:02 135522  /usr/lib64/ld-2.15.so\n";
+
+/* the heap grew, ld.so was unmapped and a library mapped */
+static const char current_maps[] =
+    "00400000-00452000 r-xp 00000000 08:02 173521      /usr/bin/dbus-daemon\n"
+    "00651000-00652000 rw-p 00051000 08:02 173521      /usr/bin/dbus-daemon\n"
+    "00e03000-00e45000 rw-p 00000000 00:00 0           [heap]\n"
+    "35b1a00000-35b1a20000 r-xp 00000000 08:02 135870  /usr/lib64/libc-2.15.so\n";
+
+static void test_stats(const char* path)
+{
+    struct SampleRecord record;
+    struct ProcessStat stat;
+    sample_ring_t producer = NULL;
+    sample_ring_t consumer = NULL;
+    sample_ring_t late = NULL;
+    unsigned long long lost = 0;
+    int pid;
+
+    CHECK(create_sample_ring(path, RING_SLOTS - 1) == NULL);
+
+    producer = create_sample_ring(path, RING_SLOTS);
+    if (CHECK(producer != NULL) == false) {
+        return;
+    }
+
+    consumer = open_sample_ring(path);
+    CHECK(consumer != NULL);
+    CHECK(read_sample_ring(consumer, &record, &lost) == false);
+
+    for (pid = 1; pid <= 5; pid++) {
+        CHECK(parse_process_stat(pid, &stat));
+        publish_process_stat(producer, 1000 + pid, &stat);
+    }
+
+    /* reading starts at records published after open */
+    late = open_sample_ring(path);
+    CHECK(late != NULL && read_sample_ring(late, &record, &lost) == false);
+
+    for (pid = 1; pid <= 5; pid++) {
+        memset(&record, 0x00, sizeof(record));
+        CHECK(read_sample_ring(consumer, &record, &lost));
+        CHECK(record.type == SAMPLE_RECORD_STAT && record.pid == pid);
+        CHECK(record.sequence == (unsigned long long)pid - 1 && record.timestamp_ns == 1000ULL + pid);
+        CHECK(record.stat.pid == pid && record.stat.vsize == (unsigned long long)pid * 4096 * 100);
+        CHECK(strncmp(record.stat.comm, "worker ", 7) == 0);
+    }
+
+    CHECK(read_sample_ring(consumer, &record, &lost) == false);
+    CHECK(lost == 0);
+
+    /* a consumer lapped by the producer skips to the oldest record left */
+    for (pid = 1; pid <= 20; pid++) {
+        CHECK(parse_process_stat(pid, &stat));
+        publish_process_stat(producer, 2000 + pid, &stat);
+    }
+
+    CHECK(read_sample_ring(consumer, &record, &lost));
+    CHECK(lost == 20 - RING_SLOTS);
+    CHECK(record.pid == 20 - RING_SLOTS + 1 && record.sequence == 5 + 20 - RING_SLOTS);
+
+    while (read_sample_ring(consumer, &record, &lost)) {
+    }
+    CHECK(record.pid == 20 && lost == 20 - RING_SLOTS);
+
+    close_sample_ring(late);
+    close_sample_ring(consumer);
+    destroy_sample_ring(producer);
+
+    /* the file goes with the producer */
+    CHECK(open_sample_ring(path) == NULL);
+}
+
+static void test_vma_changes(const char* path)
+{
+    static const unsigned int expected_types[] = {
+        SAMPLE_RECORD_VMA_CHANGED, SAMPLE_RECORD_VMA_REMOVED, SAMPLE_RECORD_VMA_ADDED
+    };
+    static const char* expected_paths[] = { "[heap]", "/usr/lib64/ld-2.15.so", "/usr/lib64/libc-2.15.so" };
+    struct VirtualMemoryArea* previous = NULL;
+    struct VirtualMemoryArea* current = NULL;
+    struct SampleRecord record;
+    sample_ring_t producer = NULL;
+    sample_ring_t consumer = NULL;
+    unsigned long long lost = 0;
+    int previous_count = 0;
+    int current_count = 0;
+    int i;
+
+    CHECK(parse_maps_data(previous_maps, sizeof(previous_maps) - 1, &previous, &previous_count));
+    CHECK(parse_maps_data(current_maps, sizeof(current_maps) - 1, &current, &current_count));
+
+    producer = create_sample_ring(path, RING_SLOTS);
+    consumer = open_sample_ring(path);
+    if (CHECK(producer != NULL && consumer != NULL) == false) {
+        return;
+    }
+
+    CHECK(publish_vma_changes(producer, 1, 42, previous, previous_count, previous, previous_count) == 0);
+    CHECK(publish_vma_changes(producer, 2, 42, previous, previous_count, current, current_count) == 3);
+
+    for (i = 0; i < 3; i++) {
+        /* only the pathname up to its NUL is copied */
+        memset(&record, 0xff, sizeof(record));
+        CHECK(read_sample_ring(consumer, &record, &lost));
+        CHECK(record.type == expected_types[i] && record.pid == 42 && record.timestamp_ns == 2);
+        CHECK(strcmp(record.vma.pathname, expected_paths[i]) == 0);
+        CHECK(record.size < sizeof(struct SampleRecord));
+    }
+
+    CHECK(record.vma.start_address == 0x35b1a00000ULL && record.vma.inode == 135870);
+    CHECK(record.vma.permissions == (VMA_READ | VMA_EXEC));
+    CHECK(read_sample_ring(consumer, &record, &lost) == false && lost == 0);
+
+    close_sample_ring(consumer);
+    destroy_sample_ring(producer);
+
+    free(previous);
+    free(current);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* fixture = get_fixture_root(argc, argv);
+    char root[PATH_MAX];
+    char path[PATH_MAX + 16];
+
+    CHECK(set_procfs_root(fixture));
+    CHECK(create_test_root(root, sizeof(root)));
+    snprintf(path, sizeof(path), "%s/ring", root);
+
+    test_stats(path);
+    test_vma_changes(path);
+
+    remove_test_root(root);
+
+    return finish_tests("sample_ring");
+}
@@ -0,0 +1,213 @@
+/*
+ * snapshot file: samples of fixture stats written and read back, and the
+ * dictionary rolled back when a block cannot be written
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <linux/limits.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+#include "procfs_parser_api.h"
+#include "test.h"
+
+static bool read_stats(const int* pids, int count, struct ProcessStat* stats)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (parse_process_stat(pids[i], &stats[i]) == false) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* row of pid in sample, -1 if it has none */
+static int find_row(snapshot_reader_t reader, int sample, pid_t pid)
+{
+    const unsigned int* ids = get_snapshot_ids(reader, sample);
+    unsigned long long timestamp_ns;
+    unsigned long long starttime;
+    int row_count;
+    pid_t row_pid;
+    int i;
+
+    if (ids == NULL || get_snapshot_sample(reader, sample, &timestamp_ns, &row_count) == false) {
+        return -1;
+    }
+
+    for (i = 0; i < row_count; i++) {
+        if (get_snapshot_process(reader, ids[i], &row_pid, &starttime) && row_pid == pid) {
+            return starttime == 1000ULL + pid ? i : -1;
+        }
+    }
+
+    return -1;
+}
+
+static void test_samples(const char* root)
+{
+    static const int first_pids[] = { 1, 2, 3 };
+    static const int second_pids[] = { 3, 4 };
+    struct ProcessStat stats[3];
+    struct ProcfsError error;
+    char path[PATH_MAX + 16];
+    snapshot_writer_t writer = NULL;
+    snapshot_reader_t reader = NULL;
+    const unsigned long long* column = NULL;
+    unsigned long long timestamp_ns;
+    int row_count;
+    int row;
+
+    snprintf(path, sizeof(path), "%s/samples", root);
+
+    writer = create_snapshot_file(path, 3);
+    if (CHECK(writer != NULL) == false) {
+        return;
+    }
+
+    CHECK(read_stats(first_pids, 3, stats));
+    stats[1].nice = -5;
+    CHECK(append_snapshot_sample(writer, 100, stats, 3));
+
+    /* a reader sees the samples published when it opened */
+    reader = open_snapshot_reader(path);
+    CHECK(reader != NULL && get_snapshot_sample_count(reader) == 1);
+
+    CHECK(read_stats(second_pids, 2, stats));
+    CHECK(append_snapshot_sample(writer, 200, stats, 2));
+    CHECK(append_snapshot_sample(writer, 200, stats, 0));
+
+    CHECK(append_snapshot_sample(writer, 300, stats, 2) == false);
+    CHECK(get_procfs_last_error(NULL, &error) && error.code == ENOSPC);
+
+    close_snapshot_file(writer);
+
+    CHECK(reader != NULL && get_snapshot_sample_count(reader) == 1);
+    close_snapshot_reader(reader);
+
+    reader = open_snapshot_reader(path);
+    if (CHECK(reader != NULL) == false) {
+        return;
+    }
+
+    CHECK(get_snapshot_sample_count(reader) == 3);
+    CHECK(find_snapshot_sample(reader, 99) == -1);
+    CHECK(find_snapshot_sample(reader, 100) == 0);
+    CHECK(find_snapshot_sample(reader, 150) == 0);
+    CHECK(find_snapshot_sample(reader, 200) == 2);
+    CHECK(find_snapshot_sample(reader, 1000) == 2);
+
+    CHECK(get_snapshot_sample(reader, 0, &timestamp_ns, &row_count) && timestamp_ns == 100 && row_count == 3);
+    CHECK(get_snapshot_sample(reader, 2, &timestamp_ns, &row_count) && timestamp_ns == 200 && row_count == 0);
+    CHECK(get_snapshot_sample(reader, 3, &timestamp_ns, &row_count) == false);
+
+    /* columns hold the fixture values, signed ones as two's complement */
+    row = find_row(reader, 0, 2);
+    column = get_snapshot_column(reader, 0, SNAPSHOT_NICE);
+    CHECK(row >= 0 && column && (long long)column[row] == -5);
+
+    column = get_snapshot_column(reader, 0, SNAPSHOT_VSIZE);
+    CHECK(row >= 0 && column && column[row] == 2ULL * 4096 * 100);
+
+    /* pid 3 keeps its dictionary id across samples */
+    row = find_row(reader, 1, 3);
+    CHECK(row >= 0 && get_snapshot_ids(reader, 1)[row] == get_snapshot_ids(reader, 0)[find_row(reader, 0, 3)]);
+
+    column = get_snapshot_column(reader, 1, SNAPSHOT_UTIME);
+    CHECK(row >= 0 && column && column[row] == 3);
+
+    row = find_row(reader, 1, 4);
+    column = get_snapshot_column(reader, 1, SNAPSHOT_NUM_THREADS);
+    CHECK(row >= 0 && column && column[row] == 1 + 4 % 16);
+
+    CHECK(get_snapshot_column(reader, 1, SNAPSHOT_COLUMN_COUNT) == NULL);
+
+    close_snapshot_reader(reader);
+}
+
+static void test_dictionary_rollback(const char* root)
+{
+    static const int first_pids[] = { 1, 2 };
+    static const int failed_pids[] = { 2, 10, 11 };
+    static const int next_pids[] = { 12, 2 };
+    struct ProcessStat stats[3];
+    struct ProcfsError error;
+    struct rlimit saved;
+    struct rlimit limit;
+    struct stat st;
+    char path[PATH_MAX + 16];
+    snapshot_writer_t writer = NULL;
+    snapshot_reader_t reader = NULL;
+    pid_t pid;
+    unsigned long long starttime;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/rollback", root);
+
+    writer = create_snapshot_file(path, 8);
+    if (CHECK(writer != NULL) == false) {
+        return;
+    }
+
+    CHECK(read_stats(first_pids, 2, stats));
+    CHECK(append_snapshot_sample(writer, 100, stats, 2));
+
+    /* the file cannot grow, the block introducing 10 and 11 is not written */
+    CHECK(stat(path, &st) == 0);
+    CHECK(getrlimit(RLIMIT_FSIZE, &saved) == 0);
+    signal(SIGXFSZ, SIG_IGN);
+
+    limit = saved;
+    limit.rlim_cur = st.st_size;
+    CHECK(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+
+    CHECK(read_stats(failed_pids, 3, stats));
+    CHECK(append_snapshot_sample(writer, 200, stats, 3) == false);
+    CHECK(get_procfs_last_error(NULL, &error) && error.code == EFBIG);
+
+    CHECK(setrlimit(RLIMIT_FSIZE, &saved) == 0);
+
+    /* 12 takes the id 10 would have had, and the reader accepts the block */
+    CHECK(read_stats(next_pids, 2, stats));
+    CHECK(append_snapshot_sample(writer, 300, stats, 2));
+
+    close_snapshot_file(writer);
+
+    reader = open_snapshot_reader(path);
+    if (CHECK(reader != NULL) == false) {
+        return;
+    }
+
+    CHECK(get_snapshot_sample_count(reader) == 2);
+    CHECK(get_snapshot_ids(reader, 1) && get_snapshot_ids(reader, 1)[0] == 2);
+    CHECK(get_snapshot_process(reader, 2, &pid, &starttime) && pid == 12 && starttime == 1012);
+    CHECK(get_snapshot_process(reader, 3, &pid, &starttime) == false);
+
+    for (i = 0; i < 2; i++) {
+        CHECK(find_row(reader, i, 2) >= 0);
+    }
+
+    close_snapshot_reader(reader);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* fixture = get_fixture_root(argc, argv);
+    char root[PATH_MAX];
+
+    CHECK(set_procfs_root(fixture));
+    CHECK(create_test_root(root, sizeof(root)));
+
+    test_samples(root);
+    test_dictionary_rollback(root);
+
+    remove_test_root(root);
+
+    return finish_tests("snapshot_file");
+}
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+
+bool match_vma_filter(const struct VmaFilter* filter, const struct VirtualMemoryArea* vma)
+{
+    unsigned long long size = vma->end_address - vma->start_address;
+
+    if ((vma->permissions & filter->permissions_mask) != (filter->permissions & filter->permissions_mask)) {
+        return false;
+    }
+
+    if ((filter->backing == VMA_ANONYMOUS && vma->inode != UNKNOWN_INODE) ||
+        (filter->backing == VMA_FILE_BACKED && vma->inode == UNKNOWN_INODE)) {
+        return false;
+    }
+
+    if (filter->inode != UNKNOWN_INODE && vma->inode != filter->inode) {
+        return false;
+    }
+
+    if (size < filter->min_size || (filter->max_size && size > filter->max_size)) {
+        return false;
+    }
+
+    /* overlapping [start_address, end_address) */
+    if (filter->end_address &&
+        (vma->end_address <= filter->start_address || vma->start_address >= filter->end_address)) {
+        return false;
+    }
+
+    /* last, the only check that is not a few compares */
+    if (filter->pathname && fnmatch(filter->pathname, vma->pathname, 0) != 0) {
+        return false;
+    }
+
+    return true;
+}
+
+/* index of the first filter vma matches, -1 if none does */
+static int match_vma_filters(const struct VmaFilter* filters, int filter_count, const struct VirtualMemoryArea* vma)
+{
+    int i;
+
+    for (i = 0; i < filter_count; i++) {
+        if (match_vma_filter(&filters[i], vma)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* to whole pages of the filter range, so the VMA stays page aligned */
+static void clip_vma(const struct VmaFilter* filter, struct VirtualMemoryArea* vma)
+{
+    unsigned long long page_size = (unsigned long long)sysconf(_SC_PAGESIZE);
+    unsigned long long start_address;
+    unsigned long long end_address;
+
+    if (filter->end_address == 0) {
+        return;
+    }
+
+    start_address = filter->start_address & ~(page_size - 1);
+    end_address = (filter->end_address + page_size - 1) & ~(page_size - 1);
+
+    if (vma->start_address < start_address) {
+        if (vma->inode != UNKNOWN_INODE) {
+            vma->file_offset += start_address - vma->start_address;
+        }
+        vma->start_address = start_address;
+    }
+
+    if (end_address != 0 && vma->end_address > end_address) {
+        vma->end_address = end_address;
+    }
+}
+
+bool select_vmas(const struct VirtualMemoryArea* VMAs, int vma_count, const struct VmaFilter* filters, int filter_count,
+    struct VirtualMemoryArea** selected_VMAs, int* selected_count)
+{
+    struct VirtualMemoryArea* selected = NULL;
+    int count = 0;
+    int i;
+
+    selected = malloc((vma_count + 1) * sizeof(struct VirtualMemoryArea));
+    if (selected == NULL) {
+        return false;
+    }
+
+    for (i = 0; i < vma_count; i++) {
+        int filter = match_vma_filters(filters, filter_count, &VMAs[i]);
+
+        if (filter >= 0) {
+            selected[count] = VMAs[i];
+            clip_vma(&filters[filter], &selected[count]);
+            count++;
+        }
+    }
+
+    *selected_VMAs = selected;
+    *selected_count = count;
+
+    return true;
+}
+
+bool select_process_vmas(const int pid, const struct VmaFilter* filters, int filter_count,
+    struct VirtualMemoryArea** selected_VMAs, int* selected_count)
+{
+    bool result = true;
+
+    struct VirtualMemoryArea* VMAs = NULL;
+    int vma_count = 0;
+
+    result = parse_maps_file(pid, &VMAs, &vma_count);
+    IFERRGOTO(result, done);
+
+    result = select_vmas(VMAs, vma_count, filters, filter_count, selected_VMAs, selected_count);
+
+done:
+
+    if (VMAs) {
+        free(VMAs);
+    }
+
+    return result;
+}
+
+bool dump_process_vmas(const int pid, const struct VmaFilter* filters, int filter_count, struct MemorySnapshot** parsed_dump)
+{
+    bool result = true;
+
+    struct MemorySnapshot* dump = NULL;
+    struct VirtualMemoryArea* VMAs = NULL;
+    int vma_count = 0;
+    bool attached = false;
+    int mem_fd = -1;
+    int i;
+
+    /* selection happens before any memory is read */
+    result = select_process_vmas(pid, filters, filter_count, &VMAs, &vma_count);
+    IFERRGOTO(result, done);
+
+    dump = calloc(1, sizeof(struct MemorySnapshot));
+    NULLERRGOTO(dump, result, done);
+
+    dump->pid = pid;
+    dump->page_size = (int)sysconf(_SC_PAGESIZE);
+
+    dump->regions = calloc(vma_count > 0 ? vma_count : 1, sizeof(struct MemoryRegion));
+    NULLERRGOTO(dump->regions, result, done);
+
+    mem_fd = open_process_file(pid, "mem", O_RDONLY);
+    if (mem_fd < 0) {
+        SETERRGOTO(result, done);
+    }
+
+    attached = attach_process_by_pid(pid);
+    if (attached == false) {
+        SETERRGOTO(result, done);
+    }
+
+    for (i = 0; i < vma_count; i++) {
+        struct MemoryRegion* region = &dump->regions[dump->region_count];
+        size_t size = (size_t)(VMAs[i].end_address - VMAs[i].start_address);
+
+        if (is_dumpable_vma(&VMAs[i]) == false) {
+            continue;
+        }
+
+        region->vma = VMAs[i];
+        region->data = malloc(size);
+        NULLERRGOTO(region->data, result, done);
+        dump->region_count++;
+
+        /* e.g. device memory, the region is kept to show the layout */
+        if (read_full_at(mem_fd, region->data, size, VMAs[i].start_address) == false) {
+            free(region->data);
+            region->data = NULL;
+            region->unreadable = true;
+        }
+    }
+
+    *parsed_dump = dump;
+    dump = NULL;
+
+done:
+
+    if (attached) {
+        detach_process_by_pid(pid);
+    }
+
+    if (mem_fd >= 0) {
+        close(mem_fd);
+    }
+
+    if (VMAs) {
+        free(VMAs);
+    }
+
+    free_memory_snapshot(dump);
+
+    return result;
+}
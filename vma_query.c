@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "procfs_parser_api.h"
+#include "pp_internal.h"
+#include "pp_stats.h"
+
+/* uapi of linux 6.11, for older headers */
+#ifndef PROCMAP_QUERY
+struct procmap_query
+{
+    __u64 size;
+    __u64 query_flags;
+    __u64 query_addr;
+    __u64 vma_start;
+    __u64 vma_end;
+    __u64 vma_flags;
+    __u64 vma_page_size;
+    __u64 vma_offset;
+    __u64 inode;
+    __u32 dev_major;
+    __u32 dev_minor;
+    __u32 vma_name_size;
+    __u32 build_id_size;
+    __u64 vma_name_addr;
+    __u64 build_id_addr;
+};
+
+#define PROCMAP_QUERY _IOWR('f', 17, struct procmap_query)
+#endif
+
+#define VMA_QUERY_PERMISSIONS (VMA_READ | VMA_WRITE | VMA_EXEC | VMA_MAYSHARE)
+#define VMA_QUERY_FLAGS       (VMA_QUERY_PERMISSIONS | VMA_QUERY_NEXT | VMA_QUERY_FILE_BACKED)
+
+struct vma_query
+{
+    int pid;
+    int fd; // "/proc/[pid]/maps", -1 once the ioctl is known to be missing
+};
+
+struct vma_search
+{
+    unsigned long long address;
+    unsigned int flags;
+    struct VirtualMemoryArea* vma;
+    bool found;
+};
+
+vma_query_t open_vma_query(const int pid)
+{
+    struct vma_query* query = NULL;
+
+    query = calloc(1, sizeof(struct vma_query));
+    if (query == NULL) {
+        return NULL;
+    }
+
+    query->pid = pid;
+    query->fd = open_process_file(pid, "maps", O_RDONLY);
+    if (query->fd < 0) {
+        free(query);
+        return NULL;
+    }
+
+    return query;
+}
+
+void close_vma_query(vma_query_t query_h)
+{
+    struct vma_query* query = (struct vma_query*)query_h;
+
+    if (query == NULL) {
+        return;
+    }
+
+    if (query->fd >= 0) {
+        close(query->fd);
+    }
+
+    free(query);
+}
+
+bool is_vma_query_ioctl(vma_query_t query_h)
+{
+    struct vma_query* query = (struct vma_query*)query_h;
+
+    return query->fd >= 0;
+}
+
+static bool match_vma_query(const struct VirtualMemoryArea* vma, unsigned int flags)
+{
+    unsigned int permissions = flags & VMA_QUERY_PERMISSIONS;
+
+    if ((vma->permissions & permissions) != permissions) {
+        return false;
+    }
+
+    return (flags & VMA_QUERY_FILE_BACKED) == 0 || vma->inode != UNKNOWN_INODE;
+}
+
+/* the same rules as the ioctl: the covering VMA, or with VMA_QUERY_NEXT the first match from there on */
+static bool find_queried_vma(const struct VirtualMemoryArea* vma, void* arg)
+{
+    struct vma_search* search = arg;
+    bool covering;
+
+    /* the gate area is shown in maps but is not a VMA of the process */
+    if (vma->end_address <= search->address || strcmp(vma->pathname, "[vsyscall]") == 0) {
+        return true;
+    }
+
+    covering = vma->start_address <= search->address;
+    if (covering == false && (search->flags & VMA_QUERY_NEXT) == 0) {
+        return false;
+    }
+
+    if (match_vma_query(vma, search->flags)) {
+        *search->vma = *vma;
+        search->found = true;
+        return false;
+    }
+
+    return (search->flags & VMA_QUERY_NEXT) != 0;
+}
+
+static bool query_vma_by_maps(struct vma_query* query, unsigned long long address, unsigned int flags,
+    struct VirtualMemoryArea* vma)
+{
+    struct vma_search search = {
+        .address = address,
+        .flags = flags,
+        .vma = vma,
+        .found = false,
+    };
+
+    if (visit_maps_file(query->pid, find_queried_vma, &search) == false) {
+        return false;
+    }
+
+    if (search.found == false) {
+        PP_ERROR(ENOENT, "no VMA at 0x%llx of %d", address, query->pid);
+    }
+
+    return search.found;
+}
+
+/* -1 if the kernel has no PROCMAP_QUERY */
+static int query_vma_by_ioctl(struct vma_query* query, unsigned long long address, unsigned int flags,
+    struct VirtualMemoryArea* vma, unsigned char* build_id, unsigned int* build_id_size)
+{
+    struct procmap_query arg;
+    int ret;
+
+    memset(&arg, 0x00, sizeof(arg));
+    arg.size = sizeof(arg);
+    arg.query_flags = flags;
+    arg.query_addr = address;
+    arg.vma_name_addr = (uintptr_t)vma->pathname;
+    arg.vma_name_size = sizeof(vma->pathname);
+
+    if (build_id && build_id_size) {
+        arg.build_id_addr = (uintptr_t)build_id;
+        arg.build_id_size = *build_id_size;
+    }
+
+    ret = ioctl(query->fd, PROCMAP_QUERY, &arg);
+    pp_stats_io(0, 1);
+
+    if (ret < 0 && errno == ENOTTY) {
+        return -1;
+    }
+
+    if (ret < 0) {
+        if (errno == ENOENT) {
+            PP_ERROR(ENOENT, "no VMA at 0x%llx of %d", address, query->pid);
+        }
+        else {
+            PP_ERROR(errno, "cannot query VMA at 0x%llx of %d", address, query->pid);
+        }
+        return 0;
+    }
+
+    vma->start_address = arg.vma_start;
+    vma->end_address = arg.vma_end;
+    vma->permissions = (unsigned char)(arg.vma_flags & VMA_QUERY_PERMISSIONS);
+    vma->file_offset = arg.vma_offset;
+    vma->device_major = (unsigned char)arg.dev_major;
+    vma->device_minor = (unsigned char)arg.dev_minor;
+    vma->inode = arg.inode;
+
+    if (arg.vma_name_size == 0) {
+        vma->pathname[0] = '\0';
+    }
+
+    if (build_id && build_id_size) {
+        *build_id_size = arg.build_id_size;
+    }
+
+    return 1;
+}
+
+bool query_vma(vma_query_t query_h, unsigned long long address, unsigned int flags, struct VirtualMemoryArea* vma,
+    unsigned char* build_id, unsigned int* build_id_size)
+{
+    bool result = true;
+
+    struct pp_stats_scope scope;
+    struct vma_query* query = (struct vma_query*)query_h;
+    int queried;
+
+    pp_stats_begin(&scope, API_QUERY_VMA);
+
+    if (flags & ~VMA_QUERY_FLAGS) {
+        PP_ERROR(EINVAL, "unknown query flags 0x%x", flags);
+        SETERRGOTO(result, done);
+    }
+
+    if (query->fd >= 0) {
+        queried = query_vma_by_ioctl(query, address, flags, vma, build_id, build_id_size);
+        if (queried >= 0) {
+            result = queried == 1;
+            goto done;
+        }
+
+        /* before 6.11, the text parser from here on */
+        close(query->fd);
+        query->fd = -1;
+    }
+
+    if (build_id && build_id_size) {
+        *build_id_size = 0;
+    }
+
+    result = query_vma_by_maps(query, address, flags, vma);
+
+done:
+
+    pp_stats_end(&scope, result);
+
+    return result;
+}